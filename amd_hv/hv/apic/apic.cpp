@@ -0,0 +1,106 @@
+#include "apic.h"
+
+#include "../../utilities/utilities.h"
+
+namespace apic
+{
+	bool	x2apic;
+	UINT8*	xapic_base;		// every core sees its own local apic at the same physical address
+}
+
+bool apic::setup()
+{
+	IA32_APIC_BASE_REGISTER apic_base{ .AsUInt = __readmsr(IA32_APIC_BASE) };
+
+	x2apic = apic_base.EnableX2ApicMode;
+
+	if (x2apic)
+		return true;
+
+	xapic_base = (UINT8*)MmMapIoSpace({ .QuadPart = (INT64)((UINT64)apic_base.ApicBase << PAGE_SHIFT) }, PAGE_SIZE, MmNonCached);
+
+	if (!xapic_base)
+	{
+		LOG_ERROR("couldnt map the xapic registers \n");
+		return false;
+	}
+
+	return true;
+}
+
+void apic::cleanup()
+{
+	if (xapic_base)
+		MmUnmapIoSpace(xapic_base, PAGE_SIZE);
+
+	xapic_base = nullptr;
+
+	return;
+}
+
+UINT32 apic::read(UINT32 reg)
+{
+	if (x2apic)
+		return (UINT32)__readmsr(0x800 + (reg >> 4));
+
+	return *(volatile UINT32*)(xapic_base + reg);
+}
+
+void apic::write(UINT32 reg, UINT32 value)
+{
+	if (x2apic)
+	{
+		__writemsr(0x800 + (reg >> 4), value);
+		return;
+	}
+
+	*(volatile UINT32*)(xapic_base + reg) = value;
+
+	return;
+}
+
+UINT32 apic::id()
+{
+	// the xapic keeps its 8 bit id in the top byte
+
+	if (x2apic)
+		return read(APIC_REG_ID);
+
+	return read(APIC_REG_ID) >> 24;
+}
+
+void apic::send_ipi(UINT32 command)
+{
+	// an ipi the guest sent right before the exit may still be on its way,
+	// the xapic doesnt take another one until its delivered
+
+	if (!x2apic)
+	{
+		while (read(APIC_REG_ICR_LOW) & APIC_ICR_PENDING)
+			_mm_pause();
+	}
+
+	write(APIC_REG_ICR_LOW, command);
+
+	return;
+}
+
+void apic::send_ipi(UINT32 command, UINT32 destination)
+{
+	if (x2apic)
+	{
+		__writemsr(0x800 + (APIC_REG_ICR_LOW >> 4), (UINT64)destination << 32 | command);
+		return;
+	}
+
+	while (read(APIC_REG_ICR_LOW) & APIC_ICR_PENDING)
+		_mm_pause();
+
+	UINT32 guest_high = read(APIC_REG_ICR_HIGH);
+
+	write(APIC_REG_ICR_HIGH, destination << 24);
+	write(APIC_REG_ICR_LOW, command);
+	write(APIC_REG_ICR_HIGH, guest_high);
+
+	return;
+}
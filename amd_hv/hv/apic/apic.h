@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+// xapic register offsets, x2apic msr-s are 0x800 + offset / 0x10
+#define APIC_REG_ID					0x20
+#define APIC_REG_ICR_LOW			0x300
+#define APIC_REG_ICR_HIGH			0x310		// xapic only, x2apic has the whole icr in one msr
+#define APIC_REG_LVT_PERFORMANCE	0x340
+
+// AMD64 Manual Volume 2: 16.4.1 Local Vector Table, message type in bits 10:8
+#define APIC_DELIVERY_MODE_NMI		0x400
+#define APIC_LVT_MASK				0x10000
+
+// 16.5 Interprocessor Interrupts, the rest of the interrupt command register low half
+#define APIC_ICR_PENDING			0x1000		// delivery status, xapic only
+#define APIC_ICR_ASSERT				0x4000
+#define APIC_ICR_ALL_EXCLUDING_SELF	0xC0000		// destination shorthand, the destination field is ignored
+
+namespace apic
+{
+	// maps the xapic registers unless the os runs the apic in x2apic mode,
+	// must be called before launching because it calls into the os
+	bool setup();
+
+	void cleanup();
+
+	// these access the local apic of the executing core
+	UINT32 read(UINT32 reg);
+
+	void write(UINT32 reg, UINT32 value);
+
+	// the executing core's apic id, the x2apic one if the apic runs in that mode
+	UINT32 id();
+
+	// sends an ipi with a destination shorthand, so the destination half of the icr is left alone.
+	// the guest could have been stopped between writing the two halves itself
+	void send_ipi(UINT32 command);
+
+	// sends an ipi to one apic id, the guest's destination half of the icr is put back afterwards
+	void send_ipi(UINT32 command, UINT32 destination);
+}
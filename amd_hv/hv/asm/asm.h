@@ -11,4 +11,10 @@ extern "C"
     bool start_hv(struct vcpu* vcpu);
 
     bool send_hv_command(unsigned long long key, unsigned long long command);
+
+    // returns the HYPERCALL_STATUS, results are written back into args
+    unsigned long long hv_call(unsigned long long code, struct HYPERCALL_ARGS* args);
+
+    // same as hv_call, but sets HYPERCALL_XMM and also passes args->xmm in xmm0 - xmm5
+    unsigned long long hv_call_xmm(unsigned long long code, struct HYPERCALL_ARGS* args);
 }
\ No newline at end of file
@@ -7,8 +7,13 @@ vcpu STRUCT
     guest_vmcb_phys   QWORD ?
     host_vmcb_phys    QWORD ?
     regs              QWORD ?
+    xmm               QWORD ?
+    spill_masks       QWORD ?
+    spill_mask        QWORD ?
 vcpu ENDS
 
+SPILL_TABLE_SIZE equ 100h   ; must match hv.h
+
 .code
 
 PUSHAQ macro
@@ -48,6 +53,21 @@ POPAQ macro
         pop     rax
 endm
 
+; the slot index in GENERAL_REGISTERS doubles as the register's bit in the spill mask held in r9d
+
+SPILL macro reg, slot
+        bt      r9d, slot
+        jnc     @F
+        mov     [rsp + slot * 8], reg
+@@:
+        endm
+FILL macro reg, slot
+        bt      r9d, slot
+        jnc     @F
+        mov     reg, [rsp + slot * 8]
+@@:
+        endm
+
 
 send_hv_command proc frame
 .endprolog
@@ -68,6 +88,84 @@ ret
 send_hv_command endp
 
 
+; args layout matches HYPERCALL_ARGS, 6 qword registers then 6 xmm registers
+
+hv_call proc frame
+push rbx
+.pushreg rbx
+.endprolog
+
+mov rbx, rdx            ; rbx survives the hypercall, every volatile register is part of the abi
+
+mov rax, rcx            ; call code
+mov rcx, [rbx + 00h]
+mov rdx, [rbx + 08h]
+mov r8,  [rbx + 10h]
+mov r9,  [rbx + 18h]
+mov r10, [rbx + 20h]
+mov r11, [rbx + 28h]
+
+vmmcall                 ; we intercept this instruction, rax holds the status afterwards
+
+mov [rbx + 00h], rcx
+mov [rbx + 08h], rdx
+mov [rbx + 10h], r8
+mov [rbx + 18h], r9
+mov [rbx + 20h], r10
+mov [rbx + 28h], r11
+
+pop rbx
+ret
+
+hv_call endp
+
+
+hv_call_xmm proc frame
+push rbx
+.pushreg rbx
+.endprolog
+
+mov rbx, rdx
+
+mov rax, rcx
+bts rax, 31             ; HYPERCALL_XMM
+
+movups xmm0, [rbx + 30h]
+movups xmm1, [rbx + 40h]
+movups xmm2, [rbx + 50h]
+movups xmm3, [rbx + 60h]
+movups xmm4, [rbx + 70h]
+movups xmm5, [rbx + 80h]
+
+mov rcx, [rbx + 00h]
+mov rdx, [rbx + 08h]
+mov r8,  [rbx + 10h]
+mov r9,  [rbx + 18h]
+mov r10, [rbx + 20h]
+mov r11, [rbx + 28h]
+
+vmmcall
+
+mov [rbx + 00h], rcx
+mov [rbx + 08h], rdx
+mov [rbx + 10h], r8
+mov [rbx + 18h], r9
+mov [rbx + 20h], r10
+mov [rbx + 28h], r11
+
+movups [rbx + 30h], xmm0
+movups [rbx + 40h], xmm1
+movups [rbx + 50h], xmm2
+movups [rbx + 60h], xmm3
+movups [rbx + 70h], xmm4
+movups [rbx + 80h], xmm5
+
+pop rbx
+ret
+
+hv_call_xmm endp
+
+
 __sgdt proc frame
 .endprolog
 
@@ -130,19 +228,90 @@ vmload rax  ; load host state
 
 pop rax     ; restore guest state
 
-PUSHAQ
-
-mov rcx, [rsp + 8 * 16]	; move vcpu into rcx
-mov [rcx + vcpu.regs], rsp ; put the ptr of the registers into its place
+sub rsp, 80h    ; the whole GENERAL_REGISTERS frame, even if only a part of it gets filled in
+
+; volatile registers are clobbered by any compiled code, so they always get spilled
+
+mov [rsp + 78h], rax
+mov [rsp + 70h], rcx
+mov [rsp + 68h], rdx
+mov [rsp + 38h], r8
+mov [rsp + 30h], r9
+mov [rsp + 28h], r10
+mov [rsp + 20h], r11
+
+; compiled code preserves the nonvolatile ones, so they only need to be in the frame if the handler uses them
+; the handler's mask is looked up by exit code, exit codes past the table get everything
+
+mov rcx, [rsp + 80h]                    ; move vcpu into rcx
+mov rdx, [rcx + vcpu.guest_vmcb + 70h]  ; exit code
+mov r9d, 0FFFFh
+cmp rdx, SPILL_TABLE_SIZE
+jae spill_mask_found
+mov r8, [rcx + vcpu.spill_masks]
+movzx r9d, word ptr [r8 + rdx * 2]
+spill_mask_found:
+mov [rcx + vcpu.spill_mask], r9
+
+SPILL rbx, 12
+SPILL rbp, 10
+SPILL rsi, 9
+SPILL rdi, 8
+SPILL r12, 3
+SPILL r13, 2
+SPILL r14, 1
+SPILL r15, 0
+
+; xmm0 - xmm5 are volatile in the x64 abi, so any compiled host code is free to clobber them
+; we spill them right under the general registers, this also carries the HYPERCALL_XMM payload
+
+sub rsp, 60h
+movaps [rsp + 00h], xmm0
+movaps [rsp + 10h], xmm1
+movaps [rsp + 20h], xmm2
+movaps [rsp + 30h], xmm3
+movaps [rsp + 40h], xmm4
+movaps [rsp + 50h], xmm5
+
+mov [rcx + vcpu.xmm], rsp ; put the ptr of the xmm registers into its place
+lea rax, [rsp + 60h]
+mov [rcx + vcpu.regs], rax ; put the ptr of the registers into its place
 
 sub rsp, 30h  ; make space for the function call
 call ?handle_vmexit@hv@@YA_NPEAUvcpu@@@Z
 add rsp, 30h
 
-test al, al ; test returned char 
+movaps xmm0, [rsp + 00h]
+movaps xmm1, [rsp + 10h]
+movaps xmm2, [rsp + 20h]
+movaps xmm3, [rsp + 30h]
+movaps xmm4, [rsp + 40h]
+movaps xmm5, [rsp + 50h]
+add rsp, 60h
+
+mov rcx, [rsp + 80h]
+mov r9, [rcx + vcpu.spill_mask]
+
+FILL rbx, 12
+FILL rbp, 10
+FILL rsi, 9
+FILL rdi, 8
+FILL r12, 3
+FILL r13, 2
+FILL r14, 1
+FILL r15, 0
+
+mov rcx, [rsp + 70h]
+mov rdx, [rsp + 68h]
+mov r8,  [rsp + 38h]
+mov r10, [rsp + 28h]
+mov r11, [rsp + 20h]
+mov r9,  [rsp + 30h]
 
-POPAQ
+test al, al ; test returned char 
 
+mov rax, [rsp + 78h]
+lea rsp, [rsp + 80h]    ; lea leaves the flags of the test alone
 
 jz vmloop ; if the returned char is zero, it means continue executing
 
@@ -0,0 +1,248 @@
+#include "broadcast.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../apic/apic.h"
+#include "../commands/commands.h"
+#include "../../utilities/utilities.h"
+
+namespace broadcast
+{
+	// held by the core running a broadcast, and by hv::shutdown once it started
+	volatile LONG	lock;
+	volatile LONG	enabled;
+
+	// only written while holding lock
+	LONG64			sequence;
+
+	// the broadcast in flight. sequence is cleared while the rest is rewritten,
+	// a core that reads it after the initiator gave up on it sees the change
+	struct REQUEST
+	{
+		volatile LONG64		sequence;
+		BROADCAST_EXECUTE	execute;
+		UINT64				code;
+		UINT64				args[5];
+		UINT8				cpl;		// of the calling core, the others interrupted unrelated code
+		bool				once;
+	} request;
+
+	enum SCOPE
+	{
+		scope_none,		// not allowed in a broadcast
+		scope_each,		// runs on every core
+		scope_once,		// global configuration, the calling core runs it and the others apply it before they run guest code again
+	};
+
+	// calls that take a buffer or a core index mean nothing on the other cores, shutdown has to exit into
+	// the caller's own context and session calls could wait on a lock the calling core holds.
+	// a command opts in with COMMAND_BROADCAST or COMMAND_BROADCAST_ONCE when its registered
+	SCOPE scope(UINT64 code)
+	{
+		auto command = commands::find(code);
+
+		if (!command)
+			return scope_none;
+
+		if (command->flags & COMMAND_BROADCAST)
+			return scope_each;
+
+		if (command->flags & COMMAND_BROADCAST_ONCE)
+			return scope_once;
+
+		return scope_none;
+	}
+
+	// the mailbox handler, context is the sequence of the broadcast
+	void answer(vcpu* vcpu, void* context)
+	{
+		auto& slot		= vcpu->get_broadcast();
+		LONG64 current	= (LONG64)context;
+
+		GENERAL_REGISTERS regs{};
+
+		regs.rax	= HYPERCALL_CODE(request.code);
+		regs.rcx	= request.args[0];
+		regs.rdx	= request.args[1];
+		regs.r8		= request.args[2];
+		regs.r9		= request.args[3];
+		regs.r10	= request.args[4];
+
+		bool once					= request.once;
+		UINT8 cpl					= request.cpl;
+		BROADCAST_EXECUTE execute	= request.execute;
+
+		// the copy is only good if the initiator didnt move on to another broadcast while we took it
+
+		_ReadWriteBarrier();
+
+		if (request.sequence != current)
+			return;
+
+		slot.status		= once ? call_success : execute(vcpu, &regs, cpl);
+		slot.completed	= current;
+
+		return;
+	}
+}
+
+void broadcast::enable()
+{
+	InterlockedExchange(&enabled, 1);
+
+	return;
+}
+
+void broadcast::disable()
+{
+	// the exchange orders the store before reading lock, a core that got the lock after it sees enabled clear
+
+	InterlockedExchange(&enabled, 0);
+
+	while (lock)
+		_mm_pause();
+
+	return;
+}
+
+UINT64 broadcast::run(vcpu* vcpu, GENERAL_REGISTERS* regs, BROADCAST_EXECUTE execute)
+{
+	UINT64 code = regs->rcx;
+	SCOPE kind	= scope(code);
+	UINT8 cpl	= vcpu->get_guest().get_state_save_area().cpl;
+
+	if (kind == scope_none)
+		return call_invalid;
+
+	// every core would deny it, no need to wake them for that
+
+	if (cpl > commands::find(code)->cpl)
+		return call_denied;
+
+	if (InterlockedCompareExchange(&lock, 1, 0))
+		return call_busy;
+
+	if (!enabled)
+	{
+		InterlockedExchange(&lock, 0);
+		return call_busy;
+	}
+
+	UINT64 start_tsc = __rdtsc();
+
+	GENERAL_REGISTERS local{};
+
+	local.rax	= HYPERCALL_CODE(code);
+	local.rcx	= regs->rdx;
+	local.rdx	= regs->r8;
+	local.r8	= regs->r9;
+	local.r9	= regs->r10;
+	local.r10	= regs->r11;
+
+	// configuration that doesnt take isnt posted at all
+
+	UINT64 status = call_success;
+
+	if (kind == scope_once)
+	{
+		status = execute(vcpu, &local, cpl);
+
+		if (status != call_success)
+		{
+			InterlockedExchange(&lock, 0);
+			return status;
+		}
+	}
+
+	LONG64 current = ++sequence;
+
+	request.sequence	= 0;
+	request.execute		= execute;
+	request.code		= code;
+	request.args[0]		= local.rcx;
+	request.args[1]		= local.rdx;
+	request.args[2]		= local.r8;
+	request.args[3]		= local.r9;
+	request.args[4]		= local.r10;
+	request.cpl			= cpl;
+	request.once		= kind == scope_once;
+	request.sequence	= current;
+
+	int cores	= utilities::get_cpu_cores();
+	int self	= (int)utilities::get_current_cpu_idx();
+
+	// a core whose mailbox is full never answers, it just counts as late
+
+	for (int i = 0; i < cores; i++)
+	{
+		if (i == self)
+			continue;
+
+		auto& target = hv::get_vcpu(i)->get_mailbox();
+
+		if (mailbox::post(&target, answer, (void*)current) != mailbox_kick)
+			mailbox::count_kick(&target);
+	}
+
+	// one ipi wakes every other core instead of a kick each, a core thats in the host already
+	// takes it right after its next vmrun
+
+	apic::send_ipi(APIC_DELIVERY_MODE_NMI | APIC_ICR_ASSERT | APIC_ICR_ALL_EXCLUDING_SELF);
+
+	// our own part runs while the others are on their way out of the guest
+
+	if (kind == scope_each)
+		status = execute(vcpu, &local, cpl);
+
+	UINT64 deadline = start_tsc + BROADCAST_TIMEOUT;
+
+	for (;;)
+	{
+		int answered = 0;
+
+		for (int i = 0; i < cores; i++)
+		{
+			if (i != self && hv::get_vcpu(i)->get_broadcast().completed == current)
+				answered++;
+		}
+
+		if (answered == cores - 1 || __rdtsc() > deadline)
+			break;
+
+		// a core could be waiting on a request of its own to us
+
+		mailbox::drain(&vcpu->get_mailbox(), vcpu);
+
+		_mm_pause();
+	}
+
+	UINT64 succeeded	= status == call_success;
+	UINT64 failed		= status != call_success;
+	UINT64 late			= 0;
+
+	for (int i = 0; i < cores; i++)
+	{
+		if (i == self)
+			continue;
+
+		auto& slot = hv::get_vcpu(i)->get_broadcast();
+
+		// completed is volatile, so status is read after it
+
+		if (slot.completed != current)
+			late++;
+		else if (slot.status == call_success)
+			succeeded++;
+		else
+			failed++;
+	}
+
+	regs->rcx	= succeeded;
+	regs->rdx	= failed;
+	regs->r8	= late;
+	regs->r9	= __rdtsc() - start_tsc;
+
+	InterlockedExchange(&lock, 0);
+
+	return call_success;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// how long the calling core waits for the others, in tsc cycles. a core that didnt answer by then is counted
+// and its broadcast is dropped, it never runs late. the caller spins with gif clear the whole time, so this
+// is a few hundred microseconds, plenty for an nmi exit and one host exit on every core. a caller that
+// saw late cores retries the broadcast
+#define BROADCAST_TIMEOUT 1000000
+
+// every core's answer, only written by that core
+struct BROADCAST_SLOT
+{
+	volatile LONG64	completed;	// sequence of the last broadcast this core answered
+	UINT64			status;		// HYPERCALL_STATUS of completed
+};
+
+// runs a command on a core for a caller at cpl, commands::dispatch_as
+typedef UINT64 (*BROADCAST_EXECUTE)(vcpu* vcpu, GENERAL_REGISTERS* regs, UINT8 cpl);
+
+// one hypercall that runs on every core. the calling core posts it to every other core's mailbox,
+// wakes them all with one nmi ipi and waits until each has answered from its next exit.
+// one broadcast is in flight at a time, and none before hv::launch or after hv::shutdown started.
+// a core running guest code exits on the nmi right away, see mailbox.h
+namespace broadcast
+{
+	// lets broadcasts through once every core runs under the hypervisor
+	void enable();
+
+	// waits for the broadcast in flight and keeps new ones out
+	void disable();
+
+	// runs the call whose code is in regs->rcx with the arguments in rdx - r11 on every core.
+	// every core checks it against the calling core's cpl, not the one of whatever it interrupted.
+	// the cores that succeeded, failed and didnt answer in time and the tsc cycles it took are written
+	// to rcx, rdx, r8 and r9. returns a HYPERCALL_STATUS for the broadcast itself
+	UINT64 run(vcpu* vcpu, GENERAL_REGISTERS* regs, BROADCAST_EXECUTE execute);
+}
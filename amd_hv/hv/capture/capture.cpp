@@ -0,0 +1,215 @@
+#include "capture.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../commands/commands.h"
+#include "../../utilities/utilities.h"
+
+namespace capture
+{
+	bool			enabled;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+
+	// swapped in for hv::get_spill_masks while capturing, a record needs every register
+	UINT16			spill_everything[SPILL_TABLE_SIZE];
+
+	static_assert(sizeof(GENERAL_REGISTERS) == sizeof(CAPTURE_STATE::gpr), "CAPTURE_STATE::gpr has to mirror GENERAL_REGISTERS");
+
+	void take_state(vcpu* vcpu, CAPTURE_STATE& target)
+	{
+		auto& control	= vcpu->get_guest().get_control_area();
+		auto& state		= vcpu->get_guest().get_state_save_area();
+
+		memcpy(target.gpr, vcpu->get_regs(), sizeof(target.gpr));
+
+		target.rip				= state.rip;
+		target.rflags			= state.rflags.AsUInt;
+		target.cr0				= state.cr0.AsUInt;
+		target.cr2				= state.cr2;
+		target.cr3				= state.cr3.AsUInt;
+		target.cr4				= state.cr4.AsUInt;
+		target.efer				= state.efer.value;
+		target.event_inject		= control.event_inject.value;
+		target.interrupt_shadow	= control.interrupt_shadow;
+		target.v_ctl			= control.v_ctl.value;
+		target.cpl				= state.cpl;
+
+		return;
+	}
+
+	// flags, applies to every core
+	UINT64 config_command(vcpu* vcpu, GENERAL_REGISTERS* regs)
+	{
+		UNREFERENCED_PARAMETER(vcpu);
+
+		configure(regs->rcx);
+
+		return call_success;
+	}
+
+	// core index, buffer, capacity in records in, records written and that core's counters out
+	UINT64 export_command(vcpu* vcpu, GENERAL_REGISTERS* regs)
+	{
+		auto target		= hv::get_vcpu((int)regs->rcx);
+		INT64 written	= export_records(vcpu, target, regs->rdx, regs->r8);
+
+		if (written < 0)
+			return call_fault;
+
+		regs->rcx	= written;
+		regs->rdx	= target->get_capture_ring()->captured;
+		regs->r8	= target->get_capture_ring()->dropped;
+		regs->r9	= target->get_capture_ring()->cycles;
+
+		return call_success;
+	}
+}
+
+bool capture::setup()
+{
+	for (auto& mask : spill_everything)
+		mask = gpr_all;
+
+	// records hold the registers, cr2, cr3 and rip of kernel code, so both calls are the kernel's
+
+	if (!commands::add(HYPERCALL_CAPTURE_CONFIG, { config_command, "capture config", 1, 0, COMMAND_SESSION | COMMAND_BROADCAST_ONCE, { arg_value } }))
+		return false;
+
+	if (!commands::add(HYPERCALL_CAPTURE_EXPORT, { export_command, "capture export", 1, 0, COMMAND_SESSION, { arg_core, arg_address, arg_value, arg_result } }))
+		return false;
+
+	return true;
+}
+
+void capture::configure(UINT64 flags)
+{
+	enabled = flags & CAPTURE_ENABLE;
+
+	if (flags & CAPTURE_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void capture::update(vcpu* vcpu)
+{
+	auto ring = vcpu->get_capture_ring();
+
+	if (ring->generation == (UINT64)generation)
+		return;
+
+	// the exporting core only moves tail forward, a reset while it copies just hands it stale records
+
+	if (ring->generation < reset_generation)
+	{
+		ring->tail		= ring->head;
+		ring->sequence	= 0;
+		ring->captured	= 0;
+		ring->dropped	= 0;
+		ring->cycles	= 0;
+	}
+
+	ring->generation = generation;
+
+	// the masks are read on the next exit, this one already spilled with the old ones
+
+	ring->active = enabled;
+
+	vcpu->get_spill_masks() = enabled ? spill_everything : hv::get_spill_masks();
+
+	return;
+}
+
+void capture::on_exit(vcpu* vcpu)
+{
+	auto ring = vcpu->get_capture_ring();
+
+	// the first exit after enabling didnt spill everything yet, its registers are partly garbage
+
+	if (!ring->active || vcpu->get_spill_mask() != gpr_all)
+		return;
+
+	UINT64 start_tsc = __rdtsc();
+
+	ring->sequence++;
+
+	if (ring->head - ring->tail >= CAPTURE_RING_SIZE)
+	{
+		ring->dropped++;
+		return;
+	}
+
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& record	= ring->entries[ring->head & (CAPTURE_RING_SIZE - 1)];
+
+	record.sequence			= ring->sequence;
+	record.tsc				= start_tsc;
+	record.exit_code		= control.exit_code;
+	record.exit_info1		= control.exit_info1;
+	record.exit_info2		= control.exit_info2;
+	record.exit_int_info	= control.exit_int_info.value;
+	record.nrip				= control.nrip;
+	record.fetched			= control.cur_instr.bytes_amt;
+	record.core				= (UINT16)utilities::get_current_cpu_idx();
+	record.declared			= control.exit_code < SPILL_TABLE_SIZE ? hv::get_spill_masks()[control.exit_code] : (UINT16)gpr_all;
+
+	memcpy(record.instruction, control.cur_instr.instruction_bytes, sizeof(record.instruction));
+
+	take_state(vcpu, record.before);
+
+	ring->pending	= 1;
+	ring->cycles	+= __rdtsc() - start_tsc;
+
+	return;
+}
+
+void capture::on_resume(vcpu* vcpu)
+{
+	auto ring = vcpu->get_capture_ring();
+
+	if (!ring->pending)
+		return;
+
+	UINT64 start_tsc = __rdtsc();
+
+	take_state(vcpu, ring->entries[ring->head & (CAPTURE_RING_SIZE - 1)].after);
+
+	ring->pending = 0;
+	ring->captured++;
+
+	// head is volatile, so the exporting core only sees the record once its complete
+
+	ring->head		= ring->head + 1;
+	ring->cycles	+= __rdtsc() - start_tsc;
+
+	return;
+}
+
+INT64 capture::export_records(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state	= caller->get_guest().get_state_save_area();
+	auto ring	= target->get_capture_ring();
+
+	INT64 tail	= ring->tail;
+	INT64 count	= min(ring->head - tail, (INT64)capacity);
+
+	for (INT64 i = 0; i < count; i++)
+	{
+		auto& record = ring->entries[(tail + i) & (CAPTURE_RING_SIZE - 1)];
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + i * sizeof(CAPTURE_RECORD), &record, sizeof(CAPTURE_RECORD)))
+			return -1;
+	}
+
+	// tail is volatile, so the slots are only handed back once we are done copying them
+
+	ring->tail = tail + count;
+
+	return count;
+}
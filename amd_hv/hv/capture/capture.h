@@ -0,0 +1,105 @@
+#pragma once
+
+// the record layout only needs fixed width types, so hv_replay builds against this file on its own
+// to read what usermode_test exported
+
+#if defined(_KERNEL_MODE)
+#include <ntifs.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <stdint.h>
+
+typedef int64_t		INT64;
+typedef int64_t		LONG64;
+typedef uint8_t		UINT8;
+typedef uint16_t	UINT16;
+typedef uint32_t	UINT32;
+typedef uint64_t	UINT64;
+#endif
+
+struct vcpu;
+
+#define CAPTURE_RING_SIZE 1024	// power of two
+
+// flags for capture::configure
+#define CAPTURE_ENABLE 0x1
+#define CAPTURE_RESET 0x2
+
+// the guest as the exit handler found it or left it. gpr is in GENERAL_REGISTERS order,
+// rax and rsp come from the vmcb like the handlers see them
+struct CAPTURE_STATE
+{
+	UINT64	gpr[16];
+	UINT64	rip;
+	UINT64	rflags;
+	UINT64	cr0;
+	UINT64	cr2;
+	UINT64	cr3;
+	UINT64	cr4;
+	UINT64	efer;
+	UINT64	event_inject;		// EVENT_INJECTION the guest gets on its next vmrun
+	UINT64	interrupt_shadow;
+	UINT64	v_ctl;				// VIRTUAL_CONTROL, carries a pending virtual interrupt
+	UINT32	cpl;
+	UINT32	reserved;
+};
+
+// one exit, before and after handle_vmexit ran
+struct CAPTURE_RECORD
+{
+	UINT64	sequence;			// per core, a gap means records were dropped
+	UINT64	tsc;				// host tsc when the exit was taken
+	UINT64	exit_code;
+	UINT64	exit_info1;
+	UINT64	exit_info2;
+	UINT64	exit_int_info;
+	UINT64	nrip;				// 0 without nrip save
+	UINT8	fetched;			// instruction bytes fetched by decode assists, 0 without them
+	UINT8	instruction[15];
+	UINT16	core;
+	UINT16	declared;			// the handler's spill mask, the registers it may change
+	UINT32	reserved;
+	CAPTURE_STATE before;
+	CAPTURE_STATE after;
+};
+
+// single producer single consumer ring, the owning core writes head and the exporting core writes tail
+struct CAPTURE_RING
+{
+	UINT64	generation;			// last configuration applied to this vcpu
+	UINT64	active;
+	UINT64	pending;			// the exit being handled has a half written record at head
+	UINT64	sequence;
+	UINT64	captured;
+	UINT64	dropped;			// records lost because the ring was full
+	UINT64	cycles;				// host time spent recording
+
+	volatile LONG64 head;
+	volatile LONG64 tail;
+
+	CAPTURE_RECORD	entries[CAPTURE_RING_SIZE];
+};
+
+// records every exit of every core while enabled, for hv_replay to check offline. capturing spills all of the
+// guest's registers on every exit, so the exit path runs slower than it does otherwise
+namespace capture
+{
+	// registers the capture hypercalls, must be called before launching
+	bool setup();
+
+	void configure(UINT64 flags);
+
+	// applies configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	// right after the guest's registers are complete, takes the state the handlers start from
+	void on_exit(vcpu* vcpu);
+
+	// right before the guest's registers go back into the vmcb, takes the state they left
+	void on_resume(vcpu* vcpu);
+
+	// moves records out of target's ring into a guest buffer of caller's current address space,
+	// returns the amount of records written, or -1 if the buffer isnt present and writable
+	INT64 export_records(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
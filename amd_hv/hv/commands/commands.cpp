@@ -0,0 +1,129 @@
+#include "commands.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../../utilities/utilities.h"
+
+namespace commands
+{
+	COMMAND table[COMMAND_MAX];
+
+	UINT64 argument(GENERAL_REGISTERS* regs, int index)
+	{
+		switch (index)
+		{
+		case 0: return regs->rcx;
+		case 1: return regs->rdx;
+		case 2: return regs->r8;
+		case 3: return regs->r9;
+		case 4: return regs->r10;
+		default: return regs->r11;
+		}
+	}
+}
+
+bool commands::add(UINT64 code, const COMMAND& command)
+{
+	if (code >= COMMAND_MAX || table[code].handler || !command.handler)
+	{
+		LOG_ERROR("couldnt register a command, its code is out of range or taken \n");
+		return false;
+	}
+
+	table[code] = command;
+
+	return true;
+}
+
+const COMMAND* commands::find(UINT64 code)
+{
+	if (code >= COMMAND_MAX || !table[code].handler)
+		return nullptr;
+
+	return &table[code];
+}
+
+UINT64 commands::dispatch(vcpu* vcpu, GENERAL_REGISTERS* regs)
+{
+	return dispatch_as(vcpu, regs, vcpu->get_guest().get_state_save_area().cpl);
+}
+
+UINT64 commands::dispatch_as(vcpu* vcpu, GENERAL_REGISTERS* regs, UINT8 cpl)
+{
+	UINT64 code = regs->rax & HYPERCALL_CODE_MASK;
+
+	if (code >= COMMAND_MAX || !table[code].handler)
+		return call_invalid;
+
+	auto& command	= table[code];
+	auto& stats		= vcpu->get_command_stats()[code];
+
+	stats.calls++;
+
+	if (cpl > command.cpl)
+	{
+		stats.failures++;
+		return call_denied;
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		if (command.args[i] == arg_core && argument(regs, i) >= (UINT64)utilities::get_cpu_cores())
+		{
+			stats.failures++;
+			return call_bad_args;
+		}
+	}
+
+	UINT64 start_tsc	= __rdtsc();
+	UINT64 status		= command.handler(vcpu, regs);
+
+	stats.cycles += __rdtsc() - start_tsc;
+
+	if (status != call_success)
+		stats.failures++;
+
+	return status;
+}
+
+INT64 commands::export_list(vcpu* caller, UINT64 buffer, UINT64 capacity)
+{
+	auto& state = caller->get_guest().get_state_save_area();
+
+	INT64 written = 0;
+
+	for (UINT64 code = 0; code < COMMAND_MAX && (UINT64)written < capacity; code++)
+	{
+		auto& command = table[code];
+
+		if (!command.handler)
+			continue;
+
+		COMMAND_INFO info{};
+
+		info.code		= (UINT16)code;
+		info.version	= command.version;
+		info.cpl		= command.cpl;
+		info.flags		= command.flags;
+
+		memcpy(info.args, command.args, sizeof(info.args));
+		memcpy(info.name, command.name, sizeof(info.name));
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + written * sizeof(COMMAND_INFO), &info, sizeof(info)))
+			return -1;
+
+		written++;
+	}
+
+	return written;
+}
+
+bool commands::export_stats(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state = caller->get_guest().get_state_save_area();
+
+	// the target core keeps counting while we copy, a torn snapshot is acceptable for statistics
+
+	return memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer, target->get_command_stats(), min(capacity, (UINT64)COMMAND_MAX) * sizeof(COMMAND_STATS));
+}
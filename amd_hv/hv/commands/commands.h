@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// codes are dense, the registry is a table indexed by them
+#define COMMAND_MAX 0x40
+
+#define COMMAND_NAME_LENGTH 24
+
+// changes whenever the layout of COMMAND_INFO or COMMAND_STATS does
+#define COMMAND_INTERFACE_VERSION 1
+
+// flags of a command
+#define COMMAND_SESSION			0x1		// may be queued in a session ring
+#define COMMAND_BROADCAST		0x2		// runs on every core in a broadcast
+#define COMMAND_BROADCAST_ONCE	0x4		// global configuration, a broadcast runs it on the calling core and every other core applies it
+
+// what a command does with each of rcx, rdx, r8 - r11
+enum COMMAND_ARG : UINT8
+{
+	arg_unused	= 0,
+	arg_value	= 1,
+	arg_core	= 2,	// a core index, the registry rejects the ones that dont exist
+	arg_address	= 3,	// a buffer in the caller's address space
+	arg_result	= 4,	// only written
+};
+
+// runs the call in regs->rax, arguments are read from and results are written to regs->rcx, rdx, r8 - r11
+// in place. returns a HYPERCALL_STATUS
+typedef UINT64 (*COMMAND_HANDLER)(vcpu* vcpu, GENERAL_REGISTERS* regs);
+
+struct COMMAND
+{
+	COMMAND_HANDLER	handler;
+	char			name[COMMAND_NAME_LENGTH];
+	UINT16			version;	// goes up when the command changes in a way callers can tell
+	UINT8			cpl;		// the highest cpl thats allowed to call it
+	UINT8			flags;
+	COMMAND_ARG		args[6];
+};
+
+// what the list hypercall hands out per command
+struct COMMAND_INFO
+{
+	UINT16			code;
+	UINT16			version;
+	UINT8			cpl;
+	UINT8			flags;
+	COMMAND_ARG		args[6];
+	char			name[COMMAND_NAME_LENGTH];
+	UINT8			reserved[4];
+};
+
+// per core and command, only the core itself counts into them
+struct COMMAND_STATS
+{
+	UINT64	calls;
+	UINT64	failures;	// calls that didnt return call_success, denied ones included
+	UINT64	cycles;		// spent in the handler
+};
+
+// every hypercall goes through here, from vmmcall, the cpuid interface, session rings and broadcasts.
+// feature modules add their own commands from setup, nothing else has to know about them
+namespace commands
+{
+	// must be called before launching, false if the code is out of range or taken
+	bool add(UINT64 code, const COMMAND& command);
+
+	// nullptr for codes nothing is registered for
+	const COMMAND* find(UINT64 code);
+
+	// checks the caller's cpl and the core arguments, then runs the handler. O(1) in the amount of commands
+	UINT64 dispatch(vcpu* vcpu, GENERAL_REGISTERS* regs);
+
+	// the same for a caller that isnt the guest code this core is running, a broadcast runs
+	// on every core with the cpl of the core that started it
+	UINT64 dispatch_as(vcpu* vcpu, GENERAL_REGISTERS* regs, UINT8 cpl);
+
+	// writes a COMMAND_INFO per registered command to a guest buffer of caller's current address space,
+	// returns how many, or -1 if the buffer isnt present and writable
+	INT64 export_list(vcpu* caller, UINT64 buffer, UINT64 capacity);
+
+	// writes target's COMMAND_STATS, indexed by code, for the first capacity codes
+	bool export_stats(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
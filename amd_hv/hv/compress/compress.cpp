@@ -0,0 +1,204 @@
+#include "compress.h"
+
+namespace compress
+{
+	// lz4 ends every block with at least 5 literals, and the last match starts 12 bytes before the end
+	constexpr SIZE_T min_match		= 4;
+	constexpr SIZE_T last_literals	= 5;
+	constexpr SIZE_T match_limit	= 12;
+
+	UINT32 read32(const UINT8* p)
+	{
+		UINT32 value;
+
+		memcpy(&value, p, sizeof(value));
+
+		return value;
+	}
+
+	UINT32 hash(UINT32 sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+	}
+
+	// the 15 in a token nibble is followed by bytes of 255 and a last one below it
+	bool write_length(UINT8*& op, const UINT8* end, SIZE_T length)
+	{
+		for (; length >= 255; length -= 255)
+		{
+			if (op == end)
+				return false;
+
+			*op++ = 255;
+		}
+
+		if (op == end)
+			return false;
+
+		*op++ = (UINT8)length;
+
+		return true;
+	}
+
+	bool read_length(const UINT8*& ip, const UINT8* end, SIZE_T& length)
+	{
+		UINT8 byte;
+
+		do
+		{
+			if (ip == end)
+				return false;
+
+			byte = *ip++;
+			length += byte;
+
+		} while (byte == 255);
+
+		return true;
+	}
+
+	bool sequence(UINT8*& op, const UINT8* end, const UINT8* literals, SIZE_T literal_length, SIZE_T offset, SIZE_T match_length)
+	{
+		if (op == end)
+			return false;
+
+		UINT8* token = op++;
+
+		*token = (UINT8)((literal_length >= 15 ? 15 : literal_length) << 4);
+
+		if (literal_length >= 15 && !write_length(op, end, literal_length - 15))
+			return false;
+
+		if ((SIZE_T)(end - op) < literal_length)
+			return false;
+
+		memcpy(op, literals, literal_length);
+		op += literal_length;
+
+		// the last sequence is only literals
+
+		if (!match_length)
+			return true;
+
+		if (end - op < 2)
+			return false;
+
+		*op++ = (UINT8)offset;
+		*op++ = (UINT8)(offset >> 8);
+
+		match_length -= min_match;
+
+		*token |= match_length >= 15 ? 15 : match_length;
+
+		return match_length < 15 || write_length(op, end, match_length - 15);
+	}
+}
+
+SIZE_T compress::lz4(COMPRESS_WORKSPACE& work, const UINT8* in, SIZE_T size, UINT8* out, SIZE_T capacity)
+{
+	if (size > COMPRESS_MAX_BLOCK)
+		return 0;
+
+	memset(work.table, 0, sizeof(work.table));
+
+	UINT8* op			= out;
+	const UINT8* end	= out + capacity;
+
+	SIZE_T anchor	= 0;
+	SIZE_T i		= 0;
+
+	// a stale or colliding table entry is harmless, every candidate is compared before its used
+
+	while (size >= match_limit + 1 && i < size - match_limit)
+	{
+		UINT32 current	= read32(in + i);
+		UINT32 slot		= hash(current);
+		SIZE_T candidate	= work.table[slot];
+
+		work.table[slot] = (UINT16)i;
+
+		if (candidate >= i || read32(in + candidate) != current)
+		{
+			i++;
+			continue;
+		}
+
+		SIZE_T length = min_match;
+
+		while (i + length < size - last_literals && in[candidate + length] == in[i + length])
+			length++;
+
+		if (!sequence(op, end, in + anchor, i - anchor, i - candidate, length))
+			return 0;
+
+		i		+= length;
+		anchor	= i;
+	}
+
+	if (!sequence(op, end, in + anchor, size - anchor, 0, 0))
+		return 0;
+
+	return op - out;
+}
+
+SIZE_T compress::unlz4(const UINT8* in, SIZE_T size, UINT8* out, SIZE_T capacity)
+{
+	const UINT8* ip		= in;
+	const UINT8* end	= in + size;
+
+	UINT8* op		= out;
+	UINT8* limit	= out + capacity;
+
+	while (ip < end)
+	{
+		UINT8 token = *ip++;
+
+		SIZE_T literal_length = token >> 4;
+
+		if (literal_length == 15 && !read_length(ip, end, literal_length))
+			return 0;
+
+		if ((SIZE_T)(end - ip) < literal_length || (SIZE_T)(limit - op) < literal_length)
+			return 0;
+
+		memcpy(op, ip, literal_length);
+
+		ip += literal_length;
+		op += literal_length;
+
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return 0;
+
+		SIZE_T offset = ip[0] | (SIZE_T)ip[1] << 8;
+		ip += 2;
+
+		SIZE_T match_length = token & 15;
+
+		if (match_length == 15 && !read_length(ip, end, match_length))
+			return 0;
+
+		match_length += min_match;
+
+		if (!offset || offset > (SIZE_T)(op - out) || (SIZE_T)(limit - op) < match_length)
+			return 0;
+
+		// the match can overlap what it writes, a run of one byte has offset 1
+
+		const UINT8* match = op - offset;
+
+		if (offset >= match_length)
+			memcpy(op, match, match_length);
+		else
+		{
+			for (SIZE_T j = 0; j < match_length; j++)
+				op[j] = match[j];
+		}
+
+		op += match_length;
+	}
+
+	return op - out;
+}
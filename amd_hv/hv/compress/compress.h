@@ -0,0 +1,41 @@
+#pragma once
+
+// like search.h this has no kernel dependencies, hv_client and hv_snapshot_bench build it as well
+
+#if defined(_KERNEL_MODE)
+#include <ntifs.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t		UINT8;
+typedef uint16_t	UINT16;
+typedef uint32_t	UINT32;
+typedef uint64_t	UINT64;
+typedef size_t		SIZE_T;
+#endif
+
+#define COMPRESS_HASH_BITS 12
+
+// the largest block compress takes, positions in the hash table are 16 bit
+#define COMPRESS_MAX_BLOCK 0xFFFF
+
+// where the compressor remembers the last position of every 4 byte sequence, its too big for the host stack
+struct COMPRESS_WORKSPACE
+{
+	UINT16	table[1 << COMPRESS_HASH_BITS];
+};
+
+// greedy compressor for the lz4 block format, so snapshots can be read with any lz4 implementation.
+// its tuned for pages: one hash probe per position and no lazy matching
+namespace compress
+{
+	// returns the compressed size, 0 if it wouldnt fit in capacity or size is over COMPRESS_MAX_BLOCK
+	SIZE_T lz4(COMPRESS_WORKSPACE& work, const UINT8* in, SIZE_T size, UINT8* out, SIZE_T capacity);
+
+	// returns the decompressed size, 0 if the block is malformed or doesnt fit in capacity
+	SIZE_T unlz4(const UINT8* in, SIZE_T size, UINT8* out, SIZE_T capacity);
+}
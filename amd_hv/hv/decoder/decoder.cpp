@@ -0,0 +1,558 @@
+#include "decoder.h"
+
+namespace decoder
+{
+	enum OPCODE_FLAGS : UINT8
+	{
+		op_none		= 0,
+		op_modrm	= 1 << 0,
+		op_imm8		= 1 << 1,
+		op_imm16	= 1 << 2,
+		op_immz		= 1 << 3,	// 2 bytes with a 16 bit operand size, 4 otherwise
+		op_immv		= 1 << 4,	// the operand size, only mov r, imm64 takes 8
+		op_imm32	= 1 << 5,
+		op_moffs	= 1 << 6,	// the address size
+		op_register	= 1 << 7,	// the modrm always names a register, whatever its mod says
+	};
+
+	struct OPCODE_TABLE
+	{
+		UINT8 flags[0x100];
+	};
+
+	// AMD64 Manual Volume 3: Appendix A, Opcode and Operand Encodings
+	constexpr OPCODE_TABLE make_one_byte_table()
+	{
+		OPCODE_TABLE table{};
+
+		// add, or, adc, sbb, and, sub, xor, cmp: r/m forms, then al, imm8 and eax, immz
+
+		for (int op = 0; op < 0x40; op += 8)
+		{
+			for (int i = 0; i < 4; i++)
+				table.flags[op + i] = op_modrm;
+
+			table.flags[op + 4] = op_imm8;
+			table.flags[op + 5] = op_immz;
+		}
+
+		table.flags[0x62] = op_modrm;
+		table.flags[0x63] = op_modrm;
+		table.flags[0x68] = op_immz;
+		table.flags[0x69] = op_modrm | op_immz;
+		table.flags[0x6A] = op_imm8;
+		table.flags[0x6B] = op_modrm | op_imm8;
+
+		// jcc rel8
+
+		for (int op = 0x70; op < 0x80; op++)
+			table.flags[op] = op_imm8;
+
+		for (int op = 0x80; op < 0x90; op++)
+			table.flags[op] = op_modrm;
+
+		table.flags[0x80] |= op_imm8;
+		table.flags[0x81] |= op_immz;
+		table.flags[0x82] |= op_imm8;
+		table.flags[0x83] |= op_imm8;
+
+		// far call ptr16:z
+
+		table.flags[0x9A] = op_immz | op_imm16;
+
+		for (int op = 0xA0; op < 0xA4; op++)
+			table.flags[op] = op_moffs;
+
+		table.flags[0xA8] = op_imm8;
+		table.flags[0xA9] = op_immz;
+
+		for (int op = 0xB0; op < 0xB8; op++)
+			table.flags[op] = op_imm8;
+
+		for (int op = 0xB8; op < 0xC0; op++)
+			table.flags[op] = op_immv;
+
+		table.flags[0xC0] = op_modrm | op_imm8;
+		table.flags[0xC1] = op_modrm | op_imm8;
+		table.flags[0xC2] = op_imm16;
+		table.flags[0xC4] = op_modrm;
+		table.flags[0xC5] = op_modrm;
+		table.flags[0xC6] = op_modrm | op_imm8;
+		table.flags[0xC7] = op_modrm | op_immz;
+		table.flags[0xC8] = op_imm16 | op_imm8;
+		table.flags[0xCA] = op_imm16;
+		table.flags[0xCD] = op_imm8;
+
+		for (int op = 0xD0; op < 0xD4; op++)
+			table.flags[op] = op_modrm;
+
+		table.flags[0xD4] = op_imm8;
+		table.flags[0xD5] = op_imm8;
+
+		// x87
+
+		for (int op = 0xD8; op < 0xE0; op++)
+			table.flags[op] = op_modrm;
+
+		// loop, jcxz, in, out
+
+		for (int op = 0xE0; op < 0xE8; op++)
+			table.flags[op] = op_imm8;
+
+		table.flags[0xE8] = op_immz;
+		table.flags[0xE9] = op_immz;
+		table.flags[0xEA] = op_immz | op_imm16;
+		table.flags[0xEB] = op_imm8;
+
+		// test f6 / f7 /0 and /1 take an immediate too, decode handles those
+
+		table.flags[0xF6] = op_modrm;
+		table.flags[0xF7] = op_modrm;
+		table.flags[0xFE] = op_modrm;
+		table.flags[0xFF] = op_modrm;
+
+		return table;
+	}
+
+	constexpr OPCODE_TABLE make_two_byte_table()
+	{
+		OPCODE_TABLE table{};
+
+		// nearly everything in the 0f map has a modrm, we clear the ones that dont
+
+		for (auto& flags : table.flags)
+			flags = op_modrm;
+
+		// syscall, clts, sysret, invd, wbinvd, ud2, femms and the unused ones around them
+
+		for (int op = 0x04; op < 0x0D; op++)
+			table.flags[op] = op_none;
+
+		table.flags[0x0E] = op_none;
+
+		// 3dnow has its opcode in an imm8 after the operands
+
+		table.flags[0x0F] = op_modrm | op_imm8;
+
+		// mov to and from control, debug and the old test registers ignore mod, there is no memory form
+
+		for (int op = 0x20; op < 0x24; op++)
+			table.flags[op] = op_modrm | op_register;
+
+		table.flags[0x24] = op_modrm | op_register;
+		table.flags[0x26] = op_modrm | op_register;
+
+		// wrmsr, rdtsc, rdmsr, rdpmc, sysenter, sysexit, getsec
+
+		for (int op = 0x30; op < 0x38; op++)
+			table.flags[op] = op_none;
+
+		for (int op = 0x70; op < 0x74; op++)
+			table.flags[op] = op_modrm | op_imm8;
+
+		// emms
+
+		table.flags[0x77] = op_none;
+
+		// jcc relz
+
+		for (int op = 0x80; op < 0x90; op++)
+			table.flags[op] = op_immz;
+
+		// push / pop fs, cpuid, push / pop gs, rsm
+
+		table.flags[0xA0] = op_none;
+		table.flags[0xA1] = op_none;
+		table.flags[0xA2] = op_none;
+		table.flags[0xA8] = op_none;
+		table.flags[0xA9] = op_none;
+		table.flags[0xAA] = op_none;
+
+		table.flags[0xA4] = op_modrm | op_imm8;
+		table.flags[0xAC] = op_modrm | op_imm8;
+		table.flags[0xBA] = op_modrm | op_imm8;
+		table.flags[0xC2] = op_modrm | op_imm8;
+		table.flags[0xC4] = op_modrm | op_imm8;
+		table.flags[0xC5] = op_modrm | op_imm8;
+		table.flags[0xC6] = op_modrm | op_imm8;
+
+		// bswap
+
+		for (int op = 0xC8; op < 0xD0; op++)
+			table.flags[op] = op_none;
+
+		return table;
+	}
+
+	constexpr OPCODE_TABLE one_byte_table = make_one_byte_table();
+	constexpr OPCODE_TABLE two_byte_table = make_two_byte_table();
+
+	UINT64 read_le(const UINT8* bytes, UINT8 size)
+	{
+		UINT64 value = 0;
+
+		for (int i = size - 1; i >= 0; i--)
+			value = value << 8 | bytes[i];
+
+		return value;
+	}
+
+	bool legacy_prefix(DECODED_INSTRUCTION& insn, UINT8 byte)
+	{
+		switch (byte)
+		{
+		case 0xF0:
+			insn.prefixes |= PREFIX_LOCK;
+			break;
+		case 0xF2:
+
+			// the last of f2 and f3 wins
+
+			insn.prefixes = (insn.prefixes & ~PREFIX_REP) | PREFIX_REPNE;
+			break;
+		case 0xF3:
+			insn.prefixes = (insn.prefixes & ~PREFIX_REPNE) | PREFIX_REP;
+			break;
+		case 0x66:
+			insn.prefixes |= PREFIX_OPSIZE;
+			break;
+		case 0x67:
+			insn.prefixes |= PREFIX_ADDRSIZE;
+			break;
+		case 0x26:
+			insn.segment = seg_es;
+			break;
+		case 0x2E:
+			insn.segment = seg_cs;
+			break;
+		case 0x36:
+			insn.segment = seg_ss;
+			break;
+		case 0x3E:
+			insn.segment = seg_ds;
+			break;
+		case 0x64:
+			insn.segment = seg_fs;
+			break;
+		case 0x65:
+			insn.segment = seg_gs;
+			break;
+		default:
+			return false;
+		}
+
+		return true;
+	}
+
+	// c4, c5 and 62 are les, lds and bound outside of long mode, unless their modrm would be a register form.
+	// 8f is pop r/m, which only uses /0, so a nonzero map select there means xop
+	bool vex_prefix(const UINT8* bytes, SIZE_T size, SIZE_T i, DECODER_MODE mode)
+	{
+		if (i + 1 >= size)
+			return false;
+
+		switch (bytes[i])
+		{
+		case 0xC4:
+		case 0xC5:
+		case 0x62:
+			return mode == decode_64 || (bytes[i + 1] & 0xC0) == 0xC0;
+		case 0x8F:
+			return (bytes[i + 1] & 0x1F) >= map_xop8;
+		default:
+			return false;
+		}
+	}
+}
+
+bool decoder::decode(const UINT8* bytes, SIZE_T size, DECODER_MODE mode, DECODED_INSTRUCTION& insn)
+{
+	insn			= {};
+	insn.mode		= mode;
+	insn.segment	= seg_none;
+
+	size = min(size, DECODER_MAX_LENGTH);
+
+	SIZE_T i = 0;
+
+	// legacy prefixes, a rex only counts when its right in front of the opcode
+
+	for (;; i++)
+	{
+		if (i >= size)
+			return false;
+
+		if (mode == decode_64 && (bytes[i] & 0xF0) == 0x40)
+		{
+			insn.rex = bytes[i];
+			continue;
+		}
+
+		if (!legacy_prefix(insn, bytes[i]))
+			break;
+
+		insn.rex = 0;
+	}
+
+	bool addrsize = insn.prefixes & PREFIX_ADDRSIZE;
+
+	if (mode == decode_64)
+		insn.address_size = addrsize ? 4 : 8;
+	else if (mode == decode_32)
+		insn.address_size = addrsize ? 2 : 4;
+	else
+		insn.address_size = addrsize ? 4 : 2;
+
+	UINT8 flags;
+
+	if (vex_prefix(bytes, size, i, mode))
+	{
+		UINT8 escape = bytes[i];
+
+		insn.vex	= 1;
+		insn.evex	= escape == 0x62;
+
+		// the payload stores R X B inverted and W as is
+
+		UINT8 payload = escape == 0xC5 ? 1 : escape == 0x62 ? 3 : 2;
+
+		if (i + payload + 1 >= size)
+			return false;
+
+		UINT8 p0 = bytes[i + 1];
+		UINT8 p1 = bytes[i + 2];
+
+		if (escape == 0xC5)
+		{
+			insn.map = map_0f;
+			insn.rex = 0x40 | ((~p0 >> 5) & 4);
+		}
+		else
+		{
+			insn.map = p0 & (insn.evex ? 7 : 0x1F);
+			insn.rex = 0x40 | ((~p0 >> 5) & 7) | ((p1 >> 4) & 8);
+		}
+
+		// outside of long mode R X B are ignored, and W only selects the instruction form
+
+		if (mode != decode_64)
+			insn.rex = 0;
+
+		i += payload + 1;
+
+		insn.opcode = bytes[i++];
+
+		flags = op_modrm;
+
+		// vzeroupper and vzeroall have no operands
+
+		if (insn.map == map_0f && insn.opcode == 0x77 && !insn.evex)
+			flags = op_none;
+
+		if (insn.map == map_0f3a || insn.map == map_xop8)
+			flags |= op_imm8;
+		else if (insn.map == map_xopa)
+			flags |= op_imm32;
+		else if (insn.map == map_0f)
+		{
+			switch (insn.opcode)
+			{
+			case 0x70: case 0x71: case 0x72: case 0x73:
+			case 0xC2: case 0xC4: case 0xC5: case 0xC6:
+				flags |= op_imm8;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	else if (bytes[i] == 0x0F)
+	{
+		if (++i >= size)
+			return false;
+
+		UINT8 byte = bytes[i++];
+
+		if (byte == 0x38 || byte == 0x3A)
+		{
+			if (i >= size)
+				return false;
+
+			insn.map	= byte == 0x38 ? map_0f38 : map_0f3a;
+			insn.opcode	= bytes[i++];
+			flags		= byte == 0x38 ? op_modrm : op_modrm | op_imm8;
+		}
+		else
+		{
+			insn.map	= map_0f;
+			insn.opcode	= byte;
+			flags		= two_byte_table.flags[byte];
+
+			// sse4a extrq and insertq take two imm8-s, the unprefixed form is an invalid vmread
+
+			if (byte == 0x78 && (insn.prefixes & (PREFIX_OPSIZE | PREFIX_REPNE)))
+				flags |= op_imm16;
+		}
+	}
+	else
+	{
+		insn.map	= map_one_byte;
+		insn.opcode	= bytes[i++];
+		flags		= one_byte_table.flags[insn.opcode];
+	}
+
+	bool opsize = insn.prefixes & PREFIX_OPSIZE;
+
+	if (mode == decode_64)
+		insn.operand_size = (insn.rex & 8) ? 8 : opsize ? 2 : 4;
+	else if (mode == decode_32)
+		insn.operand_size = opsize ? 2 : 4;
+	else
+		insn.operand_size = opsize ? 4 : 2;
+
+	if (flags & op_modrm)
+	{
+		if (i >= size)
+			return false;
+
+		insn.has_modrm	= 1;
+		insn.modrm		= bytes[i++];
+
+		if (flags & op_register)
+			insn.modrm |= 0xC0;
+
+		UINT8 mod	= insn.modrm >> 6;
+		UINT8 rm	= insn.modrm & 7;
+
+		if (mod != 3 && insn.address_size == 2)
+		{
+			if (mod == 1)
+				insn.displacement_size = 1;
+			else if (mod == 2 || rm == 6)
+				insn.displacement_size = 2;
+		}
+		else if (mod != 3)
+		{
+			if (rm == 4)
+			{
+				if (i >= size)
+					return false;
+
+				insn.has_sib	= 1;
+				insn.sib		= bytes[i++];
+			}
+
+			UINT8 base = insn.has_sib ? insn.sib & 7 : rm;
+
+			if (mod == 1)
+				insn.displacement_size = 1;
+			else if (mod == 2 || base == 5)
+				insn.displacement_size = 4;
+		}
+	}
+
+	if (i + insn.displacement_size > size)
+		return false;
+
+	if (insn.displacement_size)
+	{
+		UINT8 shift = 64 - insn.displacement_size * 8;
+
+		insn.displacement = (INT64)(read_le(bytes + i, insn.displacement_size) << shift) >> shift;
+
+		i += insn.displacement_size;
+	}
+
+	UINT8 z = insn.operand_size == 2 ? 2 : 4;
+
+	if (flags & op_imm8)
+		insn.immediate_size += 1;
+
+	if (flags & op_imm16)
+		insn.immediate_size += 2;
+
+	if (flags & op_immz)
+		insn.immediate_size += z;
+
+	if (flags & op_immv)
+		insn.immediate_size += insn.operand_size == 8 ? 8 : z;
+
+	if (flags & op_imm32)
+		insn.immediate_size += 4;
+
+	if (flags & op_moffs)
+		insn.immediate_size += insn.address_size;
+
+	// test r/m, imm is /0 and /1 of the f6 and f7 groups
+
+	if (insn.map == map_one_byte && (insn.opcode & 0xFE) == 0xF6 && ((insn.modrm >> 3) & 7) < 2)
+		insn.immediate_size += insn.opcode == 0xF6 ? 1 : z;
+
+	if (i + insn.immediate_size > size)
+		return false;
+
+	insn.immediate = read_le(bytes + i, insn.immediate_size);
+
+	i += insn.immediate_size;
+
+	insn.length = (UINT8)i;
+
+	return true;
+}
+
+bool decoder::effective_address(const DECODED_INSTRUCTION& insn, GENERAL_REGISTERS* regs, UINT64 next_rip, UINT64* address)
+{
+	// evex scales disp8 by a size that depends on the instruction, we dont know it
+
+	if (!has_memory_operand(insn) || insn.evex)
+		return false;
+
+	UINT8 mod	= modrm_mod(insn);
+	UINT8 rm	= insn.modrm & 7;
+
+	UINT64 offset = insn.displacement;
+
+	if (insn.address_size == 2)
+	{
+		// bx + si, bx + di, bp + si, bp + di, si, di, bp, bx
+
+		static constexpr UINT8 base16[8] = { 3, 3, 5, 5, 6, 7, 5, 3 };
+
+		if (mod != 0 || rm != 6)
+			offset += gpr(regs, base16[rm]);
+
+		if (rm < 4)
+			offset += gpr(regs, rm & 1 ? 7 : 6);
+
+		*address = offset & MAXUINT16;
+
+		return true;
+	}
+
+	if (insn.has_sib)
+	{
+		UINT8 base	= (insn.sib & 7) | ((insn.rex & 1) << 3);
+		UINT8 index	= ((insn.sib >> 3) & 7) | ((insn.rex & 2) << 2);
+
+		if (mod != 0 || (insn.sib & 7) != 5)
+			offset += gpr(regs, base);
+
+		// an index of rsp means none, r12 is a valid index
+
+		if (index != 4)
+			offset += gpr(regs, index) << (insn.sib >> 6);
+	}
+	else if (mod == 0 && rm == 5)
+	{
+		// rip relative in long mode, a plain disp32 otherwise
+
+		if (insn.mode == decode_64)
+			offset += next_rip;
+	}
+	else
+		offset += gpr(regs, modrm_rm(insn));
+
+	*address = insn.address_size == 4 ? offset & MAXUINT32 : offset;
+
+	return true;
+}
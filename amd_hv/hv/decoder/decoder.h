@@ -0,0 +1,108 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+// the architectural limit, longer instructions raise #GP
+#define DECODER_MAX_LENGTH 15
+
+// legacy prefixes seen on the instruction
+#define PREFIX_LOCK		0x1
+#define PREFIX_REP		0x2		// f3
+#define PREFIX_REPNE	0x4		// f2
+#define PREFIX_OPSIZE	0x8		// 66
+#define PREFIX_ADDRSIZE	0x10	// 67
+
+enum DECODER_MODE : UINT8
+{
+	decode_16 = 2,		// the values are the default address size in bytes
+	decode_32 = 4,
+	decode_64 = 8,
+};
+
+enum OPCODE_MAP : UINT8
+{
+	map_one_byte	= 0,
+	map_0f			= 1,
+	map_0f38		= 2,
+	map_0f3a		= 3,
+	map_xop8		= 8,
+	map_xop9		= 9,
+	map_xopa		= 10,
+};
+
+// segment override prefix, in the order of the sreg encoding
+enum SEGMENT_OVERRIDE : UINT8
+{
+	seg_es		= 0,
+	seg_cs		= 1,
+	seg_ss		= 2,
+	seg_ds		= 3,
+	seg_fs		= 4,
+	seg_gs		= 5,
+	seg_none	= 0xFF,
+};
+
+// vex and evex encoded instructions get their inverted R X B W bits folded into rex,
+// so operands decode the same way for every encoding
+struct DECODED_INSTRUCTION
+{
+	UINT8	length;
+	UINT8	mode;				// DECODER_MODE
+	UINT8	prefixes;			// PREFIX_ flags
+	UINT8	segment;			// SEGMENT_OVERRIDE
+	UINT8	rex;				// 0 if there was none
+	UINT8	map;				// OPCODE_MAP
+	UINT8	opcode;
+	UINT8	operand_size;		// in bytes
+	UINT8	address_size;		// in bytes
+	UINT8	has_modrm;
+	UINT8	modrm;			// mod reads 3 for the movs to and from control and debug registers, which ignore it
+	UINT8	has_sib;
+	UINT8	sib;
+	UINT8	vex;				// vex, xop or evex encoded
+	UINT8	evex;				// disp8 is scaled by the operand's size, which we dont track
+	UINT8	displacement_size;
+	UINT8	immediate_size;
+	INT64	displacement;		// sign extended
+	UINT64	immediate;			// zero extended, two immediates (enter, extrq) are packed low to high
+};
+
+// a table driven length and operand decoder, enough to find the operands of any instruction
+// the guest can exit on. it doesnt validate opcodes, a reserved encoding decodes like its neighbours
+namespace decoder
+{
+	// fails if the instruction runs past size or DECODER_MAX_LENGTH
+	bool decode(const UINT8* bytes, SIZE_T size, DECODER_MODE mode, DECODED_INSTRUCTION& insn);
+
+	// register numbers are in the encoding's order, rax = 0 ... r15 = 15
+	__forceinline UINT64& gpr(GENERAL_REGISTERS* regs, UINT8 number)
+	{
+		// GENERAL_REGISTERS is laid out from r15 down to rax
+
+		return ((UINT64*)regs)[15 - (number & 15)];
+	}
+
+	__forceinline UINT8 modrm_mod(const DECODED_INSTRUCTION& insn)
+	{
+		return insn.modrm >> 6;
+	}
+
+	__forceinline UINT8 modrm_reg(const DECODED_INSTRUCTION& insn)
+	{
+		return ((insn.modrm >> 3) & 7) | ((insn.rex & 4) << 1);
+	}
+
+	__forceinline UINT8 modrm_rm(const DECODED_INSTRUCTION& insn)
+	{
+		return (insn.modrm & 7) | ((insn.rex & 1) << 3);
+	}
+
+	__forceinline bool has_memory_operand(const DECODED_INSTRUCTION& insn)
+	{
+		return insn.has_modrm && modrm_mod(insn) != 3;
+	}
+
+	// the offset of the memory operand, without the segment base. rsp has to be in regs,
+	// next_rip is the address of the following instruction for rip relative operands
+	bool effective_address(const DECODED_INSTRUCTION& insn, GENERAL_REGISTERS* regs, UINT64 next_rip, UINT64* address);
+}
@@ -0,0 +1,120 @@
+#include "device.h"
+
+#include <wdmsec.h>
+
+#include "../hv.h"
+#include "../../utilities/utilities.h"
+
+namespace device
+{
+	PDEVICE_OBJECT	object;
+	bool			linked;
+
+	// {5B0E2C71-3F4A-4D8E-9C61-0A7D2E4B9F13}
+	constexpr GUID device_class = { 0x5B0E2C71, 0x3F4A, 0x4D8E, { 0x9C, 0x61, 0x0A, 0x7D, 0x2E, 0x4B, 0x9F, 0x13 } };
+
+	NTSTATUS complete(PIRP irp, NTSTATUS status, ULONG_PTR information)
+	{
+		irp->IoStatus.Status		= status;
+		irp->IoStatus.Information	= information;
+
+		IoCompleteRequest(irp, IO_NO_INCREMENT);
+
+		return status;
+	}
+
+	NTSTATUS open_close(PDEVICE_OBJECT device_object, PIRP irp)
+	{
+		UNREFERENCED_PARAMETER(device_object);
+
+		return complete(irp, STATUS_SUCCESS, 0);
+	}
+
+	// the device is never filtered, so this runs in the thread that sent the ioctl
+	NTSTATUS control(PDEVICE_OBJECT device_object, PIRP irp)
+	{
+		UNREFERENCED_PARAMETER(device_object);
+
+		auto& params = IoGetCurrentIrpStackLocation(irp)->Parameters.DeviceIoControl;
+
+		if (params.IoControlCode != IOCTL_HV_CALL)
+			return complete(irp, STATUS_INVALID_DEVICE_REQUEST, 0);
+
+		if (params.InputBufferLength < sizeof(HV_DEVICE_CALL) || params.OutputBufferLength < sizeof(HV_DEVICE_CALL))
+			return complete(irp, STATUS_BUFFER_TOO_SMALL, 0);
+
+		auto call = (HV_DEVICE_CALL*)irp->AssociatedIrp.SystemBuffer;
+
+		// shutdown has to run on every core and tear down what the driver set up,
+		// process exit is the notify routine's
+
+		UINT64 code = call->code & HYPERCALL_CODE_MASK;
+
+		if (code == HYPERCALL_SHUTDOWN || code == HYPERCALL_PROCESS_EXIT)
+		{
+			call->status = call_denied;
+			return complete(irp, STATUS_SUCCESS, sizeof(HV_DEVICE_CALL));
+		}
+
+		HYPERCALL_ARGS args{};
+
+		memcpy(args.regs, call->regs, sizeof(args.regs));
+
+		call->status = hv_call(HYPERCALL_CODE(code), &args);
+
+		memcpy(call->regs, args.regs, sizeof(call->regs));
+
+		return complete(irp, STATUS_SUCCESS, sizeof(HV_DEVICE_CALL));
+	}
+}
+
+bool device::create(PDRIVER_OBJECT driver_object)
+{
+	UNICODE_STRING name = RTL_CONSTANT_STRING(HV_DEVICE_NAME);
+	UNICODE_STRING link = RTL_CONSTANT_STRING(HV_DEVICE_LINK);
+
+	auto status = IoCreateDeviceSecure(driver_object, 0, &name, FILE_DEVICE_UNKNOWN, FILE_DEVICE_SECURE_OPEN, FALSE,
+		&SDDL_DEVOBJ_SYS_ALL_ADM_ALL, &device_class, &object);
+
+	if (!NT_SUCCESS(status))
+	{
+		LOG_ERROR("couldnt create the device \n");
+		return false;
+	}
+
+	if (!NT_SUCCESS(IoCreateSymbolicLink(&link, &name)))
+	{
+		LOG_ERROR("couldnt link the device \n");
+
+		IoDeleteDevice(object);
+		object = nullptr;
+
+		return false;
+	}
+
+	linked = true;
+
+	driver_object->MajorFunction[IRP_MJ_CREATE]			= open_close;
+	driver_object->MajorFunction[IRP_MJ_CLOSE]			= open_close;
+	driver_object->MajorFunction[IRP_MJ_DEVICE_CONTROL]	= control;
+
+	object->Flags &= ~DO_DEVICE_INITIALIZING;
+
+	return true;
+}
+
+void device::remove()
+{
+	UNICODE_STRING link = RTL_CONSTANT_STRING(HV_DEVICE_LINK);
+
+	if (linked)
+		IoDeleteSymbolicLink(&link);
+
+	if (object)
+		IoDeleteDevice(object);
+
+	linked = false;
+	object = nullptr;
+
+	return;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+// the kernel only commands for ring 3 tools, which make them through IOCTL_HV_CALL.
+// only system and administrators may open the device, the call runs with cpl 0 in the caller's own
+// address space, so buffers in it are the caller's user mode addresses like with a vmmcall from ring 3
+#define HV_DEVICE_NAME L"\\Device\\amd_hv"
+#define HV_DEVICE_LINK L"\\DosDevices\\amd_hv"
+
+#define IOCTL_HV_CALL CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_READ_DATA | FILE_WRITE_DATA)
+
+// in and out of IOCTL_HV_CALL
+struct HV_DEVICE_CALL
+{
+	UINT64	code;		// HYPERCALL_, without the key
+	UINT64	status;		// HYPERCALL_STATUS, out
+	UINT64	regs[6];	// rcx, rdx, r8 - r11, in and out
+};
+
+namespace device
+{
+	// once every core runs under the hypervisor
+	bool create(PDRIVER_OBJECT driver_object);
+
+	// before the hypervisor shuts down
+	void remove();
+}
@@ -0,0 +1,341 @@
+#include "emulator.h"
+
+namespace emulator
+{
+	// the flags and, or and xor define, af is undefined and left alone
+	constexpr UINT64 flag_cf = 1 << 0;
+	constexpr UINT64 flag_pf = 1 << 2;
+	constexpr UINT64 flag_zf = 1 << 6;
+	constexpr UINT64 flag_sf = 1 << 7;
+	constexpr UINT64 flag_df = 1 << 10;
+	constexpr UINT64 flag_of = 1 << 11;
+
+	UINT64 size_mask(UINT8 size)
+	{
+		return size == 8 ? MAXUINT64 : (1ull << size * 8) - 1;
+	}
+
+	UINT64 sign_extend(UINT64 value, UINT8 size)
+	{
+		UINT8 shift = 64 - size * 8;
+
+		return (INT64)(value << shift) >> shift;
+	}
+
+	UINT64 read_gpr(const DECODED_INSTRUCTION& insn, GENERAL_REGISTERS* regs, UINT8 number, UINT8 size)
+	{
+		// without a rex, byte registers 4 - 7 are ah, ch, dh and bh
+
+		if (size == 1 && !insn.rex && number >= 4 && number < 8)
+			return (decoder::gpr(regs, number - 4) >> 8) & 0xFF;
+
+		return decoder::gpr(regs, number) & size_mask(size);
+	}
+
+	void write_gpr(const DECODED_INSTRUCTION& insn, GENERAL_REGISTERS* regs, UINT8 number, UINT8 size, UINT64 value)
+	{
+		if (size == 1 && !insn.rex && number >= 4 && number < 8)
+		{
+			auto& reg = decoder::gpr(regs, number - 4);
+
+			reg = (reg & ~0xFF00ull) | (value & 0xFF) << 8;
+
+			return;
+		}
+
+		auto& reg = decoder::gpr(regs, number);
+
+		// 32 bit writes zero the upper half, 8 and 16 bit ones leave it
+
+		if (size == 4)
+			reg = value & MAXUINT32;
+		else
+			reg = (reg & ~size_mask(size)) | (value & size_mask(size));
+
+		return;
+	}
+
+	// rcx, rsi and rdi of string instructions are as wide as the address size
+	void advance(UINT64& reg, INT64 step, UINT8 address_size)
+	{
+		if (address_size == 8)
+			reg += step;
+		else if (address_size == 4)
+			reg = (reg + step) & MAXUINT32;
+		else
+			reg = (reg & ~0xFFFFull) | ((reg + step) & 0xFFFF);
+
+		return;
+	}
+
+	void logic_flags(EMULATOR_STATE& state, UINT64 result, UINT8 size)
+	{
+		state.rflags &= ~(flag_cf | flag_pf | flag_zf | flag_sf | flag_of);
+
+		result &= size_mask(size);
+
+		if (!result)
+			state.rflags |= flag_zf;
+
+		if ((result >> (size * 8 - 1)) & 1)
+			state.rflags |= flag_sf;
+
+		// pf is set when the low byte has an even number of ones
+
+		UINT8 parity = result & 0xFF;
+
+		parity ^= parity >> 4;
+		parity ^= parity >> 2;
+		parity ^= parity >> 1;
+
+		if (!(parity & 1))
+			state.rflags |= flag_pf;
+
+		return;
+	}
+
+	UINT64 segment_base(const DECODED_INSTRUCTION& insn, const EMULATOR_STATE& state)
+	{
+		// the ss default of rbp and rsp based operands isnt modelled, the guest is flat outside of fs and gs
+
+		return state.segment_bases[insn.segment == seg_none ? seg_ds : insn.segment];
+	}
+
+	bool read(const EMULATOR_OPS& ops, UINT64 address, UINT8 size, UINT64* value)
+	{
+		*value = 0;
+
+		return ops.read(ops.context, address, value, size);
+	}
+
+	bool write(const EMULATOR_OPS& ops, UINT64 address, UINT8 size, UINT64 value)
+	{
+		return ops.write(ops.context, address, &value, size);
+	}
+
+	EMULATE_STATUS string(const DECODED_INSTRUCTION& insn, EMULATOR_STATE& state, const EMULATOR_OPS& ops)
+	{
+		bool movs	= insn.opcode <= 0xA5;
+		UINT8 size	= insn.opcode & 1 ? insn.operand_size : 1;
+		bool rep	= insn.prefixes & (PREFIX_REP | PREFIX_REPNE);
+
+		auto& rcx = decoder::gpr(state.regs, 1);
+		auto& rsi = decoder::gpr(state.regs, 6);
+		auto& rdi = decoder::gpr(state.regs, 7);
+
+		UINT64 mask		= size_mask(insn.address_size);
+		INT64 step		= state.rflags & flag_df ? -(INT64)size : size;
+		UINT64 count	= rep ? rcx & mask : 1;
+
+		for (UINT64 i = 0; i < count && i < EMULATOR_MAX_ITERATIONS; i++)
+		{
+			UINT64 value = decoder::gpr(state.regs, 0);
+
+			if (movs && !read(ops, segment_base(insn, state) + (rsi & mask), size, &value))
+				return emulate_fault;
+
+			// the destination is always es, overrides only apply to the source
+
+			if (!write(ops, state.segment_bases[seg_es] + (rdi & mask), size, value))
+				return emulate_fault;
+
+			advance(rdi, step, insn.address_size);
+
+			if (movs)
+				advance(rsi, step, insn.address_size);
+
+			if (rep)
+				advance(rcx, -1, insn.address_size);
+		}
+
+		return rep && (rcx & mask) ? emulate_again : emulate_done;
+	}
+
+	EMULATE_STATUS two_byte(const DECODED_INSTRUCTION& insn, EMULATOR_STATE& state, const EMULATOR_OPS& ops, UINT64 address)
+	{
+		switch (insn.opcode)
+		{
+		case 0xB6:
+		case 0xB7:
+		case 0xBE:
+		case 0xBF:
+		{
+			// movzx and movsx, the low bit selects a word source
+
+			UINT8 size = insn.opcode & 1 ? 2 : 1;
+
+			UINT64 value;
+
+			if (!read(ops, address, size, &value))
+				return emulate_fault;
+
+			if (insn.opcode & 8)
+				value = sign_extend(value, size);
+
+			write_gpr(insn, state.regs, decoder::modrm_reg(insn), insn.operand_size, value);
+
+			return emulate_done;
+		}
+		default:
+			return emulate_unsupported;
+		}
+	}
+}
+
+EMULATE_STATUS emulator::emulate(const DECODED_INSTRUCTION& insn, EMULATOR_STATE& state, const EMULATOR_OPS& ops)
+{
+	if (insn.vex)
+		return emulate_unsupported;
+
+	if (insn.map == map_one_byte)
+	{
+		switch (insn.opcode)
+		{
+		case 0xA4:
+		case 0xA5:
+		case 0xAA:
+		case 0xAB:
+			return string(insn, state, ops);
+		case 0xA0:
+		case 0xA1:
+		case 0xA2:
+		case 0xA3:
+		{
+			// mov between the accumulator and an absolute offset
+
+			UINT8 size		= insn.opcode & 1 ? insn.operand_size : 1;
+			UINT64 address	= segment_base(insn, state) + (insn.immediate & size_mask(insn.address_size));
+
+			if (insn.opcode & 2)
+				return write(ops, address, size, decoder::gpr(state.regs, 0)) ? emulate_done : emulate_fault;
+
+			UINT64 value;
+
+			if (!read(ops, address, size, &value))
+				return emulate_fault;
+
+			write_gpr(insn, state.regs, 0, size, value);
+
+			return emulate_done;
+		}
+		default:
+			break;
+		}
+	}
+
+	// everything else accesses memory through its r/m operand
+
+	UINT64 offset;
+
+	if (!decoder::has_memory_operand(insn) || !decoder::effective_address(insn, state.regs, state.next_rip, &offset))
+		return emulate_unsupported;
+
+	UINT64 address = segment_base(insn, state) + offset;
+
+	if (insn.map == map_0f)
+		return two_byte(insn, state, ops, address);
+
+	if (insn.map != map_one_byte)
+		return emulate_unsupported;
+
+	// in every opcode pair below the low bit selects a byte or a full size operand
+
+	UINT8 size	= insn.opcode & 1 ? insn.operand_size : 1;
+	UINT8 reg	= decoder::modrm_reg(insn);
+
+	UINT64 value;
+
+	switch (insn.opcode)
+	{
+	case 0x88:
+	case 0x89:
+		return write(ops, address, size, read_gpr(insn, state.regs, reg, size)) ? emulate_done : emulate_fault;
+	case 0x8A:
+	case 0x8B:
+		if (!read(ops, address, size, &value))
+			return emulate_fault;
+
+		write_gpr(insn, state.regs, reg, size, value);
+		break;
+	case 0xC6:
+	case 0xC7:
+
+		// mov r/m, imm is /0, a 64 bit store sign extends its imm32
+
+		if ((insn.modrm >> 3) & 7)
+			return emulate_unsupported;
+
+		return write(ops, address, size, sign_extend(insn.immediate, insn.immediate_size)) ? emulate_done : emulate_fault;
+	case 0x63:
+
+		// movsxd, without rex.w its a plain 32 bit mov
+
+		if (!read(ops, address, 4, &value))
+			return emulate_fault;
+
+		write_gpr(insn, state.regs, reg, insn.operand_size, sign_extend(value, 4));
+		break;
+	case 0x86:
+	case 0x87:
+		if (!read(ops, address, size, &value))
+			return emulate_fault;
+
+		if (!write(ops, address, size, read_gpr(insn, state.regs, reg, size)))
+			return emulate_fault;
+
+		write_gpr(insn, state.regs, reg, size, value);
+		break;
+	case 0x08:
+	case 0x09:
+	case 0x0A:
+	case 0x0B:
+	case 0x20:
+	case 0x21:
+	case 0x22:
+	case 0x23:
+	{
+		// or and and, bit 1 selects the register as the destination
+
+		if (!read(ops, address, size, &value))
+			return emulate_fault;
+
+		UINT64 source = read_gpr(insn, state.regs, reg, size);
+		UINT64 result = insn.opcode < 0x20 ? value | source : value & source;
+
+		logic_flags(state, result, size);
+
+		if (insn.opcode & 2)
+		{
+			write_gpr(insn, state.regs, reg, size, result);
+			break;
+		}
+
+		return write(ops, address, size, result) ? emulate_done : emulate_fault;
+	}
+	case 0x80:
+	case 0x81:
+	case 0x83:
+	{
+		// group 1, /1 is or and /4 is and. 83 sign extends an imm8 to the full operand size
+
+		UINT8 operation = (insn.modrm >> 3) & 7;
+
+		if (operation != 1 && operation != 4)
+			return emulate_unsupported;
+
+		if (!read(ops, address, size, &value))
+			return emulate_fault;
+
+		UINT64 source = sign_extend(insn.immediate, insn.immediate_size);
+		UINT64 result = operation == 1 ? value | source : value & source;
+
+		logic_flags(state, result, size);
+
+		return write(ops, address, size, result) ? emulate_done : emulate_fault;
+	}
+	default:
+		return emulate_unsupported;
+	}
+
+	return emulate_done;
+}
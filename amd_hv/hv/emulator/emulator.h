@@ -0,0 +1,41 @@
+#pragma once
+
+#include "../svm/svm.h"
+#include "../decoder/decoder.h"
+
+// the most iterations of a rep string instruction emulated in one exit, the guest re-executes it for the rest
+#define EMULATOR_MAX_ITERATIONS 0x100
+
+enum EMULATE_STATUS : UINT8
+{
+	emulate_done		= 0,	// the instruction completed, the caller moves rip past it
+	emulate_again		= 1,	// a rep string instruction has iterations left, rip stays on it
+	emulate_unsupported	= 2,	// not one of the instructions below, or no memory operand
+	emulate_fault		= 3,	// a memory access failed, state reflects the completed iterations
+};
+
+// memory accesses of the emulated instruction, at linear addresses
+struct EMULATOR_OPS
+{
+	void*	context;
+	bool	(*read)(void* context, UINT64 address, void* buffer, UINT8 size);
+	bool	(*write)(void* context, UINT64 address, const void* buffer, UINT8 size);
+};
+
+// the guest state the emulated instruction reads and changes, rsp has to be in regs
+struct EMULATOR_STATE
+{
+	GENERAL_REGISTERS* regs;
+	UINT64	rflags;
+	UINT64	next_rip;				// for rip relative operands
+	UINT64	segment_bases[6];		// by SEGMENT_OVERRIDE, zero in long mode except fs and gs
+};
+
+// emulates the memory forms of the instructions drivers use on device memory:
+// mov, movzx, movsx, movsxd, stos, movs, and, or, xchg.
+// its kept free of vcpu and vmcb accesses, so hv_decoder_fuzz builds it on linux and checks it against the cpu.
+// nothing calls it yet, mmio exits need nested paging, which the hv doesnt enable
+namespace emulator
+{
+	EMULATE_STATUS emulate(const DECODED_INSTRUCTION& insn, EMULATOR_STATE& state, const EMULATOR_OPS& ops);
+}
@@ -0,0 +1,258 @@
+#include "events.h"
+
+#include "../vcpu/vcpu.h"
+
+namespace events
+{
+	// exceptions and software interrupts belong to the instruction the guest is on and cant wait,
+	// nmis come before interrupts. within each kind a reinjected event goes before the new ones
+	UINT8 priority(EVENT_INJECTION event, bool reinjected)
+	{
+		UINT8 kind = 0;
+
+		if (event.type == INTERRUPTION_TYPE::NonMaskableInterrupt)
+			kind = 1;
+		else if (event.type == INTERRUPTION_TYPE::ExternalInterrupt)
+			kind = 2;
+
+		return kind * 2 + !reinjected;
+	}
+
+	bool insert(EVENT_QUEUE& queue, EVENT_INJECTION event, UINT8 priority)
+	{
+		// when its full the newest event of the lowest priority makes room, if the new one beats it
+
+		if (queue.count == EVENT_QUEUE_SIZE)
+		{
+			queue.dropped++;
+
+			if (queue.entries[EVENT_QUEUE_SIZE - 1].priority <= priority)
+				return false;
+
+			queue.count--;
+		}
+
+		UINT8 index = queue.count;
+
+		for (; index > 0 && queue.entries[index - 1].priority > priority; index--)
+			queue.entries[index] = queue.entries[index - 1];
+
+		queue.entries[index].event		= event;
+		queue.entries[index].priority	= priority;
+		queue.count++;
+
+		return true;
+	}
+
+	bool deliverable(vcpu* vcpu, const EVENT_QUEUE& queue, const EVENT_ENTRY& entry)
+	{
+		// a reinjected event was already being delivered when the exit happened, its checks passed back then
+
+		if (!(entry.priority & 1))
+			return true;
+
+		auto& guest = vcpu->get_guest();
+
+		// EVENTINJ doesnt check whether the guest can take the event, the interrupt shadow of sti and mov ss included
+
+		bool shadow = guest.get_control_area().interrupt_shadow & 1;
+
+		switch (entry.event.type)
+		{
+		case INTERRUPTION_TYPE::NonMaskableInterrupt:
+			return !queue.nmi_masked && !shadow;
+		case INTERRUPTION_TYPE::ExternalInterrupt:
+			return guest.get_state_save_area().rflags.InterruptEnableFlag && !shadow;
+		default:
+			return true;
+		}
+	}
+
+	void arm(vcpu* vcpu, EVENT_QUEUE& queue)
+	{
+		auto& guest = vcpu->get_guest();
+
+		// an nmi that waits for the iret of the previous one doesnt need the window, the IRET intercept tells us
+
+		bool window = queue.window_requested;
+
+		for (UINT8 i = 0; i < queue.count && !window; i++)
+			window = queue.entries[i].event.type != INTERRUPTION_TYPE::NonMaskableInterrupt || !queue.nmi_masked || queue.iret_rip;
+
+		bool iret = queue.nmi_masked && !queue.iret_rip;
+
+		auto mode = vintr_off;
+
+		if (window)
+			mode = vintr_window;
+		else if (queue.virtual_pending || queue.vintr == vintr_virtual)
+			mode = vintr_virtual;
+
+		// only touch the vmcb when something changes, so the clean bits stay set while nothing waits
+
+		if (mode != queue.vintr)
+		{
+			// a virtual interrupt the window replaces hasnt been taken yet, it is raised again afterwards
+
+			if (queue.vintr == vintr_virtual)
+				queue.virtual_pending = true;
+
+			if ((mode == vintr_window) != (queue.vintr == vintr_window))
+				vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(guest).vintr = mode == vintr_window;
+
+			auto& control = vmcb::modify<&VMCB_CONTROL_AREA::v_ctl>(guest);
+
+			control.v_irq			= mode != vintr_off;
+			control.v_ign_tr		= mode != vintr_off;
+			control.v_intr_vector	= mode == vintr_virtual ? queue.virtual_vector : 0;
+			control.v_intr_prio		= mode == vintr_virtual ? queue.virtual_vector >> 4 : 0;
+
+			queue.vintr = mode;
+		}
+
+		if (mode == vintr_virtual)
+			queue.virtual_pending = false;
+
+		if (iret != queue.iret_armed)
+		{
+			vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(guest).iret = iret;
+
+			queue.iret_armed = iret;
+		}
+
+		return;
+	}
+}
+
+bool events::queue(vcpu* vcpu, EVENT_INJECTION event)
+{
+	event.valid = 1;
+
+	return insert(vcpu->get_event_queue(), event, priority(event, false));
+}
+
+bool events::reinject(vcpu* vcpu, EVENT_INJECTION event)
+{
+	return insert(vcpu->get_event_queue(), event, priority(event, true));
+}
+
+void events::queue_interrupt(vcpu* vcpu, UINT8 vector)
+{
+	EVENT_INJECTION event{};
+
+	event.vector	= vector;
+	event.type		= INTERRUPTION_TYPE::ExternalInterrupt;
+
+	queue(vcpu, event);
+
+	return;
+}
+
+void events::queue_nmi(vcpu* vcpu)
+{
+	EVENT_INJECTION event{};
+
+	event.vector	= EXCEPTION_VECTOR::Nmi;
+	event.type		= INTERRUPTION_TYPE::NonMaskableInterrupt;
+
+	queue(vcpu, event);
+
+	return;
+}
+
+void events::raise_virtual(vcpu* vcpu, UINT8 vector)
+{
+	auto& queue = vcpu->get_event_queue();
+
+	queue.virtual_vector	= vector;
+	queue.virtual_pending	= true;
+
+	return;
+}
+
+EVENT_INJECTION* events::pending_exception(vcpu* vcpu)
+{
+	auto& queue = vcpu->get_event_queue();
+
+	for (UINT8 i = 0; i < queue.count; i++)
+	{
+		auto& entry = queue.entries[i];
+
+		if (entry.priority == 1 && entry.event.type == INTERRUPTION_TYPE::HardwareException)
+			return &entry.event;
+	}
+
+	return nullptr;
+}
+
+void events::iret(vcpu* vcpu)
+{
+	// the exit comes before the iret runs, nmis stay blocked until it retired
+
+	vcpu->get_event_queue().iret_rip = vcpu->get_guest().get_state_save_area().rip;
+
+	return;
+}
+
+void events::request_window(vcpu* vcpu)
+{
+	vcpu->get_event_queue().window_requested = true;
+
+	return;
+}
+
+void events::deliver(vcpu* vcpu)
+{
+	auto& queue = vcpu->get_event_queue();
+
+	if (!queue.count && !queue.nmi_masked && !queue.vintr && !queue.virtual_pending && !queue.window_requested)
+		return;
+
+	auto& guest		= vcpu->get_guest();
+	auto& inject	= guest.get_control_area().event_inject;
+
+	if (guest.get_control_area().exit_code == SVMEXIT::VINTR)
+		queue.window_requested = false;
+
+	// the cpu clears V_IRQ when the guest takes the virtual interrupt, and writes it back on the exit
+
+	if (queue.vintr == vintr_virtual && !guest.get_control_area().v_ctl.v_irq)
+		queue.vintr = vintr_off;
+
+	// the intercepted iret has retired once the guest is anywhere else. an nmi handler that runs with
+	// interrupts enabled gets the next nmi on the first exit after that, not right away
+
+	if (queue.iret_rip && guest.get_state_save_area().rip != queue.iret_rip)
+	{
+		queue.nmi_masked	= false;
+		queue.iret_rip		= 0;
+	}
+
+	if (!inject.valid)
+	{
+		for (UINT8 i = 0; i < queue.count; i++)
+		{
+			if (!deliverable(vcpu, queue, queue.entries[i]))
+				continue;
+
+			inject = queue.entries[i].event;
+
+			if (inject.type == INTERRUPTION_TYPE::NonMaskableInterrupt)
+			{
+				queue.nmi_masked	= true;
+				queue.iret_rip		= 0;
+			}
+
+			queue.count--;
+
+			for (UINT8 j = i; j < queue.count; j++)
+				queue.entries[j] = queue.entries[j + 1];
+
+			break;
+		}
+	}
+
+	arm(vcpu, queue);
+
+	return;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define EVENT_QUEUE_SIZE 16
+
+// what V_IRQ is currently used for
+enum VINTR_MODE : UINT8
+{
+	vintr_off		= 0,
+	vintr_window	= 1,	// with the VINTR intercept, to find out when the guest can take the queued events
+	vintr_virtual	= 2,	// a real virtual interrupt, the cpu delivers it without an exit
+};
+
+struct EVENT_ENTRY
+{
+	EVENT_INJECTION	event;
+	UINT8			priority;	// lower goes first, see events::priority
+};
+
+// events waiting to be injected into one vcpu's guest, sorted by priority and then by age.
+// only the vcpu's own core touches it, from host context
+struct EVENT_QUEUE
+{
+	EVENT_ENTRY	entries[EVENT_QUEUE_SIZE];
+	UINT8		count;
+	bool		nmi_masked;		// an nmi we injected is still being handled
+	UINT64		iret_rip;		// the iret that will unmask nmis, 0 until it was intercepted
+	VINTR_MODE	vintr;
+	UINT8		virtual_vector;
+	bool		virtual_pending;	// raise_virtual was called, V_IRQ isnt set for it yet
+	bool		iret_armed;		// the IRET intercept is set
+	bool		window_requested;	// request_window was called, the window's exit clears it
+	UINT64		dropped;		// events that didnt fit
+};
+
+// EVENTINJ holds one event per vmrun, handlers queue theirs here instead of writing it.
+// exceptions go first, then nmis, then interrupts, an event EXITINTINFO handed back goes before the new ones
+// of its kind. whatever cant be delivered yet waits for the guest's interrupt window: V_IRQ is raised with
+// the VINTR intercept set, so the cpu exits as soon as the guest could take an interrupt.
+// the intercepts are only set while something waits, an empty queue costs nothing.
+// V_IRQ is also how raise_virtual interrupts the guest, then without the intercept. the window takes
+// precedence, a virtual interrupt raised meanwhile is delivered after the queue drained
+namespace events
+{
+	// AMD64 Manual Volume 2: 15.20 Event Injection, 15.21.4 Injecting Virtual (INTR) Interrupts
+	bool queue(vcpu* vcpu, EVENT_INJECTION event);
+
+	// an event whose delivery an exit interrupted, it is delivered before anything else of its kind
+	bool reinject(vcpu* vcpu, EVENT_INJECTION event);
+
+	void queue_interrupt(vcpu* vcpu, UINT8 vector);
+
+	void queue_nmi(vcpu* vcpu);
+
+	// the guest takes vector through V_IRQ as soon as it has interrupts enabled, without an exit.
+	// raising it again before it was taken delivers it once. the guest's tpr isnt consulted
+	void raise_virtual(vcpu* vcpu, UINT8 vector);
+
+	// an exit as soon as the guest could take an interrupt again, for a caller without an event to deliver
+	void request_window(vcpu* vcpu);
+
+	// the first queued exception that isnt a reinjection, for merging it with an interrupted one
+	EVENT_INJECTION* pending_exception(vcpu* vcpu);
+
+	// IRET exit, the guest is about to return from the nmi we injected
+	void iret(vcpu* vcpu);
+
+	// injects the first deliverable event and arms the intercepts for the rest, handle_vmexit calls this last
+	void deliver(vcpu* vcpu);
+}
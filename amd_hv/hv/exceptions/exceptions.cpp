@@ -0,0 +1,209 @@
+#include "exceptions.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../events/events.h"
+
+namespace exceptions
+{
+	EXCEPTION_HANDLER volatile handlers[EXCEPTION_VECTORS];
+
+	volatile LONG	handler_mask;		// vectors with a registered handler
+	volatile LONG	reflect_mask;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+
+	// #DF, #TS, #NP, #SS, #GP, #PF, #AC, #CP, #VC, #SX push an error code, EXITINFO1 holds it
+	constexpr UINT32 error_code_vectors = 0x60227D00;
+
+	// #DE, #TS, #NP, #SS, #GP
+	constexpr UINT32 contributory_vectors = 0x3C01;
+
+	bool is_contributory(UINT8 vector)
+	{
+		return contributory_vectors & (1u << vector);
+	}
+
+	// AMD64 Manual Volume 2: 8.2.9 Double-Fault Exception
+	bool is_double_fault(UINT8 first, UINT8 second)
+	{
+		if (is_contributory(first))
+			return is_contributory(second);
+
+		return first == EXCEPTION_VECTOR::PageFault && (is_contributory(second) || second == EXCEPTION_VECTOR::PageFault);
+	}
+
+	void reflect(vcpu* vcpu, const EXCEPTION_INFO& info)
+	{
+		auto& guest = vcpu->get_guest();
+
+		// the cpu doesnt write cr2 when it intercepts a #PF, the guest's handler expects the address there
+
+		if (info.vector == EXCEPTION_VECTOR::PageFault)
+			vmcb::write<&VMCB_STATE_SAVE_AREA::cr2>(guest, info.exit_info2);
+
+		// #BP and #OF are traps, the intercept leaves rip on int3 / into but the guest has to see the one after
+
+		if (info.vector == EXCEPTION_VECTOR::Breakpoint || info.vector == EXCEPTION_VECTOR::Overflow)
+			instruction::skip(vcpu);
+
+		EVENT_INJECTION event{};
+
+		event.vector		= info.vector;
+		event.type			= INTERRUPTION_TYPE::HardwareException;
+		event.ev			= info.has_error;
+		event.error_code	= info.error_code;
+
+		events::queue(vcpu, event);
+
+		return;
+	}
+}
+
+bool exceptions::register_handler(UINT8 vector, EXCEPTION_HANDLER handler)
+{
+	if (vector >= EXCEPTION_VECTORS || !(EXCEPTION_INTERCEPTABLE & (1u << vector)))
+		return false;
+
+	// one handler per vector, a second one would silently take the first one's exceptions
+
+	if (InterlockedCompareExchangePointer((PVOID volatile*)&handlers[vector], (PVOID)handler, nullptr))
+		return false;
+
+	InterlockedOr(&handler_mask, 1 << vector);
+	InterlockedIncrement64(&generation);
+
+	return true;
+}
+
+void exceptions::unregister_handler(UINT8 vector)
+{
+	if (vector >= EXCEPTION_VECTORS)
+		return;
+
+	InterlockedAnd(&handler_mask, ~(1 << vector));
+	InterlockedExchangePointer((PVOID volatile*)&handlers[vector], nullptr);
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void exceptions::configure(UINT32 mask, UINT64 flags)
+{
+	reflect_mask = mask & EXCEPTION_INTERCEPTABLE;
+
+	if (flags & EXCEPTION_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void exceptions::update(vcpu* vcpu)
+{
+	auto& state = vcpu->get_exception_state();
+
+	// read before the masks, a configuration racing with us just gets applied again on the next exit
+
+	UINT64 current = generation;
+
+	if (state.generation == current)
+		return;
+
+	// each vcpu clears its own counters, so we never race with the core counting into them
+
+	if (state.generation < reset_generation)
+		memset(&state.stats, 0, sizeof(state.stats));
+
+	state.generation = current;
+
+	vmcb::modify<&VMCB_CONTROL_AREA::intercept_exceptions>(vcpu->get_guest()).value = handler_mask | reflect_mask;
+
+	return;
+}
+
+void exceptions::dispatch(vcpu* vcpu)
+{
+	UINT64 start = __rdtsc();
+
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& stats		= vcpu->get_exception_state().stats;
+
+	EXCEPTION_INFO info{};
+
+	info.vector		= (UINT8)(control.exit_code - SVMEXIT::DE);
+	info.has_error	= (error_code_vectors >> info.vector) & 1;
+	info.error_code	= (UINT32)control.exit_info1;
+	info.exit_info2	= control.exit_info2;
+
+	// vectors nobody registered a handler for are only intercepted to be measured, they go straight back
+
+	auto handler = handlers[info.vector];
+
+	if (handler && handler(vcpu, info))
+		stats.handled++;
+	else
+		reflect(vcpu, info);
+
+	stats.exits[info.vector]++;
+	stats.cycles[info.vector] += __rdtsc() - start;
+
+	return;
+}
+
+void exceptions::complete(vcpu* vcpu)
+{
+	auto& stats = vcpu->get_exception_state().stats;
+
+	auto interrupted = vcpu->get_guest().get_control_area().exit_int_info;
+
+	if (!interrupted.valid)
+		return;
+
+	auto raised = events::pending_exception(vcpu);
+
+	if (raised)
+	{
+		// the handler raised an exception while the guest was delivering another one.
+		// the first one is raised again anyway once its instruction restarts, unless the two make a #DF
+
+		if (interrupted.type == INTERRUPTION_TYPE::HardwareException)
+		{
+			if (!is_double_fault((UINT8)interrupted.vector, (UINT8)raised->vector))
+				return;
+
+			raised->value		= 0;
+			raised->vector		= EXCEPTION_VECTOR::DoubleFault;
+			raised->type		= INTERRUPTION_TYPE::HardwareException;
+			raised->ev			= 1;
+			raised->valid		= 1;
+
+			stats.double_faults++;
+
+			return;
+		}
+
+		// an interrupt or nmi isnt raised again, it waits in the queue until the exception has been delivered
+
+		stats.deferred++;
+	}
+
+	events::reinject(vcpu, interrupted);
+	stats.reinjected++;
+
+	return;
+}
+
+bool exceptions::export_stats(vcpu* caller, vcpu* target, UINT64 buffer)
+{
+	auto& state = caller->get_guest().get_state_save_area();
+
+	// the target core keeps counting while we copy, a torn snapshot is acceptable for statistics
+
+	EXCEPTION_STATS stats = target->get_exception_state().stats;
+
+	return memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer, &stats, sizeof(stats));
+}
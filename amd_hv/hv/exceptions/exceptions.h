@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define EXCEPTION_VECTORS 32
+
+// vectors with an intercept bit, 2 goes through the nmi intercept and the others are reserved
+#define EXCEPTION_INTERCEPTABLE 0x602F7DFB
+
+// flags for exceptions::configure
+#define EXCEPTION_RESET 0x1
+
+// the exception an intercept caught, before it reached the guest
+struct EXCEPTION_INFO
+{
+	UINT8	vector;
+	UINT8	has_error;
+	UINT32	error_code;
+	UINT64	exit_info2;		// the faulting address of a #PF
+};
+
+// return true if the exception was dealt with, false to have it reflected into the guest unchanged.
+// handlers run in host context on the core that took the exception, with every guest register spilled
+typedef bool (*EXCEPTION_HANDLER)(vcpu* vcpu, const EXCEPTION_INFO& info);
+
+struct EXCEPTION_STATS
+{
+	UINT64	exits[EXCEPTION_VECTORS];
+	UINT64	cycles[EXCEPTION_VECTORS];	// host time from dispatch to the exception being handled or queued
+	UINT64	handled;					// exits a registered handler consumed
+	UINT64	reinjected;					// events from EXITINTINFO queued again
+	UINT64	deferred;					// interrupted events that had to wait for a newer exception
+	UINT64	double_faults;
+};
+
+struct EXCEPTION_STATE
+{
+	UINT64	generation;					// last configuration applied to this vcpu
+	EXCEPTION_STATS stats;
+};
+
+// an exit can interrupt the delivery of an event to the guest, the cpu then leaves it in EXITINTINFO
+// and its gone unless we inject it again. complete queues it again for every exit, intercepted or not.
+// exception intercepts are shared: any number of handlers register for the vectors they care about
+// and the intercept bits follow the registrations
+namespace exceptions
+{
+	// AMD64 Manual Volume 2: 15.12 Exception Intercepts, 15.7.2 Intercepts During IDT Interrupt Delivery
+	bool register_handler(UINT8 vector, EXCEPTION_HANDLER handler);
+
+	// doesnt wait for the handler to return on cores that are running it
+	void unregister_handler(UINT8 vector);
+
+	// vectors to intercept and reflect without a handler, to measure what the round trip costs
+	void configure(UINT32 mask, UINT64 flags);
+
+	// applies registration and configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	// handles an exception intercept, exit codes 0x40 - 0x5F
+	void dispatch(vcpu* vcpu);
+
+	// requeues the event this exit interrupted, handle_vmexit calls this after the handler
+	void complete(vcpu* vcpu);
+
+	// writes target's EXCEPTION_STATS to a guest buffer of caller's current address space
+	bool export_stats(vcpu* caller, vcpu* target, UINT64 buffer);
+}
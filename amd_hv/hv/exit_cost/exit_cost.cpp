@@ -0,0 +1,329 @@
+#include "exit_cost.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+
+namespace exit_cost
+{
+	bool			enabled;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+
+	// the counters are 48 bits wide, deltas are taken modulo that
+	constexpr UINT64 counter_mask = (1ull << 48) - 1;
+
+	// counters 0 - 5 of the core performance counter extensions
+	constexpr int core_counters = RTL_NUMBER_OF(VMCB_STATE_SAVE_AREA::perf);
+
+	constexpr UINT32 counters[cost_events] = { 0, 1, 2, 4 };
+
+	// event select and unit mask, PMCx076 CPU Clocks not Halted, PMCx0C0 Retired Instructions,
+	// PMCx064 Core to L2 Cacheable Request Access Status (DC and IC misses), PMCx045 L1 DTLB Miss (L2 DTLB misses)
+	constexpr UINT8 events[cost_events][2] = { { 0x76, 0 }, { 0xC0, 0 }, { 0x64, 0x09 }, { 0x45, 0xF0 } };
+
+	UINT32 ctl_msr(int event)
+	{
+		return AMD_MSR::perf_ctl_ext0 + 2 * counters[event];
+	}
+
+	UINT32 ctr_msr(int event)
+	{
+		return AMD_MSR::perf_ctr_ext0 + 2 * counters[event];
+	}
+
+	// rdpmc doesnt serialize, which is what we want here, the counters keep up with the instruction stream anyway
+	__forceinline void read(UINT64* values)
+	{
+		for (int i = 0; i < cost_events; i++)
+			values[i] = __readpmc(counters[i]);
+
+		return;
+	}
+
+	UINT64 reason_index(UINT64 exit_code)
+	{
+		if (exit_code < 0xF0)
+			return exit_code;
+
+		if (exit_code >= 0x400 && exit_code < 0x410)
+			return 0xF0 + exit_code - 0x400;
+
+		return EXIT_COST_REASONS;
+	}
+
+	UINT64 reason_exit_code(UINT64 index)
+	{
+		return index < 0xF0 ? index : 0x400 + index - 0xF0;
+	}
+
+	bool pmc_virt_supported()
+	{
+		int cpuid_regs[4];
+		__cpuid(cpuid_regs, 0x8000000A);
+
+		// EDX[8] PmcVirt
+
+		return cpuid_regs[3] & (1 << 8);
+	}
+
+	// the guest starts out with the counters as the os left them, from here on vmrun swaps its copy in the vmcb
+	// with ours. while we are measuring the msrs hold ours, the guest's values for those are the saved ones
+	void virtualize(vcpu* vcpu)
+	{
+		auto& guest = vcpu->get_guest();
+		auto table	= vcpu->get_cost_table();
+
+		for (int i = 0; i < core_counters; i++)
+		{
+			guest.get_state_save_area().perf[i].ctl = __readmsr(AMD_MSR::perf_ctl_ext0 + 2 * i);
+			guest.get_state_save_area().perf[i].ctr = __readmsr(AMD_MSR::perf_ctr_ext0 + 2 * i);
+		}
+
+		if (table->active)
+		{
+			for (int i = 0; i < cost_events; i++)
+			{
+				guest.get_state_save_area().perf[counters[i]].ctl = table->saved_ctl[i];
+				guest.get_state_save_area().perf[counters[i]].ctr = table->saved_ctr[i];
+			}
+		}
+
+		vmcb::modify<&VMCB_CONTROL_AREA::v_ctl2>(guest).pmc_virt = 1;
+
+		table->virtualized = 1;
+
+		return;
+	}
+
+	// the guest's counters go back into the msrs, ours are restored to its latest values when profiling stops
+	void devirtualize(vcpu* vcpu)
+	{
+		auto& guest = vcpu->get_guest();
+		auto table	= vcpu->get_cost_table();
+
+		for (int i = 0; i < cost_events; i++)
+		{
+			table->saved_ctl[i] = guest.get_state_save_area().perf[counters[i]].ctl;
+			table->saved_ctr[i] = guest.get_state_save_area().perf[counters[i]].ctr;
+		}
+
+		// counter 3 is the sampler's, its the reason we give the counters back
+
+		if (!vcpu->get_sample_ring()->active)
+		{
+			__writemsr(AMD_MSR::perf_ctl3, guest.get_state_save_area().perf[3].ctl);
+			__writemsr(AMD_MSR::perf_ctr3, guest.get_state_save_area().perf[3].ctr);
+		}
+
+		__writemsr(AMD_MSR::perf_ctl_ext0 + 2 * 5, guest.get_state_save_area().perf[5].ctl);
+		__writemsr(AMD_MSR::perf_ctr_ext0 + 2 * 5, guest.get_state_save_area().perf[5].ctr);
+
+		vmcb::modify<&VMCB_CONTROL_AREA::v_ctl2>(guest).pmc_virt = 0;
+
+		table->virtualized = 0;
+
+		return;
+	}
+}
+
+bool exit_cost::supported()
+{
+	int cpuid_regs[4];
+	__cpuid(cpuid_regs, 0x80000001);
+
+	// ECX[23] PerfCtrExtCore
+
+	return cpuid_regs[2] & (1 << 23);
+}
+
+void exit_cost::configure(UINT64 flags)
+{
+	enabled = flags & EXIT_COST_ENABLE;
+
+	if (flags & EXIT_COST_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void exit_cost::update(vcpu* vcpu)
+{
+	auto table = vcpu->get_cost_table();
+
+	// the sampler's counter has to count the guest, with pmc virtualization it would count the guest's copy.
+	// sampler::update runs first, so this happens before the next vmrun
+
+	bool sampling = vcpu->get_sample_ring()->active;
+
+	if (table->virtualized && sampling)
+		devirtualize(vcpu);
+	else if (table->active && !table->virtualized && !sampling && pmc_virt_supported())
+		virtualize(vcpu);
+
+	if (table->generation == (UINT64)generation)
+		return;
+
+	// each vcpu clears its own table, so we never race with the core recording into it
+
+	if (table->generation < reset_generation)
+		memset(table->entries, 0, sizeof(table->entries));
+
+	table->generation = generation;
+
+	if (!enabled)
+	{
+		stop(vcpu);
+		return;
+	}
+
+	if (table->active)
+		return;
+
+	// with pmc virtualization the cpu swaps the guest's counters with the vmcb on every world switch,
+	// so the guest keeps its own counters while we use the host's. not while the sampler runs, see above
+
+	if (pmc_virt_supported() && !sampling)
+		virtualize(vcpu);
+
+	for (int i = 0; i < cost_events; i++)
+	{
+		table->saved_ctl[i] = __readmsr(ctl_msr(i));
+		table->saved_ctr[i] = __readmsr(ctr_msr(i));
+
+		AMD_PERF_CTL_MSR ctl{ .value = 0 };
+		ctl.event_select	= events[i][0];
+		ctl.unit_mask		= events[i][1];
+		ctl.usr				= 1;
+		ctl.os				= 1;
+		ctl.enable			= 1;
+		ctl.host_only		= 1;
+
+		__writemsr(ctl_msr(i), ctl.value);
+	}
+
+	// this exit started before the counters were programmed, measuring starts at the next one
+
+	table->active			= 1;
+	table->pending			= 0;
+	table->measured_leave	= 0;
+
+	return;
+}
+
+void exit_cost::stop(vcpu* vcpu)
+{
+	auto table = vcpu->get_cost_table();
+
+	if (!table->active)
+		return;
+
+	// the guest kept using its counters, what it left in the vmcb is what it has to find in the msrs
+
+	if (table->virtualized)
+		devirtualize(vcpu);
+
+	for (int i = 0; i < cost_events; i++)
+	{
+		__writemsr(ctl_msr(i), table->saved_ctl[i]);
+		__writemsr(ctr_msr(i), table->saved_ctr[i]);
+	}
+
+	table->active			= 0;
+	table->pending			= 0;
+	table->measured_leave	= 0;
+
+	return;
+}
+
+void exit_cost::on_exit(vcpu* vcpu)
+{
+	auto table = vcpu->get_cost_table();
+
+	if (!table->active)
+		return;
+
+	UINT64 now[cost_events];
+	read(now);
+
+	UINT64 index = reason_index(vcpu->get_guest().get_control_area().exit_code);
+
+	if (index == EXIT_COST_REASONS)
+	{
+		table->pending = 0;
+		return;
+	}
+
+	auto& entry = table->entries[index];
+
+	entry.exits++;
+
+	// the counters only count in host mode, so everything since the previous leave reading is
+	// the tail of the last world switch in vmloop plus the head of this one
+
+	if (table->measured_leave)
+	{
+		for (int i = 0; i < cost_events; i++)
+			entry.world_switch[i] += (now[i] - table->leave[i]) & counter_mask;
+	}
+
+	memcpy(table->enter, now, sizeof(now));
+
+	table->pending = index + 1;
+
+	return;
+}
+
+void exit_cost::on_resume(vcpu* vcpu)
+{
+	auto table = vcpu->get_cost_table();
+
+	if (!table->active)
+		return;
+
+	UINT64 now[cost_events];
+	read(now);
+
+	if (table->pending)
+	{
+		auto& entry = table->entries[table->pending - 1];
+
+		for (int i = 0; i < cost_events; i++)
+			entry.handler[i] += (now[i] - table->enter[i]) & counter_mask;
+	}
+
+	memcpy(table->leave, now, sizeof(now));
+
+	table->pending			= 0;
+	table->measured_leave	= 1;
+
+	return;
+}
+
+INT64 exit_cost::export_records(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state	= caller->get_guest().get_state_save_area();
+	auto table	= target->get_cost_table();
+
+	// the target core keeps recording while we read, a torn entry is acceptable for a profile
+
+	INT64 written = 0;
+
+	for (int i = 0; i < EXIT_COST_REASONS && (UINT64)written < capacity; i++)
+	{
+		if (!table->entries[i].exits)
+			continue;
+
+		EXIT_COST_RECORD record{ .exit_code = reason_exit_code(i), .cost = table->entries[i] };
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + written * sizeof(EXIT_COST_RECORD), &record, sizeof(EXIT_COST_RECORD)))
+			return -1;
+
+		written++;
+	}
+
+	return written;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// exit codes 0x0 - 0xEF map onto themselves, 0x400 - 0x40F (npf, avic, vmgexit) onto 0xF0 - 0xFF
+#define EXIT_COST_REASONS 0x100
+
+// flags for exit_cost::configure
+#define EXIT_COST_ENABLE 0x1
+#define EXIT_COST_RESET 0x2
+
+// the host counters we measure with
+enum EXIT_COST_EVENT
+{
+	cost_cycles,
+	cost_instructions,
+	cost_l2_misses,
+	cost_tlb_misses,
+	cost_events
+};
+
+// what one exit reason cost the host, summed over all of its exits
+struct EXIT_COST_ENTRY
+{
+	UINT64	exits;
+	UINT64	world_switch[cost_events];	// from the previous vmrun in vmloop to handle_vmexit
+	UINT64	handler[cost_events];		// handle_vmexit itself
+};
+
+// the per exit reason record handed out by the stats hypercall
+struct EXIT_COST_RECORD
+{
+	UINT64	exit_code;
+	EXIT_COST_ENTRY cost;
+};
+
+struct EXIT_COST_TABLE
+{
+	UINT64	generation;					// last configuration applied to this vcpu
+	UINT64	active;						// our counters are programmed on this core
+	UINT64	pending;					// reason index + 1 of the exit being measured, 0 if none
+	UINT64	measured_leave;				// leave holds a reading from the previous exit
+	UINT64	virtualized;				// the guest's counters live in the vmcb, see exit_cost::update
+	UINT64	saved_ctl[cost_events];		// the os's counter configuration, restored when profiling stops
+	UINT64	saved_ctr[cost_events];
+	UINT64	enter[cost_events];
+	UINT64	leave[cost_events];
+	EXIT_COST_ENTRY entries[EXIT_COST_REASONS];
+};
+
+// counts host only cycles, retired instructions, l2 misses and dtlb misses on counters 0, 1, 2 and 4,
+// counter 3 belongs to the sampler. the event encodings are the family 17h / 19h ones.
+// without pmc virtualization, or while the sampler runs, the guest shares these counters with us while profiling is enabled
+namespace exit_cost
+{
+	// needs the core performance counter extensions for counter 4
+	bool supported();
+
+	void configure(UINT64 flags);
+
+	// applies configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	// restores the os's counters on this core
+	void stop(vcpu* vcpu);
+
+	// first thing in handle_vmexit, closes the world switch window and opens the handler window
+	void on_exit(vcpu* vcpu);
+
+	// last thing before vmrun, closes the handler window
+	void on_resume(vcpu* vcpu);
+
+	// copies the reasons target has seen to a guest buffer of caller's current address space,
+	// returns the amount of records written, or -1 if the buffer isnt present and writable
+	INT64 export_records(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
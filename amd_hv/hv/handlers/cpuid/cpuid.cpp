@@ -1,12 +1,11 @@
 #include "../handlers.h"
 
+#include "../../commands/commands.h"
 #include "../../../utilities/utilities.h"
 
 void handlers::cpuid(vcpu* vcpu)
 {
-	auto& state		= vcpu->get_guest().get_state_save_area();
-	auto& control	= vcpu->get_guest().get_control_area();
-	auto regs		= vcpu->get_regs();
+	auto regs = vcpu->get_regs();
 
 	// if this intercept isnt from us sending a command to the hypervisor
 	// we need to mimic cpuid instruction as close to bare metal as possible 
@@ -32,36 +31,34 @@ void handlers::cpuid(vcpu* vcpu)
 		regs->rcx = (regs->rcx & upper_4bytes) + cpuid_regs[2];
 		regs->rdx = (regs->rdx & upper_4bytes) + cpuid_regs[3];
 
-		goto ret;
+		instruction::skip(vcpu);
+		return;
 	}
 
-	// set rax to 1 to indicate handled
-	
-	regs->rax = 1; 
+	// the old ids still work, anything else is a command code. only rax, rbx, rcx and rdx
+	// are spilled on this exit so the command gets no arguments and its results are dropped
 
-	switch (regs->rdx) 
-	{
-	case PING_ID: 
+	UINT64 code = regs->rdx;
 
-		// ping should just return if its handled or not, and we set handled a few lines above
+	if (code == PING_ID)
+		code = HYPERCALL_PING;
+	else if (code == SHUTDOWN_ID)
+		code = HYPERCALL_SHUTDOWN;
 
-		break;
-	case SHUTDOWN_ID:
+	// set rax to 1 to indicate handled, 0 if nothing is registered for it
 
-		// only shutdown if its a command sent from kernel because we need to exit into a kernel rip and context
+	regs->rax = 0;
 
-		if (!state.cpl)
-			vcpu->wants_shutdown() = 1;
-		break;
-	default:
+	if (code < COMMAND_MAX)
+	{
+		GENERAL_REGISTERS command{};
 
-		// set rax to 0 to indicate unhandled
+		command.rax = HYPERCALL_CODE(code);
 
-		regs->rax = 0;
+		regs->rax = commands::dispatch(vcpu, &command) != call_invalid;
 	}
 
-	ret:
-	state.rip = control.nrip;
+	instruction::skip(vcpu);
 
 	return;
 }
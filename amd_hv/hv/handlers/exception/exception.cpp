@@ -0,0 +1,10 @@
+#include "../handlers.h"
+
+// only vectors with a registered handler or configured for reflection are intercepted, see exceptions.h
+
+void handlers::exception(vcpu* vcpu)
+{
+	exceptions::dispatch(vcpu);
+
+	return;
+}
@@ -2,11 +2,48 @@
 
 #include "../hv.h"
 
+// every handler declares the guest registers it reads or writes through vcpu->get_regs() in its _regs mask,
+// the exit path in helpers.asm only spills those (and the volatile ones, which compiled code clobbers anyway).
+// a register thats not declared holds garbage in GENERAL_REGISTERS, so a handler that starts using one
+// has to add it here. exit codes without a declaration get everything spilled, see hv::spill_table
 namespace handlers 
 {
 
 	void vmrun(vcpu* vcpu);
+	constexpr UINT16 vmrun_regs = gpr_none;
 
 	void cpuid(vcpu* vcpu);
+	constexpr UINT16 cpuid_regs = gpr_rax | gpr_rbx | gpr_rcx | gpr_rdx;
+
+	void vmmcall(vcpu* vcpu);
+	constexpr UINT16 vmmcall_regs = gpr_rax | gpr_rcx | gpr_rdx | gpr_r8 | gpr_r9 | gpr_r10 | gpr_r11;
+
+	// adds the built in hypercalls to the command registry, before launching
+	bool register_commands();
+
+	void rdtsc(vcpu* vcpu);
+	constexpr UINT16 rdtsc_regs = gpr_rax | gpr_rdx;
+
+	void rdtscp(vcpu* vcpu);
+	constexpr UINT16 rdtscp_regs = gpr_rax | gpr_rcx | gpr_rdx;
+
+	void pause(vcpu* vcpu);
+	constexpr UINT16 pause_regs = gpr_none;
+
+	void nmi(vcpu* vcpu);
+	constexpr UINT16 nmi_regs = gpr_none;
+
+	// registered exception handlers get every register, they are free to emulate whatever faulted
+	void exception(vcpu* vcpu);
+	constexpr UINT16 exception_regs = gpr_all;
+
+	void intr(vcpu* vcpu);
+	constexpr UINT16 intr_regs = gpr_none;
+
+	void vintr(vcpu* vcpu);
+	constexpr UINT16 vintr_regs = gpr_none;
+
+	void iret(vcpu* vcpu);
+	constexpr UINT16 iret_regs = gpr_none;
 
 }
@@ -0,0 +1,10 @@
+#include "../handlers.h"
+
+// this is only intercepted while the core runs a job, see jobs.h
+
+void handlers::intr(vcpu* vcpu)
+{
+	jobs::interrupted(vcpu);
+
+	return;
+}
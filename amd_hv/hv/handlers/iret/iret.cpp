@@ -0,0 +1,10 @@
+#include "../handlers.h"
+
+// this is only intercepted while the guest handles an nmi we injected, see events.h
+
+void handlers::iret(vcpu* vcpu)
+{
+	events::iret(vcpu);
+
+	return;
+}
@@ -0,0 +1,25 @@
+#include "../handlers.h"
+
+// this is always intercepted, cores wake each other with an nmi when they post to a mailbox, see mailbox.h
+
+void handlers::nmi(vcpu* vcpu)
+{
+	// both get a look, a sample and a kick can arrive as one nmi
+
+	bool sample	= sampler::handle_nmi(vcpu);
+	bool kick	= mailbox::claim_kick(&vcpu->get_mailbox());
+
+	// the nmi that caused this exit stays pending and would exit again right after vmrun,
+	// so we let it be delivered on the host through the os's idt.
+	// ours gets swallowed by the sampler's nmi callback, anything else is handled
+	// by the os exactly like it would have been in the guest
+
+	sampler::drain_nmi(sample || kick);
+
+	// a kick sent before this point would have merged into the nmi we just let through,
+	// so kicked stayed set until now and the cores posting meanwhile didnt send one
+
+	mailbox::drain(&vcpu->get_mailbox(), vcpu);
+
+	return;
+}
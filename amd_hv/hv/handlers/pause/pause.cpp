@@ -0,0 +1,12 @@
+#include "../handlers.h"
+
+// this is only intercepted while the pause profiler is enabled, see pause_profiler.h
+
+void handlers::pause(vcpu* vcpu)
+{
+	pause_profiler::record(vcpu);
+
+	instruction::skip(vcpu);
+
+	return;
+}
@@ -0,0 +1,38 @@
+#include "../handlers.h"
+
+// these are only intercepted with tsc_mode_intercept, see tsc.h
+
+void handlers::rdtsc(vcpu* vcpu)
+{
+	auto regs		= vcpu->get_regs();
+
+	UINT32 aux;
+	UINT64 value = tsc::read(vcpu, &aux);
+
+	// rdtsc zero extends edx:eax, the upper 4 bytes are cleared on bare metal
+
+	regs->rax = value & MAXUINT32;
+	regs->rdx = value >> 32;
+
+	instruction::skip(vcpu);
+
+	return;
+}
+
+void handlers::rdtscp(vcpu* vcpu)
+{
+	auto regs		= vcpu->get_regs();
+
+	// TSC_AUX isnt swapped by vmrun, so the value we read is the guest's
+
+	UINT32 aux;
+	UINT64 value = tsc::read(vcpu, &aux);
+
+	regs->rax = value & MAXUINT32;
+	regs->rdx = value >> 32;
+	regs->rcx = aux;
+
+	instruction::skip(vcpu);
+
+	return;
+}
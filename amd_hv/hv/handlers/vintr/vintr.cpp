@@ -0,0 +1,11 @@
+#include "../handlers.h"
+
+// this is only intercepted while an event waits for the guest's interrupt window, see events.h.
+// the window is open now, events::deliver runs after every exit and injects the event
+
+void handlers::vintr(vcpu* vcpu)
+{
+	UNREFERENCED_PARAMETER(vcpu);
+
+	return;
+}
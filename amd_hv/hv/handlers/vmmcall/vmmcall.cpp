@@ -0,0 +1,548 @@
+#include "../handlers.h"
+
+#include "../../simd/simd.h"
+#include "../../session/session.h"
+#include "../../transfer/transfer.h"
+#include "../../commands/commands.h"
+#include "../../process/process.h"
+#include "../../../utilities/utilities.h"
+
+namespace handlers
+{
+	// the built in commands. arguments are read from and results are written to regs->rcx, rdx, r8 - r11 in place,
+	// core arguments and the caller's cpl were already checked by the registry, see commands.h
+	namespace hypercalls
+	{
+		UINT64 ping(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+			UNREFERENCED_PARAMETER(regs);
+
+			// ping should just return if its handled or not
+
+			return call_success;
+		}
+
+		UINT64 shutdown(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(regs);
+
+			// only the kernel can shutdown because we need to exit into a kernel rip and context
+
+			vcpu->wants_shutdown() = 1;
+
+			return call_success;
+		}
+
+		UINT64 echo(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+			UNREFERENCED_PARAMETER(regs);
+
+			// every argument and the xmm payload are returned untouched,
+			// this measures the bare round trip of the abi
+
+			return call_success;
+		}
+
+		UINT64 tsc_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// mode, exit overhead, max skew
+
+			if (regs->rcx > tsc_mode_intercept)
+				return call_bad_args;
+
+			// nothing else keeps the cores of offset mode apart by less than the skew
+
+			if (regs->rcx == tsc_mode_offset && !regs->r8)
+				return call_bad_args;
+
+			tsc::configure((TSC_MODE)regs->rcx, regs->rdx, regs->r8);
+
+			return call_success;
+		}
+
+		UINT64 tsc_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// core index in, that core's counters out
+
+			auto target		= hv::get_vcpu((int)regs->rcx);
+			auto& counters	= target->get_tsc();
+
+			regs->rcx	= counters.compensated_exits;
+			regs->rdx	= counters.compensated_cycles;
+			regs->r8	= counters.residual_cycles;
+			regs->r9	= counters.clamped_reads;
+			regs->r10	= target->get_guest().get_control_area().tsc_offset;
+			regs->r11	= tsc::get_skew(target);
+
+			return call_success;
+		}
+
+		UINT64 pause_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// flags, filter count, filter threshold, sample rate
+
+			if ((regs->rcx & PAUSE_ENABLE) && !pause_profiler::supported())
+				return call_unsupported;
+
+			if ((regs->rcx & PAUSE_ENABLE) && !regs->rdx)
+				return call_bad_args;
+
+			pause_profiler::configure(regs->rcx, (UINT16)regs->rdx, (UINT16)regs->r8, regs->r9);
+
+			return call_success;
+		}
+
+		UINT64 pause_export(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer, capacity in entries in, entries written and that core's counters out
+
+			auto target		= hv::get_vcpu((int)regs->rcx);
+			INT64 written	= pause_profiler::export_entries(vcpu, target, regs->rdx, regs->r8);
+
+			if (written < 0)
+				return call_fault;
+
+			regs->rcx	= written;
+			regs->rdx	= target->get_pause_histogram()->exits;
+			regs->r8	= target->get_pause_histogram()->sampled;
+			regs->r9	= target->get_pause_histogram()->dropped;
+
+			return call_success;
+		}
+
+		UINT64 sampler_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// flags, period in guest cycles, stack depth
+
+			if ((regs->rcx & SAMPLER_ENABLE) && regs->rdx < SAMPLE_MIN_PERIOD)
+				return call_bad_args;
+
+			if (regs->r8 > SAMPLE_STACK_DEPTH)
+				return call_bad_args;
+
+			sampler::configure(regs->rcx, regs->rdx, regs->r8);
+
+			return call_success;
+		}
+
+		UINT64 sampler_export(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer, capacity in samples in, samples written and that core's counters out
+
+			auto target		= hv::get_vcpu((int)regs->rcx);
+			INT64 written	= sampler::export_samples(vcpu, target, regs->rdx, regs->r8);
+
+			if (written < 0)
+				return call_fault;
+
+			regs->rcx	= written;
+			regs->rdx	= target->get_sample_ring()->samples;
+			regs->r8	= target->get_sample_ring()->dropped;
+			regs->r9	= target->get_sample_ring()->cycles;
+
+			return call_success;
+		}
+
+		UINT64 lbr_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// flags
+
+			if ((regs->rcx & LBR_ENABLE) && !lbr::supported())
+				return call_unsupported;
+
+			lbr::configure(regs->rcx);
+
+			return call_success;
+		}
+
+		UINT64 lbr_export(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer, capacity in entries in, entries written and that core's counters out
+
+			auto target		= hv::get_vcpu((int)regs->rcx);
+			INT64 written	= lbr::export_entries(vcpu, target, regs->rdx, regs->r8);
+
+			if (written < 0)
+				return call_fault;
+
+			regs->rcx	= written;
+			regs->rdx	= target->get_branch_table()->captures;
+			regs->r8	= target->get_branch_table()->dropped;
+			regs->r9	= target->get_branch_table()->cycles;
+
+			return call_success;
+		}
+
+		UINT64 exit_cost_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// flags
+
+			if ((regs->rcx & EXIT_COST_ENABLE) && !exit_cost::supported())
+				return call_unsupported;
+
+			exit_cost::configure(regs->rcx);
+
+			return call_success;
+		}
+
+		UINT64 exit_cost_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer, capacity in records in, records written out
+
+			INT64 written = exit_cost::export_records(vcpu, hv::get_vcpu((int)regs->rcx), regs->rdx, regs->r8);
+
+			if (written < 0)
+				return call_fault;
+
+			regs->rcx = written;
+
+			return call_success;
+		}
+
+		UINT64 checksum(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			auto& state = vcpu->get_guest().get_state_save_area();
+
+			// buffer, size in bytes, flags in, checksum out
+
+			if ((regs->rcx & 7) || (regs->rdx & 7) || regs->rdx > CHECKSUM_MAX_SIZE)
+				return call_bad_args;
+
+			bool vector = !(regs->r8 & CHECKSUM_SCALAR) && simd::avx2_supported();
+
+			if (vector)
+				xsave::acquire(vcpu);
+
+			if (!simd::checksum_guest(vcpu, state.cr3.AsUInt, state.cpl, regs->rcx, regs->rdx, vector, &regs->rcx))
+				return call_fault;
+
+			return call_success;
+		}
+
+		UINT64 xsave_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// core index in, that core's simd exits, cycles spent saving and restoring and the area size out
+
+			auto& counters = hv::get_vcpu((int)regs->rcx)->get_xsave();
+
+			regs->rcx	= counters.simd_exits;
+			regs->rdx	= counters.cycles;
+			regs->r8	= counters.size;
+
+			return call_success;
+		}
+
+		UINT64 instruction_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer for an INSTRUCTION_STATS in, the cpu's INSTRUCTION_ support flags out
+
+			if (!instruction::export_stats(vcpu, hv::get_vcpu((int)regs->rcx), regs->rdx))
+				return call_fault;
+
+			regs->rcx = instruction::supported();
+
+			return call_success;
+		}
+
+		UINT64 exception_config(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// vectors to intercept and reflect, flags
+
+			if (regs->rcx & ~(UINT64)EXCEPTION_INTERCEPTABLE)
+				return call_bad_args;
+
+			exceptions::configure((UINT32)regs->rcx, regs->rdx);
+
+			return call_success;
+		}
+
+		UINT64 exception_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer for an EXCEPTION_STATS
+
+			if (!exceptions::export_stats(vcpu, hv::get_vcpu((int)regs->rcx), regs->rdx))
+				return call_fault;
+
+			return call_success;
+		}
+
+		UINT64 notify_register(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// vector or 0, core or NOTIFY_ANY_CORE. an interrupt nobody handles would crash the guest,
+			// so only the kernel can register
+
+			if ((regs->rcx && regs->rcx < NOTIFY_MIN_VECTOR) || regs->rcx > 0xFF ||
+				(regs->rdx != NOTIFY_ANY_CORE && regs->rdx >= (UINT64)utilities::get_cpu_cores()))
+				return call_bad_args;
+
+			notify::register_vector((UINT8)regs->rcx, (UINT32)regs->rdx);
+
+			return call_success;
+		}
+
+		UINT64 notify_poll(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(vcpu);
+
+			// returns cookie, status, how many completions are left and when it was posted in rcx, rdx, r8 and r9
+
+			NOTIFY_COMPLETION completion;
+
+			if (!notify::poll(&completion, &regs->r8))
+				return call_empty;
+
+			regs->rcx = completion.cookie;
+			regs->rdx = completion.status;
+			regs->r9  = completion.tsc;
+
+			return call_success;
+		}
+
+		UINT64 notify_post(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// cookie, status, returns whether it fit in the ring. completes nothing,
+			// it lets a guest test its notification handler
+
+			regs->rcx = notify::post(vcpu, regs->rcx, regs->rdx);
+
+			return call_success;
+		}
+
+		UINT64 session_open(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// ring address, entries, batch quota in, session id out
+
+			return session::open(vcpu, regs->rcx, regs->rdx, regs->r8, &regs->rcx);
+		}
+
+		// the session id comes in rax, commands from a ring never get here
+		SESSION* resolve_session(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			return session::resolve(vcpu, (regs->rax >> HYPERCALL_SESSION_SHIFT) & SESSION_ID_MASK);
+		}
+
+		UINT64 session_close(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			auto target = resolve_session(vcpu, regs);
+
+			if (!target)
+				return call_bad_args;
+
+			session::close(target);
+
+			return call_success;
+		}
+
+		UINT64 session_submit(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			auto target = resolve_session(vcpu, regs);
+
+			if (!target)
+				return call_bad_args;
+
+			// returns how many commands ran and how many are still queued in rcx and rdx
+
+			return session::submit(vcpu, target, commands::dispatch, &regs->rcx, &regs->rdx);
+		}
+
+		UINT64 job_start(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// kind, base, size, cycle budget per exit or 0, flags, the kind's parameters. runs on the calling core
+
+			return jobs::start(vcpu, (JOB_KIND)regs->rcx, regs->rdx, regs->r8, regs->r9, regs->r10, regs->r11);
+		}
+
+		UINT64 job_poll(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core in, state, bytes done, size, result, slices and the longest slice out
+
+			auto target = hv::get_vcpu((int)regs->rcx);
+
+			if (!jobs::owns(vcpu, target))
+				return call_denied;
+
+			auto& job = target->get_job();
+
+			regs->rcx	= job.state;
+			regs->rdx	= job.cursor;
+			regs->r8	= job.size;
+			regs->r9	= job.result;
+			regs->r10	= job.stats.slices;
+			regs->r11	= job.stats.max_slice;
+
+			return call_success;
+		}
+
+		UINT64 job_cancel(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core
+
+			auto target = hv::get_vcpu((int)regs->rcx);
+
+			if (!jobs::owns(vcpu, target))
+				return call_denied;
+
+			jobs::cancel(target);
+
+			return call_success;
+		}
+
+		UINT64 process_exit(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			UNREFERENCED_PARAMETER(regs);
+
+			// made by process::watch's notify routine from the exiting process, so its cr3 is current
+
+			process::release(vcpu->get_guest().get_state_save_area().cr3.AsUInt);
+
+			return call_success;
+		}
+
+		UINT64 scatter_gather(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// list of TRANSFER_ENTRY, count in, entries processed and how many of them failed out
+
+			return transfer::scatter_gather(vcpu, regs->rcx, regs->rdx, &regs->rcx, &regs->rdx);
+		}
+
+		UINT64 broadcast(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// code and up to 5 arguments in, the cores that succeeded, failed and didnt answer and the cycles it took out.
+			// the other cores run it from their own exits, never from here
+
+			return broadcast::run(vcpu, regs, commands::dispatch_as);
+		}
+
+		UINT64 command_list(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// buffer, capacity in COMMAND_INFO-s in, how many were written and the interface version out
+
+			INT64 written = commands::export_list(vcpu, regs->rcx, regs->rdx);
+
+			if (written < 0)
+				return call_fault;
+
+			regs->rcx = written;
+			regs->rdx = COMMAND_INTERFACE_VERSION;
+
+			return call_success;
+		}
+
+		UINT64 command_stats(vcpu* vcpu, GENERAL_REGISTERS* regs)
+		{
+			// core index, buffer, capacity in COMMAND_STATS-s, indexed by code
+
+			if (!commands::export_stats(vcpu, hv::get_vcpu((int)regs->rcx), regs->rdx, regs->r8))
+				return call_fault;
+
+			return call_success;
+		}
+	}
+}
+
+bool handlers::register_commands()
+{
+	// the highest cpl allowed, and where a command may run other than a plain vmmcall.
+	// user mode only gets the pings, whatever reads statistics and copies within its own address space,
+	// everything that configures the hypervisor, touches physical memory or other address spaces or exports
+	// guest state is the kernel's. scatter gather checks that per entry.
+	// sessions and broadcasts are only a way to queue or fan out calls, what runs in them is checked against
+	// the submitter's cpl
+
+	constexpr UINT8 kernel	= 0;
+	constexpr UINT8 anyone	= 3;
+
+	constexpr UINT8 queued		= COMMAND_SESSION;
+	constexpr UINT8 everywhere	= COMMAND_SESSION | COMMAND_BROADCAST;
+	constexpr UINT8 global		= COMMAND_SESSION | COMMAND_BROADCAST_ONCE;
+
+	const struct
+	{
+		UINT64	code;
+		COMMAND	command;
+	} builtin[] =
+	{
+		{ HYPERCALL_PING,				{ hypercalls::ping,				"ping",				1, anyone, everywhere } },
+		{ HYPERCALL_SHUTDOWN,			{ hypercalls::shutdown,			"shutdown",			1, kernel, 0 } },
+		{ HYPERCALL_ECHO,				{ hypercalls::echo,				"echo",				1, anyone, everywhere, { arg_value, arg_value, arg_value, arg_value, arg_value, arg_value } } },
+		{ HYPERCALL_TSC_CONFIG,			{ hypercalls::tsc_config,		"tsc config",		1, kernel, global, { arg_value, arg_value, arg_value } } },
+		{ HYPERCALL_TSC_STATS,			{ hypercalls::tsc_stats,		"tsc stats",		1, anyone, queued, { arg_core, arg_result, arg_result, arg_result, arg_result, arg_result } } },
+		{ HYPERCALL_PAUSE_CONFIG,		{ hypercalls::pause_config,		"pause config",		1, kernel, global, { arg_value, arg_value, arg_value, arg_value } } },
+		{ HYPERCALL_PAUSE_EXPORT,		{ hypercalls::pause_export,		"pause export",		1, kernel, queued, { arg_core, arg_address, arg_value, arg_result } } },
+		{ HYPERCALL_SAMPLER_CONFIG,		{ hypercalls::sampler_config,	"sampler config",	1, kernel, global, { arg_value, arg_value, arg_value } } },
+		{ HYPERCALL_SAMPLER_EXPORT,		{ hypercalls::sampler_export,	"sampler export",	1, kernel, queued, { arg_core, arg_address, arg_value, arg_result } } },
+		{ HYPERCALL_LBR_CONFIG,			{ hypercalls::lbr_config,		"lbr config",		1, kernel, global, { arg_value } } },
+		{ HYPERCALL_LBR_EXPORT,			{ hypercalls::lbr_export,		"lbr export",		1, kernel, queued, { arg_core, arg_address, arg_value, arg_result } } },
+		{ HYPERCALL_EXIT_COST_CONFIG,	{ hypercalls::exit_cost_config,	"exit cost config",	1, kernel, global, { arg_value } } },
+		{ HYPERCALL_EXIT_COST_STATS,	{ hypercalls::exit_cost_stats,	"exit cost stats",	1, anyone, queued, { arg_core, arg_address, arg_value } } },
+		{ HYPERCALL_CHECKSUM,			{ hypercalls::checksum,			"checksum",			1, kernel, queued, { arg_address, arg_value, arg_value } } },
+		{ HYPERCALL_XSAVE_STATS,		{ hypercalls::xsave_stats,		"xsave stats",		1, anyone, queued, { arg_core, arg_result, arg_result } } },
+		{ HYPERCALL_INSTRUCTION_STATS,	{ hypercalls::instruction_stats, "instruction stats", 1, anyone, queued, { arg_core, arg_address } } },
+		{ HYPERCALL_EXCEPTION_CONFIG,	{ hypercalls::exception_config,	"exception config",	1, kernel, global, { arg_value, arg_value } } },
+		{ HYPERCALL_EXCEPTION_STATS,	{ hypercalls::exception_stats,	"exception stats",	1, anyone, queued, { arg_core, arg_address } } },
+		{ HYPERCALL_NOTIFY_REGISTER,	{ hypercalls::notify_register,	"notify register",	1, kernel, queued, { arg_value, arg_value } } },
+		{ HYPERCALL_NOTIFY_POLL,		{ hypercalls::notify_poll,		"notify poll",		1, kernel, queued, { arg_result, arg_result, arg_result, arg_result } } },
+		{ HYPERCALL_NOTIFY_POST,		{ hypercalls::notify_post,		"notify post",		1, kernel, queued, { arg_value, arg_value } } },
+		{ HYPERCALL_SESSION_OPEN,		{ hypercalls::session_open,		"session open",		1, anyone, 0, { arg_address, arg_value, arg_value } } },
+		{ HYPERCALL_SESSION_CLOSE,		{ hypercalls::session_close,	"session close",	1, anyone, 0 } },
+		{ HYPERCALL_SESSION_SUBMIT,		{ hypercalls::session_submit,	"session submit",	1, anyone, 0, { arg_result, arg_result } } },
+		{ HYPERCALL_JOB_START,			{ hypercalls::job_start,		"job start",		1, kernel, queued, { arg_value, arg_address, arg_value, arg_value, arg_value, arg_address } } },
+		{ HYPERCALL_JOB_POLL,			{ hypercalls::job_poll,			"job poll",			1, anyone, queued, { arg_core, arg_result, arg_result, arg_result, arg_result, arg_result } } },
+		{ HYPERCALL_JOB_CANCEL,			{ hypercalls::job_cancel,		"job cancel",		1, kernel, queued, { arg_core } } },
+		{ HYPERCALL_SCATTER_GATHER,		{ hypercalls::scatter_gather,	"scatter gather",	1, anyone, queued, { arg_address, arg_value } } },
+		{ HYPERCALL_BROADCAST,			{ hypercalls::broadcast,		"broadcast",		1, anyone, 0, { arg_value, arg_value, arg_value, arg_value, arg_value, arg_value } } },
+		{ HYPERCALL_COMMAND_LIST,		{ hypercalls::command_list,		"command list",		1, anyone, queued, { arg_address, arg_value } } },
+		{ HYPERCALL_COMMAND_STATS,		{ hypercalls::command_stats,	"command stats",	1, anyone, queued, { arg_core, arg_address, arg_value } } },
+		{ HYPERCALL_PROCESS_EXIT,		{ hypercalls::process_exit,		"process exit",		1, kernel, 0 } },
+	};
+
+	for (auto& entry : builtin)
+	{
+		if (!commands::add(entry.code, entry.command))
+			return false;
+	}
+
+	return true;
+}
+
+void handlers::vmmcall(vcpu* vcpu)
+{
+	auto regs = vcpu->get_regs();
+
+	// on bare metal vmmcall raises #UD when no hypervisor intercepts it,
+	// so anything that isnt keyed for us gets exactly that
+
+	if ((regs->rax >> 32) != HYPERCALL_KEY)
+	{
+		vcpu->inject_exception(EXCEPTION_VECTOR::InvalidOpcode);
+		return;
+	}
+
+	// if HYPERCALL_XMM is set the payload is in vcpu->get_xmm() which is written back the same way
+
+	regs->rax = commands::dispatch(vcpu, regs);
+
+	instruction::skip(vcpu);
+
+	return;
+}
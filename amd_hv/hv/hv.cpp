@@ -1,12 +1,46 @@
 #include "hv.h"
 
 #include "handlers/handlers.h"
+#include "apic/apic.h"
+#include "process/process.h"
 
 #include "../utilities/utilities.h"
 
 namespace hv 
 {
 	vcpu** vcpus;
+
+	struct SPILL_TABLE
+	{
+		UINT16 masks[SPILL_TABLE_SIZE];
+	};
+
+	// built from the declarations in handlers.h, keep it in sync with the switch in handle_vmexit
+	constexpr SPILL_TABLE make_spill_table()
+	{
+		SPILL_TABLE table{};
+
+		for (auto& mask : table.masks)
+			mask = gpr_all;
+
+		table.masks[SVMEXIT::VMRUN]		= handlers::vmrun_regs;
+		table.masks[SVMEXIT::CPUID]		= handlers::cpuid_regs;
+		table.masks[SVMEXIT::VMMCALL]	= handlers::vmmcall_regs;
+		table.masks[SVMEXIT::RDTSC]		= handlers::rdtsc_regs;
+		table.masks[SVMEXIT::RDTSCP]	= handlers::rdtscp_regs;
+		table.masks[SVMEXIT::PAUSE]		= handlers::pause_regs;
+		table.masks[SVMEXIT::NMI]		= handlers::nmi_regs;
+		table.masks[SVMEXIT::INTR]		= handlers::intr_regs;
+		table.masks[SVMEXIT::VINTR]		= handlers::vintr_regs;
+		table.masks[SVMEXIT::IRET]		= handlers::iret_regs;
+
+		for (int vector = 0; vector < EXCEPTION_VECTORS; vector++)
+			table.masks[SVMEXIT::DE + vector] = handlers::exception_regs;
+
+		return table;
+	}
+
+	constexpr SPILL_TABLE spill_table = make_spill_table();
 }
 
 bool hv::setup() 
@@ -26,6 +60,28 @@ bool hv::setup()
 		memset(vcpus[i], 0, sizeof(vcpu));
 	}
 
+	// these are needed from the host, which cant call into the os
+
+	if (!apic::setup())
+		return false;
+
+	if (!sampler::setup())
+		return false;
+
+	if (!vmcb::setup())
+		return false;
+
+	if (!memory::setup_ranges())
+		return false;
+
+	instruction::setup();
+
+	if (!handlers::register_commands())
+		return false;
+
+	if (!capture::setup())
+		return false;
+
 	return true;
 }
 
@@ -62,7 +118,8 @@ bool hv::launch()
 
 		svm::enable_svm();
 
-		vcpu->setup();
+		if (!vcpu->setup())
+			return false;
 
 		if (!vcpu->validate_guest()) 
 			return false;
@@ -73,6 +130,15 @@ bool hv::launch()
 		LOG("core %i virtualization successful! \n", i);
 	}
 
+	// a broadcast needs every core to answer its nmi
+
+	broadcast::enable();
+
+	// jobs have to stop before the process that started them is gone
+
+	if (!process::watch())
+		return false;
+
 	LOG("cpu fully virtualized! \n");
 
 	return true;
@@ -83,6 +149,14 @@ bool hv::shutdown()
 	if (!check_loaded())
 		return false;
 
+	// the notify routine calls into the hypervisor
+
+	process::unwatch();
+
+	// a core thats gone cant answer a broadcast, and an nmi sent to it wouldnt be claimed
+
+	broadcast::disable();
+
 	// run shutdown command from kernel on all cores
 
 	int core_amt = utilities::get_cpu_cores();
@@ -90,13 +164,19 @@ bool hv::shutdown()
 	{
 		utilities::use_cpu_core(i);
 
-		if (!send_hv_command(COMMAND_KEY, SHUTDOWN_ID)) 
+		HYPERCALL_ARGS args{};
+
+		if (hv_call(HYPERCALL_CODE(HYPERCALL_SHUTDOWN), &args) != call_success) 
 		{
 			LOG_ERROR("shutdown failed \n");
 			return false;
 		}
 	}
 
+	sampler::cleanup();
+	apic::cleanup();
+	vmcb::cleanup();
+
 	LOG("cpu fully devirtualized! \n");
 
 	return true;
@@ -107,7 +187,19 @@ bool hv::handle_vmexit(vcpu* vcpu)
 {
 	auto& control = vcpu->get_guest().get_control_area();
 
+	// take the timestamp before anything else, so as little host time as possible goes unaccounted
+
+	tsc::on_exit(vcpu);
+	exit_cost::on_exit(vcpu);
+
 	vcpu->prologue();
+
+	capture::on_exit(vcpu);
+
+	// requests other cores posted for this one. an nmi exit drains once the nmi is through, see handlers::nmi
+
+	if (control.exit_code != SVMEXIT::NMI)
+		mailbox::drain(&vcpu->get_mailbox(), vcpu);
 	
 	// uncomment this to test fsbase being set correctly 
 	//if (_readfsbase_u64() == (UINT64)vcpu)
@@ -125,24 +217,94 @@ bool hv::handle_vmexit(vcpu* vcpu)
 
 		handlers::cpuid(vcpu); 
 
+		break;
+	case SVMEXIT::VMMCALL:
+		handlers::vmmcall(vcpu);
+		break;
+	case SVMEXIT::RDTSC:
+		handlers::rdtsc(vcpu);
+		break;
+	case SVMEXIT::RDTSCP:
+		handlers::rdtscp(vcpu);
+		break;
+	case SVMEXIT::PAUSE:
+		handlers::pause(vcpu);
+		break;
+	case SVMEXIT::NMI:
+		handlers::nmi(vcpu);
+		break;
+	case SVMEXIT::INTR:
+		handlers::intr(vcpu);
+		break;
+	case SVMEXIT::VINTR:
+		handlers::vintr(vcpu);
+		break;
+	case SVMEXIT::IRET:
+		handlers::iret(vcpu);
 		break;
 	default:
+
+		// exception intercepts are 0x40 + vector
+
+		if (control.exit_code - SVMEXIT::DE < EXCEPTION_VECTORS)
+			handlers::exception(vcpu);
+
 		break;
 	}
 
+	// whatever event this exit interrupted goes back into the guest, unless the handler raised one that beats it
+
+	exceptions::complete(vcpu);
+
+	// completions other cores posted for this one become a virtual interrupt, deliver arms it
+
+	notify::update(vcpu);
+	events::deliver(vcpu);
+
+	// a slice of this core's long running job, before xsave::release since it can use avx2
+
+	jobs::run(vcpu);
+
+	// handlers that used simd saved the guest's extended state, it goes back before anything else runs
+
+	xsave::release(vcpu);
+
+	lbr::on_exit(vcpu);
+
+	pause_profiler::update(vcpu);
+	sampler::update(vcpu);
+	lbr::update(vcpu);
+	exit_cost::update(vcpu);
+	exceptions::update(vcpu);
+	capture::update(vcpu);
+
+	// everything the guest sees of this exit is in place, only rax and rsp still have to go back into the vmcb
+
+	capture::on_resume(vcpu);
+
 	vcpu->epilogue();
 
+	exit_cost::on_resume(vcpu);
+	tsc::on_resume(vcpu);
+
+	vmcb::verify(vcpu);
+
 	return vcpu->wants_shutdown();
 }
 
+const UINT16* hv::get_spill_masks()
+{
+	return spill_table.masks;
+}
+
 void hv::cleanup(vcpu* vcpu) 
 {
-	auto& control	= vcpu->get_guest().get_control_area();
 	auto& state		= vcpu->get_guest().get_state_save_area();
 
 	// we store these on stack so we can access them
 	// after their memory has been free-d
-	UINT64 next_rip			= control.nrip;
+	// the shutdown handler already moved rip past its instruction
+	UINT64 next_rip			= state.rip;
 	UINT64 guest_cr3		= state.cr3.AsUInt;
 	UINT64 guest_rflags		= state.rflags.AsUInt;
 	UINT64 guest_vmcb_phys	= vcpu->get_guest_phys();
@@ -152,11 +314,26 @@ void hv::cleanup(vcpu* vcpu)
 	// restore rax
 	regs->rax				= state.rax;
 
+	// this core's counter would keep raising nmi-s nobody claims anymore
+
+	sampler::stop(vcpu);
+	lbr::stop(vcpu);
+	exit_cost::stop(vcpu);
+
+	memory::free_window(vcpu->get_window());
+	ExFreePoolWithTag(vcpu->get_pause_histogram(), 'ENON');
+	ExFreePoolWithTag(vcpu->get_sample_ring(), 'ENON');
+	ExFreePoolWithTag(vcpu->get_branch_table(), 'ENON');
+	ExFreePoolWithTag(vcpu->get_cost_table(), 'ENON');
+	ExFreePoolWithTag(vcpu->get_capture_ring(), 'ENON');
+	ExFreePoolWithTag(vcpu->get_decode_cache(), 'ENON');
+	xsave::free(vcpu->get_xsave());
+
 	MmFreeContiguousMemory(vcpu->get_host_stack_base());
 	MmFreeContiguousMemory(vcpu);
 
 	// on the last core, free the vcpu array
-	if (utilities::get_current_cpu_idx() == utilities::get_cpu_cores() - 1)
+	if (utilities::get_current_cpu_idx() == (ULONG)utilities::get_cpu_cores() - 1)
 		ExFreePoolWithTag(vcpus, 'ENON');
 
 	LOG("hv cleanup! exit rip -> %p \n", next_rip);
@@ -6,6 +6,79 @@
 #define PING_ID 0x123
 #define COMMAND_KEY 0x123456789
 
+// VMMCALL hypercall abi
+// rax                      - HYPERCALL_KEY in the upper 32 bits, flags, session id and call code in the lower 32 bits
+// rcx, rdx, r8, r9, r10, r11 - up to 6 arguments in, up to 6 results out
+// xmm0 - xmm5              - 96 byte payload in and out, only if HYPERCALL_XMM is set
+// rax                      - HYPERCALL_STATUS on return
+
+#define HYPERCALL_KEY 0x616D6476
+#define HYPERCALL_XMM 0x80000000
+#define HYPERCALL_CODE_MASK 0xFFFF
+#define HYPERCALL_SESSION_SHIFT 16
+#define HYPERCALL_SESSION(id) ((UINT64)(id) << HYPERCALL_SESSION_SHIFT)
+#define HYPERCALL_CODE(code) ((UINT64)HYPERCALL_KEY << 32 | (code))
+
+#define HYPERCALL_PING 0x1
+#define HYPERCALL_SHUTDOWN 0x2
+#define HYPERCALL_ECHO 0x3
+#define HYPERCALL_TSC_CONFIG 0x4
+#define HYPERCALL_TSC_STATS 0x5
+#define HYPERCALL_PAUSE_CONFIG 0x6
+#define HYPERCALL_PAUSE_EXPORT 0x7
+#define HYPERCALL_SAMPLER_CONFIG 0x8
+#define HYPERCALL_SAMPLER_EXPORT 0x9
+#define HYPERCALL_LBR_CONFIG 0xA
+#define HYPERCALL_LBR_EXPORT 0xB
+#define HYPERCALL_EXIT_COST_CONFIG 0xC
+#define HYPERCALL_EXIT_COST_STATS 0xD
+#define HYPERCALL_CHECKSUM 0xE
+#define HYPERCALL_XSAVE_STATS 0xF
+#define HYPERCALL_INSTRUCTION_STATS 0x10
+#define HYPERCALL_EXCEPTION_CONFIG 0x11
+#define HYPERCALL_EXCEPTION_STATS 0x12
+#define HYPERCALL_NOTIFY_REGISTER 0x13
+#define HYPERCALL_NOTIFY_POLL 0x14
+#define HYPERCALL_NOTIFY_POST 0x15
+#define HYPERCALL_SESSION_OPEN 0x16
+#define HYPERCALL_SESSION_CLOSE 0x17
+#define HYPERCALL_SESSION_SUBMIT 0x18
+#define HYPERCALL_JOB_START 0x19
+#define HYPERCALL_JOB_POLL 0x1A
+#define HYPERCALL_JOB_CANCEL 0x1B
+#define HYPERCALL_SCATTER_GATHER 0x1C
+#define HYPERCALL_BROADCAST 0x1D
+#define HYPERCALL_COMMAND_LIST 0x1E
+#define HYPERCALL_COMMAND_STATS 0x1F
+#define HYPERCALL_CAPTURE_CONFIG 0x20
+#define HYPERCALL_CAPTURE_EXPORT 0x21
+#define HYPERCALL_PROCESS_EXIT 0x22
+#define HYPERCALL_VMCB_STATS 0x23
+
+enum HYPERCALL_STATUS : UINT64
+{
+	call_success	= 0,
+	call_invalid	= 1,	// unknown call code
+	call_denied		= 2,	// the caller's cpl isnt allowed to make this call
+	call_bad_args	= 3,	// an argument is out of range
+	call_unsupported = 4,	// the cpu doesnt support a feature the call needs
+	call_fault		= 5,	// a guest buffer isnt present or writable, the caller has to fault it in first
+	call_empty		= 6,	// there was nothing to return
+	call_exhausted	= 7,	// the session table or the caller's share of it is full
+	call_busy		= 8,	// the core is still running a job, or another broadcast is in flight
+};
+
+// the layout is relied on by hv_call and hv_call_xmm in helpers.asm
+struct HYPERCALL_ARGS
+{
+	UINT64 regs[6];		// rcx, rdx, r8, r9, r10, r11
+	M128A  xmm[6];		// xmm0 - xmm5
+};
+
+// exit codes below this get their spill mask from hv::spill_table, the rest always get everything spilled.
+// must match helpers.asm
+#define SPILL_TABLE_SIZE 0x100
+
 namespace hv 
 {
 	bool setup();
@@ -21,6 +94,9 @@ namespace hv
 
 	bool handle_vmexit(vcpu* vcpu);
 
+	// the guest registers to spill per exit code, indexed by helpers.asm through the vcpu
+	const UINT16* get_spill_masks();
+
 	// cleanup the allocations
 	void cleanup(vcpu* vcpu);
 }
\ No newline at end of file
@@ -0,0 +1,338 @@
+#include "instruction.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../../utilities/utilities.h"
+
+namespace instruction
+{
+	bool nrip_save;
+	bool decode_assists;
+
+	// the shortest encoding of the instructions whose handlers skip them,
+	// only used when we can neither trust nrip nor read the instruction
+	UINT8 shortest_length(UINT64 exit_code)
+	{
+		switch (exit_code)
+		{
+		case SVMEXIT::CPUID:
+		case SVMEXIT::RDTSC:
+		case SVMEXIT::PAUSE:
+			return 2;
+		case SVMEXIT::VMRUN:
+		case SVMEXIT::VMMCALL:
+		case SVMEXIT::RDTSCP:
+			return 3;
+		default:
+			return 0;
+		}
+	}
+
+	UINT64 segment_base(vcpu* vcpu, UINT8 segment)
+	{
+		auto& state = vcpu->get_guest().get_state_save_area();
+
+		switch (segment)
+		{
+		case seg_fs:
+			return state.fs.base;
+		case seg_gs:
+			return state.gs.base;
+		default:
+			break;
+		}
+
+		// long mode ignores the base of the other segments
+
+		if (mode(vcpu) == decode_64)
+			return 0;
+
+		switch (segment)
+		{
+		case seg_es:
+			return state.es.Base;
+		case seg_cs:
+			return state.cs.Base;
+		case seg_ss:
+			return state.ss.Base;
+		default:
+			return state.ds.Base;
+		}
+	}
+}
+
+void instruction::setup()
+{
+	int cpuid_regs[4];
+	__cpuid(cpuid_regs, 0x8000000A);
+
+	// EDX[3] NRIPS, EDX[7] DecodeAssists
+
+	nrip_save		= cpuid_regs[3] & (1 << 3);
+	decode_assists	= cpuid_regs[3] & (1 << 7);
+
+	if (!nrip_save || !decode_assists)
+	{
+		LOG("instruction info falls back to software decoding, nrip save %i decode assists %i \n", nrip_save, decode_assists);
+	}
+
+	return;
+}
+
+UINT64 instruction::supported()
+{
+	return (nrip_save ? INSTRUCTION_NRIP_SAVE : 0) | (decode_assists ? INSTRUCTION_DECODE_ASSISTS : 0);
+}
+
+DECODER_MODE instruction::mode(vcpu* vcpu)
+{
+	auto& state = vcpu->get_guest().get_state_save_area();
+
+	if (state.efer.lma && state.cs.Attrib.long_mode)
+		return decode_64;
+
+	return state.cs.Attrib.default_bit ? decode_32 : decode_16;
+}
+
+bool instruction::fetch(vcpu* vcpu, UINT8* bytes, UINT8* count)
+{
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& state		= vcpu->get_guest().get_state_save_area();
+	auto& stats		= vcpu->get_instruction_stats();
+
+	// the cpu only leaves the bytes here on nested and guest page faults
+
+	if (decode_assists && control.cur_instr.bytes_amt)
+	{
+		*count = min(control.cur_instr.bytes_amt, DECODER_MAX_LENGTH);
+
+		memcpy(bytes, control.cur_instr.instruction_bytes, *count);
+
+		stats.assist_fetches++;
+
+		return true;
+	}
+
+	// memory::translate walks the guest's page tables, so we cant follow a guest running without paging
+
+	if (!state.cr0.PagingEnable)
+	{
+		stats.failures++;
+		return false;
+	}
+
+	UINT64 linear = state.rip;
+
+	if (mode(vcpu) != decode_64)
+		linear = (linear + state.cs.Base) & MAXUINT32;
+
+	UINT8 first = (UINT8)min(DECODER_MAX_LENGTH, PAGE_SIZE - (linear & (PAGE_SIZE - 1)));
+
+	if (!memory::read_guest(vcpu, state.cr3.AsUInt, state.cpl, linear, bytes, first))
+	{
+		stats.failures++;
+		return false;
+	}
+
+	*count = first;
+
+	// the instruction can end before the next page, which doesnt have to be present
+
+	if (first < DECODER_MAX_LENGTH && memory::read_guest(vcpu, state.cr3.AsUInt, state.cpl, linear + first, bytes + first, DECODER_MAX_LENGTH - first))
+		*count = DECODER_MAX_LENGTH;
+
+	stats.software_fetches++;
+
+	return true;
+}
+
+bool instruction::decode(vcpu* vcpu, DECODED_INSTRUCTION& insn)
+{
+	UINT8 bytes[DECODER_MAX_LENGTH];
+	UINT8 count;
+
+	if (!fetch(vcpu, bytes, &count))
+		return false;
+
+	if (!decoder::decode(bytes, count, mode(vcpu), insn))
+	{
+		vcpu->get_instruction_stats().failures++;
+		return false;
+	}
+
+	return true;
+}
+
+bool instruction::decode_cached(vcpu* vcpu, DECODED_INSTRUCTION& insn)
+{
+	auto& state		= vcpu->get_guest().get_state_save_area();
+	auto& stats		= vcpu->get_instruction_stats();
+
+	// the low 12 bits are the pcid, the same tables can be loaded with several of them
+
+	UINT64 cr3	= state.cr3.AsUInt & ~0xFFFull;
+	UINT64 rip	= state.rip;
+
+	auto current_mode = mode(vcpu);
+
+	// the bytes are read again on every lookup, the code at rip can have been rewritten or another image
+	// loaded there. decode assists only provide them on page faults, otherwise they come from guest memory
+
+	UINT8 bytes[DECODER_MAX_LENGTH];
+	UINT8 count;
+
+	if (!fetch(vcpu, bytes, &count))
+		return false;
+
+	auto& entry = vcpu->get_decode_cache()->entries[((rip ^ cr3) * 0x9E3779B97F4A7C15) >> (64 - DECODE_CACHE_BITS)];
+
+	if (entry.insn.length && entry.rip == rip && entry.cr3 == cr3 && entry.insn.mode == current_mode &&
+		count >= entry.insn.length && !memcmp(entry.bytes, bytes, entry.insn.length))
+	{
+		insn = entry.insn;
+
+		stats.cache_hits++;
+
+		return true;
+	}
+
+	stats.cache_misses++;
+
+	if (!decoder::decode(bytes, count, current_mode, insn))
+	{
+		stats.failures++;
+		return false;
+	}
+
+	entry.cr3	= cr3;
+	entry.rip	= rip;
+	entry.insn	= insn;
+
+	memcpy(entry.bytes, bytes, insn.length);
+
+	return true;
+}
+
+UINT64 instruction::next_rip(vcpu* vcpu)
+{
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& state		= vcpu->get_guest().get_state_save_area();
+	auto& stats		= vcpu->get_instruction_stats();
+
+	// the cpu saves nrip for instruction intercepts and zeroes it for everything else
+
+	if (nrip_save && control.nrip)
+	{
+		stats.nrip_hits++;
+		return control.nrip;
+	}
+
+	UINT8 length;
+
+	DECODED_INSTRUCTION insn;
+
+	if (decode_cached(vcpu, insn))
+	{
+		length = insn.length;
+		stats.software_lengths++;
+	}
+	else
+		length = shortest_length(control.exit_code);
+
+	UINT64 rip = state.rip + length;
+
+	return mode(vcpu) == decode_64 ? rip : rip & MAXUINT32;
+}
+
+void instruction::skip(vcpu* vcpu)
+{
+	vcpu->get_guest().get_state_save_area().rip = next_rip(vcpu);
+
+	return;
+}
+
+bool instruction::mov_cr_gpr(vcpu* vcpu, UINT8* gpr)
+{
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& stats		= vcpu->get_instruction_stats();
+
+	bool debug = control.exit_code >= SVMEXIT::DR0_READ;
+
+	if (decode_assists)
+	{
+		// EXITINFO1[63] tells a mov apart from lmsw and clts, debug register exits are always movs
+
+		if (!debug && !(control.exit_info1 >> 63))
+			return false;
+
+		*gpr = control.exit_info1 & 0xF;
+
+		stats.assist_operands++;
+
+		return true;
+	}
+
+	DECODED_INSTRUCTION insn;
+
+	if (!decode_cached(vcpu, insn))
+		return false;
+
+	// 0f 20 / 22 for control and 0f 21 / 23 for debug registers, the gpr is always in r/m
+
+	if (insn.map != map_0f || (insn.opcode & 0xFC) != 0x20 || (bool)(insn.opcode & 1) != debug)
+		return false;
+
+	*gpr = decoder::modrm_rm(insn);
+
+	stats.software_operands++;
+
+	return true;
+}
+
+bool instruction::invlpg_address(vcpu* vcpu, UINT64* address)
+{
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& state		= vcpu->get_guest().get_state_save_area();
+	auto& stats		= vcpu->get_instruction_stats();
+
+	if (decode_assists)
+	{
+		*address = control.exit_info1;
+
+		stats.assist_operands++;
+
+		return true;
+	}
+
+	DECODED_INSTRUCTION insn;
+
+	if (!decode_cached(vcpu, insn))
+		return false;
+
+	// 0f 01 /7 with a memory operand, the register forms of /7 are swapgs and rdtscp
+
+	if (insn.map != map_0f || insn.opcode != 0x01 || ((insn.modrm >> 3) & 7) != 7 || !decoder::has_memory_operand(insn))
+		return false;
+
+	UINT64 offset;
+
+	if (!decoder::effective_address(insn, vcpu->get_regs(), state.rip + insn.length, &offset))
+		return false;
+
+	*address = segment_base(vcpu, insn.segment) + offset;
+
+	stats.software_operands++;
+
+	return true;
+}
+
+bool instruction::export_stats(vcpu* caller, vcpu* target, UINT64 buffer)
+{
+	auto& state = caller->get_guest().get_state_save_area();
+
+	// the target core keeps counting while we copy, a torn snapshot is acceptable for statistics
+
+	INSTRUCTION_STATS stats = target->get_instruction_stats();
+
+	return memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer, &stats, sizeof(stats));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../svm/svm.h"
+#include "../decoder/decoder.h"
+
+struct vcpu;
+
+// bits of the support mask the stats hypercall returns
+#define INSTRUCTION_NRIP_SAVE		0x1
+#define INSTRUCTION_DECODE_ASSISTS	0x2
+
+#define DECODE_CACHE_BITS 6
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_BITS)
+
+// how often each path was taken on one vcpu, the software ones should stay at zero on any recent cpu
+struct INSTRUCTION_STATS
+{
+	UINT64	nrip_hits;			// next rip read from the vmcb
+	UINT64	software_lengths;	// next rip found by decoding the guest's instruction
+	UINT64	assist_fetches;		// instruction bytes the cpu left in the vmcb
+	UINT64	software_fetches;	// instruction bytes read from guest memory
+	UINT64	assist_operands;	// mov cr / dr register and invlpg address from exit_info1
+	UINT64	software_operands;	// the same decoded from the instruction
+	UINT64	failures;			// the instruction couldnt be read or decoded
+	UINT64	cache_hits;			// decodes served from the DECODE_CACHE
+	UINT64	cache_misses;
+};
+
+struct DECODE_CACHE_ENTRY
+{
+	UINT64	cr3;
+	UINT64	rip;
+	UINT8	bytes[DECODER_MAX_LENGTH];	// checked against the bytes at rip on every lookup
+	DECODED_INSTRUCTION insn;			// length is 0 while the entry is unused
+};
+
+// per vcpu direct mapped cache of decoded instructions, keyed by address space and rip.
+// the same few instructions exit over and over, so repeated exits skip the decode
+struct DECODE_CACHE
+{
+	DECODE_CACHE_ENTRY entries[DECODE_CACHE_SIZE];
+};
+
+// handlers ask this layer about the intercepted instruction instead of reading the vmcb themselves.
+// it prefers what the cpu saved on the exit and falls back to fetching and decoding the instruction
+// from guest memory on cpus without nrip save or decode assists
+namespace instruction
+{
+	// AMD64 Manual Volume 2: 15.7.1 State Saved on Exit, 15.33 Decode Assists
+	void setup();
+
+	// INSTRUCTION_ flags
+	UINT64 supported();
+
+	// the guest's current execution mode, for decoder::decode
+	DECODER_MODE mode(vcpu* vcpu);
+
+	// the bytes at the guest's rip, count is how many of them could be read
+	bool fetch(vcpu* vcpu, UINT8* bytes, UINT8* count);
+
+	bool decode(vcpu* vcpu, DECODED_INSTRUCTION& insn);
+
+	// decode through the vcpu's DECODE_CACHE. the instruction is fetched every time and a hit needs
+	// the same bytes, so rewritten code or a new image at a cached rip is decoded again
+	bool decode_cached(vcpu* vcpu, DECODED_INSTRUCTION& insn);
+
+	// rip of the instruction after the intercepted one
+	UINT64 next_rip(vcpu* vcpu);
+
+	// moves the guest past the intercepted instruction
+	void skip(vcpu* vcpu);
+
+	// the general register of a mov to or from a control or debug register, in the encoding's order.
+	// fails for lmsw and clts, which also exit as cr0 writes
+	bool mov_cr_gpr(vcpu* vcpu, UINT8* gpr);
+
+	// the linear address of an intercepted invlpg, the handler has to declare every register
+	bool invlpg_address(vcpu* vcpu, UINT64* address);
+
+	// writes target's counters to a guest buffer of caller's current address space
+	bool export_stats(vcpu* caller, vcpu* target, UINT64 buffer);
+}
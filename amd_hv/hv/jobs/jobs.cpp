@@ -0,0 +1,614 @@
+#include "jobs.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../xsave/xsave.h"
+#include "../../utilities/utilities.h"
+
+namespace jobs
+{
+	// only touches the vmcb when it changes, so the clean bits stay set
+	void pace(vcpu* vcpu, bool on)
+	{
+		auto& job = vcpu->get_job();
+
+		if (job.paced == on)
+			return;
+
+		vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(vcpu->get_guest()).intr = on;
+
+		job.paced = on;
+
+		return;
+	}
+
+	bool checksum_step(vcpu* vcpu, JOB& job, UINT64 deadline)
+	{
+		bool vector = !(job.flags & CHECKSUM_SCALAR);
+
+		if (vector)
+			xsave::acquire(vcpu);
+
+		do
+		{
+			UINT64 virt = job.base + job.cursor;
+
+			UINT64 phys;
+			if (!memory::translate(vcpu, job.cr3, job.cpl, virt, &phys))
+				return false;
+
+			SIZE_T chunk	= min(job.size - job.cursor, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+			auto words		= (const UINT64*)memory::map_phys(vcpu, phys);
+
+			if (!words)
+				return false;
+
+			if (vector)
+				simd::checksum_avx2(job.checksum, words, chunk / 8);
+			else
+				simd::checksum_scalar(job.checksum, words, chunk / 8);
+
+			job.cursor += chunk;
+
+		} while (job.cursor < job.size && __rdtsc() < deadline);
+
+		if (job.cursor == job.size)
+			job.result = simd::checksum_final(job.checksum);
+
+		return true;
+	}
+
+	// appends matches to the client's ring, the caller made sure they fit
+	bool flush(vcpu* vcpu, JOB& job, const UINT64* found, UINT32 count)
+	{
+		auto& state = job.search;
+
+		for (UINT32 i = 0; i < count; i++, state.tail++)
+		{
+			UINT64 slot = state.ring + sizeof(SEARCH_RING_HEADER) + (UINT64)(state.tail & (state.capacity - 1)) * sizeof(UINT64);
+
+			if (!memory::write_guest(vcpu, job.cr3, job.cpl, slot, &found[i], sizeof(UINT64)))
+				return false;
+		}
+
+		job.result += count;
+
+		return memory::write_guest(vcpu, job.cr3, job.cpl, state.ring + FIELD_OFFSET(SEARCH_RING_HEADER, tail), &state.tail, sizeof(UINT32));
+	}
+
+	// matches starting in the page at cursor, through the map window one page at a time.
+	// starts whose match runs into the next page are checked on a copy of both ends
+	bool search_step(vcpu* vcpu, JOB& job, UINT64 deadline)
+	{
+		auto& state		= job.search;
+		auto& pattern	= state.pattern;
+
+		if (state.kernel == search_avx2)
+			xsave::acquire(vcpu);
+
+		SEARCH_RING_HEADER header;
+
+		if (!memory::read_guest(vcpu, job.cr3, job.cpl, state.ring, &header, sizeof(header)))
+			return false;
+
+		UINT32 used = state.tail - header.head;
+
+		if (used > state.capacity)
+			return false;
+
+		UINT32 space	= state.capacity - used;
+		UINT64 end		= job.base + job.size;
+		UINT64 limit	= end - pattern.length + 1;		// first start whose match wouldnt fit in the range
+		SIZE_T inside	= PAGE_SIZE - pattern.length + 1;	// first start whose match leaves its page
+
+		UINT64 found[SEARCH_BATCH];
+		UINT32 count = 0;
+
+		while (job.cursor < job.size)
+		{
+			UINT64 phys = job.base + job.cursor;
+
+			if (phys >= limit)
+			{
+				job.cursor = job.size;
+				break;
+			}
+
+			// no match can span a hole, device memory in it is never read
+
+			UINT64 next;
+
+			if (!memory::is_ram(phys, &next))
+			{
+				job.cursor = min(next, end) - job.base;
+				continue;
+			}
+
+			// the slice ends once the ring is full, the job goes on when the client made room
+
+			if (count == SEARCH_BATCH)
+			{
+				if (!flush(vcpu, job, found, count))
+					return false;
+
+				space -= count;
+				count = 0;
+			}
+
+			UINT32 wanted = min(space - count, SEARCH_BATCH - count);
+
+			if (!wanted)
+				break;
+
+			UINT64 page		= phys & ~(UINT64)(PAGE_SIZE - 1);
+			SIZE_T first	= phys - page;
+			SIZE_T last		= min((UINT64)PAGE_SIZE, limit - page);
+
+			auto data = (const UINT8*)memory::map_phys(vcpu, page);
+
+			UINT32 offsets[SEARCH_BATCH];
+
+			SIZE_T matched = search::find(state.kernel, pattern, data, first, min(last, inside), offsets, wanted);
+
+			if (matched < wanted && last > inside && memory::is_ram(page + PAGE_SIZE, &next))
+			{
+				UINT8 stitch[SEARCH_MAX_PATTERN * 2];
+				SIZE_T carry = pattern.length - 1;
+
+				memcpy(stitch, data + inside, carry);
+				memcpy(stitch + carry, memory::map_phys(vcpu, page + PAGE_SIZE), carry);
+
+				SIZE_T from		= first > inside ? first - inside : 0;
+				SIZE_T stitched	= search::find(state.kernel, pattern, stitch, from, last - inside, offsets + matched, wanted - matched);
+
+				for (SIZE_T i = matched; i < matched + stitched; i++)
+					offsets[i] += (UINT32)inside;
+
+				matched += stitched;
+			}
+
+			for (SIZE_T i = 0; i < matched; i++)
+				found[count++] = page + offsets[i];
+
+			// a full batch stops in the middle of the page, the rest of it is searched from after the last match
+
+			if (matched == wanted)
+				job.cursor = page + offsets[matched - 1] + 1 - job.base;
+			else
+				job.cursor = min(page + PAGE_SIZE, end) - job.base;
+
+			if (__rdtsc() >= deadline)
+				break;
+		}
+
+		return flush(vcpu, job, found, count);
+	}
+
+	bool is_zero(const UINT64* words)
+	{
+		for (SIZE_T i = 0; i < PAGE_SIZE / sizeof(UINT64); i++)
+		{
+			if (words[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	// writes the record and the data in slot to the next ring slot, the caller made sure theres one
+	bool emit(vcpu* vcpu, JOB& job, SIZE_T size)
+	{
+		auto& state = job.snapshot;
+
+		UINT64 address = state.ring + sizeof(SNAPSHOT_RING_HEADER) + (UINT64)(state.tail & (state.capacity - 1)) * SNAPSHOT_SLOT_SIZE;
+
+		if (!memory::write_guest(vcpu, job.cr3, job.cpl, address, state.slot, sizeof(SNAPSHOT_RECORD) + size))
+			return false;
+
+		state.tail++;
+		job.result += size;
+
+		return true;
+	}
+
+	bool emit_zeros(vcpu* vcpu, JOB& job)
+	{
+		auto& state = job.snapshot;
+
+		if (!state.zero_pages)
+			return true;
+
+		auto& record = *(SNAPSHOT_RECORD*)state.slot;
+
+		record			= {};
+		record.phys		= state.zero_phys;
+		record.pages	= state.zero_pages;
+		record.kind		= snapshot_zero;
+
+		state.zero_pages = 0;
+
+		return emit(vcpu, job, 0);
+	}
+
+	// the fingerprint of the page at index in the range, through the block of them thats loaded
+	bool fingerprint(vcpu* vcpu, JOB& job, UINT64 index, UINT64*& print)
+	{
+		auto& state = job.snapshot;
+
+		UINT64 block = index / SNAPSHOT_PRINTS_PER_BLOCK;
+
+		if (state.block != block)
+		{
+			if (state.block_dirty && !memory::write_guest(vcpu, job.cr3, job.cpl, state.prints + state.block * PAGE_SIZE, state.block_prints, PAGE_SIZE))
+				return false;
+
+			if (!memory::read_guest(vcpu, job.cr3, job.cpl, state.prints + block * PAGE_SIZE, state.block_prints, PAGE_SIZE))
+				return false;
+
+			state.block			= block;
+			state.block_dirty	= false;
+		}
+
+		print = &state.block_prints[index % SNAPSHOT_PRINTS_PER_BLOCK];
+
+		return true;
+	}
+
+	// pages go out one per slot, compressed when that saves anything. runs of zero pages
+	// become one record, and with fingerprints unchanged pages of an incremental pass are left out
+	bool snapshot_step(vcpu* vcpu, JOB& job, UINT64 deadline)
+	{
+		auto& state = job.snapshot;
+
+		SNAPSHOT_RING_HEADER header;
+
+		if (!memory::read_guest(vcpu, job.cr3, job.cpl, state.ring, &header, sizeof(header)))
+			return false;
+
+		UINT32 used = state.tail - header.head;
+
+		if (used > state.capacity)
+			return false;
+
+		UINT32 start	= state.tail;
+		UINT64 end		= job.base + job.size;
+
+		while (job.cursor < job.size)
+		{
+			UINT64 phys = job.base + job.cursor;
+
+			UINT64 next;
+
+			if (!memory::is_ram(phys, &next))
+			{
+				if (!emit_zeros(vcpu, job))
+					return false;
+
+				job.cursor = min(next, end) - job.base;
+				continue;
+			}
+
+			// a page can take two slots, one for the zero run before it
+
+			if (state.capacity - (used + state.tail - start) < 2)
+				break;
+
+			auto words = (const UINT64*)memory::map_phys(vcpu, phys);
+
+			if (state.prints)
+			{
+				UINT64 current = simd::hash(words, PAGE_SIZE / sizeof(UINT64));
+				UINT64* print;
+
+				if (!fingerprint(vcpu, job, job.cursor / PAGE_SIZE, print))
+					return false;
+
+				bool unchanged = *print == current;
+
+				*print				= current;
+				state.block_dirty	= true;
+
+				if (unchanged && (job.flags & SNAPSHOT_INCREMENTAL))
+				{
+					if (!emit_zeros(vcpu, job))
+						return false;
+
+					job.cursor += PAGE_SIZE;
+					continue;
+				}
+			}
+
+			if (is_zero(words))
+			{
+				if (state.zero_pages && state.zero_phys + (UINT64)state.zero_pages * PAGE_SIZE != phys && !emit_zeros(vcpu, job))
+					return false;
+
+				if (!state.zero_pages)
+					state.zero_phys = phys;
+
+				state.zero_pages++;
+				job.cursor += PAGE_SIZE;
+				continue;
+			}
+
+			if (!emit_zeros(vcpu, job))
+				return false;
+
+			auto& record	= *(SNAPSHOT_RECORD*)state.slot;
+			auto data		= state.slot + sizeof(SNAPSHOT_RECORD);
+
+			record			= {};
+			record.phys		= phys;
+			record.pages	= 1;
+
+			// a block that isnt smaller than the page isnt worth decompressing
+
+			SIZE_T size = 0;
+
+			if (!(job.flags & SNAPSHOT_UNCOMPRESSED))
+				size = compress::lz4(state.work, (const UINT8*)words, PAGE_SIZE, data, PAGE_SIZE - 1);
+
+			if (size)
+				record.kind = snapshot_lz4;
+			else
+			{
+				memcpy(data, words, PAGE_SIZE);
+
+				record.kind	= snapshot_raw;
+				size		= PAGE_SIZE;
+			}
+
+			record.size = (UINT16)size;
+
+			if (!emit(vcpu, job, size))
+				return false;
+
+			job.cursor += PAGE_SIZE;
+
+			if (__rdtsc() >= deadline)
+				break;
+		}
+
+		// a zero run is cut at the end of a slice, so the client sees everything this slice went over
+
+		if (!emit_zeros(vcpu, job))
+			return false;
+
+		if (state.block_dirty && state.block != MAXUINT64)
+		{
+			if (!memory::write_guest(vcpu, job.cr3, job.cpl, state.prints + state.block * PAGE_SIZE, state.block_prints, PAGE_SIZE))
+				return false;
+
+			state.block_dirty = false;
+		}
+
+		return memory::write_guest(vcpu, job.cr3, job.cpl, state.ring + FIELD_OFFSET(SNAPSHOT_RING_HEADER, tail), &state.tail, sizeof(UINT32));
+	}
+
+	// by JOB_KIND
+	constexpr JOB_STEP steps[job_kinds] =
+	{
+		nullptr,
+		checksum_step,
+		search_step,
+		snapshot_step,
+	};
+}
+
+UINT64 jobs::start(vcpu* vcpu, JOB_KIND kind, UINT64 base, UINT64 size, UINT64 budget, UINT64 flags, UINT64 params)
+{
+	auto& job = vcpu->get_job();
+
+	UINT64 cr3	= vcpu->get_guest().get_state_save_area().cr3.AsUInt;
+	UINT8 cpl	= vcpu->get_guest().get_state_save_area().cpl;
+
+	if (kind == job_none || kind >= job_kinds || budget > JOB_MAX_BUDGET || !size)
+		return call_bad_args;
+
+	if (kind == job_checksum)
+	{
+		if ((base & 7) || (size & 7))
+			return call_bad_args;
+
+		if (!(flags & CHECKSUM_SCALAR) && !simd::avx2_supported())
+			flags |= CHECKSUM_SCALAR;
+	}
+
+	SEARCH_PARAMS search_params{};
+	SEARCH_PATTERN pattern{};
+
+	if (kind == job_search)
+	{
+		// the pattern can be anything, so user mode could read all of physical memory a match at a time
+
+		if (cpl)
+			return call_denied;
+
+		if (!memory::read_guest(vcpu, cr3, cpl, params, &search_params, sizeof(search_params)))
+			return call_fault;
+
+		memcpy(pattern.bytes, search_params.bytes, sizeof(pattern.bytes));
+		memcpy(pattern.mask, search_params.mask, sizeof(pattern.mask));
+
+		pattern.length = search_params.length;
+
+		auto capacity = search_params.capacity;
+
+		if (!search::prepare(pattern) || pattern.length > size || base + size < base ||
+			flags >= search_kernels || !capacity || (capacity & (capacity - 1)))
+			return call_bad_args;
+
+		// sse2 is always there in long mode
+
+		if (flags == search_best)
+			flags = simd::avx2_supported() ? search_avx2 : search_sse;
+		else if (flags == search_avx2 && !simd::avx2_supported())
+			return call_unsupported;
+	}
+
+	SNAPSHOT_PARAMS snapshot_params{};
+
+	if (kind == job_snapshot)
+	{
+		// streams every page of the range out, the whole of physical memory for the asking
+
+		if (cpl)
+			return call_denied;
+
+		if (!memory::read_guest(vcpu, cr3, cpl, params, &snapshot_params, sizeof(snapshot_params)))
+			return call_fault;
+
+		auto capacity = snapshot_params.capacity;
+
+		if ((base & (PAGE_SIZE - 1)) || (size & (PAGE_SIZE - 1)) || base + size < base ||
+			capacity < 2 || (capacity & (capacity - 1)) || (snapshot_params.prints & (PAGE_SIZE - 1)))
+			return call_bad_args;
+
+		if ((flags & SNAPSHOT_INCREMENTAL) && !snapshot_params.prints)
+			return call_bad_args;
+	}
+
+	if (job.state == job_running)
+		return call_busy;
+
+	job.kind		= kind;
+	job.flags		= flags;
+	job.cr3			= cr3;
+	job.cpl			= cpl;
+	job.base		= base;
+	job.size		= size;
+	job.cursor		= 0;
+	job.budget		= budget ? budget : JOB_DEFAULT_BUDGET;
+	job.result		= 0;
+	job.checksum	= {};
+	job.stats		= {};
+	job.cancel		= 0;
+
+	if (kind == job_search)
+	{
+		auto& state = job.search;
+
+		state = {};
+
+		state.pattern	= pattern;
+		state.kernel	= (SEARCH_KERNEL)flags;
+		state.capacity	= search_params.capacity;
+		state.ring		= search_params.ring;
+	}
+
+	if (kind == job_snapshot)
+	{
+		auto& state = job.snapshot;
+
+		state.ring			= snapshot_params.ring;
+		state.capacity		= snapshot_params.capacity;
+		state.tail			= 0;
+		state.prints		= snapshot_params.prints;
+		state.block			= MAXUINT64;
+		state.block_dirty	= false;
+		state.zero_pages	= 0;
+	}
+
+	// the first slice runs at the end of this exit
+
+	job.state		= job_running;
+
+	return call_success;
+}
+
+bool jobs::owns(vcpu* caller, vcpu* target)
+{
+	auto& state = caller->get_guest().get_state_save_area();
+
+	return !state.cpl || !((target->get_job().cr3 ^ state.cr3.AsUInt) & ~0xFFFull);
+}
+
+void jobs::cancel(vcpu* target)
+{
+	InterlockedExchange(&target->get_job().cancel, 1);
+
+	return;
+}
+
+void jobs::release(UINT64 cr3)
+{
+	// the low 12 bits are the pcid
+
+	for (int i = 0; i < utilities::get_cpu_cores(); i++)
+	{
+		auto& job = hv::get_vcpu(i)->get_job();
+
+		while (InterlockedCompareExchange(&job.lock, 1, 0))
+			_mm_pause();
+
+		if (job.state == job_running && !((job.cr3 ^ cr3) & ~0xFFFull))
+			job.state = job_cancelled;
+
+		InterlockedExchange(&job.lock, 0);
+	}
+
+	return;
+}
+
+void jobs::run(vcpu* vcpu)
+{
+	auto& job = vcpu->get_job();
+
+	if (job.state != job_running)
+	{
+		pace(vcpu, false);
+		return;
+	}
+
+	// a release holds the lock for a moment, the slice runs on the next exit instead
+
+	if (InterlockedCompareExchange(&job.lock, 1, 0))
+		return;
+
+	if (job.state != job_running)
+	{
+		InterlockedExchange(&job.lock, 0);
+		return;
+	}
+
+	if (job.cancel)
+	{
+		job.state = job_cancelled;
+		InterlockedExchange(&job.lock, 0);
+		return;
+	}
+
+	UINT64 start = __rdtsc();
+
+	bool progressed = steps[job.kind](vcpu, job, start + job.budget);
+
+	UINT64 cycles = __rdtsc() - start;
+
+	job.stats.slices++;
+	job.stats.cycles += cycles;
+	job.stats.max_slice = max(job.stats.max_slice, cycles);
+
+	if (!progressed)
+		job.state = job_failed;
+	else if (job.cursor == job.size)
+		job.state = job_done;
+
+	InterlockedExchange(&job.lock, 0);
+
+	// an interrupt this exit intercepted has to get through first
+
+	pace(vcpu, job.state == job_running && vcpu->get_guest().get_control_area().exit_code != SVMEXIT::INTR);
+
+	return;
+}
+
+void jobs::interrupted(vcpu* vcpu)
+{
+	pace(vcpu, false);
+
+	if (vcpu->get_job().state == job_running)
+		events::request_window(vcpu);
+
+	return;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "../svm/svm.h"
+#include "../simd/simd.h"
+#include "../search/search.h"
+#include "../compress/compress.h"
+
+struct vcpu;
+
+// host cycles a job may take per exit when the caller doesnt pick a budget
+#define JOB_DEFAULT_BUDGET 20000
+
+#define JOB_MAX_BUDGET 1000000
+
+enum JOB_KIND : UINT32
+{
+	job_none		= 0,
+	job_checksum	= 1,	// checksum of guest virtual memory, without the size limit of the checksum hypercall
+	job_search		= 2,	// pattern search over guest physical memory, matches go into a SEARCH_RING. the kernel only
+	job_snapshot	= 3,	// guest physical pages streamed into a SNAPSHOT_RING, lz4 compressed. the kernel only
+	job_kinds,
+};
+
+enum JOB_STATE : UINT32
+{
+	job_idle		= 0,
+	job_running		= 1,
+	job_done		= 2,
+	job_failed		= 3,	// a page wasnt present, cursor is where it stopped
+	job_cancelled	= 4,
+};
+
+// a job_search's pattern and ring, params of jobs::start points to it in the starter's memory
+struct SEARCH_PARAMS
+{
+	UINT8	bytes[SEARCH_MAX_PATTERN];
+	UINT8	mask[SEARCH_MAX_PATTERN];
+	UINT32	length;
+	UINT32	capacity;	// of the ring, a power of two
+	UINT64	ring;		// the starter's address of a SEARCH_RING_HEADER, followed by capacity physical addresses
+};
+
+// the job waits while the ring is full, the client takes matches from head on
+struct SEARCH_RING_HEADER
+{
+	UINT32	head;		// written by the client
+	UINT32	tail;		// written by the hypervisor
+	UINT8	reserved[0x38];
+};
+
+// the most matches a slice collects before it writes them out
+#define SEARCH_BATCH 64
+
+struct SEARCH_STATE
+{
+	SEARCH_PATTERN	pattern;
+	SEARCH_KERNEL	kernel;
+	UINT32			capacity;
+	UINT32			tail;		// our copy, the client could overwrite the ring's
+	UINT64			ring;
+};
+
+// flags of a snapshot job
+#define SNAPSHOT_INCREMENTAL	0x1		// only pages whose fingerprint changed since the last pass
+#define SNAPSHOT_UNCOMPRESSED	0x2		// every page raw, to compare against
+
+// a job_snapshot's ring and fingerprints, params of jobs::start points to it in the starter's memory
+struct SNAPSHOT_PARAMS
+{
+	UINT64	ring;		// a SNAPSHOT_RING_HEADER, followed by capacity slots of SNAPSHOT_SLOT_SIZE
+	UINT32	capacity;	// a power of two, at least 2
+	UINT32	reserved;
+	UINT64	prints;		// one UINT64 per page of the range the job writes and compares with, 0 for none
+};
+
+struct SNAPSHOT_RING_HEADER
+{
+	UINT32	head;		// written by the client
+	UINT32	tail;		// written by the hypervisor
+	UINT8	reserved[0x38];
+};
+
+enum SNAPSHOT_KIND : UINT8
+{
+	snapshot_raw	= 0,	// size is PAGE_SIZE
+	snapshot_lz4	= 1,	// an lz4 block of size bytes
+	snapshot_zero	= 2,	// pages zeroed pages from phys on, nothing follows
+};
+
+// the start of every slot, the page's data follows it
+struct SNAPSHOT_RECORD
+{
+	UINT64	phys;
+	UINT32	pages;
+	UINT16	size;
+	UINT8	kind;		// SNAPSHOT_KIND
+	UINT8	reserved;
+};
+
+#define SNAPSHOT_SLOT_SIZE (sizeof(SNAPSHOT_RECORD) + PAGE_SIZE)
+
+// fingerprints of a range are read and written a page of them at a time
+#define SNAPSHOT_PRINTS_PER_BLOCK (PAGE_SIZE / sizeof(UINT64))
+
+struct SNAPSHOT_STATE
+{
+	UINT64		ring;
+	UINT32		capacity;
+	UINT32		tail;
+	UINT64		prints;
+	UINT64		block;			// index of the fingerprints in block, MAXUINT64 before the first
+	bool		block_dirty;
+	UINT64		zero_phys;		// a run of zero pages that isnt in the ring yet
+	UINT32		zero_pages;
+	UINT64		block_prints[SNAPSHOT_PRINTS_PER_BLOCK];
+	UINT8		slot[SNAPSHOT_SLOT_SIZE];
+	COMPRESS_WORKSPACE work;
+};
+
+struct JOB_STATS
+{
+	UINT64	slices;			// exits that ran a part of the job
+	UINT64	cycles;			// host time spent on it in total
+	UINT64	max_slice;		// longest a single exit spent on it, the latency the guest saw from the job
+};
+
+// one per vcpu, only the core that started it runs it so it needs no lock.
+// other cores read it for polling and get a torn snapshot at worst
+struct JOB
+{
+	volatile JOB_STATE	state;
+	volatile LONG		cancel;
+	volatile LONG		lock;		// held while a slice runs, so a release can stop the job between two of them
+	JOB_KIND			kind;
+	UINT64				flags;		// CHECKSUM_SCALAR for job_checksum, a SEARCH_KERNEL for job_search, SNAPSHOT_ for job_snapshot
+	UINT64				cr3;		// the starter's address space
+	UINT8				cpl;		// the starter's privilege, its memory is only accessed with it
+	UINT64				base;		// virtual for job_checksum, physical for the others
+	UINT64				size;
+	UINT64				cursor;		// bytes of base done, the job continues from here
+	UINT64				budget;		// host cycles per exit
+	UINT64				result;		// the checksum, how many matches were found or how many bytes were streamed so far
+	union
+	{
+		CHECKSUM		checksum;
+		SEARCH_STATE	search;
+		SNAPSHOT_STATE	snapshot;
+	};
+	JOB_STATS			stats;
+	bool				paced;		// physical interrupts exit on this core, see jobs::interrupted
+};
+
+// a step does the job's work from job.cursor on until the deadline passes, at least one page of it
+// so every slice makes progress. it sets job.result once cursor reaches size, false if the job cant go on
+typedef bool (*JOB_STEP)(vcpu* vcpu, JOB& job, UINT64 deadline);
+
+// host context cant be preempted, so work that would keep a core in it for too long is split into
+// slices of a cycle budget. the core that started a job runs one slice on each of its exits until its done.
+// while it runs that core intercepts physical interrupts, so the host's own timer ticks keep the job going
+// on a core that wouldnt exit otherwise, and the guest still gets everything in between
+namespace jobs
+{
+	// starts a job on the calling core, params are the kind's SEARCH_PARAMS or SNAPSHOT_PARAMS.
+	// returns a HYPERCALL_STATUS
+	UINT64 start(vcpu* vcpu, JOB_KIND kind, UINT64 base, UINT64 size, UINT64 budget, UINT64 flags, UINT64 params);
+
+	// a caller in user mode may only poll and cancel a job its own address space started
+	bool owns(vcpu* caller, vcpu* target);
+
+	// the job stops on the next exit of its core
+	void cancel(vcpu* target);
+
+	// stops every job started from cr3 right away, the process is exiting and its memory goes away
+	// once we return. waits for a slice in progress, which is bounded by its budget
+	void release(UINT64 cr3);
+
+	// runs a slice of the vcpu's job if it has one, handle_vmexit calls this on every exit
+	void run(vcpu* vcpu);
+
+	// INTR exit. the interrupt stays pending and only reaches the guest with the intercept off,
+	// the interrupt window brings the core back right after the guest took it to set it again
+	void interrupted(vcpu* vcpu);
+}
@@ -0,0 +1,202 @@
+#include "lbr.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+
+namespace lbr
+{
+	bool			enabled;
+	bool			capture_exits;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+
+	void record(BRANCH_TABLE* table, UINT64 from, UINT64 to, UINT64 cr3)
+	{
+		// fibonacci hashing, the top bits of the product are the best mixed
+
+		UINT64 hash = ((from ^ (to << 1) ^ cr3) * 0x9E3779B97F4A7C15) >> (64 - BRANCH_TABLE_BITS);
+
+		for (int i = 0; i < BRANCH_PROBE_LIMIT; i++)
+		{
+			auto& entry = table->entries[(hash + i) & (BRANCH_TABLE_SIZE - 1)];
+
+			if (!entry.count)
+			{
+				entry.from	= from;
+				entry.to	= to;
+				entry.cr3	= cr3;
+			}
+			else if (entry.from != from || entry.to != to || entry.cr3 != cr3)
+				continue;
+
+			entry.count++;
+
+			return;
+		}
+
+		table->dropped++;
+
+		return;
+	}
+}
+
+bool lbr::supported()
+{
+	int cpuid_regs[4];
+	__cpuid(cpuid_regs, 0x8000000A);
+
+	// EDX[1] LbrVirt
+
+	return cpuid_regs[3] & (1 << 1);
+}
+
+void lbr::configure(UINT64 flags)
+{
+	enabled			= flags & LBR_ENABLE;
+	capture_exits	= flags & LBR_CAPTURE_EXITS;
+
+	if (flags & LBR_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void lbr::update(vcpu* vcpu)
+{
+	auto table = vcpu->get_branch_table();
+
+	if (table->generation == (UINT64)generation)
+		return;
+
+	// each vcpu clears its own table, so we never race with the core recording into it
+
+	if (table->generation < reset_generation)
+	{
+		memset(table->entries, 0, sizeof(table->entries));
+
+		table->captures	= 0;
+		table->dropped	= 0;
+		table->cycles	= 0;
+	}
+
+	table->generation		= generation;
+	table->capture_exits	= capture_exits;
+
+	if (!enabled)
+	{
+		stop(vcpu);
+		return;
+	}
+
+	if (table->active)
+		return;
+
+	auto& guest = vcpu->get_guest();
+
+	// without lbr virtualization the guest and the host share the live DebugCtl,
+	// from now on the guest's copy lives in the vmcb and only gets loaded by vmrun
+
+	IA32_DEBUGCTL_REGISTER debug_ctl{ .AsUInt = __readmsr(IA32_DEBUGCTL) };
+
+	table->guest_lbr	= debug_ctl.Lbr;
+	debug_ctl.Lbr		= 1;
+
+	vmcb::write<&VMCB_STATE_SAVE_AREA::debug_ctl>(guest, debug_ctl);
+	vmcb::write<&VMCB_STATE_SAVE_AREA::br_from>(guest, 0);
+	vmcb::write<&VMCB_STATE_SAVE_AREA::br_to>(guest, 0);
+
+	vmcb::modify<&VMCB_CONTROL_AREA::v_ctl2>(guest).lbr_virt = 1;
+	table->active = 1;
+
+	return;
+}
+
+void lbr::stop(vcpu* vcpu)
+{
+	auto& guest		= vcpu->get_guest();
+	auto& state		= guest.get_state_save_area();
+	auto table		= vcpu->get_branch_table();
+
+	if (!table->active)
+		return;
+
+	// vmrun stops loading the vmcb copy, so whatever the guest wrote to DebugCtl meanwhile goes back into the msr
+
+	auto debug_ctl	= state.debug_ctl;
+	debug_ctl.Lbr	= table->guest_lbr;
+
+	__writemsr(IA32_DEBUGCTL, debug_ctl.AsUInt);
+
+	vmcb::modify<&VMCB_CONTROL_AREA::v_ctl2>(guest).lbr_virt = 0;
+	table->active = 0;
+
+	return;
+}
+
+void lbr::on_exit(vcpu* vcpu)
+{
+	auto table = vcpu->get_branch_table();
+
+	if (!table->capture_exits)
+		return;
+
+	UINT64 from, to;
+	capture(vcpu, &from, &to);
+
+	return;
+}
+
+bool lbr::capture(vcpu* vcpu, UINT64* from, UINT64* to)
+{
+	auto& state	= vcpu->get_guest().get_state_save_area();
+	auto table	= vcpu->get_branch_table();
+
+	if (!table->active)
+		return false;
+
+	UINT64 start_tsc = __rdtsc();
+
+	// the exit saved the guest's last branch record into the vmcb, reading it costs nothing but the hashing
+
+	*from	= state.br_from;
+	*to		= state.br_to;
+
+	// the low 12 bits of cr3 hold the pcid, the same address space can show up with different ones
+
+	if (*from)
+		record(table, *from, *to, state.cr3.AsUInt & ~(UINT64)(PAGE_SIZE - 1));
+
+	table->captures++;
+	table->cycles += __rdtsc() - start_tsc;
+
+	return true;
+}
+
+INT64 lbr::export_entries(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state	= caller->get_guest().get_state_save_area();
+	auto table	= target->get_branch_table();
+
+	// the target core keeps recording while we read, a torn entry is acceptable for a profile
+
+	INT64 written = 0;
+
+	for (int i = 0; i < BRANCH_TABLE_SIZE && (UINT64)written < capacity; i++)
+	{
+		auto entry = table->entries[i];
+
+		if (!entry.count)
+			continue;
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + written * sizeof(BRANCH_ENTRY), &entry, sizeof(BRANCH_ENTRY)))
+			return -1;
+
+		written++;
+	}
+
+	return written;
+}
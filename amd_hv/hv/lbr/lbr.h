@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define BRANCH_TABLE_BITS 10
+#define BRANCH_TABLE_SIZE (1 << BRANCH_TABLE_BITS)
+#define BRANCH_PROBE_LIMIT 16
+
+// flags for lbr::configure
+#define LBR_ENABLE 0x1
+#define LBR_RESET 0x2
+#define LBR_CAPTURE_EXITS 0x4	// record the last branch at every exit, otherwise only at sampler nmi-s
+
+// one taken branch, keyed by source, destination and cr3
+struct BRANCH_ENTRY
+{
+	UINT64	from;
+	UINT64	to;
+	UINT64	cr3;
+	UINT64	count;
+};
+
+// per vcpu open addressing hash table of captured last branch records
+struct BRANCH_TABLE
+{
+	UINT64	generation;		// last configuration applied to this vcpu
+	UINT64	active;			// lbr virtualization is enabled on this vcpu
+	UINT64	capture_exits;
+	UINT64	guest_lbr;		// DebugCtl.LBR as the guest had it before we enabled it
+	UINT64	captures;
+	UINT64	dropped;		// captures that found no free slot
+	UINT64	cycles;			// host time spent capturing
+	BRANCH_ENTRY entries[BRANCH_TABLE_SIZE];
+};
+
+// with lbr virtualization the cpu swaps DebugCtl and the last branch record with the vmcb on every
+// vmrun and exit, so the guest's branches dont get overwritten by ours and we can read them from the vmcb.
+// the swap makes every world switch somewhat slower, which is why its only on while profiling
+namespace lbr
+{
+	// AMD64 Manual Volume 2: 15.23 Last Branch Record Virtualization
+	bool supported();
+
+	void configure(UINT64 flags);
+
+	// applies configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	// disables lbr virtualization and hands DebugCtl back to the guest
+	void stop(vcpu* vcpu);
+
+	// records the guest's last branch if capturing at every exit is enabled
+	void on_exit(vcpu* vcpu);
+
+	// records the guest's last branch, returns false if lbr virtualization is off
+	bool capture(vcpu* vcpu, UINT64* from, UINT64* to);
+
+	// copies the used entries of target's table to a guest buffer of caller's current address space,
+	// returns the amount of entries written, or -1 if the buffer isnt present and writable
+	INT64 export_entries(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
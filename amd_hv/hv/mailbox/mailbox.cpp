@@ -0,0 +1,119 @@
+#include "mailbox.h"
+
+// based on Dmitry Vyukov's bounded queue, each slot's sequence says whose turn it is.
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+void mailbox::init(MAILBOX* mailbox)
+{
+	mailbox->tail	= 0;
+	mailbox->head	= 0;
+	mailbox->kicked	= 0;
+	mailbox->kicks	= 0;
+
+	for (LONG64 i = 0; i < MAILBOX_SIZE; i++)
+		mailbox->slots[i].sequence = i;
+
+	return;
+}
+
+MAILBOX_POST mailbox::post(MAILBOX* mailbox, MAILBOX_HANDLER handler, void* context)
+{
+	LONG64 position = mailbox->tail;
+	MAILBOX_SLOT* slot;
+
+	for (;;)
+	{
+		slot = &mailbox->slots[position & (MAILBOX_SIZE - 1)];
+
+		LONG64 sequence = slot->sequence;
+
+		if (sequence == position)
+		{
+			LONG64 seen = InterlockedCompareExchange64(&mailbox->tail, position + 1, position);
+
+			if (seen == position)
+				break;
+
+			position = seen;
+		}
+		else if (sequence < position)
+		{
+			// the owner didnt run the request from the last lap yet
+
+			return mailbox_full;
+		}
+		else
+			position = mailbox->tail;
+	}
+
+	slot->handler = handler;
+	slot->context = context;
+
+	_ReadWriteBarrier();
+
+	slot->sequence = position + 1;
+
+	// the exchange is a full barrier, the request is visible before we look at kicked.
+	// a plain read could pass our store and miss the owner clearing it
+
+	if (InterlockedExchange(&mailbox->kicked, 1))
+		return mailbox_queued;
+
+	InterlockedIncrement(&mailbox->kicks);
+
+	return mailbox_kick;
+}
+
+void mailbox::count_kick(MAILBOX* mailbox)
+{
+	InterlockedExchange(&mailbox->kicked, 1);
+	InterlockedIncrement(&mailbox->kicks);
+
+	return;
+}
+
+UINT32 mailbox::drain(MAILBOX* mailbox, vcpu* owner)
+{
+	// cleared before we look at the slots, a request posted after this kicks again.
+	// this also has to be a full barrier, for the same reason as in post
+
+	if (mailbox->kicked)
+		InterlockedExchange(&mailbox->kicked, 0);
+
+	UINT32 ran = 0;
+
+	for (; ran < MAILBOX_SIZE; ran++)
+	{
+		auto& slot = mailbox->slots[mailbox->head & (MAILBOX_SIZE - 1)];
+
+		// a producer that took this position but didnt fill it in yet kicks once its done
+
+		if (slot.sequence != mailbox->head + 1)
+			break;
+
+		MAILBOX_HANDLER handler	= slot.handler;
+		void* context			= slot.context;
+
+		_ReadWriteBarrier();
+
+		// the slot is handed back before the handler runs, so a handler can post to its own core
+
+		slot.sequence = mailbox->head + MAILBOX_SIZE;
+		mailbox->head++;
+
+		handler(owner, context);
+	}
+
+	return ran;
+}
+
+bool mailbox::claim_kick(MAILBOX* mailbox)
+{
+	// the nmi that caused this exit stays pending until handlers::nmi lets it through, every kick sent
+	// before that merged into it. so it claims all of them, a count left over would swallow the os's next nmi
+
+	if (!mailbox->kicks)
+		return false;
+
+	return InterlockedExchange(&mailbox->kicks, 0) > 0;
+}
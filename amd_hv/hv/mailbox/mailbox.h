@@ -0,0 +1,102 @@
+#pragma once
+
+// the queue only needs fixed width types and interlocked operations, so hv_mailbox_bench builds this file
+// on its own and stands in for the nmi that wakes the owning core
+
+#if defined(_KERNEL_MODE)
+#include <ntifs.h>
+#include <intrin.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+typedef int32_t		LONG;
+typedef int64_t		LONG64;
+typedef uint8_t		UINT8;
+typedef uint32_t	UINT32;
+typedef uint64_t	UINT64;
+
+inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedIncrement(volatile LONG* target)
+{
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* target)
+{
+	return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedCompareExchange64(volatile LONG64* target, LONG64 value, LONG64 comparand)
+{
+	return __sync_val_compare_and_swap(target, comparand, value);
+}
+
+#define _ReadWriteBarrier() __asm__ __volatile__("" ::: "memory")
+#endif
+
+struct vcpu;
+
+#define MAILBOX_SIZE 64		// power of two
+
+// runs on the core that owns the mailbox, from the start of one of its exits
+typedef void (*MAILBOX_HANDLER)(vcpu* vcpu, void* context);
+
+struct MAILBOX_SLOT
+{
+	volatile LONG64	sequence;	// the position that may take this slot, one past it once the request is in
+	MAILBOX_HANDLER	handler;
+	void*			context;
+	UINT64			reserved;
+};
+
+// bounded multi producer single consumer queue, one per vcpu. any core posts without a lock,
+// only the owning core takes requests out. the producers and the owner keep to their own cache lines
+struct alignas(64) MAILBOX
+{
+	volatile LONG64	tail;		// the next position a producer takes
+	volatile LONG	kicked;		// a producer sent an nmi and the owner hasnt drained since
+	volatile LONG	kicks;		// nmi-s sent to the owner since its last claim
+	UINT8			reserved0[0x30];
+
+	LONG64			head;		// the next position the owner runs
+	UINT8			reserved1[0x38];
+
+	MAILBOX_SLOT	slots[MAILBOX_SIZE];
+};
+
+enum MAILBOX_POST
+{
+	mailbox_full,		// nothing was queued
+	mailbox_queued,		// an nmi is already on its way to the owner
+	mailbox_kick,		// queued, the caller has to send the owner an nmi. its already counted
+};
+
+namespace mailbox
+{
+	// every slot starts out free for the position of its index
+	void init(MAILBOX* mailbox);
+
+	// lock free, any number of cores can post to the same mailbox at once.
+	// a request is either run by a drain thats already going on or it gets a kick of its own
+	MAILBOX_POST post(MAILBOX* mailbox, MAILBOX_HANDLER handler, void* context);
+
+	// for an nmi the caller sends without posting through it, like an ipi with a destination shorthand
+	void count_kick(MAILBOX* mailbox);
+
+	// runs what was queued on the owning core, at most MAILBOX_SIZE requests so a flood cant hold it.
+	// returns how many ran
+	UINT32 drain(MAILBOX* mailbox, vcpu* owner);
+
+	// whether the owner's intercepted nmi is a kick, only while one is outstanding.
+	// has to run before the nmi is delivered on the host
+	bool claim_kick(MAILBOX* mailbox);
+}
@@ -0,0 +1,250 @@
+#include "memory.h"
+
+#include "../vcpu/vcpu.h"
+#include "../../utilities/utilities.h"
+
+namespace memory
+{
+	RAM_RANGE	ram_ranges[MEMORY_MAX_RANGES];
+	UINT32		ram_range_count;
+
+	// index of the table entry for virt at a paging level, 4 being the pml4
+	__forceinline UINT64 table_index(UINT64 virt, int level)
+	{
+		return (virt >> (12 + 9 * (level - 1))) & 0x1FF;
+	}
+}
+
+bool memory::setup_ranges()
+{
+	auto ranges = MmGetPhysicalMemoryRanges();
+
+	if (!ranges)
+	{
+		LOG_ERROR("couldnt get the physical memory ranges \n");
+		return false;
+	}
+
+	// the list ends with a zeroed entry, its sorted by address
+
+	for (auto range = ranges; range->BaseAddress.QuadPart || range->NumberOfBytes.QuadPart; range++)
+	{
+		// merging would cover the holes in between, which can be device memory
+
+		if (ram_range_count == MEMORY_MAX_RANGES)
+		{
+			LOG("more than %d ram ranges, the rest isnt searchable \n", MEMORY_MAX_RANGES);
+			break;
+		}
+
+		UINT64 base = range->BaseAddress.QuadPart;
+
+		ram_ranges[ram_range_count++] = { base, base + range->NumberOfBytes.QuadPart };
+	}
+
+	ExFreePool(ranges);
+
+	return true;
+}
+
+bool memory::is_ram(UINT64 phys, UINT64* next)
+{
+	for (UINT32 i = 0; i < ram_range_count; i++)
+	{
+		if (phys < ram_ranges[i].base)
+		{
+			*next = ram_ranges[i].base;
+			return false;
+		}
+
+		if (phys < ram_ranges[i].end)
+			return true;
+	}
+
+	*next = MAXUINT64;
+
+	return false;
+}
+
+bool memory::setup_window(MAP_WINDOW& window)
+{
+	window.va = (UINT8*)MmAllocateMappingAddress(PAGE_SIZE, 'ENON');
+
+	if (!window.va)
+	{
+		LOG_ERROR("couldnt reserve the mapping window \n");
+		return false;
+	}
+
+	// the reserved range is backed by page tables, so we can walk our own cr3 down to the pte
+	// page table pages are always mapped by the os, which lets us reach them through MmGetVirtualForPhysical
+
+	CR3 cr3{ .AsUInt = __readcr3() };
+	UINT64 table_phys = (UINT64)cr3.AddressOfPageDirectory << PAGE_SHIFT;
+
+	for (int level = 4; level > 1; level--)
+	{
+		auto table = (PML4E_64*)MmGetVirtualForPhysical({ .QuadPart = (INT64)table_phys });
+		auto entry = table[table_index((UINT64)window.va, level)];
+
+		// PML4E, PDPTE and PDE share the layout of the bits we use, large pages cant back a mapping address
+
+		if (!entry.Present || entry.MustBeZero)
+		{
+			LOG_ERROR("mapping window isnt backed by a pte \n");
+			return false;
+		}
+
+		table_phys = (UINT64)entry.PageFrameNumber << PAGE_SHIFT;
+	}
+
+	auto pt = (PTE_64*)MmGetVirtualForPhysical({ .QuadPart = (INT64)table_phys });
+
+	window.pte = &pt[table_index((UINT64)window.va, 1)];
+	window.pfn = 0;
+
+	return true;
+}
+
+void memory::free_window(MAP_WINDOW& window)
+{
+	if (!window.va)
+		return;
+
+	// the os expects the reserved range to be unmapped when its released
+
+	window.pte->AsUInt = 0;
+	__invlpg(window.va);
+
+	MmFreeMappingAddress(window.va, 'ENON');
+
+	return;
+}
+
+void* memory::map_phys(vcpu* vcpu, UINT64 phys)
+{
+	auto& window = vcpu->get_window();
+
+	UINT64 pfn = phys >> PAGE_SHIFT;
+
+	if (!window.pte->Present || window.pfn != pfn)
+	{
+		// a cached mapping of device memory could read ahead or write back into registers
+
+		UINT64 next;
+
+		if (!is_ram(pfn << PAGE_SHIFT, &next))
+			return nullptr;
+
+		PTE_64 pte{ .AsUInt = 0 };
+		pte.Present			= 1;
+		pte.Write			= 1;
+		pte.ExecuteDisable	= 1;
+		pte.PageFrameNumber	= pfn;
+
+		*window.pte = pte;
+		window.pfn	= pfn;
+
+		// host tlb entries live in asid 0, so they survive world switches and we must flush the stale one
+
+		__invlpg(window.va);
+	}
+
+	return window.va + (phys & (PAGE_SIZE - 1));
+}
+
+bool memory::translate(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, UINT64* phys, bool writable)
+{
+	UINT64 table_phys = (UINT64)CR3{ .AsUInt = cr3 }.AddressOfPageDirectory << PAGE_SHIFT;
+
+	// we only support 4 level paging, which is all windows uses
+
+	for (int level = 4; level > 0; level--)
+	{
+		auto table = (PTE_64*)map_phys(vcpu, table_phys);
+
+		if (!table)
+			return false;
+
+		auto entry = table[table_index(virt, level)];
+
+		// the cpu checks every level too, user mode only gets through when all of them allow it
+
+		if (!entry.Present || (writable && !entry.Write) || (cpl == 3 && !entry.Supervisor))
+			return false;
+
+		// bit 7 is the page size bit on the pdpte and the pde
+
+		if (level == 3 && ((PDPTE_64&)entry).LargePage)
+		{
+			*phys = ((UINT64)((PDPTE_1GB_64&)entry).PageFrameNumber << 30) + (virt & ((1ull << 30) - 1));
+			return true;
+		}
+
+		if (level == 2 && ((PDE_64&)entry).LargePage)
+		{
+			*phys = ((UINT64)((PDE_2MB_64&)entry).PageFrameNumber << 21) + (virt & ((1ull << 21) - 1));
+			return true;
+		}
+
+		table_phys = (UINT64)entry.PageFrameNumber << PAGE_SHIFT;
+	}
+
+	*phys = table_phys + (virt & (PAGE_SIZE - 1));
+
+	return true;
+}
+
+bool memory::read_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, void* buffer, SIZE_T size)
+{
+	auto out = (UINT8*)buffer;
+
+	while (size)
+	{
+		UINT64 phys;
+		if (!translate(vcpu, cr3, cpl, virt, &phys))
+			return false;
+
+		// never copy across a page boundary, the next page can be anywhere physically
+
+		SIZE_T chunk	= min(size, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+		auto source		= map_phys(vcpu, phys);
+
+		if (!source)
+			return false;
+
+		memcpy(out, source, chunk);
+
+		out		+= chunk;
+		virt	+= chunk;
+		size	-= chunk;
+	}
+
+	return true;
+}
+
+bool memory::write_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, const void* buffer, SIZE_T size)
+{
+	auto in = (const UINT8*)buffer;
+
+	while (size)
+	{
+		UINT64 phys;
+		if (!translate(vcpu, cr3, cpl, virt, &phys, true))
+			return false;
+
+		SIZE_T chunk	= min(size, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+		auto target		= map_phys(vcpu, phys);
+
+		if (!target)
+			return false;
+
+		memcpy(target, in, chunk);
+
+		in		+= chunk;
+		virt	+= chunk;
+		size	-= chunk;
+	}
+
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// ram ranges the os reported at setup, the host only reads memory in the first this many
+#define MEMORY_MAX_RANGES 64
+
+struct RAM_RANGE
+{
+	UINT64	base;
+	UINT64	end;
+};
+
+// every vcpu owns a one page virtual window, whose pte we repoint at any physical page
+// this gives the host access to guest physical memory without calling into the os from host context
+struct MAP_WINDOW
+{
+	UINT8*	va;
+	PTE_64*	pte;
+	UINT64	pfn;	// page currently mapped, so we can skip the invlpg when it doesnt change
+};
+
+namespace memory
+{
+	// reads the os's physical memory ranges, the host cant ask for them later
+	bool setup_ranges();
+
+	// true if phys is ram, reading device memory can have side effects. otherwise next is
+	// where the next ram range starts, MAXUINT64 past the last one
+	bool is_ram(UINT64 phys, UINT64* next);
+
+	// reserves the window and finds its pte, must be called from the core's own setup
+	bool setup_window(MAP_WINDOW& window);
+
+	void free_window(MAP_WINDOW& window);
+
+	// maps the page containing phys, the pointer stays valid until the next map on this vcpu.
+	// nullptr if phys isnt ram, the window is write back and device memory must never be cached
+	void* map_phys(vcpu* vcpu, UINT64 phys);
+
+	// walks the guest's 4 level page tables as an access from cpl would, fails if any level isnt present,
+	// isnt writable when writable is requested or is supervisor only and cpl is 3
+	bool translate(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, UINT64* phys, bool writable = false);
+
+	// copy between host memory and guest virtual memory, page by page
+	// these dont fault pages in, so the guest has to make sure its buffers are present.
+	// cpl is the privilege of whoever asked for the copy, the caller's own cpl for hypercall buffers
+	bool read_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, void* buffer, SIZE_T size);
+
+	bool write_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, const void* buffer, SIZE_T size);
+}
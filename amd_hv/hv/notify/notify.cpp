@@ -0,0 +1,121 @@
+#include "notify.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+
+namespace notify
+{
+	// the core in the upper bits and the vector in the low byte, so both change together
+	volatile LONG64		registration;
+
+	NOTIFY_COMPLETION	ring[NOTIFY_RING_SIZE];
+	UINT64				head;		// the next completion to poll
+	UINT64				tail;		// where the next one is posted
+	volatile LONG		ring_lock;
+
+	// every core is in host context with interrupts off while it holds this, for a few instructions
+	void lock()
+	{
+		while (InterlockedCompareExchange(&ring_lock, 1, 0))
+			_mm_pause();
+
+		return;
+	}
+
+	void unlock()
+	{
+		InterlockedExchange(&ring_lock, 0);
+
+		return;
+	}
+
+	void raise_pending(vcpu* vcpu, void* context)
+	{
+		UNREFERENCED_PARAMETER(context);
+
+		update(vcpu);
+
+		return;
+	}
+}
+
+void notify::register_vector(UINT8 vector, UINT32 core)
+{
+	InterlockedExchange64(&registration, (LONG64)core << 8 | vector);
+
+	return;
+}
+
+bool notify::post(vcpu* poster, UINT64 cookie, UINT64 status)
+{
+	lock();
+
+	bool queued = tail - head < NOTIFY_RING_SIZE;
+
+	if (queued)
+	{
+		auto& completion = ring[tail++ % NOTIFY_RING_SIZE];
+
+		completion.cookie	= cookie;
+		completion.status	= status;
+		completion.tsc		= __rdtsc();
+	}
+
+	unlock();
+
+	// a dropped completion still raises the vector, the guest is behind and should drain the ring
+
+	UINT64 current	= registration;
+	UINT8 vector	= current & 0xFF;
+	UINT32 core		= (UINT32)(current >> 8);
+
+	if (!vector)
+		return queued;
+
+	if (core == NOTIFY_ANY_CORE || hv::get_vcpu(core) == poster)
+	{
+		events::raise_virtual(poster, vector);
+		return queued;
+	}
+
+	// the registered core could stay in the guest for a long time, the mailbox kicks it out.
+	// one request covers every completion posted until it runs
+
+	auto target = hv::get_vcpu(core);
+
+	if (!InterlockedExchange(&target->get_notify_state().pending, 1))
+		target->post(raise_pending, nullptr);
+
+	return queued;
+}
+
+bool notify::poll(NOTIFY_COMPLETION* completion, UINT64* remaining)
+{
+	lock();
+
+	bool found = head != tail;
+
+	if (found)
+		*completion = ring[head++ % NOTIFY_RING_SIZE];
+
+	*remaining = tail - head;
+
+	unlock();
+
+	return found;
+}
+
+void notify::update(vcpu* vcpu)
+{
+	auto& state = vcpu->get_notify_state();
+
+	if (!state.pending || !InterlockedExchange(&state.pending, 0))
+		return;
+
+	UINT8 vector = registration & 0xFF;
+
+	if (vector)
+		events::raise_virtual(vcpu, vector);
+
+	return;
+}
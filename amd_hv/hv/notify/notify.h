@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define NOTIFY_RING_SIZE 64
+
+// register the vector for whichever core posts the completion, it gets it without waiting for an exit
+#define NOTIFY_ANY_CORE 0xFFFFFFFF
+
+// vectors below this are exceptions
+#define NOTIFY_MIN_VECTOR 0x20
+
+struct NOTIFY_COMPLETION
+{
+	UINT64	cookie;		// identifies the operation, chosen by whoever started it
+	UINT64	status;		// a HYPERCALL_STATUS
+	UINT64	tsc;		// when it was posted
+};
+
+struct NOTIFY_STATE
+{
+	volatile LONG	pending;	// another core posted a completion for this one, a mailbox request raises it
+};
+
+// completions of hypervisor operations are queued in one ring and announced to the guest as a virtual
+// interrupt through V_IRQ, so a guest driver can wait for them instead of polling with hypercalls.
+// the interrupt doesnt go through the local apic: the handler drains the ring with HYPERCALL_NOTIFY_POLL,
+// and an eoi it writes lands on the real apic. AVIC isnt used, the hypervisor doesnt enable it
+namespace notify
+{
+	// AMD64 Manual Volume 2: 15.21.4 Injecting Virtual (INTR) Interrupts
+	// vector 0 turns notifications off, completions are still queued
+	void register_vector(UINT8 vector, UINT32 core);
+
+	// queues a completion and raises the vector, false if the ring was full and it was dropped
+	bool post(vcpu* poster, UINT64 cookie, UINT64 status);
+
+	// the oldest completion, remaining is how many are left after it
+	bool poll(NOTIFY_COMPLETION* completion, UINT64* remaining);
+
+	// raises the vector on this core if another core posted for it. the poster's mailbox request runs it,
+	// and every exit does in case the mailbox was full
+	void update(vcpu* vcpu);
+}
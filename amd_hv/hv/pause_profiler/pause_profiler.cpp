@@ -0,0 +1,133 @@
+#include "pause_profiler.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+
+namespace pause_profiler
+{
+	bool			enabled;
+	UINT16			filter_count;
+	UINT16			filter_threshold;
+	UINT64			sample_rate = 1;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+}
+
+bool pause_profiler::supported()
+{
+	int cpuid_regs[4];
+	__cpuid(cpuid_regs, 0x8000000A);
+
+	// EDX[10] PauseFilter, EDX[12] PauseFilterThreshold
+
+	return (cpuid_regs[3] & (1 << 10)) && (cpuid_regs[3] & (1 << 12));
+}
+
+void pause_profiler::configure(UINT64 flags, UINT16 new_filter_count, UINT16 new_filter_threshold, UINT64 new_sample_rate)
+{
+	enabled				= flags & PAUSE_ENABLE;
+	filter_count		= new_filter_count;
+	filter_threshold	= new_filter_threshold;
+	sample_rate			= new_sample_rate ? new_sample_rate : 1;
+
+	if (flags & PAUSE_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void pause_profiler::update(vcpu* vcpu)
+{
+	auto histogram = vcpu->get_pause_histogram();
+
+	if (histogram->generation == (UINT64)generation)
+		return;
+
+	// each vcpu clears its own histogram, so we never race with the core recording into it
+
+	if (histogram->generation < reset_generation)
+		memset(histogram, 0, sizeof(PAUSE_HISTOGRAM));
+
+	histogram->generation = generation;
+
+	auto& guest = vcpu->get_guest();
+
+	vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(guest).pause = enabled;
+	vmcb::write<&VMCB_CONTROL_AREA::pause_filter_count>(guest, filter_count);
+	vmcb::write<&VMCB_CONTROL_AREA::pause_filter_threshold>(guest, filter_threshold);
+
+	return;
+}
+
+void pause_profiler::record(vcpu* vcpu)
+{
+	auto& state		= vcpu->get_guest().get_state_save_area();
+	auto histogram	= vcpu->get_pause_histogram();
+
+	if (histogram->exits++ % sample_rate)
+		return;
+
+	histogram->sampled++;
+
+	// the low 12 bits of cr3 hold the pcid, the same address space can show up with different ones
+
+	UINT64 rip = state.rip;
+	UINT64 cr3 = state.cr3.AsUInt & ~(UINT64)(PAGE_SIZE - 1);
+	UINT64 tsc = __rdtsc();
+
+	// fibonacci hashing, the top bits of the product are the best mixed
+
+	UINT64 hash = ((rip ^ cr3) * 0x9E3779B97F4A7C15) >> (64 - PAUSE_HISTOGRAM_BITS);
+
+	for (int i = 0; i < PAUSE_PROBE_LIMIT; i++)
+	{
+		auto& entry = histogram->entries[(hash + i) & (PAUSE_HISTOGRAM_SIZE - 1)];
+
+		if (!entry.count)
+		{
+			entry.rip		= rip;
+			entry.cr3		= cr3;
+			entry.first_tsc	= tsc;
+		}
+		else if (entry.rip != rip || entry.cr3 != cr3)
+			continue;
+
+		entry.count++;
+		entry.last_tsc = tsc;
+
+		return;
+	}
+
+	histogram->dropped++;
+
+	return;
+}
+
+INT64 pause_profiler::export_entries(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state		= caller->get_guest().get_state_save_area();
+	auto histogram	= target->get_pause_histogram();
+
+	// the target core keeps recording while we read, a torn entry is acceptable for a profile
+
+	INT64 written = 0;
+
+	for (int i = 0; i < PAUSE_HISTOGRAM_SIZE && (UINT64)written < capacity; i++)
+	{
+		auto entry = histogram->entries[i];
+
+		if (!entry.count)
+			continue;
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + written * sizeof(PAUSE_ENTRY), &entry, sizeof(PAUSE_ENTRY)))
+			return -1;
+
+		written++;
+	}
+
+	return written;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define PAUSE_HISTOGRAM_BITS 10
+#define PAUSE_HISTOGRAM_SIZE (1 << PAUSE_HISTOGRAM_BITS)
+#define PAUSE_PROBE_LIMIT 16
+
+// flags for pause_profiler::configure
+#define PAUSE_ENABLE 0x1
+#define PAUSE_RESET 0x2
+
+// one spin loop location, keyed by guest rip and cr3
+struct PAUSE_ENTRY
+{
+	UINT64	rip;
+	UINT64	cr3;
+	UINT64	count;
+	UINT64	first_tsc;
+	UINT64	last_tsc;
+};
+
+// per vcpu open addressing hash table of pause loop exits
+struct PAUSE_HISTOGRAM
+{
+	UINT64	generation;		// last configuration applied to this vcpu
+	UINT64	exits;			// every pause loop exit
+	UINT64	sampled;		// exits that were recorded
+	UINT64	dropped;		// recorded exits that found no free slot
+	PAUSE_ENTRY entries[PAUSE_HISTOGRAM_SIZE];
+};
+
+namespace pause_profiler
+{
+	// AMD64 Manual Volume 2: 15.14.4 Pause Intercept Filtering
+	bool supported();
+
+	// filter_count is the amount of pause instructions before we get an exit,
+	// filter_threshold is the most cycles between two pauses that still count as the same spin loop,
+	// 1 out of every sample_rate exits is recorded
+	void configure(UINT64 flags, UINT16 filter_count, UINT16 filter_threshold, UINT64 sample_rate);
+
+	// applies configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	void record(vcpu* vcpu);
+
+	// copies the used entries of target's histogram to a guest buffer of caller's current address space,
+	// returns the amount of entries written, or -1 if the buffer isnt present and writable
+	INT64 export_entries(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
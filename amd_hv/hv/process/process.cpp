@@ -0,0 +1,64 @@
+#include "process.h"
+
+#include "../hv.h"
+#include "../jobs/jobs.h"
+#include "../session/session.h"
+#include "../../utilities/utilities.h"
+
+namespace process
+{
+	bool watching;
+
+	// the last thread of the process calls this on its way out, so we are still in its address space
+	void on_process(HANDLE parent, HANDLE id, BOOLEAN create)
+	{
+		UNREFERENCED_PARAMETER(parent);
+		UNREFERENCED_PARAMETER(id);
+
+		if (create)
+			return;
+
+		HYPERCALL_ARGS args{};
+
+		hv_call(HYPERCALL_CODE(HYPERCALL_PROCESS_EXIT), &args);
+
+		return;
+	}
+}
+
+bool process::watch()
+{
+	// the Ex version needs the image linked with /INTEGRITYCHECK, the exit notification is all we need
+
+	auto status = PsSetCreateProcessNotifyRoutine(on_process, FALSE);
+
+	if (!NT_SUCCESS(status))
+	{
+		LOG_ERROR("couldnt register the process notify routine \n");
+		return false;
+	}
+
+	watching = true;
+
+	return true;
+}
+
+void process::unwatch()
+{
+	if (!watching)
+		return;
+
+	PsSetCreateProcessNotifyRoutine(on_process, TRUE);
+
+	watching = false;
+
+	return;
+}
+
+void process::release(UINT64 cr3)
+{
+	jobs::release(cr3);
+	session::release(cr3);
+
+	return;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+// the hypervisor keeps jobs and sessions by the address space that started them, and cant tell when a process is gone.
+// a process notify routine in the guest makes a HYPERCALL_PROCESS_EXIT from the exiting process's own
+// context before its page tables are freed. amd cpus arent affected by meltdown so windows doesnt shadow
+// the kernel's page tables, a process runs with the same cr3 in user and kernel mode
+namespace process
+{
+	// registers the notify routine, from the guest once every core runs under the hypervisor
+	bool watch();
+
+	// removes it and waits for the calls in flight, before the hypervisor shuts down
+	void unwatch();
+
+	// drops what the hypervisor holds for cr3, from the hypercall
+	void release(UINT64 cr3);
+}
@@ -0,0 +1,260 @@
+#include "sampler.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../apic/apic.h"
+#include "../../utilities/utilities.h"
+
+namespace sampler
+{
+	bool			enabled;
+	UINT64			period;
+	UINT64			depth;
+	volatile LONG64	generation;
+
+	// generation of the last configuration that asked for a reset
+	UINT64			reset_generation;
+
+	PVOID			nmi_callback_handle;
+
+	// per core, set right before one of our nmi-s is delivered on the host
+	volatile UINT8*	claims;
+
+	// PMCx076 CPU Clocks not Halted
+	constexpr UINT64 cycles_event = 0x76;
+
+	// the counters are 48 bits wide
+	constexpr UINT64 counter_mask = (1ull << 48) - 1;
+
+	BOOLEAN nmi_callback(PVOID context, BOOLEAN handled)
+	{
+		UNREFERENCED_PARAMETER(context);
+
+		auto idx = utilities::get_current_cpu_idx();
+
+		if (claims[idx])
+		{
+			claims[idx] = 0;
+			return TRUE;
+		}
+
+		return handled;
+	}
+
+	// the counter counts up from -period and overflows after period guest cycles
+	void arm()
+	{
+		__writemsr(AMD_MSR::perf_ctr3, (0 - period) & counter_mask);
+		return;
+	}
+
+	void start(vcpu* vcpu)
+	{
+		auto ring = vcpu->get_sample_ring();
+
+		if (!ring->active)
+			ring->saved_lvt = apic::read(APIC_REG_LVT_PERFORMANCE);
+
+		apic::write(APIC_REG_LVT_PERFORMANCE, APIC_DELIVERY_MODE_NMI);
+
+		arm();
+
+		AMD_PERF_CTL_MSR ctl{ .value = 0 };
+		ctl.event_select	= cycles_event;
+		ctl.usr				= 1;
+		ctl.os				= 1;
+		ctl.interrupt		= 1;
+		ctl.enable			= 1;
+		ctl.guest_only		= 1;
+
+		__writemsr(AMD_MSR::perf_ctl3, ctl.value);
+
+		ring->active = 1;
+
+		return;
+	}
+}
+
+bool sampler::setup()
+{
+	claims = (volatile UINT8*)ExAllocatePoolZero(NonPagedPool, utilities::get_cpu_cores(), 'ENON');
+
+	if (!claims)
+		return false;
+
+	nmi_callback_handle = KeRegisterNmiCallback(nmi_callback, nullptr);
+
+	if (!nmi_callback_handle)
+	{
+		LOG_ERROR("couldnt register the nmi callback \n");
+		return false;
+	}
+
+	return true;
+}
+
+void sampler::cleanup()
+{
+	// every core has stopped its counter in hv::cleanup by now
+
+	if (nmi_callback_handle)
+		KeDeregisterNmiCallback(nmi_callback_handle);
+
+	if (claims)
+		ExFreePoolWithTag((PVOID)claims, 'ENON');
+
+	nmi_callback_handle = nullptr;
+	claims				= nullptr;
+
+	return;
+}
+
+void sampler::configure(UINT64 flags, UINT64 new_period, UINT64 new_depth)
+{
+	enabled	= flags & SAMPLER_ENABLE;
+	period	= new_period;
+	depth	= new_depth;
+
+	if (flags & SAMPLER_RESET)
+		reset_generation = generation + 1;
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void sampler::update(vcpu* vcpu)
+{
+	auto ring = vcpu->get_sample_ring();
+
+	if (ring->generation == (UINT64)generation)
+		return;
+
+	if (ring->generation < reset_generation)
+	{
+		ring->head		= 0;
+		ring->tail		= 0;
+		ring->samples	= 0;
+		ring->dropped	= 0;
+		ring->cycles	= 0;
+	}
+
+	ring->generation = generation;
+
+	if (enabled)
+		start(vcpu);
+	else
+		stop(vcpu);
+
+	return;
+}
+
+void sampler::stop(vcpu* vcpu)
+{
+	auto ring = vcpu->get_sample_ring();
+
+	if (!ring->active)
+		return;
+
+	__writemsr(AMD_MSR::perf_ctl3, 0);
+
+	apic::write(APIC_REG_LVT_PERFORMANCE, ring->saved_lvt);
+
+	ring->active = 0;
+
+	return;
+}
+
+bool sampler::handle_nmi(vcpu* vcpu)
+{
+	auto& state	= vcpu->get_guest().get_state_save_area();
+	auto ring	= vcpu->get_sample_ring();
+
+	// the counter starts out with bit 47 set, once it overflowed its clear
+
+	if (!ring->active || (__readmsr(AMD_MSR::perf_ctr3) & (1ull << 47)))
+		return false;
+
+	UINT64 start_tsc = __rdtsc();
+
+	if (ring->head - ring->tail >= SAMPLE_RING_SIZE)
+		ring->dropped++;
+	else
+	{
+		auto& sample = ring->entries[ring->head & (SAMPLE_RING_SIZE - 1)];
+
+		sample.tsc	= start_tsc;
+		sample.rip	= state.rip;
+		sample.rsp	= state.rsp;
+		sample.cr3	= state.cr3.AsUInt;
+		sample.cpl	= state.cpl;
+
+		// a stack page that isnt present just gives us a sample without a stack.
+		// its read with the rights of the code we interrupted, so a user sample only ever has user memory
+
+		bool read	= memory::read_guest(vcpu, sample.cr3, (UINT8)sample.cpl, sample.rsp, sample.stack, depth * sizeof(UINT64));
+		sample.depth = read ? (UINT32)depth : 0;
+
+		if (!lbr::capture(vcpu, &sample.branch_from, &sample.branch_to))
+		{
+			sample.branch_from	= 0;
+			sample.branch_to	= 0;
+		}
+
+		// head is volatile, so this store publishes the sample to the exporting core
+
+		ring->head = ring->head + 1;
+	}
+
+	ring->samples++;
+
+	arm();
+
+	// the lvt entry may get masked when it delivers, so we write it again
+
+	apic::write(APIC_REG_LVT_PERFORMANCE, APIC_DELIVERY_MODE_NMI);
+
+	ring->cycles += __rdtsc() - start_tsc;
+
+	return true;
+}
+
+void sampler::drain_nmi(bool claimed)
+{
+	claims[utilities::get_current_cpu_idx()] = claimed;
+
+	// only the nmi may be taken here, a maskable interrupt on the host stack could end up scheduling
+
+	UINT64 flags = __readeflags();
+	_disable();
+
+	__svm_stgi();
+	__svm_clgi();
+
+	__writeeflags(flags);
+
+	return;
+}
+
+INT64 sampler::export_samples(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity)
+{
+	auto& state	= caller->get_guest().get_state_save_area();
+	auto ring	= target->get_sample_ring();
+
+	INT64 tail	= ring->tail;
+	INT64 count	= min(ring->head - tail, (INT64)capacity);
+
+	for (INT64 i = 0; i < count; i++)
+	{
+		auto& sample = ring->entries[(tail + i) & (SAMPLE_RING_SIZE - 1)];
+
+		if (!memory::write_guest(caller, state.cr3.AsUInt, state.cpl, buffer + i * sizeof(SAMPLE), &sample, sizeof(SAMPLE)))
+			return -1;
+	}
+
+	// tail is volatile, so the slots are only handed back once we are done copying them
+
+	ring->tail = tail + count;
+
+	return count;
+}
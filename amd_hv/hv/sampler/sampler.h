@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define SAMPLE_STACK_DEPTH 8
+#define SAMPLE_RING_SIZE 2048	// power of two
+
+// the smallest sampling period we allow, anything lower would keep the guest in nmi-s
+#define SAMPLE_MIN_PERIOD 10000
+
+// flags for sampler::configure
+#define SAMPLER_ENABLE 0x1
+#define SAMPLER_RESET 0x2
+
+// one guest execution sample
+struct SAMPLE
+{
+	UINT64	tsc;
+	UINT64	rip;
+	UINT64	rsp;
+	UINT64	cr3;
+	UINT32	cpl;
+	UINT32	depth;						// valid qwords in stack
+	UINT64	branch_from;				// the guest's last taken branch, only if lbr virtualization is enabled
+	UINT64	branch_to;
+	UINT64	stack[SAMPLE_STACK_DEPTH];	// the top of the guest stack, usermode picks the return addresses out of it
+};
+
+// single producer single consumer ring, the owning core writes head and the exporting core writes tail
+struct SAMPLE_RING
+{
+	UINT64	generation;		// last configuration applied to this vcpu
+	UINT64	active;			// the pmc and the lvt entry are programmed on this core
+	UINT64	samples;
+	UINT64	dropped;		// samples lost because the ring was full
+	UINT64	cycles;			// host time spent taking samples
+	UINT32	saved_lvt;		// the os's lvt performance counter entry, restored when sampling stops
+	UINT32	reserved;
+
+	volatile LONG64 head;
+	volatile LONG64 tail;
+
+	SAMPLE entries[SAMPLE_RING_SIZE];
+};
+
+// samples are driven by performance counter 3 counting guest only cycles, its overflow raises an nmi
+// which we intercept. guest use of that counter will conflict with the sampler while its enabled
+namespace sampler
+{
+	// registers the nmi callback, must be called before launching because it calls into the os
+	bool setup();
+
+	void cleanup();
+
+	// period is in guest cycles, depth is the amount of stack qwords captured per sample
+	void configure(UINT64 flags, UINT64 period, UINT64 depth);
+
+	// applies configuration changes, every vcpu picks them up on its next exit
+	void update(vcpu* vcpu);
+
+	// disarms the counter and restores the lvt entry of this core
+	void stop(vcpu* vcpu);
+
+	// if the intercepted nmi came from our counter, takes a sample and rearms it
+	bool handle_nmi(vcpu* vcpu);
+
+	// delivers the pending nmi on the host, claimed tells our nmi callback to swallow it
+	void drain_nmi(bool claimed);
+
+	// moves samples out of target's ring into a guest buffer of caller's current address space,
+	// returns the amount of samples written, or -1 if the buffer isnt present and writable
+	INT64 export_samples(vcpu* caller, vcpu* target, UINT64 buffer, UINT64 capacity);
+}
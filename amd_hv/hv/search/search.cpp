@@ -0,0 +1,156 @@
+#include "search.h"
+
+namespace search
+{
+	UINT32 lowest_bit(UINT32 bits)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+
+		_BitScanForward(&index, bits);
+
+		return index;
+#else
+		return __builtin_ctz(bits);
+#endif
+	}
+
+	bool matches(const SEARCH_PATTERN& pattern, const UINT8* data)
+	{
+		for (UINT32 i = 0; i < pattern.length; i++)
+		{
+			if ((data[i] ^ pattern.bytes[i]) & pattern.mask[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	SIZE_T find_scalar(const SEARCH_PATTERN& pattern, const UINT8* data, SIZE_T start, SIZE_T end, UINT32* offsets, SIZE_T capacity)
+	{
+		SIZE_T count = 0;
+
+		for (SIZE_T i = start; i < end && count < capacity; i++)
+		{
+			if (matches(pattern, data + i))
+				offsets[count++] = (UINT32)i;
+		}
+
+		return count;
+	}
+
+	// both vector kernels compare a block of candidate starts at once against the two anchors,
+	// the few starts where both bytes are equal get the full check
+
+	SIZE_T find_sse(const SEARCH_PATTERN& pattern, const UINT8* data, SIZE_T start, SIZE_T end, UINT32* offsets, SIZE_T capacity)
+	{
+		__m128i first	= _mm_set1_epi8((char)pattern.bytes[pattern.first]);
+		__m128i last	= _mm_set1_epi8((char)pattern.bytes[pattern.last]);
+
+		SIZE_T count	= 0;
+		SIZE_T i		= start;
+
+		for (; i + 16 <= end; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(data + i + pattern.first));
+			__m128i b = _mm_loadu_si128((const __m128i*)(data + i + pattern.last));
+
+			UINT32 bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+			for (; bits; bits &= bits - 1)
+			{
+				SIZE_T offset = i + lowest_bit(bits);
+
+				if (!matches(pattern, data + offset))
+					continue;
+
+				offsets[count++] = (UINT32)offset;
+
+				if (count == capacity)
+					return count;
+			}
+		}
+
+		return count + find_scalar(pattern, data, i, end, offsets + count, capacity - count);
+	}
+
+	SIZE_T find_avx2(const SEARCH_PATTERN& pattern, const UINT8* data, SIZE_T start, SIZE_T end, UINT32* offsets, SIZE_T capacity)
+	{
+		__m256i first	= _mm256_set1_epi8((char)pattern.bytes[pattern.first]);
+		__m256i last	= _mm256_set1_epi8((char)pattern.bytes[pattern.last]);
+
+		SIZE_T count	= 0;
+		SIZE_T i		= start;
+
+		for (; i + 32 <= end; i += 32)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(data + i + pattern.first));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(data + i + pattern.last));
+
+			UINT32 bits = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+			for (; bits; bits &= bits - 1)
+			{
+				SIZE_T offset = i + lowest_bit(bits);
+
+				if (!matches(pattern, data + offset))
+					continue;
+
+				offsets[count++] = (UINT32)offset;
+
+				if (count == capacity)
+				{
+					_mm256_zeroupper();
+					return count;
+				}
+			}
+		}
+
+		// the host's compiled code uses legacy sse, mixing it with dirty upper halves is slow
+
+		_mm256_zeroupper();
+
+		return count + find_sse(pattern, data, i, end, offsets + count, capacity - count);
+	}
+}
+
+bool search::prepare(SEARCH_PATTERN& pattern)
+{
+	if (!pattern.length || pattern.length > SEARCH_MAX_PATTERN)
+		return false;
+
+	bool wildcard = true;
+
+	pattern.anchored = false;
+
+	for (UINT32 i = 0; i < pattern.length; i++)
+	{
+		if (pattern.mask[i])
+			wildcard = false;
+
+		if (pattern.mask[i] != 0xFF)
+			continue;
+
+		if (!pattern.anchored)
+			pattern.first = i;
+
+		pattern.last		= i;
+		pattern.anchored	= true;
+	}
+
+	return !wildcard;
+}
+
+SIZE_T search::find(SEARCH_KERNEL kernel, const SEARCH_PATTERN& pattern, const UINT8* data, SIZE_T start, SIZE_T end, UINT32* offsets, SIZE_T capacity)
+{
+	if (start >= end || !capacity)
+		return 0;
+
+	if (!pattern.anchored || kernel == search_scalar)
+		return find_scalar(pattern, data, start, end, offsets, capacity);
+
+	if (kernel == search_sse)
+		return find_sse(pattern, data, start, end, offsets, capacity);
+
+	return find_avx2(pattern, data, start, end, offsets, capacity);
+}
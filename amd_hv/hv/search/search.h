@@ -0,0 +1,57 @@
+#pragma once
+
+// the kernels only need fixed width types and intrinsics, so hv_search_bench builds this file on its own
+
+#if defined(_KERNEL_MODE)
+#include <ntifs.h>
+#include <intrin.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+typedef uint8_t		UINT8;
+typedef uint32_t	UINT32;
+typedef uint64_t	UINT64;
+typedef size_t		SIZE_T;
+#endif
+
+#define SEARCH_MAX_PATTERN 32
+
+enum SEARCH_KERNEL : UINT32
+{
+	search_best		= 0,	// the fastest one the cpu supports
+	search_scalar	= 1,
+	search_sse		= 2,	// 16 bytes per step, sse2 compares
+	search_avx2		= 3,	// 32 bytes per step, needs the ymm state saved in host context
+	search_kernels,
+};
+
+struct SEARCH_PATTERN
+{
+	UINT8	bytes[SEARCH_MAX_PATTERN];
+	UINT8	mask[SEARCH_MAX_PATTERN];	// set bits have to match, 0 is a wildcard byte
+	UINT32	length;
+
+	// two bytes without wildcard bits, the vector kernels only verify where both of them match.
+	// prepare picks the first and the last one, patterns without any only run scalar
+	UINT32	first;
+	UINT32	last;
+	bool	anchored;
+};
+
+// byte pattern search with wildcards. its kept free of vcpu and vmcb accesses,
+// the caller maps the memory and deals with matches that cross into memory it hasnt mapped
+namespace search
+{
+	// checks the pattern and picks its anchors, false if its empty, too long or all wildcards
+	bool prepare(SEARCH_PATTERN& pattern);
+
+	// finds matches starting at offsets start up to end of data, data has to be readable up to
+	// end + pattern.length - 1. writes their offsets in order and returns how many, once capacity are found
+	// the search stops and the caller continues after the last one
+	SIZE_T find(SEARCH_KERNEL kernel, const SEARCH_PATTERN& pattern, const UINT8* data, SIZE_T start, SIZE_T end, UINT32* offsets, SIZE_T capacity);
+}
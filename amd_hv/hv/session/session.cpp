@@ -0,0 +1,317 @@
+#include "session.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../commands/commands.h"
+
+namespace session
+{
+	SESSION			sessions[SESSION_MAX];
+
+	// only open and close take this, submits only lock their own session
+	volatile LONG	table_lock;
+
+	void lock(volatile LONG* target)
+	{
+		while (InterlockedCompareExchange(target, 1, 0))
+			_mm_pause();
+
+		return;
+	}
+
+	void unlock(volatile LONG* target)
+	{
+		InterlockedExchange(target, 0);
+
+		return;
+	}
+
+	UINT64 command_address(SESSION* session, UINT32 index)
+	{
+		return session->ring + sizeof(SESSION_RING_HEADER) + (UINT64)(index & (session->entries - 1)) * sizeof(SESSION_COMMAND);
+	}
+
+	UINT64 completion_address(SESSION* session, UINT32 index)
+	{
+		return session->ring + sizeof(SESSION_RING_HEADER) + (UINT64)session->entries * sizeof(SESSION_COMMAND) +
+			(UINT64)(index & (session->entries - 1)) * sizeof(SESSION_COMPLETION);
+	}
+
+	// ids handed out for this slot stop resolving, generation 0 is skipped so an id is never 0.
+	// the caller holds the session's lock and the table lock
+	void retire(SESSION* session)
+	{
+		session->open		= false;
+		session->generation	= (session->generation + 1) & SESSION_GENERATION_MASK;
+
+		if (!session->generation)
+			session->generation = 1;
+
+		return;
+	}
+
+	// an expired session's process is probably gone without us hearing of it, or just leaked it.
+	// a submit holding its lock means its still in use
+	bool reclaim(SESSION* session)
+	{
+		if (__rdtsc() - session->last_used < SESSION_EXPIRY)
+			return false;
+
+		if (InterlockedCompareExchange(&session->lock, 1, 0))
+			return false;
+
+		retire(session);
+		unlock(&session->lock);
+
+		return true;
+	}
+
+	// session calls would recurse into the lock we hold, shutdown has to exit into the caller's own context
+	// and a broadcast would keep the lock while it waits for cores that could be waiting for it.
+	// none of them are registered with COMMAND_SESSION
+	bool allowed(UINT64 code)
+	{
+		auto command = commands::find(code & HYPERCALL_CODE_MASK);
+
+		return command && (command->flags & COMMAND_SESSION);
+	}
+}
+
+UINT64 session::open(vcpu* vcpu, UINT64 ring, UINT64 entries, UINT64 batch, UINT64* id)
+{
+	UINT64 cr3	= vcpu->get_guest().get_state_save_area().cr3.AsUInt;
+	UINT8 cpl	= vcpu->get_guest().get_state_save_area().cpl;
+
+	if ((ring & (PAGE_SIZE - 1)) || !entries || entries > SESSION_MAX_ENTRIES || (entries & (entries - 1)) ||
+		!batch || batch > SESSION_MAX_BATCH)
+		return call_bad_args;
+
+	// every page of the ring has to be there now, a submit that faults halfway leaves commands unfinished
+
+	for (UINT64 offset = 0; offset < SESSION_RING_SIZE(entries); offset += PAGE_SIZE)
+	{
+		UINT64 phys;
+
+		if (!memory::translate(vcpu, cr3, cpl, ring + offset, &phys, true))
+			return call_fault;
+	}
+
+	SESSION_RING_HEADER header{};
+
+	if (!memory::write_guest(vcpu, cr3, cpl, ring, &header, sizeof(header)))
+		return call_fault;
+
+	lock(&table_lock);
+
+	SESSION* free	= nullptr;
+	SESSION* stale	= nullptr;
+	UINT32 owned	= 0;
+
+	for (auto& session : sessions)
+	{
+		if (!session.open)
+		{
+			if (!free)
+				free = &session;
+		}
+		else if (__rdtsc() - session.last_used >= SESSION_EXPIRY)
+		{
+			if (!stale)
+				stale = &session;
+		}
+		else if (session.cr3 == cr3)
+			owned++;
+	}
+
+	// expired sessions dont count against their address space, and only get reclaimed once the table is full
+
+	if (!free && stale && reclaim(stale))
+		free = stale;
+
+	if (!free || owned >= SESSION_PER_ADDRESS_SPACE)
+	{
+		unlock(&table_lock);
+		return call_exhausted;
+	}
+
+	free->cr3			= cr3;
+	free->cpl			= cpl;
+	free->ring			= ring;
+	free->entries		= (UINT32)entries;
+	free->batch			= (UINT32)batch;
+	free->submit_head	= 0;
+	free->complete_tail	= 0;
+	free->last_used		= __rdtsc();
+	free->open			= true;
+
+	if (!free->generation)
+		free->generation = 1;
+
+	*id = (UINT64)free->generation << SESSION_INDEX_BITS | (UINT64)(free - sessions);
+
+	unlock(&table_lock);
+
+	return call_success;
+}
+
+SESSION* session::resolve(vcpu* vcpu, UINT64 id)
+{
+	auto& state = vcpu->get_guest().get_state_save_area();
+
+	auto session = &sessions[id & (SESSION_MAX - 1)];
+
+	if (!session->open || session->generation != (id >> SESSION_INDEX_BITS))
+		return nullptr;
+
+	if (state.cpl && session->cr3 != state.cr3.AsUInt)
+		return nullptr;
+
+	return session;
+}
+
+void session::close(SESSION* session)
+{
+	// waits for a submit on another core to finish with the ring
+
+	lock(&session->lock);
+	lock(&table_lock);
+
+	retire(session);
+
+	unlock(&table_lock);
+	unlock(&session->lock);
+
+	return;
+}
+
+void session::release(UINT64 cr3)
+{
+	// the low 12 bits are the pcid. the lock waits for a submit in progress, which is bounded by its batch,
+	// and the owner is checked under it so a slot reopened by another process in the meantime stays open
+
+	for (auto& session : sessions)
+	{
+		if (!session.open)
+			continue;
+
+		lock(&session.lock);
+
+		if (session.open && !((session.cr3 ^ cr3) & ~0xFFFull))
+		{
+			lock(&table_lock);
+			retire(&session);
+			unlock(&table_lock);
+		}
+
+		unlock(&session.lock);
+	}
+
+	return;
+}
+
+UINT64 session::submit(vcpu* vcpu, SESSION* session, SESSION_EXECUTE execute, UINT64* processed, UINT64* pending)
+{
+	*processed	= 0;
+	*pending	= 0;
+
+	lock(&session->lock);
+
+	// the session could have been closed between resolve and here
+
+	if (!session->open)
+	{
+		unlock(&session->lock);
+		return call_bad_args;
+	}
+
+	UINT64 status = call_success;
+
+	session->last_used = __rdtsc();
+
+	SESSION_RING_HEADER header;
+
+	if (!memory::read_guest(vcpu, session->cr3, session->cpl, session->ring, &header, sizeof(header)))
+	{
+		unlock(&session->lock);
+		return call_fault;
+	}
+
+	// only the client's indices are taken from the ring, a tail thats more than a ring ahead is garbage
+
+	UINT32 queued	= header.submit_tail - session->submit_head;
+	UINT32 unread	= session->complete_tail - header.complete_head;
+
+	if (queued > session->entries || unread > session->entries)
+	{
+		unlock(&session->lock);
+		return call_bad_args;
+	}
+
+	// commands only run while their completion has somewhere to go
+
+	UINT32 count = min(min(queued, session->entries - unread), session->batch);
+
+	for (UINT32 i = 0; i < count; i++)
+	{
+		SESSION_COMMAND command;
+
+		if (!memory::read_guest(vcpu, session->cr3, session->cpl, command_address(session, session->submit_head), &command, sizeof(command)))
+		{
+			status = call_fault;
+			break;
+		}
+
+		SESSION_COMPLETION completion{};
+
+		completion.cookie = command.cookie;
+
+		if (command.code & HYPERCALL_XMM)
+			completion.status = call_bad_args;
+		else if (!allowed(command.code))
+			completion.status = call_invalid;
+		else
+		{
+			GENERAL_REGISTERS regs{};
+
+			regs.rax	= HYPERCALL_CODE(command.code & MAXUINT32);
+			regs.rcx	= command.args[0];
+			regs.rdx	= command.args[1];
+			regs.r8		= command.args[2];
+			regs.r9		= command.args[3];
+			regs.r10	= command.args[4];
+			regs.r11	= command.args[5];
+
+			completion.status = execute(vcpu, &regs);
+
+			completion.results[0] = regs.rcx;
+			completion.results[1] = regs.rdx;
+			completion.results[2] = regs.r8;
+			completion.results[3] = regs.r9;
+			completion.results[4] = regs.r10;
+			completion.results[5] = regs.r11;
+		}
+
+		if (!memory::write_guest(vcpu, session->cr3, session->cpl, completion_address(session, session->complete_tail), &completion, sizeof(completion)))
+		{
+			status = call_fault;
+			break;
+		}
+
+		session->submit_head++;
+		session->complete_tail++;
+
+		(*processed)++;
+	}
+
+	// only the indices we own are written back, the client may be queueing on another core
+
+	if (!memory::write_guest(vcpu, session->cr3, session->cpl, session->ring + FIELD_OFFSET(SESSION_RING_HEADER, submit_head), &session->submit_head, sizeof(UINT32)) ||
+		!memory::write_guest(vcpu, session->cr3, session->cpl, session->ring + FIELD_OFFSET(SESSION_RING_HEADER, complete_tail), &session->complete_tail, sizeof(UINT32)))
+		status = call_fault;
+
+	*pending = header.submit_tail - session->submit_head;
+
+	unlock(&session->lock);
+
+	return status;
+}
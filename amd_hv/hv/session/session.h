@@ -0,0 +1,92 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define SESSION_INDEX_BITS 6
+#define SESSION_MAX (1 << SESSION_INDEX_BITS)
+
+// the session id is 15 bits of rax, the index and a generation that changes when a slot is reused
+#define SESSION_ID_MASK 0x7FFF
+#define SESSION_GENERATION_MASK (SESSION_ID_MASK >> SESSION_INDEX_BITS)
+
+#define SESSION_MAX_ENTRIES 256
+#define SESSION_MAX_BATCH 64
+
+// sessions one address space can hold, so a single tool cant take the whole table
+#define SESSION_PER_ADDRESS_SPACE 4
+
+// tsc cycles a session can go without a submit before an open may take its slot, about a minute at 4 GHz
+#define SESSION_EXPIRY 0x4000000000ull
+
+// the start of a session's ring, in the client's memory. each index only ever grows, the slot is index % entries
+struct SESSION_RING_HEADER
+{
+	UINT32	submit_head;	// next command the hypervisor takes, written by the hypervisor
+	UINT32	submit_tail;	// where the client queues the next command
+	UINT32	complete_head;	// next completion the client takes
+	UINT32	complete_tail;	// where the hypervisor writes the next completion, written by the hypervisor
+	UINT8	reserved[0x30];
+};
+
+// a hypercall as it would be made with vmmcall, code without HYPERCALL_KEY
+struct SESSION_COMMAND
+{
+	UINT64	code;
+	UINT64	cookie;		// handed back in the completion, so the client can match them up
+	UINT64	args[6];	// rcx, rdx, r8, r9, r10, r11
+};
+
+struct SESSION_COMPLETION
+{
+	UINT64	cookie;
+	UINT64	status;		// HYPERCALL_STATUS
+	UINT64	results[6];
+};
+
+// the header, then entries commands, then entries completions
+#define SESSION_RING_SIZE(entries) (sizeof(SESSION_RING_HEADER) + (entries) * (sizeof(SESSION_COMMAND) + sizeof(SESSION_COMPLETION)))
+
+struct SESSION
+{
+	volatile LONG	lock;		// held while a core drains the ring
+	UINT16			generation;
+	bool			open;
+	UINT64			cr3;		// the owner's address space, the ring is only read through it
+	UINT8			cpl;		// the owner's privilege, the ring is only accessed with it
+	UINT64			ring;
+	UINT32			entries;	// power of two
+	UINT32			batch;		// most commands taken per submit, bounds the time spent in one exit
+	UINT32			submit_head;	// our copies of the indices we own, the client could overwrite the ring's
+	UINT32			complete_tail;
+	volatile UINT64	last_used;	// tsc of the open or the last submit
+};
+
+// executes a command taken from a ring, the same way vmmcall would with these registers.
+// regs only holds rax, rcx, rdx and r8 - r11
+typedef UINT64 (*SESSION_EXECUTE)(vcpu* vcpu, GENERAL_REGISTERS* regs);
+
+// every client opens its own session and queues commands in a ring in its own memory,
+// one hypercall then executes a batch of them. sessions have their own lock,
+// so clients on different cores never wait for each other. a session is closed when the process
+// that opened it exits, see process.h, and one that went SESSION_EXPIRY without a submit is taken
+// over by the next open that finds no free slot. the kernel can close any
+namespace session
+{
+	// opens a session for the caller's address space, returns a HYPERCALL_STATUS
+	UINT64 open(vcpu* vcpu, UINT64 ring, UINT64 entries, UINT64 batch, UINT64* id);
+
+	// the session with this id if it belongs to the caller's address space, O(1).
+	// the kernel resolves any session, so it can close the ones whose process is gone
+	SESSION* resolve(vcpu* vcpu, UINT64 id);
+
+	void close(SESSION* session);
+
+	// closes every session opened from cr3, its process is exiting
+	void release(UINT64 cr3);
+
+	// takes up to the session's batch of commands from its ring, processed and pending are how many
+	// were executed and how many are still queued. returns a HYPERCALL_STATUS
+	UINT64 submit(vcpu* vcpu, SESSION* session, SESSION_EXECUTE execute, UINT64* processed, UINT64* pending);
+}
@@ -0,0 +1,176 @@
+#include "simd.h"
+
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+
+bool simd::avx2_supported()
+{
+	int cpuid_regs[4];
+
+	// ECX[27] OSXSAVE, ECX[28] AVX
+
+	__cpuid(cpuid_regs, 1);
+
+	if (!(cpuid_regs[2] & (1 << 27)) || !(cpuid_regs[2] & (1 << 28)))
+		return false;
+
+	// xcr0 bit 1 sse and bit 2 avx state
+
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	// EBX[5] AVX2
+
+	__cpuidex(cpuid_regs, 7, 0);
+
+	return cpuid_regs[1] & (1 << 5);
+}
+
+void simd::checksum_scalar(CHECKSUM& sum, const UINT64* words, SIZE_T count)
+{
+	for (SIZE_T i = 0; i < count; i++)
+	{
+		auto lane = sum.index++ % CHECKSUM_LANES;
+
+		sum.s1[lane] += words[i];
+		sum.s2[lane] += sum.s1[lane];
+	}
+
+	return;
+}
+
+void simd::checksum_avx2(CHECKSUM& sum, const UINT64* words, SIZE_T count)
+{
+	// bring the lanes in line with the vector first, a page chunk can start on any word
+
+	SIZE_T head = min(count, (CHECKSUM_LANES - sum.index % CHECKSUM_LANES) % CHECKSUM_LANES);
+
+	checksum_scalar(sum, words, head);
+
+	words += head;
+	count -= head;
+
+	__m256i s1 = _mm256_loadu_si256((__m256i*)sum.s1);
+	__m256i s2 = _mm256_loadu_si256((__m256i*)sum.s2);
+
+	SIZE_T i = 0;
+
+	for (; i + CHECKSUM_LANES <= count; i += CHECKSUM_LANES)
+	{
+		s1 = _mm256_add_epi64(s1, _mm256_loadu_si256((__m256i*)(words + i)));
+		s2 = _mm256_add_epi64(s2, s1);
+	}
+
+	_mm256_storeu_si256((__m256i*)sum.s1, s1);
+	_mm256_storeu_si256((__m256i*)sum.s2, s2);
+
+	// the host's compiled code uses legacy sse, mixing it with dirty upper halves is slow
+
+	_mm256_zeroupper();
+
+	sum.index += i;
+
+	checksum_scalar(sum, words + i, count - i);
+
+	return;
+}
+
+UINT64 simd::checksum_final(const CHECKSUM& sum)
+{
+	UINT64 result = sum.index;
+
+	for (int i = 0; i < CHECKSUM_LANES; i++)
+		result ^= _rotl64(sum.s1[i], i * 8) ^ _rotl64(sum.s2[i], 32 + i * 8);
+
+	return result;
+}
+
+namespace
+{
+	constexpr UINT64 prime1 = 0x9E3779B185EBCA87;
+	constexpr UINT64 prime2 = 0xC2B2AE3D27D4EB4F;
+	constexpr UINT64 prime3 = 0x165667B19E3779F9;
+	constexpr UINT64 prime4 = 0x85EBCA77C2B2AE63;
+	constexpr UINT64 prime5 = 0x27D4EB2F165667C5;
+
+	UINT64 mix(UINT64 accumulator, UINT64 word)
+	{
+		return _rotl64(accumulator + word * prime2, 31) * prime1;
+	}
+
+	UINT64 merge(UINT64 hash, UINT64 accumulator)
+	{
+		return (hash ^ mix(0, accumulator)) * prime1 + prime4;
+	}
+}
+
+UINT64 simd::hash(const UINT64* words, SIZE_T count)
+{
+	UINT64 result;
+	SIZE_T i = 0;
+
+	if (count >= 4)
+	{
+		UINT64 v[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+
+		for (; i + 4 <= count; i += 4)
+		{
+			for (int j = 0; j < 4; j++)
+				v[j] = mix(v[j], words[i + j]);
+		}
+
+		result = _rotl64(v[0], 1) + _rotl64(v[1], 7) + _rotl64(v[2], 12) + _rotl64(v[3], 18);
+
+		for (int j = 0; j < 4; j++)
+			result = merge(result, v[j]);
+	}
+	else
+		result = prime5;
+
+	result += count * sizeof(UINT64);
+
+	for (; i < count; i++)
+		result = _rotl64(result ^ mix(0, words[i]), 27) * prime1 + prime4;
+
+	// avalanche
+
+	result ^= result >> 33;
+	result *= prime2;
+	result ^= result >> 29;
+	result *= prime3;
+	result ^= result >> 32;
+
+	return result;
+}
+
+bool simd::checksum_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, SIZE_T size, bool vector, UINT64* result)
+{
+	CHECKSUM sum{};
+
+	while (size)
+	{
+		UINT64 phys;
+		if (!memory::translate(vcpu, cr3, cpl, virt, &phys))
+			return false;
+
+		// the window only maps one page at a time
+
+		SIZE_T chunk = min(size, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+		auto words = (const UINT64*)memory::map_phys(vcpu, phys);
+
+		if (!words)
+			return false;
+
+		if (vector)
+			checksum_avx2(sum, words, chunk / 8);
+		else
+			checksum_scalar(sum, words, chunk / 8);
+
+		virt += chunk;
+		size -= chunk;
+	}
+
+	*result = checksum_final(sum);
+
+	return true;
+}
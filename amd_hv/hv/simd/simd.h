@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define CHECKSUM_LANES 4
+
+// the largest buffer a single checksum hypercall may cover
+#define CHECKSUM_MAX_SIZE 0x100000
+
+// flags for the checksum hypercall
+#define CHECKSUM_SCALAR 0x1		// skip the avx2 path, to compare against it
+
+// order dependent checksum over 8 byte words, CHECKSUM_LANES interleaved fletcher sums
+// so one ymm register holds all of them. word n goes into lane n % CHECKSUM_LANES
+struct CHECKSUM
+{
+	UINT64	s1[CHECKSUM_LANES];
+	UINT64	s2[CHECKSUM_LANES];
+	UINT64	index;				// words summed so far
+};
+
+namespace simd
+{
+	// avx2 needs the cpu to support it and the os to have ymm state enabled in xcr0
+	bool avx2_supported();
+
+	void checksum_scalar(CHECKSUM& sum, const UINT64* words, SIZE_T count);
+
+	// gives the same result as checksum_scalar, the caller must have called xsave::acquire
+	void checksum_avx2(CHECKSUM& sum, const UINT64* words, SIZE_T count);
+
+	UINT64 checksum_final(const CHECKSUM& sum);
+
+	// xxh64 with seed 0 over count words. the checksum's sums let some edits of several words cancel out,
+	// this is what decides whether a page changed
+	UINT64 hash(const UINT64* words, SIZE_T count);
+
+	// checksums a buffer of caller's guest virtual memory, virt and size have to be 8 byte aligned.
+	// fails if any page of it isnt present or cpl couldnt read it
+	bool checksum_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, SIZE_T size, bool vector, UINT64* result);
+}
@@ -29,10 +29,45 @@ struct GENERAL_REGISTERS
     UINT64  rax;
 };
 
+// one bit per GENERAL_REGISTERS slot, the bit index is the slot index. handlers declare which ones they use with these
+enum GPR_MASK : UINT16
+{
+    gpr_none = 0,
+    gpr_r15  = 1 << 0,
+    gpr_r14  = 1 << 1,
+    gpr_r13  = 1 << 2,
+    gpr_r12  = 1 << 3,
+    gpr_r11  = 1 << 4,
+    gpr_r10  = 1 << 5,
+    gpr_r9   = 1 << 6,
+    gpr_r8   = 1 << 7,
+    gpr_rdi  = 1 << 8,
+    gpr_rsi  = 1 << 9,
+    gpr_rbp  = 1 << 10,
+    gpr_rsp  = 1 << 11,
+    gpr_rbx  = 1 << 12,
+    gpr_rdx  = 1 << 13,
+    gpr_rcx  = 1 << 14,
+    gpr_rax  = 1 << 15,
+    gpr_all  = 0xFFFF,
+};
+
+// xmm0 - xmm5, spilled by the vmexit handler in helpers.asm right under GENERAL_REGISTERS
+struct GUEST_XMM
+{
+    M128A   xmm[6];
+};
+
 enum AMD_MSR : UINT64
 {
     vm_cr       = 0xC0010114,
     vm_hsave_pa = 0xC0010117,
+    perf_ctl3   = 0xC0010003,
+    perf_ctr3   = 0xC0010007,
+
+    // core performance counter extensions, counter n is at + 2 * n
+    perf_ctl_ext0 = 0xC0010200,
+    perf_ctr_ext0 = 0xC0010201,
 };
 
 // 3.1.7 Extended Feature Enable Register (EFER)
@@ -85,6 +120,31 @@ union AMD_VM_CR_MSR
 };
 
 
+// 13.2.1 Performance Counters, PerfEvtSeln
+union AMD_PERF_CTL_MSR
+{
+    struct
+    {
+        UINT64 event_select     : 8;    // EventSelect[7:0]
+        UINT64 unit_mask        : 8;
+        UINT64 usr              : 1;    // count while cpl is 1, 2 or 3
+        UINT64 os               : 1;    // count while cpl is 0
+        UINT64 edge             : 1;
+        UINT64 reserved1        : 1;
+        UINT64 interrupt        : 1;    // signal the apic LVT performance counter entry on overflow
+        UINT64 reserved2        : 1;
+        UINT64 enable           : 1;
+        UINT64 invert           : 1;
+        UINT64 counter_mask     : 8;
+        UINT64 event_select_hi  : 4;    // EventSelect[11:8]
+        UINT64 reserved3        : 4;
+        UINT64 guest_only       : 1;    // only count while in guest mode
+        UINT64 host_only        : 1;    // only count while in host mode
+        UINT64 reserved4        : 22;
+    };
+    UINT64 value;
+};
+
 // 14.1.3  Processor Initialization State 
 // Table 14-2. Initial State of Segment-Register Attributes
 union SEGMENT_ATTRIBUTE
@@ -227,14 +287,17 @@ union INTERCEPT_VECTOR_2
         UINT32 ss : 1;          // #SS (Stack Fault)
         UINT32 gp : 1;          // #GP (General Protection)
         UINT32 pf : 1;          // #PF (Page Fault)
+        UINT32 reserved3 : 1;   // Vector 15 (Reserved)
         UINT32 mf : 1;          // #MF (X87 Floating Point)
         UINT32 ac : 1;          // #AC (Alignment Check)
         UINT32 mc : 1;          // #MC (Machine Check)
         UINT32 xf : 1;          // #XF (SIMD Floating Point)
-        UINT32 sx : 1;          // #SX (Security Exception)
+        UINT32 reserved4 : 1;   // Vector 20 (Reserved)
         UINT32 cp : 1;          // #CP (Control Protection)
-
-        UINT32 reserved3 : 11;
+        UINT32 reserved5 : 7;   // Vectors 22-28 (Reserved)
+        UINT32 vc : 1;          // #VC (VMM Communication)
+        UINT32 sx : 1;          // #SX (Security Exception)
+        UINT32 reserved6 : 1;
     };
     UINT32 value;
 };
@@ -436,6 +499,13 @@ union HARDENING_CONTROL
     UINT64 value;
 };
 
+// one core performance counter, PerfEvtSeln and PerfCtrn
+struct GUEST_PMC
+{
+    UINT64 ctl;
+    UINT64 ctr;
+};
+
 union VIRTUAL_CONTROL_2
 {
     struct
@@ -595,7 +665,9 @@ struct VMCB_STATE_SAVE_AREA
     UINT64      br_to;                  // 0x280
     UINT64      last_excp_from;         // 0x288
     UINT64      last_excp_to;           // 0x290
-    UINT8       reserved7[0x530];       // 0x298
+    UINT8       reserved7[0x68];        // 0x298
+    GUEST_PMC   perf[6];                // 0x300, the guest's core counters while pmc virtualization is enabled
+    UINT8       reserved8[0x468];       // 0x360
 
 
     __forceinline void setup_x86_segment(x86segment* seg, UINT16 segment_selector) 
@@ -680,10 +752,10 @@ __declspec(align(PAGE_SIZE)) struct VMCB
 // AMD64 Manual Volume 2: Appendix C SVM Intercept Exit Codes
 enum SVMEXIT : UINT64
 {
-    INVALID              = -1,
-    BUSY                 = -2,
-    VMEXIT_IDLE_REQUIRED = -3,
-    VMEXIT_INVALID_PMC   = -4,
+    INVALID              = (UINT64)-1,
+    BUSY                 = (UINT64)-2,
+    VMEXIT_IDLE_REQUIRED = (UINT64)-3,
+    VMEXIT_INVALID_PMC   = (UINT64)-4,
 
     UNUSED = 0xF000000,
 
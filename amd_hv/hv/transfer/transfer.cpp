@@ -0,0 +1,172 @@
+#include "transfer.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+
+namespace transfer
+{
+	// entries are read and written back this many at a time
+	constexpr UINT64 block_entries = 32;
+
+	constexpr UINT64 bounce_size = 0x200;
+
+	constexpr UINT64 cache_size = 16;
+
+	// lists usually hit the same few pages over and over, a page walk maps four tables
+	struct TRANSLATION_CACHE
+	{
+		UINT64	cr3[cache_size];
+		UINT64	page[cache_size];
+		UINT64	phys[cache_size];
+		bool	writable[cache_size];
+	};
+
+	// the cache only ever holds walks of one call, so they were all made with the caller's cpl
+	bool resolve(vcpu* vcpu, TRANSLATION_CACHE& cache, UINT64 cr3, UINT8 cpl, UINT64 address, bool physical, bool writable, UINT64* phys)
+	{
+		UINT64 page = address & ~(UINT64)(PAGE_SIZE - 1);
+
+		if (physical)
+		{
+			// device memory can have side effects, only ram is copied
+
+			UINT64 next;
+
+			*phys = address;
+
+			return memory::is_ram(page, &next);
+		}
+
+		UINT64 slot = (page >> PAGE_SHIFT) % cache_size;
+
+		if (cache.cr3[slot] == cr3 && cache.page[slot] == page && (cache.writable[slot] || !writable))
+		{
+			*phys = cache.phys[slot] + (address & (PAGE_SIZE - 1));
+			return true;
+		}
+
+		if (!memory::translate(vcpu, cr3, cpl, page, &cache.phys[slot], writable))
+		{
+			cache.cr3[slot] = 0;
+			return false;
+		}
+
+		cache.cr3[slot]			= cr3;
+		cache.page[slot]		= page;
+		cache.writable[slot]	= writable;
+
+		*phys = cache.phys[slot] + (address & (PAGE_SIZE - 1));
+
+		return true;
+	}
+
+	UINT64 copy(vcpu* vcpu, TRANSLATION_CACHE& cache, UINT64 caller_cr3, UINT8 cpl, const TRANSFER_ENTRY& entry)
+	{
+		bool write		= entry.flags & TRANSFER_WRITE;
+		bool physical	= entry.flags & TRANSFER_PHYSICAL;
+		UINT64 cr3		= entry.cr3 ? entry.cr3 : caller_cr3;
+
+		UINT8 bounce[bounce_size];
+
+		for (UINT64 done = 0; done < entry.length; )
+		{
+			UINT64 target = entry.address + done;
+			UINT64 buffer = entry.buffer + done;
+
+			// neither side may cross a page, the next one can be anywhere physically
+
+			UINT64 chunk = min(entry.length - done, bounce_size);
+
+			chunk = min(chunk, PAGE_SIZE - (target & (PAGE_SIZE - 1)));
+			chunk = min(chunk, PAGE_SIZE - (buffer & (PAGE_SIZE - 1)));
+
+			UINT64 target_phys, buffer_phys;
+
+			if (!resolve(vcpu, cache, cr3, cpl, target, physical, write, &target_phys) ||
+				!resolve(vcpu, cache, caller_cr3, cpl, buffer, false, !write, &buffer_phys))
+				return call_fault;
+
+			// the window maps one page at a time, so everything goes through the bounce buffer.
+			// a page table can still point at device memory, map_phys refuses it
+
+			UINT64 from	= write ? buffer_phys : target_phys;
+			UINT64 to	= write ? target_phys : buffer_phys;
+
+			auto source = memory::map_phys(vcpu, from);
+
+			if (!source)
+				return call_fault;
+
+			memcpy(bounce, source, chunk);
+
+			auto destination = memory::map_phys(vcpu, to);
+
+			if (!destination)
+				return call_fault;
+
+			memcpy(destination, bounce, chunk);
+
+			done += chunk;
+		}
+
+		return call_success;
+	}
+}
+
+UINT64 transfer::scatter_gather(vcpu* vcpu, UINT64 list, UINT64 count, UINT64* processed, UINT64* failed)
+{
+	auto& state = vcpu->get_guest().get_state_save_area();
+
+	*processed	= 0;
+	*failed		= 0;
+
+	if (count > TRANSFER_MAX_ENTRIES)
+		return call_bad_args;
+
+	UINT64 caller_cr3 = state.cr3.AsUInt;
+
+	TRANSLATION_CACHE cache{};
+	TRANSFER_ENTRY entries[block_entries];
+
+	UINT64 bytes = 0;
+
+	while (*processed < count && bytes < TRANSFER_MAX_BYTES)
+	{
+		UINT64 address	= list + *processed * sizeof(TRANSFER_ENTRY);
+		UINT64 block	= min(count - *processed, block_entries);
+
+		if (!memory::read_guest(vcpu, caller_cr3, state.cpl, address, entries, block * sizeof(TRANSFER_ENTRY)))
+			return call_fault;
+
+		UINT64 i = 0;
+
+		for (; i < block && bytes < TRANSFER_MAX_BYTES; i++)
+		{
+			auto& entry = entries[i];
+
+			// reading another process or physical memory leaks as much as writing it corrupts
+
+			bool foreign = entry.flags & TRANSFER_PHYSICAL || (entry.cr3 && entry.cr3 != caller_cr3);
+
+			if ((entry.flags & ~(TRANSFER_WRITE | TRANSFER_PHYSICAL)) || entry.length > TRANSFER_MAX_BYTES)
+				entry.status = call_bad_args;
+			else if (foreign && state.cpl)
+				entry.status = call_denied;
+			else
+				entry.status = (UINT16)copy(vcpu, cache, caller_cr3, state.cpl, entry);
+
+			if (entry.status != call_success)
+				(*failed)++;
+
+			bytes += entry.length;
+		}
+
+		if (!memory::write_guest(vcpu, caller_cr3, state.cpl, address, entries, i * sizeof(TRANSFER_ENTRY)))
+			return call_fault;
+
+		*processed += i;
+	}
+
+	return call_success;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+#define TRANSFER_MAX_ENTRIES 4096
+
+// bytes one call copies at most, the entries after that are left for the next call. its also the longest entry
+#define TRANSFER_MAX_BYTES 0x100000
+
+// flags of a TRANSFER_ENTRY
+#define TRANSFER_WRITE		0x1		// from buffer into address, otherwise from address into buffer
+#define TRANSFER_PHYSICAL	0x2		// address is guest physical, cr3 is ignored
+
+// one piece of a scatter gather list, in the caller's memory
+struct TRANSFER_ENTRY
+{
+	UINT64	address;	// in the address space of cr3
+	UINT64	cr3;		// 0 for the caller's own
+	UINT64	buffer;		// in the caller's address space
+	UINT32	length;
+	UINT16	flags;
+	UINT16	status;		// HYPERCALL_STATUS, written back
+};
+
+// copies between the caller's buffers and any address space or physical memory in one exit.
+// anything outside of the caller's own address space is for the kernel only, reads as well as writes
+namespace transfer
+{
+	// processes entries of list from the first on, processed and failed are how many were done
+	// and how many of those didnt succeed. returns a HYPERCALL_STATUS for the list itself
+	UINT64 scatter_gather(vcpu* vcpu, UINT64 list, UINT64 count, UINT64* processed, UINT64* failed);
+}
@@ -0,0 +1,157 @@
+#include "tsc.h"
+
+#include "../hv.h"
+#include "../../utilities/utilities.h"
+
+namespace tsc
+{
+	TSC_MODE		mode;
+	UINT64			exit_overhead;
+	UINT64			max_skew;
+	volatile LONG64	generation;
+
+	// the highest value handed out by an intercepted read on any core
+	volatile LONG64	last_read;
+
+	UINT64 lowest_compensation()
+	{
+		UINT64 lowest = MAXUINT64;
+
+		int core_amt = utilities::get_cpu_cores();
+		for (int i = 0; i < core_amt; i++)
+			lowest = min(lowest, hv::get_vcpu(i)->get_tsc().compensated_cycles);
+
+		return lowest;
+	}
+}
+
+void tsc::configure(TSC_MODE new_mode, UINT64 new_exit_overhead, UINT64 new_max_skew)
+{
+	mode			= new_mode;
+	exit_overhead	= new_exit_overhead;
+	max_skew		= new_max_skew;
+
+	// every vcpu picks this up on its next exit
+
+	InterlockedIncrement64(&generation);
+
+	return;
+}
+
+void tsc::on_exit(vcpu* vcpu)
+{
+	auto& state = vcpu->get_tsc();
+
+	state.exit_tsc = __rdtsc();
+
+	// vmrun, however little the guest ran and the vmexit, the shortest of these is the
+	// tightest bound on the world switch we can get from the host
+
+	if (state.resume_tsc)
+	{
+		UINT64 trip = state.exit_tsc - state.resume_tsc;
+
+		if (!state.round_trip || trip < state.round_trip)
+			state.round_trip = trip;
+	}
+
+	return;
+}
+
+void tsc::on_resume(vcpu* vcpu)
+{
+	auto& guest	= vcpu->get_guest();
+	auto& state	= vcpu->get_tsc();
+
+	if (state.generation != (UINT64)generation)
+	{
+		state.generation = generation;
+
+		vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(guest).rdtsc	= mode == tsc_mode_intercept;
+		vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions2>(guest).rdtscp	= mode == tsc_mode_intercept;
+
+		// the raw tsc again, the guest sees everything that was hidden at once. nothing is hidden
+		// anymore, so the skew starts over too
+
+		if (mode == tsc_mode_off && guest.get_control_area().tsc_offset)
+		{
+			vmcb::modify<&VMCB_CONTROL_AREA::tsc_offset>(guest) = 0;
+
+			state.compensated_cycles	= 0;
+			state.skew_floor			= 0;
+		}
+	}
+
+	if (mode == tsc_mode_off)
+	{
+		state.resume_tsc = __rdtsc();
+		return;
+	}
+
+	// the guest tsc stays monotonic on this core, because we only ever hide time 
+	// that passed after the guest was already stopped, plus at most one world switch
+
+	UINT64 now		= __rdtsc();
+	UINT64 elapsed	= now - state.exit_tsc + min(exit_overhead, state.round_trip);
+
+	if (max_skew)
+	{
+		// refreshing the floor scans every vcpu, so we only do it every 64 exits,
+		// a stale floor is lower than the real one so it can only cap more, never less
+
+		if (!(state.compensated_exits % 64))
+			state.skew_floor = lowest_compensation();
+
+		UINT64 limit = state.skew_floor + max_skew;
+		UINT64 allowed = limit > state.compensated_cycles ? limit - state.compensated_cycles : 0;
+
+		if (elapsed > allowed)
+		{
+			state.residual_cycles += elapsed - allowed;
+			elapsed = allowed;
+		}
+	}
+
+	vmcb::modify<&VMCB_CONTROL_AREA::tsc_offset>(guest) -= elapsed;
+
+	state.compensated_cycles += elapsed;
+	state.compensated_exits++;
+
+	state.resume_tsc = now;
+
+	return;
+}
+
+UINT64 tsc::read(vcpu* vcpu, UINT32* aux)
+{
+	auto& control	= vcpu->get_guest().get_control_area();
+	auto& state		= vcpu->get_tsc();
+
+	INT64 value = __rdtscp(aux) + control.tsc_offset;
+
+	// cores are compensated independently, so one core could read a value lower than
+	// another core already has, we hand out at least one more than the highest value seen on any core
+
+	INT64 last = last_read;
+
+	for (;;)
+	{
+		INT64 next = value > last ? value : last + 1;
+		INT64 seen = InterlockedCompareExchange64(&last_read, next, last);
+
+		if (seen == last)
+		{
+			if (next != value)
+				state.clamped_reads++;
+
+			return next;
+		}
+
+		last = seen;
+	}
+}
+
+UINT64 tsc::get_skew(vcpu* vcpu)
+{
+	return vcpu->get_tsc().compensated_cycles - lowest_compensation();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+enum TSC_MODE : UINT64
+{
+	tsc_mode_off		= 0,	// the guest sees the raw tsc, including the time spent in the host. switching to it jumps forward
+	tsc_mode_offset		= 1,	// host time is subtracted through control.tsc_offset, nothing is intercepted
+	tsc_mode_intercept	= 2,	// same as above, and rdtsc/rdtscp are intercepted to stay monotonic across cores
+};
+
+// per vcpu bookkeeping of the time hidden from the guest
+struct TSC_STATE
+{
+	UINT64	exit_tsc;				// host tsc when handle_vmexit was entered
+	UINT64	resume_tsc;				// host tsc when the guest was last resumed
+	UINT64	round_trip;				// shortest resume to exit seen, 0 until measured. bounds exit_overhead
+	UINT64	generation;				// last configuration applied to this vcpu
+	UINT64	compensated_exits;
+	UINT64	compensated_cycles;		// host time hidden from the guest
+	UINT64	residual_cycles;		// host time left visible to keep the cores within max_skew
+	UINT64	clamped_reads;			// intercepted reads raised to stay monotonic across cores
+	UINT64	skew_floor;				// cached lowest compensated_cycles of all cores, used for max_skew
+};
+
+namespace tsc
+{
+	// exit_overhead is added to every exit for the part of the world switch we cant measure from the host,
+	// it must stay below the real vmexit latency or the guest tsc can go backwards. every core clamps it
+	// to the shortest world switch it measured and hides nothing extra until it has measured one
+	// max_skew caps how far ahead of the least compensated core any core may go, 0 is unlimited.
+	// only tsc_mode_intercept keeps reads monotonic across cores by itself, offset mode needs a cap
+	void configure(TSC_MODE mode, UINT64 exit_overhead, UINT64 max_skew);
+
+	// first thing on a vmexit
+	void on_exit(vcpu* vcpu);
+
+	// last thing before resuming the guest, applies configuration changes and compensates the exit
+	void on_resume(vcpu* vcpu);
+
+	// the tsc value the guest should observe now, only used with tsc_mode_intercept
+	UINT64 read(vcpu* vcpu, UINT32* aux);
+
+	// how far this core's compensation is ahead of the least compensated core
+	UINT64 get_skew(vcpu* vcpu);
+}
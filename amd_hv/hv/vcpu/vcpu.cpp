@@ -1,4 +1,6 @@
 #include "vcpu.h"
+#include "../hv.h"
+#include "../apic/apic.h"
 
 #include "../../utilities/utilities.h"
 
@@ -26,6 +28,69 @@ bool vcpu::setup()
 
 	host_stack = (char*)host_stack_base + KERNEL_STACK_SIZE - 0x10;
 
+	spill_masks = hv::get_spill_masks();
+
+	// everything the host needs at runtime is allocated here, we cant call into the os from host context
+
+	if (!memory::setup_window(window))
+		return false;
+
+	pause_histogram = (PAUSE_HISTOGRAM*)ExAllocatePoolZero(NonPagedPool, sizeof(PAUSE_HISTOGRAM), 'ENON');
+
+	if (!pause_histogram)
+	{
+		LOG_ERROR("couldnt allocate the pause histogram \n");
+		return false;
+	}
+
+	sample_ring = (SAMPLE_RING*)ExAllocatePoolZero(NonPagedPool, sizeof(SAMPLE_RING), 'ENON');
+
+	if (!sample_ring)
+	{
+		LOG_ERROR("couldnt allocate the sample ring \n");
+		return false;
+	}
+
+	branch_table = (BRANCH_TABLE*)ExAllocatePoolZero(NonPagedPool, sizeof(BRANCH_TABLE), 'ENON');
+
+	if (!branch_table)
+	{
+		LOG_ERROR("couldnt allocate the branch table \n");
+		return false;
+	}
+
+	cost_table = (EXIT_COST_TABLE*)ExAllocatePoolZero(NonPagedPool, sizeof(EXIT_COST_TABLE), 'ENON');
+
+	if (!cost_table)
+	{
+		LOG_ERROR("couldnt allocate the exit cost table \n");
+		return false;
+	}
+
+	capture_ring = (CAPTURE_RING*)ExAllocatePoolZero(NonPagedPool, sizeof(CAPTURE_RING), 'ENON');
+
+	if (!capture_ring)
+	{
+		LOG_ERROR("couldnt allocate the capture ring \n");
+		return false;
+	}
+
+	decode_cache = (DECODE_CACHE*)ExAllocatePoolZero(NonPagedPool, sizeof(DECODE_CACHE), 'ENON');
+
+	if (!decode_cache)
+	{
+		LOG_ERROR("couldnt allocate the decode cache \n");
+		return false;
+	}
+
+	if (!xsave::setup(xsave))
+		return false;
+
+	// setup runs on this vcpu's own core, other cores address their kicks to its apic
+
+	mailbox::init(&mailbox);
+	apic_id = apic::id();
+
 	CONTEXT ctx{};
 	RtlCaptureContext(&ctx);
 
@@ -50,6 +115,8 @@ bool vcpu::setup()
 
 	control.intercept_instructions2.vmrun = 1; // hv wont start without this
 	control.intercept_instructions1.cpuid = 1; // set this to show we are hypervised 
+	control.intercept_instructions2.vmmcall = 1; // hypercall interface, see hv.h
+	control.intercept_instructions1.nmi = 1; // other cores wake this one with an nmi, see mailbox.h
 
 	// rip and rsp are set outside of this function
 	// we initialize other important registers here
@@ -230,11 +297,18 @@ void vcpu::prologue()
 	// we complete the general registers class to fully represent the guest's registers for 
 	// better quality of life and ease of use
 
-	backup_rax = regs->rax;
-	regs->rax  = guest_vmcb.get_state_save_area().rax;
-	regs->rsp  = guest_vmcb.get_state_save_area().rsp;
+	// rax and rsp only get filled in if this exit's handler declared them, see handlers.h
 
-	// we dont need to backup or restore rsp because its never overwriting it on POPAQ macro
+	if (spill_mask & gpr_rax)
+	{
+		backup_rax = regs->rax;
+		regs->rax  = guest_vmcb.get_state_save_area().rax;
+	}
+
+	if (spill_mask & gpr_rsp)
+		regs->rsp = guest_vmcb.get_state_save_area().rsp;
+
+	// we dont need to backup or restore rsp because its never restored from the frame in helpers.asm
 
 	// mark everything as cached for better vmrun performance
 	// later on some parts of the VMCB may be changed which would require 
@@ -242,6 +316,10 @@ void vcpu::prologue()
 
 	guest_vmcb.get_control_area().vmcb_clean.reset();
 
+	// from here on cached fields have to be changed through the accessors in vmcb.h
+
+	vmcb::snapshot(this);
+
 	// The VMRUN instruction reads, but does not change, thevalue of the TLB_CONTROL field.
 	// we must make sure to restore this to its idle state to avoid unnecessary tlb flushes
 	
@@ -254,12 +332,17 @@ void vcpu::epilogue()
 {
 	// save any modifications into the guest's state 
 
-	guest_vmcb.get_state_save_area().rax = regs->rax;
-	guest_vmcb.get_state_save_area().rsp = regs->rsp;
+	if (spill_mask & gpr_rax)
+	{
+		guest_vmcb.get_state_save_area().rax = regs->rax;
 
-	// restore our rax
+		// restore our rax
 
-	regs->rax = backup_rax;
+		regs->rax = backup_rax;
+	}
+
+	if (spill_mask & gpr_rsp)
+		guest_vmcb.get_state_save_area().rsp = regs->rsp;
 
 	return;
 }
@@ -279,6 +362,11 @@ GENERAL_REGISTERS* vcpu::get_regs()
 	return regs;
 }
 
+GUEST_XMM* vcpu::get_xmm()
+{
+	return xmm;
+}
+
 UINT64 vcpu::get_guest_phys() 
 {
 	return guest_vmcb_phys;
@@ -299,9 +387,121 @@ UINT8& vcpu::wants_shutdown()
 	return should_shutdown;
 }
 
+const UINT16*& vcpu::get_spill_masks()
+{
+	return spill_masks;
+}
+
+UINT64 vcpu::get_spill_mask()
+{
+	return spill_mask;
+}
+
+TSC_STATE& vcpu::get_tsc()
+{
+	return tsc;
+}
+
+MAP_WINDOW& vcpu::get_window()
+{
+	return window;
+}
+
+PAUSE_HISTOGRAM* vcpu::get_pause_histogram()
+{
+	return pause_histogram;
+}
+
+SAMPLE_RING* vcpu::get_sample_ring()
+{
+	return sample_ring;
+}
+
+BRANCH_TABLE* vcpu::get_branch_table()
+{
+	return branch_table;
+}
+
+EXIT_COST_TABLE* vcpu::get_cost_table()
+{
+	return cost_table;
+}
+
+CAPTURE_RING* vcpu::get_capture_ring()
+{
+	return capture_ring;
+}
+
+XSAVE_STATE& vcpu::get_xsave()
+{
+	return xsave;
+}
+
+INSTRUCTION_STATS& vcpu::get_instruction_stats()
+{
+	return instruction_stats;
+}
+
+DECODE_CACHE* vcpu::get_decode_cache()
+{
+	return decode_cache;
+}
+
+EXCEPTION_STATE& vcpu::get_exception_state()
+{
+	return exception_state;
+}
+
+EVENT_QUEUE& vcpu::get_event_queue()
+{
+	return event_queue;
+}
+
+NOTIFY_STATE& vcpu::get_notify_state()
+{
+	return notify_state;
+}
+
+JOB& vcpu::get_job()
+{
+	return job;
+}
+
+BROADCAST_SLOT& vcpu::get_broadcast()
+{
+	return broadcast;
+}
+
+MAILBOX& vcpu::get_mailbox()
+{
+	return mailbox;
+}
+
+UINT32 vcpu::get_apic_id()
+{
+	return apic_id;
+}
+
+COMMAND_STATS* vcpu::get_command_stats()
+{
+	return command_stats;
+}
+
+bool vcpu::post(MAILBOX_HANDLER handler, void* context)
+{
+	auto result = mailbox::post(&mailbox, handler, context);
+
+	// a core thats in the host already takes the nmi right after its next vmrun, and drains again then
+
+	if (result == mailbox_kick)
+		apic::send_ipi(APIC_DELIVERY_MODE_NMI | APIC_ICR_ASSERT, apic_id);
+
+	return result != mailbox_full;
+}
+
 void vcpu::inject_exception(EXCEPTION_VECTOR exception, INTERRUPTION_TYPE type, int error )
 {
-	auto& event = guest_vmcb.get_control_area().event_inject;
+	EVENT_INJECTION event{};
 
 	// which exceptions can have error codes
 	// we use a static array for best performance
@@ -342,5 +542,9 @@ void vcpu::inject_exception(EXCEPTION_VECTOR exception, INTERRUPTION_TYPE type,
 		event.error_code = error;
 	}
 
+	// it goes through the queue so an event already waiting for this vcpu isnt overwritten
+
+	events::queue(this, event);
+
 	return;
 }
\ No newline at end of file
@@ -1,6 +1,23 @@
 #pragma once
 
 #include "../svm/svm.h"
+#include "../vmcb/vmcb.h"
+#include "../tsc/tsc.h"
+#include "../memory/memory.h"
+#include "../pause_profiler/pause_profiler.h"
+#include "../sampler/sampler.h"
+#include "../lbr/lbr.h"
+#include "../exit_cost/exit_cost.h"
+#include "../xsave/xsave.h"
+#include "../instruction/instruction.h"
+#include "../exceptions/exceptions.h"
+#include "../events/events.h"
+#include "../notify/notify.h"
+#include "../jobs/jobs.h"
+#include "../mailbox/mailbox.h"
+#include "../broadcast/broadcast.h"
+#include "../commands/commands.h"
+#include "../capture/capture.h"
 
 __declspec(align(0x1000)) struct vcpu
 {
@@ -15,9 +32,32 @@ private:
 	UINT64	host_vmcb_phys;			// these are for vmsave, vmload, vmrun instructions
 
 	GENERAL_REGISTERS* regs;
+	GUEST_XMM*	xmm;
+	const UINT16* spill_masks;		// these two are used by helpers.asm, see hv::get_spill_masks
+	UINT64	spill_mask;				// the guest registers spilled on the current exit
 	UINT64	backup_rax;
 	UINT8	should_shutdown;
 
+	TSC_STATE tsc;
+
+	MAP_WINDOW window;
+	PAUSE_HISTOGRAM* pause_histogram;
+	SAMPLE_RING* sample_ring;
+	BRANCH_TABLE* branch_table;
+	EXIT_COST_TABLE* cost_table;
+	CAPTURE_RING* capture_ring;
+	XSAVE_STATE xsave;
+	INSTRUCTION_STATS instruction_stats;
+	DECODE_CACHE* decode_cache;
+	EXCEPTION_STATE exception_state;
+	EVENT_QUEUE event_queue;
+	NOTIFY_STATE notify_state;
+	JOB job;
+	BROADCAST_SLOT broadcast;
+	MAILBOX mailbox;
+	UINT32 apic_id;
+	COMMAND_STATS command_stats[COMMAND_MAX];
+
 public:
 
 	bool setup();
@@ -34,6 +74,8 @@ public:
 
 	GENERAL_REGISTERS* get_regs();
 
+	GUEST_XMM* get_xmm();
+
 	UINT64 get_guest_phys();
 
 	UINT64 get_host_phys();
@@ -42,5 +84,51 @@ public:
 
 	UINT8& wants_shutdown();
 
+	// the table helpers.asm picks the next exit's spill mask from, and the mask of the current exit
+	const UINT16*& get_spill_masks();
+
+	UINT64 get_spill_mask();
+
+	TSC_STATE& get_tsc();
+
+	MAP_WINDOW& get_window();
+
+	PAUSE_HISTOGRAM* get_pause_histogram();
+
+	SAMPLE_RING* get_sample_ring();
+
+	BRANCH_TABLE* get_branch_table();
+
+	EXIT_COST_TABLE* get_cost_table();
+
+	CAPTURE_RING* get_capture_ring();
+
+	XSAVE_STATE& get_xsave();
+
+	INSTRUCTION_STATS& get_instruction_stats();
+
+	DECODE_CACHE* get_decode_cache();
+
+	EXCEPTION_STATE& get_exception_state();
+
+	EVENT_QUEUE& get_event_queue();
+
+	NOTIFY_STATE& get_notify_state();
+
+	JOB& get_job();
+
+	BROADCAST_SLOT& get_broadcast();
+
+	MAILBOX& get_mailbox();
+
+	UINT32 get_apic_id();
+
+	// indexed by command code
+	COMMAND_STATS* get_command_stats();
+
+	// queues a request for this core's host from any other core and wakes it if it runs guest code,
+	// false if the mailbox is full. only between hv::launch and hv::shutdown, nothing drains it otherwise
+	bool post(MAILBOX_HANDLER handler, void* context);
+
 	void inject_exception(EXCEPTION_VECTOR exception, INTERRUPTION_TYPE type = INTERRUPTION_TYPE::HardwareException, int error = 0);
 };
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "vmcb.h"
+
+#include "../hv.h"
+#include "../vcpu/vcpu.h"
+#include "../memory/memory.h"
+#include "../commands/commands.h"
+#include "../../utilities/utilities.h"
+
+#ifdef VMCB_CLEAN_DEBUG
+
+namespace vmcb
+{
+	VMCB* snapshots;
+
+	struct CACHED_FIELD
+	{
+		UINT32		offset;		// from the start of the vmcb
+		UINT32		size;
+		UINT64		bit;
+		char		name[VMCB_FIELD_NAME_LENGTH];
+	};
+
+	template <typename A>
+	constexpr UINT32 area_offset = offsetof(VMCB, control_area);
+
+	template <>
+	constexpr UINT32 area_offset<VMCB_STATE_SAVE_AREA> = offsetof(VMCB, state_save_area);
+
+#define VMCB_CACHED_FIELD_ENTRY(area, field, bit) \
+	{ area_offset<area> + (UINT32)offsetof(area, field), sizeof(area::field), bit, #field },
+
+	constexpr CACHED_FIELD cached_fields[] = { VMCB_CACHED_FIELDS(VMCB_CACHED_FIELD_ENTRY) };
+
+#undef VMCB_CACHED_FIELD_ENTRY
+
+	// per core, only the core itself counts into it
+	struct VERIFY_STATS
+	{
+		UINT64			verified;	// exits diffed
+		VMCB_MISMATCH	fields[RTL_NUMBER_OF(cached_fields)];
+	};
+
+	VERIFY_STATS* stats;
+
+	// core index, buffer, capacity in VMCB_MISMATCH-s in.
+	// how many were written, the exits verified and the mismatches of all fields out
+	UINT64 stats_command(vcpu* vcpu, GENERAL_REGISTERS* regs)
+	{
+		auto& state		= vcpu->get_guest().get_state_save_area();
+		auto& counts	= stats[regs->rcx];
+
+		UINT64 written		= 0;
+		UINT64 mismatches	= 0;
+
+		for (auto& field : counts.fields)
+		{
+			if (!field.count)
+				continue;
+
+			mismatches += field.count;
+
+			if (written == regs->r8)
+				continue;
+
+			if (!memory::write_guest(vcpu, state.cr3.AsUInt, state.cpl, regs->rdx + written * sizeof(VMCB_MISMATCH), &field, sizeof(field)))
+				return call_fault;
+
+			written++;
+		}
+
+		regs->rcx	= written;
+		regs->rdx	= counts.verified;
+		regs->r8	= mismatches;
+
+		return call_success;
+	}
+}
+
+bool vmcb::setup()
+{
+	int core_amt = utilities::get_cpu_cores();
+
+	snapshots	= (VMCB*)ExAllocatePoolZero(NonPagedPool, sizeof(VMCB) * core_amt, 'ENON');
+	stats		= (VERIFY_STATS*)ExAllocatePoolZero(NonPagedPool, sizeof(VERIFY_STATS) * core_amt, 'ENON');
+
+	if (!snapshots || !stats)
+		return false;
+
+	// the names are filled in once, verify only counts
+
+	for (int i = 0; i < core_amt; i++)
+	{
+		for (UINT32 j = 0; j < RTL_NUMBER_OF(cached_fields); j++)
+			memcpy(stats[i].fields[j].name, cached_fields[j].name, VMCB_FIELD_NAME_LENGTH);
+	}
+
+	// statistics, user mode may read them
+
+	return commands::add(HYPERCALL_VMCB_STATS, { stats_command, "vmcb stats", 1, 3, COMMAND_SESSION, { arg_core, arg_address, arg_value } });
+}
+
+void vmcb::cleanup()
+{
+	if (snapshots)
+		ExFreePoolWithTag(snapshots, 'ENON');
+
+	if (stats)
+		ExFreePoolWithTag(stats, 'ENON');
+
+	snapshots	= nullptr;
+	stats		= nullptr;
+
+	return;
+}
+
+void vmcb::snapshot(vcpu* vcpu)
+{
+	memcpy(&snapshots[utilities::get_current_cpu_idx()], &vcpu->get_guest(), sizeof(VMCB));
+	return;
+}
+
+void vmcb::verify(vcpu* vcpu)
+{
+	auto& guest		= vcpu->get_guest();
+	auto& clean		= guest.get_control_area().vmcb_clean;
+	auto idx		= utilities::get_current_cpu_idx();
+	auto snapshot	= &snapshots[idx];
+	auto& counts	= stats[idx];
+
+	counts.verified++;
+
+	for (UINT32 i = 0; i < RTL_NUMBER_OF(cached_fields); i++)
+	{
+		auto& field = cached_fields[i];
+
+		if (!(clean.value & field.bit))
+			continue;
+
+		if (!memcmp((UINT8*)&guest + field.offset, (UINT8*)snapshot + field.offset, field.size))
+			continue;
+
+		// a field changed without clearing its clean bit
+
+		counts.fields[i].count++;
+		counts.fields[i].last_exit_code = guest.get_control_area().exit_code;
+
+		clean.value &= ~field.bit;
+	}
+
+	return;
+}
+
+#endif
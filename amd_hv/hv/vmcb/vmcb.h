@@ -0,0 +1,168 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// in debug builds the guest vmcb is diffed around every exit, a cached field that changed
+// while its clean bit stayed set gets counted and its bit cleared, so the bug shows up in HYPERCALL_VMCB_STATS
+// instead of as stale state. release builds dont register the call
+#ifdef _DEBUG
+#define VMCB_CLEAN_DEBUG
+#endif
+
+#define VMCB_FIELD_NAME_LENGTH 24
+
+// per core and cached field, what the stats hypercall hands out for the fields that ever mismatched
+struct VMCB_MISMATCH
+{
+	char	name[VMCB_FIELD_NAME_LENGTH];
+	UINT64	count;
+	UINT64	last_exit_code;		// the exit that changed it last
+};
+
+// AMD64 Manual Volume 2: 15.15.3 VMCB Clean Field
+enum VMCB_CLEAN_BIT : UINT64
+{
+	clean_i		= 1 << 0,
+	clean_iopm	= 1 << 1,
+	clean_asid	= 1 << 2,
+	clean_tpr	= 1 << 3,
+	clean_np	= 1 << 4,
+	clean_crx	= 1 << 5,
+	clean_drx	= 1 << 6,
+	clean_dt	= 1 << 7,
+	clean_seg	= 1 << 8,
+	clean_cr2	= 1 << 9,
+	clean_lbr	= 1 << 10,
+	clean_avic	= 1 << 11,
+	clean_cet	= 1 << 12,	// S_CET, SSP, ISST_ADDR, which arent named in our state save area yet
+};
+
+// every vmcb field the cpu may cache between vmrun-s, and the clean bit it is cached under.
+// anything not listed here (tlb_ctl, event_inject, nrip, rip, rsp, rax, perf, ...) is reloaded by every vmrun
+// and can be written directly. v_ctl2 decides whether the lbr fields are loaded at all, so its under their bit
+#define VMCB_CACHED_FIELDS(X) \
+	X(VMCB_CONTROL_AREA,	intercept_cr,				clean_i)	\
+	X(VMCB_CONTROL_AREA,	intercept_dr,				clean_i)	\
+	X(VMCB_CONTROL_AREA,	intercept_exceptions,		clean_i)	\
+	X(VMCB_CONTROL_AREA,	intercept_instructions1,	clean_i)	\
+	X(VMCB_CONTROL_AREA,	intercept_instructions2,	clean_i)	\
+	X(VMCB_CONTROL_AREA,	intercept_instructions3,	clean_i)	\
+	X(VMCB_CONTROL_AREA,	pause_filter_threshold,		clean_i)	\
+	X(VMCB_CONTROL_AREA,	pause_filter_count,			clean_i)	\
+	X(VMCB_CONTROL_AREA,	tsc_offset,					clean_i)	\
+	X(VMCB_CONTROL_AREA,	iopm_base_phys,				clean_iopm)	\
+	X(VMCB_CONTROL_AREA,	msrpm_base_phys,			clean_iopm)	\
+	X(VMCB_CONTROL_AREA,	guest_asid,					clean_asid)	\
+	X(VMCB_CONTROL_AREA,	v_ctl,						clean_tpr)	\
+	X(VMCB_CONTROL_AREA,	v_ctl2,						clean_lbr)	\
+	X(VMCB_CONTROL_AREA,	ncr3,						clean_np)	\
+	X(VMCB_CONTROL_AREA,	avic_apic_bar,				clean_avic)	\
+	X(VMCB_CONTROL_AREA,	avic_apic_backing_page,		clean_avic)	\
+	X(VMCB_CONTROL_AREA,	avic_logical_table,			clean_avic)	\
+	X(VMCB_CONTROL_AREA,	avic_physical_table,		clean_avic)	\
+	X(VMCB_STATE_SAVE_AREA,	es,							clean_seg)	\
+	X(VMCB_STATE_SAVE_AREA,	cs,							clean_seg)	\
+	X(VMCB_STATE_SAVE_AREA,	ss,							clean_seg)	\
+	X(VMCB_STATE_SAVE_AREA,	ds,							clean_seg)	\
+	X(VMCB_STATE_SAVE_AREA,	cpl,						clean_seg)	\
+	X(VMCB_STATE_SAVE_AREA,	gdtr,						clean_dt)	\
+	X(VMCB_STATE_SAVE_AREA,	idtr,						clean_dt)	\
+	X(VMCB_STATE_SAVE_AREA,	efer,						clean_crx)	\
+	X(VMCB_STATE_SAVE_AREA,	cr4,						clean_crx)	\
+	X(VMCB_STATE_SAVE_AREA,	cr3,						clean_crx)	\
+	X(VMCB_STATE_SAVE_AREA,	cr0,						clean_crx)	\
+	X(VMCB_STATE_SAVE_AREA,	dr7,						clean_drx)	\
+	X(VMCB_STATE_SAVE_AREA,	dr6,						clean_drx)	\
+	X(VMCB_STATE_SAVE_AREA,	cr2,						clean_cr2)	\
+	X(VMCB_STATE_SAVE_AREA,	g_pat,						clean_np)	\
+	X(VMCB_STATE_SAVE_AREA,	debug_ctl,					clean_lbr)	\
+	X(VMCB_STATE_SAVE_AREA,	br_from,					clean_lbr)	\
+	X(VMCB_STATE_SAVE_AREA,	br_to,						clean_lbr)	\
+	X(VMCB_STATE_SAVE_AREA,	last_excp_from,				clean_lbr)	\
+	X(VMCB_STATE_SAVE_AREA,	last_excp_to,				clean_lbr)
+
+// vcpu::prologue marks the whole vmcb as cached on every exit, so cached fields have to be changed through
+// these, for example vmcb::write<&VMCB_CONTROL_AREA::tsc_offset>(vmcb, offset)
+// or vmcb::modify<&VMCB_CONTROL_AREA::intercept_instructions1>(vmcb).rdtsc = 1.
+// using one on a field thats not in VMCB_CACHED_FIELDS doesnt compile
+namespace vmcb
+{
+	template <auto field>
+	struct clean_bit;
+
+#define VMCB_CLEAN_BIT_OF(area, field, bit) \
+	template <> struct clean_bit<&area::field> { static constexpr UINT64 value = bit; };
+
+	VMCB_CACHED_FIELDS(VMCB_CLEAN_BIT_OF)
+
+#undef VMCB_CLEAN_BIT_OF
+
+	template <typename T>
+	struct member_of;
+
+	template <typename A, typename T>
+	struct member_of<T A::*>
+	{
+		using area = A;
+	};
+
+	template <typename A>
+	A& area(VMCB& vmcb);
+
+	template <>
+	__forceinline VMCB_CONTROL_AREA& area<VMCB_CONTROL_AREA>(VMCB& vmcb)
+	{
+		return vmcb.get_control_area();
+	}
+
+	template <>
+	__forceinline VMCB_STATE_SAVE_AREA& area<VMCB_STATE_SAVE_AREA>(VMCB& vmcb)
+	{
+		return vmcb.get_state_save_area();
+	}
+
+	// clears the field's clean bit and hands out a reference to change it through
+	template <auto field>
+	__forceinline auto& modify(VMCB& vmcb)
+	{
+		vmcb.get_control_area().vmcb_clean.value &= ~clean_bit<field>::value;
+
+		return area<typename member_of<decltype(field)>::area>(vmcb).*field;
+	}
+
+	template <auto field, typename T>
+	__forceinline void write(VMCB& vmcb, T value)
+	{
+		modify<field>(vmcb) = value;
+		return;
+	}
+
+#ifdef VMCB_CLEAN_DEBUG
+
+	// allocates a vmcb snapshot and the mismatch counters per core and registers the stats hypercall,
+	// must be called before launching because it calls into the os
+	bool setup();
+
+	void cleanup();
+
+	// takes the snapshot, right after the clean bits were set in vcpu::prologue
+	void snapshot(vcpu* vcpu);
+
+	// diffs the cached fields against the snapshot, right before returning to vmrun.
+	// runs with gif clear, so it only counts
+	void verify(vcpu* vcpu);
+
+#else
+
+	__forceinline bool setup() { return true; }
+
+	__forceinline void cleanup() { return; }
+
+	__forceinline void snapshot(vcpu* vcpu) { UNREFERENCED_PARAMETER(vcpu); return; }
+
+	__forceinline void verify(vcpu* vcpu) { UNREFERENCED_PARAMETER(vcpu); return; }
+
+#endif
+}
@@ -0,0 +1,100 @@
+#include "xsave.h"
+
+#include "../vcpu/vcpu.h"
+#include "../../utilities/utilities.h"
+
+namespace xsave
+{
+	// every x64 cpu has fxsave, xsave is only missing on very old ones or if the os didnt enable it
+	bool use_xsave;
+}
+
+bool xsave::setup(XSAVE_STATE& state)
+{
+	int cpuid_regs[4];
+	__cpuid(cpuid_regs, 1);
+
+	// ECX[26] XSAVE, ECX[27] OSXSAVE
+
+	use_xsave = (cpuid_regs[2] & (1 << 26)) && (cpuid_regs[2] & (1 << 27));
+
+	state.size = 512;
+
+	if (use_xsave)
+	{
+		// ECX is the size needed for every feature the cpu supports, not only the ones enabled in xcr0,
+		// so the guest can enable more of them later without us reallocating
+
+		__cpuidex(cpuid_regs, 0xD, 0);
+		state.size = cpuid_regs[2];
+	}
+
+	state.base = (UINT8*)ExAllocatePoolZero(NonPagedPool, state.size + 64, 'ENON');
+
+	if (!state.base)
+	{
+		LOG_ERROR("couldnt allocate the xsave area \n");
+		return false;
+	}
+
+	state.area = (UINT8*)(((UINT64)state.base + 63) & ~63ull);
+
+	return true;
+}
+
+void xsave::free(XSAVE_STATE& state)
+{
+	if (state.base)
+		ExFreePoolWithTag(state.base, 'ENON');
+
+	state.base = nullptr;
+	state.area = nullptr;
+
+	return;
+}
+
+void xsave::acquire(vcpu* vcpu)
+{
+	auto& state = vcpu->get_xsave();
+
+	if (state.acquired)
+		return;
+
+	UINT64 start_tsc = __rdtsc();
+
+	// xcr0 isnt intercepted, so the host runs with the guest's
+
+	if (use_xsave)
+	{
+		state.features = _xgetbv(0);
+		_xsave64(state.area, state.features);
+	}
+	else
+		_fxsave64(state.area);
+
+	state.acquired = 1;
+	state.simd_exits++;
+	state.cycles += __rdtsc() - start_tsc;
+
+	return;
+}
+
+void xsave::release(vcpu* vcpu)
+{
+	auto& state = vcpu->get_xsave();
+
+	if (!state.acquired)
+		return;
+
+	UINT64 start_tsc = __rdtsc();
+
+	if (use_xsave)
+		_xrstor64(state.area, state.features);
+	else
+		_fxrstor64(state.area);
+
+	state.acquired = 0;
+	state.cycles += __rdtsc() - start_tsc;
+
+	return;
+}
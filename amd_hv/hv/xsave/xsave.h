@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../svm/svm.h"
+
+struct vcpu;
+
+// the guest's extended state while a handler uses simd
+struct XSAVE_STATE
+{
+	UINT8*	base;			// the allocation, area is 64 byte aligned inside of it
+	UINT8*	area;
+	UINT32	size;			// CPUID 0xD ECX, big enough for every feature the cpu supports
+	UINT32	acquired;		// the guest's state is in area and has to go back before vmrun
+	UINT64	features;		// xcr0 at the time of the save
+	UINT64	simd_exits;		// exits that saved and restored the guest's extended state
+	UINT64	cycles;			// host time spent saving and restoring it
+};
+
+// helpers.asm only spills xmm0 - xmm5, which covers compiled code using legacy sse.
+// anything that touches ymm / zmm, x87 or the upper xmm registers in place of the compiler
+// has to call acquire first, and the guest's state gets restored at the end of the exit
+namespace xsave
+{
+	// allocates the area, must be called from the core's own setup
+	bool setup(XSAVE_STATE& state);
+
+	void free(XSAVE_STATE& state);
+
+	// saves the guest's extended state the first time a handler asks for it on this exit
+	void acquire(vcpu* vcpu);
+
+	// restores it if it was saved, handle_vmexit calls this after the handler
+	void release(vcpu* vcpu);
+}
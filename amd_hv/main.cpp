@@ -5,6 +5,7 @@
 #include "hv/svm/svm.h"
 #include "utilities/utilities.h"
 #include "hv/hv.h"
+#include "hv/device/device.h"
 
 #include <intrin.h>
 
@@ -12,6 +13,10 @@ void UnloadDriver(PDRIVER_OBJECT driver_object)
 {
 	UNREFERENCED_PARAMETER(driver_object);
 
+	// no call may come in while the cores shut down
+
+	device::remove();
+
 	hv::shutdown();
 
 	return;
@@ -29,5 +34,9 @@ extern "C" NTSTATUS DriverEntry(PDRIVER_OBJECT driver_object, PUNICODE_STRING re
 	if (!hv::launch())
 		return STATUS_FAILED_DRIVER_ENTRY;
 
+	// without it ring 3 only loses the kernel only commands, the hypervisor is already running
+
+	device::create(driver_object);
+
 	return STATUS_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,194 @@
+// hv_bench.cpp : round trip latency of every read only command, per core, as csv on stdout.
+// latencies are in tsc cycles, throughput is in calls per second.
+// usage: hv_bench [samples per command] [label]
+// the big scatter gather batches take a fraction of the samples, each of them is thousands of copies.
+// the broadcast row waits for every core, compare it across machines with different core counts.
+// the label goes into every row, so runs against different hypervisor builds can be concatenated and compared.
+// only commands user mode may call are timed, a row whose first call fails is left out and the status goes to stderr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "../hv_client/hv_client.h"
+
+struct COMMAND
+{
+    const char* name;
+    CALL_STATUS (*call)();
+    size_t divisor = 1;     // the slow ones take fewer samples
+};
+
+// echoes run through a session per sample, compare its row to SESSION_BATCH echo rows
+#define SESSION_BATCH 32
+
+// where the commands write their results, the lambdas below dont capture so they convert to function pointers
+HYPERCALL_ARGS args;
+TSC_STATS tsc_stats;
+XSAVE_STATS xsave_stats;
+INSTRUCTION_STATS instruction_stats;
+EXCEPTION_STATS exception_stats;
+unsigned int current_core;
+client::session session;
+
+// the scatter gather rows read 64 bytes per entry from consecutive spots of one buffer
+TRANSFER_ENTRY transfer_entries[TRANSFER_MAX_ENTRIES];
+unsigned char transfer_source[TRANSFER_MAX_ENTRIES * 64];
+unsigned char transfer_destination[TRANSFER_MAX_ENTRIES * 64];
+
+template <unsigned long long count>
+CALL_STATUS scatter_gather()
+{
+    unsigned long long processed, failed;
+
+    auto status = client::scatter_gather(transfer_entries, count, processed, failed);
+
+    return status == call_success && failed ? call_fault : status;
+}
+
+CALL_STATUS session_echoes()
+{
+    for (unsigned long long i = 0; i < SESSION_BATCH; i++)
+        session.queue(HYPERCALL_ECHO, i);
+
+    unsigned long long processed, pending;
+
+    auto status = session.submit(processed, pending);
+
+    SESSION_COMPLETION completion;
+
+    while (session.complete(completion));
+
+    return status;
+}
+
+// the first two arent commands, they show what timing and a plain cpuid exit cost on their own
+const COMMAND commands[] =
+{
+    { "rdtscp",             [] { return call_success; } },
+    { "cpuid passthrough",  [] { int regs[4]; __cpuid(regs, 0); return call_success; } },
+    { "cpuid ping",         [] { return client::cpuid_ping() ? call_success : call_not_loaded; } },
+    { "ping",               [] { return client::ping(); } },
+    { "echo",               [] { return client::echo(args); } },
+    { "echo xmm",           [] { return client::echo(args, true); } },
+    { "tsc stats",          [] { return client::tsc_stats(current_core, tsc_stats); } },
+    { "xsave stats",        [] { return client::xsave_stats(current_core, xsave_stats); } },
+    { "instruction stats",  [] { unsigned long long supported; return client::instruction_stats(current_core, instruction_stats, supported); } },
+    { "exception stats",    [] { return client::exception_stats(current_core, exception_stats); } },
+    { "session echo x32",   session_echoes },
+    { "scatter gather x1",    scatter_gather<1> },
+    { "scatter gather x64",   scatter_gather<64>, 16 },
+    { "scatter gather x4096", scatter_gather<4096>, 256 },
+    { "broadcast ping",     [] { BROADCAST_RESULT result; auto status = client::broadcast(HYPERCALL_PING, result); return status == call_success && result.failed ? call_fault : status; }, 16 },
+};
+
+// nearest rank, samples are sorted
+unsigned long long percentile(const std::vector<unsigned long long>& samples, double p)
+{
+    size_t rank = (size_t)(p * samples.size() + 0.999999);
+
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+void measure(const char* label, unsigned int core, const COMMAND& command, size_t count, std::vector<unsigned long long>& samples)
+{
+    unsigned int aux;
+
+    // a failing call would time the error path, not the command
+
+    if (auto status = command.call(); status != call_success)
+    {
+        fprintf(stderr, "%s on core %u: %s \n", command.name, core, client::status_name(status));
+        return;
+    }
+
+    samples.resize(count);
+
+    // warm the caches and the branch predictors, on both sides of the exit
+
+    for (size_t i = 0; i < count / 10; i++)
+        command.call();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned long long start = __rdtscp(&aux);
+
+        command.call();
+
+        samples[i] = __rdtscp(&aux) - start;
+    }
+
+    // throughput of back to back calls, in wall clock time so its independent of the tsc frequency
+
+    LARGE_INTEGER frequency, begin, end;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+
+    for (size_t i = 0; i < count; i++)
+        command.call();
+
+    QueryPerformanceCounter(&end);
+
+    double seconds = (double)(end.QuadPart - begin.QuadPart) / frequency.QuadPart;
+
+    unsigned long long total = 0;
+
+    for (auto sample : samples)
+        total += sample;
+
+    std::sort(samples.begin(), samples.end());
+
+    printf("%s,%u,%s,%zu,%llu,%llu,%llu,%llu,%llu,%llu,%.0f\n", label, core, command.name, count,
+        samples.front(), percentile(samples, 0.5), percentile(samples, 0.99), percentile(samples, 0.999), samples.back(),
+        total / count, seconds > 0 ? count / seconds : 0);
+}
+
+int main(int argc, char** argv)
+{
+    size_t count        = argc > 1 ? strtoull(argv[1], nullptr, 0) : 100000;
+    const char* label   = argc > 2 ? argv[2] : "";
+
+    if (!count)
+    {
+        fprintf(stderr, "usage: hv_bench [samples per command] [label] \n");
+        return 1;
+    }
+
+    if (!client::loaded())
+    {
+        fprintf(stderr, "hypervisor isnt loaded \n");
+        return 1;
+    }
+
+    // less interference from other threads on the measured core
+
+    SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+    if (auto status = session.open(SESSION_BATCH, SESSION_BATCH); status != call_success)
+    {
+        fprintf(stderr, "cant open a session: %s \n", client::status_name(status));
+        return 1;
+    }
+
+    for (size_t i = 0; i < TRANSFER_MAX_ENTRIES; i++)
+        transfer_entries[i] = { (unsigned long long)&transfer_source[i * 64], 0, (unsigned long long)&transfer_destination[i * 64], 64, 0, 0 };
+
+    std::vector<unsigned long long> samples(count);
+
+    printf("label,core,command,samples,min,p50,p99,p99.9,max,mean,calls_per_second\n");
+
+    for (current_core = 0; current_core < client::core_count(); current_core++)
+    {
+        client::core_pin pin(current_core);
+
+        for (auto& command : commands)
+            measure(label, current_core, command, std::max<size_t>(count / command.divisor, 1), samples);
+
+        fflush(stdout);
+    }
+
+    return 0;
+}
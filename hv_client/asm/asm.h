@@ -0,0 +1,12 @@
+#pragma once
+
+extern "C" 
+{ 
+	bool send_hv_command(unsigned long long key, unsigned long long command);
+
+	// returns the hypercall status, results are written back into args
+	unsigned long long hv_call(unsigned long long code, struct HYPERCALL_ARGS* args);
+
+	// same as hv_call, but sets the xmm flag and also passes args->xmm in xmm0 - xmm5
+	unsigned long long hv_call_xmm(unsigned long long code, struct HYPERCALL_ARGS* args);
+}
\ No newline at end of file
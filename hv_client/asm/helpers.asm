@@ -0,0 +1,101 @@
+PUBLIC send_hv_command
+PUBLIC hv_call
+PUBLIC hv_call_xmm
+
+.code
+
+send_hv_command proc frame
+.endprolog
+
+xor rax, rax
+
+cpuid
+
+cmp rax, 1		; check if its exactly 1
+
+je return		; if it is, return it
+
+xor rax, rax	; if its not, return 0
+
+return:
+ret
+
+send_hv_command endp
+
+; args layout matches HYPERCALL_ARGS, 6 qword registers then 6 xmm registers
+
+hv_call proc frame
+push rbx
+.pushreg rbx
+.endprolog
+
+mov rbx, rdx	; rbx survives the hypercall, every volatile register is part of the abi
+
+mov rax, rcx
+mov rcx, [rbx + 00h]
+mov rdx, [rbx + 08h]
+mov r8,  [rbx + 10h]
+mov r9,  [rbx + 18h]
+mov r10, [rbx + 20h]
+mov r11, [rbx + 28h]
+
+vmmcall			; raises #UD if the hypervisor isnt loaded
+
+mov [rbx + 00h], rcx
+mov [rbx + 08h], rdx
+mov [rbx + 10h], r8
+mov [rbx + 18h], r9
+mov [rbx + 20h], r10
+mov [rbx + 28h], r11
+
+pop rbx
+ret
+
+hv_call endp
+
+hv_call_xmm proc frame
+push rbx
+.pushreg rbx
+.endprolog
+
+mov rbx, rdx
+
+mov rax, rcx
+bts rax, 31		; xmm flag
+
+movups xmm0, [rbx + 30h]
+movups xmm1, [rbx + 40h]
+movups xmm2, [rbx + 50h]
+movups xmm3, [rbx + 60h]
+movups xmm4, [rbx + 70h]
+movups xmm5, [rbx + 80h]
+
+mov rcx, [rbx + 00h]
+mov rdx, [rbx + 08h]
+mov r8,  [rbx + 10h]
+mov r9,  [rbx + 18h]
+mov r10, [rbx + 20h]
+mov r11, [rbx + 28h]
+
+vmmcall
+
+mov [rbx + 00h], rcx
+mov [rbx + 08h], rdx
+mov [rbx + 10h], r8
+mov [rbx + 18h], r9
+mov [rbx + 20h], r10
+mov [rbx + 28h], r11
+
+movups [rbx + 30h], xmm0
+movups [rbx + 40h], xmm1
+movups [rbx + 50h], xmm2
+movups [rbx + 60h], xmm3
+movups [rbx + 70h], xmm4
+movups [rbx + 80h], xmm5
+
+pop rbx
+ret
+
+hv_call_xmm endp
+
+END 
\ No newline at end of file
@@ -0,0 +1,758 @@
+#include "hv_client.h"
+#include "../amd_hv/hv/compress/compress.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+namespace client
+{
+    // the hypervisor writes through the guest's page tables and fails on pages that arent present yet
+    void touch(void* buffer, unsigned long long size)
+    {
+        memset(buffer, 0, size);
+    }
+
+    // per code, whether the call goes through the driver's device
+    bool through_device[COMMAND_MAX];
+
+    HANDLE device = INVALID_HANDLE_VALUE;
+
+    CALL_STATUS vmmcall(unsigned long long code, HYPERCALL_ARGS& args, bool xmm)
+    {
+        __try
+        {
+            return (CALL_STATUS)(xmm ? hv_call_xmm(HYPERCALL_CODE(code), &args) : hv_call(HYPERCALL_CODE(code), &args));
+        }
+        __except (GetExceptionCode() == EXCEPTION_ILLEGAL_INSTRUCTION ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+        {
+            return call_not_loaded;
+        }
+    }
+
+    // once per process, from the first call. the list is what the driver registered, not what this build knows
+    bool connect()
+    {
+        static COMMAND_INFO list[COMMAND_MAX];
+
+        touch(list, sizeof(list));
+
+        HYPERCALL_ARGS args{};
+        args.regs[0] = (unsigned long long)list;
+        args.regs[1] = COMMAND_MAX;
+
+        if (vmmcall(HYPERCALL_COMMAND_LIST, args, false) == call_success)
+        {
+            for (unsigned long long i = 0; i < args.regs[0]; i++)
+                through_device[list[i].code % COMMAND_MAX] = !list[i].cpl;
+        }
+
+        device = CreateFileW(HV_DEVICE_PATH, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+
+        // jobs started through the device belong to the kernel's cr3 of this process, which with kva shadowing
+        // isnt the one ring 3 runs on. polling and cancelling them has to come from the same side
+
+        if (device != INVALID_HANDLE_VALUE)
+        {
+            through_device[HYPERCALL_JOB_POLL]      = true;
+            through_device[HYPERCALL_JOB_CANCEL]    = true;
+        }
+
+        return true;
+    }
+
+    // the driver makes the call from the kernel, in this process's address space
+    CALL_STATUS device_call(unsigned long long code, HYPERCALL_ARGS& args)
+    {
+        if (device == INVALID_HANDLE_VALUE)
+            return call_denied;
+
+        HV_DEVICE_CALL request{};
+        request.code = code;
+
+        memcpy(request.regs, args.regs, sizeof(request.regs));
+
+        DWORD returned;
+
+        if (!DeviceIoControl(device, IOCTL_HV_CALL, &request, sizeof(request), &request, sizeof(request), &returned, nullptr))
+            return call_denied;
+
+        memcpy(args.regs, request.regs, sizeof(args.regs));
+
+        return (CALL_STATUS)request.status;
+    }
+
+    // core index in rcx, a buffer in rdx and its capacity in r8, the shape of every export call
+    CALL_STATUS export_call(unsigned long long code, unsigned int core, void* buffer, unsigned long long size, unsigned long long capacity, HYPERCALL_ARGS& args)
+    {
+        touch(buffer, size * capacity);
+
+        args = {};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)buffer;
+        args.regs[2] = capacity;
+
+        return call(code, args);
+    }
+}
+
+const char* client::status_name(CALL_STATUS status)
+{
+    switch (status)
+    {
+    case call_success:      return "success";
+    case call_invalid:      return "invalid";
+    case call_denied:       return "denied";
+    case call_bad_args:     return "bad args";
+    case call_unsupported:  return "unsupported";
+    case call_fault:        return "fault";
+    case call_empty:        return "empty";
+    case call_exhausted:    return "exhausted";
+    case call_busy:         return "busy";
+    case call_not_loaded:   return "not loaded";
+    default:                return "unknown";
+    }
+}
+
+CALL_STATUS client::call(unsigned long long code, HYPERCALL_ARGS& args, bool xmm)
+{
+    static bool connected = connect();
+
+    // the session bits arent part of the command
+
+    unsigned long long command = code & 0xFFFF;
+
+    if (!xmm && connected && command < COMMAND_MAX && through_device[command])
+        return device_call(code, args);
+
+    return vmmcall(code, args, xmm);
+}
+
+bool client::loaded()
+{
+    return ping() == call_success;
+}
+
+unsigned int client::core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors;
+}
+
+client::core_pin::core_pin(unsigned int core)
+{
+    previous = SetThreadAffinityMask(GetCurrentThread(), 1ull << core);
+
+    // the thread keeps running where it was until its next quantum otherwise
+
+    SwitchToThread();
+}
+
+client::core_pin::~core_pin()
+{
+    if (previous)
+        SetThreadAffinityMask(GetCurrentThread(), previous);
+}
+
+void client::ping_all_cores()
+{
+    for (unsigned int core = 0; core < core_count(); core++)
+    {
+        core_pin pin(core);
+
+        ping();
+    }
+}
+
+bool client::cpuid_ping()
+{
+    return send_hv_command(COMMAND_KEY, PING_ID);
+}
+
+CALL_STATUS client::ping()
+{
+    HYPERCALL_ARGS args{};
+
+    return call(HYPERCALL_PING, args);
+}
+
+CALL_STATUS client::shutdown()
+{
+    HYPERCALL_ARGS args{};
+
+    return call(HYPERCALL_SHUTDOWN, args);
+}
+
+CALL_STATUS client::echo(HYPERCALL_ARGS& args, bool xmm)
+{
+    return call(HYPERCALL_ECHO, args, xmm);
+}
+
+CALL_STATUS client::tsc_config(const TSC_CONFIG& config)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = config.mode;
+    args.regs[1] = config.exit_overhead;
+    args.regs[2] = config.max_skew;
+
+    return call(HYPERCALL_TSC_CONFIG, args);
+}
+
+CALL_STATUS client::tsc_stats(unsigned int core, TSC_STATS& stats)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = core;
+
+    auto status = call(HYPERCALL_TSC_STATS, args);
+
+    if (status == call_success)
+    {
+        stats.compensated_exits     = args.regs[0];
+        stats.compensated_cycles    = args.regs[1];
+        stats.residual_cycles       = args.regs[2];
+        stats.clamped_reads         = args.regs[3];
+        stats.tsc_offset            = args.regs[4];
+        stats.skew                  = args.regs[5];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::pause_config(const PAUSE_CONFIG& config)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = config.flags;
+    args.regs[1] = config.filter_count;
+    args.regs[2] = config.filter_threshold;
+    args.regs[3] = config.sample_rate;
+
+    return call(HYPERCALL_PAUSE_CONFIG, args);
+}
+
+CALL_STATUS client::pause_export(unsigned int core, PAUSE_ENTRY* entries, unsigned long long capacity, PAUSE_EXPORT& result)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_PAUSE_EXPORT, core, entries, sizeof(PAUSE_ENTRY), capacity, args);
+
+    if (status == call_success)
+    {
+        result.written  = args.regs[0];
+        result.exits    = args.regs[1];
+        result.sampled  = args.regs[2];
+        result.dropped  = args.regs[3];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::sampler_config(const SAMPLER_CONFIG& config)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = config.flags;
+    args.regs[1] = config.period;
+    args.regs[2] = config.depth;
+
+    return call(HYPERCALL_SAMPLER_CONFIG, args);
+}
+
+CALL_STATUS client::sampler_export(unsigned int core, SAMPLE* samples, unsigned long long capacity, SAMPLER_EXPORT& result)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_SAMPLER_EXPORT, core, samples, sizeof(SAMPLE), capacity, args);
+
+    if (status == call_success)
+    {
+        result.written  = args.regs[0];
+        result.samples  = args.regs[1];
+        result.dropped  = args.regs[2];
+        result.cycles   = args.regs[3];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::lbr_config(unsigned long long flags)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = flags;
+
+    return call(HYPERCALL_LBR_CONFIG, args);
+}
+
+CALL_STATUS client::lbr_export(unsigned int core, BRANCH_ENTRY* entries, unsigned long long capacity, LBR_EXPORT& result)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_LBR_EXPORT, core, entries, sizeof(BRANCH_ENTRY), capacity, args);
+
+    if (status == call_success)
+    {
+        result.written  = args.regs[0];
+        result.captures = args.regs[1];
+        result.dropped  = args.regs[2];
+        result.cycles   = args.regs[3];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::exit_cost_config(unsigned long long flags)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = flags;
+
+    return call(HYPERCALL_EXIT_COST_CONFIG, args);
+}
+
+CALL_STATUS client::exit_cost_stats(unsigned int core, EXIT_COST_RECORD* records, unsigned long long capacity, unsigned long long& written)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_EXIT_COST_STATS, core, records, sizeof(EXIT_COST_RECORD), capacity, args);
+
+    if (status == call_success)
+        written = args.regs[0];
+
+    return status;
+}
+
+CALL_STATUS client::capture_config(unsigned long long flags)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = flags;
+
+    return call(HYPERCALL_CAPTURE_CONFIG, args);
+}
+
+CALL_STATUS client::capture_export(unsigned int core, CAPTURE_RECORD* records, unsigned long long capacity, CAPTURE_EXPORT& result)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_CAPTURE_EXPORT, core, records, sizeof(CAPTURE_RECORD), capacity, args);
+
+    if (status == call_success)
+    {
+        result.written  = args.regs[0];
+        result.captured = args.regs[1];
+        result.dropped  = args.regs[2];
+        result.cycles   = args.regs[3];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::checksum(const void* buffer, unsigned long long size, unsigned long long flags, unsigned long long& checksum)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = (unsigned long long)buffer;
+    args.regs[1] = size;
+    args.regs[2] = flags;
+
+    auto status = call(HYPERCALL_CHECKSUM, args);
+
+    if (status == call_success)
+        checksum = args.regs[0];
+
+    return status;
+}
+
+CALL_STATUS client::xsave_stats(unsigned int core, XSAVE_STATS& stats)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = core;
+
+    auto status = call(HYPERCALL_XSAVE_STATS, args);
+
+    if (status == call_success)
+    {
+        stats.simd_exits    = args.regs[0];
+        stats.cycles        = args.regs[1];
+        stats.size          = args.regs[2];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::instruction_stats(unsigned int core, INSTRUCTION_STATS& stats, unsigned long long& supported)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_INSTRUCTION_STATS, core, &stats, sizeof(stats), 1, args);
+
+    if (status == call_success)
+        supported = args.regs[0];
+
+    return status;
+}
+
+CALL_STATUS client::exception_config(unsigned long long reflect_mask, unsigned long long flags)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = reflect_mask;
+    args.regs[1] = flags;
+
+    return call(HYPERCALL_EXCEPTION_CONFIG, args);
+}
+
+CALL_STATUS client::exception_stats(unsigned int core, EXCEPTION_STATS& stats)
+{
+    HYPERCALL_ARGS args;
+
+    return export_call(HYPERCALL_EXCEPTION_STATS, core, &stats, sizeof(stats), 1, args);
+}
+
+CALL_STATUS client::notify_register(unsigned char vector, unsigned int core)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = vector;
+    args.regs[1] = core;
+
+    return call(HYPERCALL_NOTIFY_REGISTER, args);
+}
+
+CALL_STATUS client::notify_poll(NOTIFY_COMPLETION& completion, unsigned long long& remaining)
+{
+    HYPERCALL_ARGS args{};
+
+    auto status = call(HYPERCALL_NOTIFY_POLL, args);
+
+    if (status == call_success)
+    {
+        completion.cookie   = args.regs[0];
+        completion.status   = args.regs[1];
+        remaining           = args.regs[2];
+        completion.tsc      = args.regs[3];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::notify_post(unsigned long long cookie, unsigned long long status, bool& queued)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = cookie;
+    args.regs[1] = status;
+
+    auto result = call(HYPERCALL_NOTIFY_POST, args);
+
+    if (result == call_success)
+        queued = args.regs[0];
+
+    return result;
+}
+
+CALL_STATUS client::job_start(unsigned long long kind, const void* base, unsigned long long size, unsigned long long budget, unsigned long long flags, const void* params)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = kind;
+    args.regs[1] = (unsigned long long)base;
+    args.regs[2] = size;
+    args.regs[3] = budget;
+    args.regs[4] = flags;
+    args.regs[5] = (unsigned long long)params;
+
+    return call(HYPERCALL_JOB_START, args);
+}
+
+CALL_STATUS client::search_start(unsigned long long base, unsigned long long size, const SEARCH_PARAMS& params, SEARCH_KERNEL kernel, unsigned long long budget)
+{
+    return job_start(JOB_SEARCH, (const void*)base, size, budget, kernel, &params);
+}
+
+bool client::parse_pattern(const char* text, SEARCH_PARAMS& params)
+{
+    memset(params.bytes, 0, sizeof(params.bytes));
+    memset(params.mask, 0, sizeof(params.mask));
+
+    params.length = 0;
+
+    for (; *text; text++)
+    {
+        if (*text == ' ')
+            continue;
+
+        if (params.length == SEARCH_MAX_PATTERN || !text[1])
+            return false;
+
+        if (text[0] == '?' && text[1] == '?')
+        {
+            params.length++;
+            text++;
+            continue;
+        }
+
+        char hex[3] = { text[0], text[1], 0 };
+        char* end;
+
+        params.bytes[params.length] = (unsigned char)strtoul(hex, &end, 16);
+        params.mask[params.length++] = 0xFF;
+
+        if (*end)
+            return false;
+
+        text++;
+    }
+
+    return params.length;
+}
+
+CALL_STATUS client::job_poll(unsigned int core, JOB_PROGRESS& progress)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = core;
+
+    auto status = call(HYPERCALL_JOB_POLL, args);
+
+    if (status == call_success)
+    {
+        progress.state      = (JOB_STATE)args.regs[0];
+        progress.done       = args.regs[1];
+        progress.size       = args.regs[2];
+        progress.result     = args.regs[3];
+        progress.slices     = args.regs[4];
+        progress.max_slice  = args.regs[5];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::job_cancel(unsigned int core)
+{
+    HYPERCALL_ARGS args{};
+    args.regs[0] = core;
+
+    return call(HYPERCALL_JOB_CANCEL, args);
+}
+
+CALL_STATUS client::broadcast(unsigned long long code, BROADCAST_RESULT& result, const unsigned long long* args, unsigned int count)
+{
+    if (count > 5)
+        return call_bad_args;
+
+    HYPERCALL_ARGS call_args{};
+    call_args.regs[0] = code;
+
+    for (unsigned int i = 0; i < count; i++)
+        call_args.regs[i + 1] = args[i];
+
+    auto status = call(HYPERCALL_BROADCAST, call_args);
+
+    result.succeeded    = call_args.regs[0];
+    result.failed       = call_args.regs[1];
+    result.late         = call_args.regs[2];
+    result.cycles       = call_args.regs[3];
+
+    return status;
+}
+
+CALL_STATUS client::command_list(COMMAND_INFO* commands, unsigned long long capacity, unsigned long long& written, unsigned long long& version)
+{
+    touch(commands, capacity * sizeof(COMMAND_INFO));
+
+    HYPERCALL_ARGS args{};
+    args.regs[0] = (unsigned long long)commands;
+    args.regs[1] = capacity;
+
+    auto status = call(HYPERCALL_COMMAND_LIST, args);
+
+    if (status == call_success)
+    {
+        written = args.regs[0];
+        version = args.regs[1];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::command_stats(unsigned int core, COMMAND_STATS* stats, unsigned long long capacity)
+{
+    HYPERCALL_ARGS args;
+
+    return export_call(HYPERCALL_COMMAND_STATS, core, stats, sizeof(COMMAND_STATS), capacity, args);
+}
+
+CALL_STATUS client::vmcb_stats(unsigned int core, VMCB_MISMATCH* fields, unsigned long long capacity, VMCB_STATS& result)
+{
+    HYPERCALL_ARGS args;
+
+    auto status = export_call(HYPERCALL_VMCB_STATS, core, fields, sizeof(VMCB_MISMATCH), capacity, args);
+
+    if (status == call_success)
+    {
+        result.written      = args.regs[0];
+        result.verified     = args.regs[1];
+        result.mismatches   = args.regs[2];
+    }
+
+    return status;
+}
+
+CALL_STATUS client::snapshot_start(unsigned long long base, unsigned long long size, const SNAPSHOT_PARAMS& params, unsigned long long flags, unsigned long long budget)
+{
+    return job_start(JOB_SNAPSHOT, (const void*)base, size, budget, flags, &params);
+}
+
+bool client::expand_record(const SNAPSHOT_RECORD& record, const void* data, void* page)
+{
+    if (record.kind == snapshot_raw)
+    {
+        memcpy(page, data, 0x1000);
+        return true;
+    }
+
+    return record.kind == snapshot_lz4 && compress::unlz4((const UINT8*)data, record.size, (UINT8*)page, 0x1000) == 0x1000;
+}
+
+CALL_STATUS client::scatter_gather(TRANSFER_ENTRY* entries, unsigned long long count, unsigned long long& processed, unsigned long long& failed)
+{
+    // reads write into the buffers, they have to be present. the source of a write is only read
+
+    for (unsigned long long i = 0; i < count; i++)
+    {
+        if (!(entries[i].flags & TRANSFER_WRITE))
+            touch((void*)entries[i].buffer, entries[i].length);
+    }
+
+    HYPERCALL_ARGS args{};
+    args.regs[0] = (unsigned long long)entries;
+    args.regs[1] = count;
+
+    auto status = call(HYPERCALL_SCATTER_GATHER, args);
+
+    processed   = args.regs[0];
+    failed      = args.regs[1];
+
+    return status;
+}
+
+client::session::~session()
+{
+    close();
+}
+
+CALL_STATUS client::session::open(unsigned int count, unsigned int batch)
+{
+    if (ring || !count || count > SESSION_MAX_ENTRIES)
+        return call_bad_args;
+
+    // the hypervisor reads the ring without faulting it in, so it stays committed and locked
+
+    SIZE_T size = SESSION_RING_SIZE(count);
+
+    ring = (unsigned char*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!ring)
+        return call_fault;
+
+    VirtualLock(ring, size);
+    touch(ring, size);
+
+    HYPERCALL_ARGS args{};
+    args.regs[0] = (unsigned long long)ring;
+    args.regs[1] = count;
+    args.regs[2] = batch;
+
+    auto status = call(HYPERCALL_SESSION_OPEN, args);
+
+    if (status != call_success)
+    {
+        VirtualFree(ring, 0, MEM_RELEASE);
+        ring = nullptr;
+
+        return status;
+    }
+
+    id      = args.regs[0];
+    entries = count;
+
+    return status;
+}
+
+CALL_STATUS client::session::close()
+{
+    if (!ring)
+        return call_success;
+
+    HYPERCALL_ARGS args{};
+
+    auto status = call(HYPERCALL_SESSION_CLOSE | HYPERCALL_SESSION(id), args);
+
+    // once its closed the hypervisor doesnt touch the ring again, if the close failed we leak it
+
+    if (status == call_success || status == call_not_loaded)
+        VirtualFree(ring, 0, MEM_RELEASE);
+
+    ring = nullptr;
+
+    return status;
+}
+
+volatile SESSION_RING_HEADER* client::session::header() const
+{
+    return (volatile SESSION_RING_HEADER*)ring;
+}
+
+SESSION_COMMAND* client::session::commands() const
+{
+    return (SESSION_COMMAND*)(ring + sizeof(SESSION_RING_HEADER));
+}
+
+SESSION_COMPLETION* client::session::completions() const
+{
+    return (SESSION_COMPLETION*)(ring + sizeof(SESSION_RING_HEADER) + entries * sizeof(SESSION_COMMAND));
+}
+
+bool client::session::queue(unsigned long long code, unsigned long long cookie, const unsigned long long* args)
+{
+    unsigned int tail = header()->submit_tail;
+
+    if (tail - header()->submit_head >= entries)
+        return false;
+
+    auto& command = commands()[tail & (entries - 1)];
+
+    command.code    = code;
+    command.cookie  = cookie;
+
+    for (int i = 0; i < 6; i++)
+        command.args[i] = args ? args[i] : 0;
+
+    // the command has to be complete before the hypervisor can see the new tail
+
+    _ReadWriteBarrier();
+
+    header()->submit_tail = tail + 1;
+
+    return true;
+}
+
+CALL_STATUS client::session::submit(unsigned long long& processed, unsigned long long& pending)
+{
+    HYPERCALL_ARGS args{};
+
+    auto status = call(HYPERCALL_SESSION_SUBMIT | HYPERCALL_SESSION(id), args);
+
+    processed   = args.regs[0];
+    pending     = args.regs[1];
+
+    return status;
+}
+
+bool client::session::complete(SESSION_COMPLETION& completion)
+{
+    unsigned int head = header()->complete_head;
+
+    if (head == header()->complete_tail)
+        return false;
+
+    completion = completions()[head & (entries - 1)];
+
+    _ReadWriteBarrier();
+
+    header()->complete_head = head + 1;
+
+    return true;
+}
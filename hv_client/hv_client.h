@@ -0,0 +1,665 @@
+#pragma once
+
+// the hypercall interface of amd_hv for usermode tools: the codes and layouts shared with the driver,
+// and a typed wrapper per command. every wrapper returns a CALL_STATUS, results go into the response struct.
+// buffers the hypervisor writes to have to be committed, the wrappers touch the ones they get before the call
+
+#include <windows.h>
+#include <winioctl.h>
+#include <intrin.h>
+
+#include "asm/asm.h"
+
+#define PING_ID 0x123
+#define COMMAND_KEY 0x123456789
+
+#define HYPERCALL_KEY 0x616D6476
+#define HYPERCALL_CODE(code) ((unsigned long long)HYPERCALL_KEY << 32 | (code))
+#define HYPERCALL_PING 0x1
+#define HYPERCALL_SHUTDOWN 0x2
+#define HYPERCALL_ECHO 0x3
+#define HYPERCALL_TSC_CONFIG 0x4
+#define HYPERCALL_TSC_STATS 0x5
+#define HYPERCALL_PAUSE_CONFIG 0x6
+#define HYPERCALL_PAUSE_EXPORT 0x7
+#define HYPERCALL_SAMPLER_CONFIG 0x8
+#define HYPERCALL_SAMPLER_EXPORT 0x9
+#define HYPERCALL_LBR_CONFIG 0xA
+#define HYPERCALL_LBR_EXPORT 0xB
+#define HYPERCALL_EXIT_COST_CONFIG 0xC
+#define HYPERCALL_EXIT_COST_STATS 0xD
+#define HYPERCALL_CHECKSUM 0xE
+#define HYPERCALL_XSAVE_STATS 0xF
+#define HYPERCALL_INSTRUCTION_STATS 0x10
+#define HYPERCALL_EXCEPTION_CONFIG 0x11
+#define HYPERCALL_EXCEPTION_STATS 0x12
+#define HYPERCALL_NOTIFY_REGISTER 0x13
+#define HYPERCALL_NOTIFY_POLL 0x14
+#define HYPERCALL_NOTIFY_POST 0x15
+#define HYPERCALL_SESSION_OPEN 0x16
+#define HYPERCALL_SESSION_CLOSE 0x17
+#define HYPERCALL_SESSION_SUBMIT 0x18
+#define HYPERCALL_JOB_START 0x19
+#define HYPERCALL_JOB_POLL 0x1A
+#define HYPERCALL_JOB_CANCEL 0x1B
+#define HYPERCALL_SCATTER_GATHER 0x1C
+#define HYPERCALL_BROADCAST 0x1D
+#define HYPERCALL_COMMAND_LIST 0x1E
+#define HYPERCALL_COMMAND_STATS 0x1F
+#define HYPERCALL_CAPTURE_CONFIG 0x20
+#define HYPERCALL_CAPTURE_EXPORT 0x21
+#define HYPERCALL_PROCESS_EXIT 0x22     // made by the driver when a process exits, not by clients
+#define HYPERCALL_VMCB_STATS 0x23       // debug builds of the driver only
+#define HYPERCALL_SESSION(id) ((unsigned long long)(id) << 16)
+
+#define CHECKSUM_SCALAR 0x1
+
+#define TSC_MODE_OFF 0
+#define TSC_MODE_OFFSET 1
+#define TSC_MODE_INTERCEPT 2
+
+#define PAUSE_ENABLE 0x1
+#define PAUSE_RESET 0x2
+
+struct PAUSE_ENTRY
+{
+    unsigned long long rip;
+    unsigned long long cr3;
+    unsigned long long count;
+    unsigned long long first_tsc;
+    unsigned long long last_tsc;
+};
+
+#define SAMPLE_STACK_DEPTH 8
+#define SAMPLER_ENABLE 0x1
+#define SAMPLER_RESET 0x2
+
+struct SAMPLE
+{
+    unsigned long long tsc;
+    unsigned long long rip;
+    unsigned long long rsp;
+    unsigned long long cr3;
+    unsigned int cpl;
+    unsigned int depth;
+    unsigned long long branch_from;
+    unsigned long long branch_to;
+    unsigned long long stack[SAMPLE_STACK_DEPTH];
+};
+
+#define LBR_ENABLE 0x1
+#define LBR_RESET 0x2
+#define LBR_CAPTURE_EXITS 0x4
+
+struct BRANCH_ENTRY
+{
+    unsigned long long from;
+    unsigned long long to;
+    unsigned long long cr3;
+    unsigned long long count;
+};
+
+#define EXIT_COST_ENABLE 0x1
+#define EXIT_COST_RESET 0x2
+#define EXIT_COST_REASONS 0x100
+
+// cycles, instructions, l2 misses, tlb misses
+struct EXIT_COST_RECORD
+{
+    unsigned long long exit_code;
+    unsigned long long exits;
+    unsigned long long world_switch[4];
+    unsigned long long handler[4];
+};
+
+#define CAPTURE_ENABLE 0x1
+#define CAPTURE_RESET 0x2
+
+// the guest on one side of an exit, gpr is r15 first and rax last
+struct CAPTURE_STATE
+{
+    unsigned long long gpr[16];
+    unsigned long long rip;
+    unsigned long long rflags;
+    unsigned long long cr0;
+    unsigned long long cr2;
+    unsigned long long cr3;
+    unsigned long long cr4;
+    unsigned long long efer;
+    unsigned long long event_inject;
+    unsigned long long interrupt_shadow;
+    unsigned long long v_ctl;
+    unsigned int cpl;
+    unsigned int reserved;
+};
+
+// one exit before and after the hypervisor handled it, hv_replay reads files of these
+struct CAPTURE_RECORD
+{
+    unsigned long long sequence;        // per core, a gap means records were dropped
+    unsigned long long tsc;
+    unsigned long long exit_code;
+    unsigned long long exit_info1;
+    unsigned long long exit_info2;
+    unsigned long long exit_int_info;
+    unsigned long long nrip;
+    unsigned char fetched;
+    unsigned char instruction[15];
+    unsigned short core;
+    unsigned short declared;            // the registers the exit's handler may change
+    unsigned int reserved;
+    CAPTURE_STATE before;
+    CAPTURE_STATE after;
+};
+
+#define INSTRUCTION_NRIP_SAVE 0x1
+#define INSTRUCTION_DECODE_ASSISTS 0x2
+
+struct INSTRUCTION_STATS
+{
+    unsigned long long nrip_hits;
+    unsigned long long software_lengths;
+    unsigned long long assist_fetches;
+    unsigned long long software_fetches;
+    unsigned long long assist_operands;
+    unsigned long long software_operands;
+    unsigned long long failures;
+    unsigned long long cache_hits;
+    unsigned long long cache_misses;
+};
+
+#define EXCEPTION_VECTORS 32
+#define EXCEPTION_RESET 0x1
+
+struct EXCEPTION_STATS
+{
+    unsigned long long exits[EXCEPTION_VECTORS];
+    unsigned long long cycles[EXCEPTION_VECTORS];
+    unsigned long long handled;
+    unsigned long long reinjected;
+    unsigned long long deferred;
+    unsigned long long double_faults;
+};
+
+#define NOTIFY_ANY_CORE 0xFFFFFFFF
+
+struct NOTIFY_COMPLETION
+{
+    unsigned long long cookie;
+    unsigned long long status;
+    unsigned long long tsc;
+};
+
+#define SESSION_MAX_ENTRIES 256
+#define SESSION_MAX_BATCH 64
+
+// the start of a session's ring, indices only grow and the slot is index % entries
+struct SESSION_RING_HEADER
+{
+    unsigned int submit_head;       // written by the hypervisor
+    unsigned int submit_tail;
+    unsigned int complete_head;
+    unsigned int complete_tail;     // written by the hypervisor
+    unsigned char reserved[0x30];
+};
+
+struct SESSION_COMMAND
+{
+    unsigned long long code;        // HYPERCALL_ code without the key
+    unsigned long long cookie;
+    unsigned long long args[6];
+};
+
+struct SESSION_COMPLETION
+{
+    unsigned long long cookie;
+    unsigned long long status;      // CALL_STATUS
+    unsigned long long results[6];
+};
+
+// the header, then entries commands, then entries completions
+#define SESSION_RING_SIZE(entries) (sizeof(SESSION_RING_HEADER) + (entries) * (sizeof(SESSION_COMMAND) + sizeof(SESSION_COMPLETION)))
+
+#define JOB_CHECKSUM 1
+#define JOB_SEARCH 2
+#define JOB_SNAPSHOT 3
+
+#define SEARCH_MAX_PATTERN 32
+
+// the flags of a search job
+enum SEARCH_KERNEL : unsigned long long
+{
+    search_best     = 0,
+    search_scalar   = 1,
+    search_sse      = 2,
+    search_avx2     = 3,
+};
+
+struct SEARCH_PARAMS
+{
+    unsigned char bytes[SEARCH_MAX_PATTERN];
+    unsigned char mask[SEARCH_MAX_PATTERN];     // set bits have to match, 0 for a wildcard byte
+    unsigned int length;
+    unsigned int capacity;                      // of the ring, a power of two
+    unsigned long long ring;                    // a SEARCH_RING_HEADER followed by capacity physical addresses
+};
+
+struct SEARCH_RING_HEADER
+{
+    unsigned int head;                          // the next match to take
+    unsigned int tail;                          // written by the hypervisor
+    unsigned char reserved[0x38];
+};
+
+enum JOB_STATE : unsigned long long
+{
+    job_idle        = 0,
+    job_running     = 1,
+    job_done        = 2,
+    job_failed      = 3,    // a page wasnt present, done is where it stopped
+    job_cancelled   = 4,
+};
+
+// flags of a snapshot job
+#define SNAPSHOT_INCREMENTAL    0x1     // only pages whose fingerprint changed since the last pass
+#define SNAPSHOT_UNCOMPRESSED   0x2
+
+struct SNAPSHOT_PARAMS
+{
+    unsigned long long ring;        // a SNAPSHOT_RING_HEADER followed by capacity slots of SNAPSHOT_SLOT_SIZE
+    unsigned int capacity;          // a power of two, at least 2
+    unsigned int reserved;
+    unsigned long long prints;      // page aligned, 8 bytes per page of the range rounded up to a page, or 0
+};
+
+struct SNAPSHOT_RING_HEADER
+{
+    unsigned int head;
+    unsigned int tail;              // written by the hypervisor
+    unsigned char reserved[0x38];
+};
+
+enum SNAPSHOT_KIND : unsigned char
+{
+    snapshot_raw    = 0,
+    snapshot_lz4    = 1,            // an lz4 block, any lz4 implementation reads it
+    snapshot_zero   = 2,            // pages zeroed pages, no data
+};
+
+struct SNAPSHOT_RECORD
+{
+    unsigned long long phys;
+    unsigned int pages;
+    unsigned short size;            // bytes of data after the record
+    unsigned char kind;
+    unsigned char reserved;
+};
+
+#define SNAPSHOT_SLOT_SIZE (sizeof(SNAPSHOT_RECORD) + 0x1000)
+
+#define TRANSFER_MAX_ENTRIES 4096
+#define TRANSFER_MAX_BYTES 0x100000
+
+#define TRANSFER_WRITE      0x1     // from buffer into address
+#define TRANSFER_PHYSICAL   0x2     // address is guest physical
+
+struct TRANSFER_ENTRY
+{
+    unsigned long long address;     // in the address space of cr3
+    unsigned long long cr3;         // 0 for this process's own
+    unsigned long long buffer;      // in this process
+    unsigned int length;
+    unsigned short flags;
+    unsigned short status;          // CALL_STATUS of this entry
+};
+
+struct JOB_PROGRESS
+{
+    JOB_STATE state;
+    unsigned long long done;        // bytes
+    unsigned long long size;
+    unsigned long long result;      // the checksum, how many matches a search found, or the bytes a snapshot streamed
+    unsigned long long slices;      // exits that ran a part of it
+    unsigned long long max_slice;   // most cycles one exit spent on it
+};
+
+// commands with COMMAND_BROADCAST run on every core, the ones with COMMAND_BROADCAST_ONCE are global and
+// every core applies them before it runs anything again. the other calls cant be broadcast
+struct BROADCAST_RESULT
+{
+    unsigned long long succeeded;   // cores, this one included
+    unsigned long long failed;
+    unsigned long long late;        // cores that didnt answer in time, they never run it
+    unsigned long long cycles;      // tsc cycles the calling core spent on it in the hypervisor
+};
+
+// the command registry, the codes above are whatever the driver registered for them
+#define COMMAND_MAX 0x40
+#define COMMAND_NAME_LENGTH 24
+#define COMMAND_INTERFACE_VERSION 1
+
+#define COMMAND_SESSION         0x1     // may be queued in a session
+#define COMMAND_BROADCAST       0x2
+#define COMMAND_BROADCAST_ONCE  0x4
+
+// what a command does with each of its 6 arguments
+enum COMMAND_ARG : unsigned char
+{
+    arg_unused  = 0,
+    arg_value   = 1,
+    arg_core    = 2,
+    arg_address = 3,    // a buffer in this process
+    arg_result  = 4,    // only written
+};
+
+struct COMMAND_INFO
+{
+    unsigned short code;
+    unsigned short version;
+    unsigned char cpl;              // the highest cpl thats allowed to call it
+    unsigned char flags;
+    COMMAND_ARG args[6];
+    char name[COMMAND_NAME_LENGTH];
+    unsigned char reserved[4];
+};
+
+// per core, indexed by code
+struct COMMAND_STATS
+{
+    unsigned long long calls;
+    unsigned long long failures;
+    unsigned long long cycles;      // spent in the handler
+};
+
+struct HYPERCALL_ARGS
+{
+    unsigned long long regs[6];     // rcx, rdx, r8, r9, r10, r11
+    M128A xmm[6];                   // xmm0 - xmm5
+};
+
+// the driver's device, which makes the kernel only commands for administrators. see device.h
+#define HV_DEVICE_PATH L"\\\\.\\amd_hv"
+#define IOCTL_HV_CALL CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_READ_DATA | FILE_WRITE_DATA)
+
+struct HV_DEVICE_CALL
+{
+    unsigned long long code;
+    unsigned long long status;
+    unsigned long long regs[6];
+};
+
+// HYPERCALL_STATUS of the driver, and what the wrappers add to it
+enum CALL_STATUS : unsigned long long
+{
+    call_success        = 0,
+    call_invalid        = 1,    // unknown call code
+    call_denied         = 2,    // the caller's cpl isnt allowed to make this call
+    call_bad_args       = 3,    // an argument is out of range
+    call_unsupported    = 4,    // the cpu doesnt support a feature the call needs
+    call_fault          = 5,    // a buffer isnt present or writable
+    call_empty          = 6,    // there was nothing to return
+    call_exhausted      = 7,    // the session table or this process's share of it is full
+    call_busy           = 8,    // the core is still running a job, or another broadcast is in flight
+    call_not_loaded     = 0x100,    // vmmcall raised #UD, the hypervisor isnt running
+};
+
+struct TSC_CONFIG
+{
+    unsigned long long mode;            // TSC_MODE_
+    unsigned long long exit_overhead;   // extra cycles hidden per exit, capped at the shortest measured world switch
+    unsigned long long max_skew;        // cycles any core may be ahead of the others, 0 is unlimited and bad_args in offset mode
+};
+
+struct TSC_STATS
+{
+    unsigned long long compensated_exits;
+    unsigned long long compensated_cycles;
+    unsigned long long residual_cycles;
+    unsigned long long clamped_reads;
+    unsigned long long tsc_offset;
+    unsigned long long skew;
+};
+
+struct PAUSE_CONFIG
+{
+    unsigned long long flags;           // PAUSE_
+    unsigned long long filter_count;
+    unsigned long long filter_threshold;
+    unsigned long long sample_rate;
+};
+
+// entries written, and the core's counters
+struct PAUSE_EXPORT
+{
+    unsigned long long written;
+    unsigned long long exits;
+    unsigned long long sampled;
+    unsigned long long dropped;
+};
+
+struct SAMPLER_CONFIG
+{
+    unsigned long long flags;           // SAMPLER_
+    unsigned long long period;          // guest cycles between samples
+    unsigned long long depth;           // stack slots captured, up to SAMPLE_STACK_DEPTH
+};
+
+struct SAMPLER_EXPORT
+{
+    unsigned long long written;
+    unsigned long long samples;
+    unsigned long long dropped;
+    unsigned long long cycles;
+};
+
+#define VMCB_FIELD_NAME_LENGTH 24
+
+// a cached vmcb field the driver changed without clearing its clean bit
+struct VMCB_MISMATCH
+{
+    char name[VMCB_FIELD_NAME_LENGTH];
+    unsigned long long count;
+    unsigned long long last_exit_code;
+};
+
+struct VMCB_STATS
+{
+    unsigned long long written;
+    unsigned long long verified;        // exits diffed
+    unsigned long long mismatches;      // of every field, including the ones that didnt fit
+};
+
+struct CAPTURE_EXPORT
+{
+    unsigned long long written;
+    unsigned long long captured;
+    unsigned long long dropped;
+    unsigned long long cycles;
+};
+
+struct LBR_EXPORT
+{
+    unsigned long long written;
+    unsigned long long captures;
+    unsigned long long dropped;
+    unsigned long long cycles;
+};
+
+struct XSAVE_STATS
+{
+    unsigned long long simd_exits;
+    unsigned long long cycles;
+    unsigned long long size;
+};
+
+namespace client
+{
+    const char* status_name(CALL_STATUS status);
+
+    // makes the HYPERCALL_ code, catching the #UD it raises when the hypervisor isnt loaded.
+    // commands the driver registered for the kernel only go through its device instead, which only
+    // administrators can open, and so do job polls and cancels once it is open. for everyone else the
+    // kernel only commands come back call_denied
+    CALL_STATUS call(unsigned long long code, HYPERCALL_ARGS& args, bool xmm = false);
+
+    bool loaded();
+
+    unsigned int core_count();
+
+    // keeps the calling thread on one core while it lives, per core commands dont need it
+    // but timing them does
+    class core_pin
+    {
+    public:
+        explicit core_pin(unsigned int core);
+        ~core_pin();
+
+        core_pin(const core_pin&) = delete;
+        core_pin& operator=(const core_pin&) = delete;
+
+    private:
+        DWORD_PTR previous;
+    };
+
+    // configuration is applied by every core on its next exit, idle cores might not exit for a while
+    void ping_all_cores();
+
+    // the cpuid command channel, which works from any cpl without a vmmcall
+    bool cpuid_ping();
+
+    // user mode may only ping, list the commands, poll jobs, read statistics, copy within its own address
+    // space and broadcast what it may call itself. configuration, exports of guest state and physical memory
+    // are for the kernel, they only work through the driver's device. command_list has the cpl of every command
+
+    CALL_STATUS ping();
+
+    // the kernel only, exits every core of the hypervisor
+    CALL_STATUS shutdown();
+
+    // args come back unchanged
+    CALL_STATUS echo(HYPERCALL_ARGS& args, bool xmm = false);
+
+    CALL_STATUS tsc_config(const TSC_CONFIG& config);
+
+    CALL_STATUS tsc_stats(unsigned int core, TSC_STATS& stats);
+
+    CALL_STATUS pause_config(const PAUSE_CONFIG& config);
+
+    CALL_STATUS pause_export(unsigned int core, PAUSE_ENTRY* entries, unsigned long long capacity, PAUSE_EXPORT& result);
+
+    CALL_STATUS sampler_config(const SAMPLER_CONFIG& config);
+
+    CALL_STATUS sampler_export(unsigned int core, SAMPLE* samples, unsigned long long capacity, SAMPLER_EXPORT& result);
+
+    CALL_STATUS lbr_config(unsigned long long flags);
+
+    CALL_STATUS lbr_export(unsigned int core, BRANCH_ENTRY* entries, unsigned long long capacity, LBR_EXPORT& result);
+
+    CALL_STATUS exit_cost_config(unsigned long long flags);
+
+    CALL_STATUS exit_cost_stats(unsigned int core, EXIT_COST_RECORD* records, unsigned long long capacity, unsigned long long& written);
+
+    // the kernel only, every core records its exits while enabled and spills all guest registers on each of them.
+    // records hold kernel registers and addresses, so exporting them is the kernel's too
+    CALL_STATUS capture_config(unsigned long long flags);
+
+    CALL_STATUS capture_export(unsigned int core, CAPTURE_RECORD* records, unsigned long long capacity, CAPTURE_EXPORT& result);
+
+    // size and the buffer's address have to be 8 byte aligned
+    CALL_STATUS checksum(const void* buffer, unsigned long long size, unsigned long long flags, unsigned long long& checksum);
+
+    CALL_STATUS xsave_stats(unsigned int core, XSAVE_STATS& stats);
+
+    // supported gets the INSTRUCTION_ flags
+    CALL_STATUS instruction_stats(unsigned int core, INSTRUCTION_STATS& stats, unsigned long long& supported);
+
+    CALL_STATUS exception_config(unsigned long long reflect_mask, unsigned long long flags);
+
+    CALL_STATUS exception_stats(unsigned int core, EXCEPTION_STATS& stats);
+
+    // the kernel only, vector 0 turns notifications off
+    CALL_STATUS notify_register(unsigned char vector, unsigned int core);
+
+    // call_empty when theres no completion left
+    CALL_STATUS notify_poll(NOTIFY_COMPLETION& completion, unsigned long long& remaining);
+
+    CALL_STATUS notify_post(unsigned long long cookie, unsigned long long status, bool& queued);
+
+    // starts a job on the calling core, it runs a slice of budget cycles on each of the core's exits.
+    // a budget of 0 takes the hypervisor's default
+    CALL_STATUS job_start(unsigned long long kind, const void* base, unsigned long long size, unsigned long long budget, unsigned long long flags, const void* params = nullptr);
+
+    // the kernel only, searches guest physical memory. the ring in params has to stay committed and locked until the job is over
+    CALL_STATUS search_start(unsigned long long base, unsigned long long size, const SEARCH_PARAMS& params, SEARCH_KERNEL kernel, unsigned long long budget);
+
+    // parses hex bytes with ?? for wildcards, like "48 8B 05 ?? ?? ?? ??"
+    bool parse_pattern(const char* text, SEARCH_PARAMS& params);
+
+    // the kernel only, streams guest physical pages, base and size page aligned. the ring and the fingerprints in params
+    // have to stay committed and locked until the job is over
+    CALL_STATUS snapshot_start(unsigned long long base, unsigned long long size, const SNAPSHOT_PARAMS& params, unsigned long long flags, unsigned long long budget);
+
+    // the page a raw or lz4 record holds
+    bool expand_record(const SNAPSHOT_RECORD& record, const void* data, void* page);
+
+    // copies every entry in one exit, each gets its own status. a call stops after TRANSFER_MAX_BYTES,
+    // processed tells where to continue. buffers are touched first, like the export calls do.
+    // from user mode, entries for physical memory or another address space fail with call_denied
+    CALL_STATUS scatter_gather(TRANSFER_ENTRY* entries, unsigned long long count, unsigned long long& processed, unsigned long long& failed);
+
+    // polling from the job's own core also advances it. user mode only sees jobs its own process started,
+    // and a job stops by itself when its process exits
+    CALL_STATUS job_poll(unsigned int core, JOB_PROGRESS& progress);
+
+    CALL_STATUS job_cancel(unsigned int core);
+
+    // runs code on every core from one call, with up to 5 arguments. call_busy while another one is running.
+    // user mode can broadcast what it may call itself, the pings
+    CALL_STATUS broadcast(unsigned long long code, BROADCAST_RESULT& result, const unsigned long long* args = nullptr, unsigned int count = 0);
+
+    // every command the driver has registered, version is the driver's COMMAND_INTERFACE_VERSION
+    CALL_STATUS command_list(COMMAND_INFO* commands, unsigned long long capacity, unsigned long long& written, unsigned long long& version);
+
+    // capacity in codes, up to COMMAND_MAX
+    CALL_STATUS command_stats(unsigned int core, COMMAND_STATS* stats, unsigned long long capacity);
+
+    // the fields that ever changed behind their clean bit, call_invalid on a release build of the driver
+    CALL_STATUS vmcb_stats(unsigned int core, VMCB_MISMATCH* fields, unsigned long long capacity, VMCB_STATS& result);
+
+    // commands queued in a ring in this process and run in batches, one hypercall per submit.
+    // every tool or thread opens its own, sessions never wait on each other in the hypervisor.
+    // a process can hold SESSION_PER_ADDRESS_SPACE (4) of them. they are closed when the process exits,
+    // and one that goes about a minute without a submit can be taken over by another process's open
+    class session
+    {
+    public:
+        session() = default;
+        ~session();
+
+        session(const session&) = delete;
+        session& operator=(const session&) = delete;
+
+        // entries is a power of two up to SESSION_MAX_ENTRIES, batch how many commands one submit runs at most
+        CALL_STATUS open(unsigned int entries, unsigned int batch);
+
+        CALL_STATUS close();
+
+        // writes a command into the ring without calling the hypervisor, false when the ring is full
+        bool queue(unsigned long long code, unsigned long long cookie, const unsigned long long* args = nullptr);
+
+        // runs up to a batch of the queued commands, pending is how many are still queued
+        CALL_STATUS submit(unsigned long long& processed, unsigned long long& pending);
+
+        // the oldest completion, false when there is none
+        bool complete(SESSION_COMPLETION& completion);
+
+    private:
+        unsigned long long id = 0;
+        unsigned char* ring = nullptr;
+        unsigned int entries = 0;
+
+        volatile SESSION_RING_HEADER* header() const;
+        SESSION_COMMAND* commands() const;
+        SESSION_COMPLETION* completions() const;
+    };
+}
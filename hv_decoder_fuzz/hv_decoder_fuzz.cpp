@@ -0,0 +1,747 @@
+// hv_decoder_fuzz.cpp : the driver's own decoder.cpp and emulator.cpp, checked against references on linux.
+// usage:
+//   hv_decoder_fuzz decode [instructions] [seed] [64 | 32 | 16]
+//   hv_decoder_fuzz emulate [instructions] [seed]
+//   hv_decoder_fuzz bench [instructions] [seed]
+// decode feeds biased random bytes to the decoder and to objdump (or $OBJDUMP) and compares the lengths. each
+// candidate gets a 32 byte slot padded with nops, an instruction is at most 15 bytes so objdump is back in step
+// at the next slot whatever it made of the rest. encodings objdump calls (bad) are skipped, the decoder doesnt
+// validate opcodes, and so are the few objdump gets wrong itself. emulate generates the memory forms the emulator supports, runs each on the cpu and through
+// emulator::emulate from the same registers and memory, and compares registers, memory and flags.
+// bench prints the cycles per decode and per emulation over the emulate corpus
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../amd_hv/hv/decoder/decoder.h"
+#include "../amd_hv/hv/emulator/emulator.h"
+
+extern "C" void run_native(GENERAL_REGISTERS* regs, const void* code, UINT64* rflags);
+
+#define SLOT_SIZE 32
+#define BATCH_SIZE 0x10000
+
+// the data the emulated instructions access, under 2gb so absolute disp32 and 32 bit addressing reach it
+#define DATA_SIZE 0x10000
+
+// or and and define these, af is undefined
+#define COMPARED_FLAGS (0x1 | 0x4 | 0x40 | 0x80 | 0x400 | 0x800)
+
+std::mt19937_64 rng;
+
+UINT64 random(UINT64 bound)
+{
+    return rng() % bound;
+}
+
+const char* gpr_names[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+
+void print_bytes(const UINT8* bytes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        printf("%02x ", bytes[i]);
+}
+
+// prefixes, then an opcode map picked so every escape and encoding gets its share, then random bytes
+void random_candidate(UINT8* bytes, DECODER_MODE mode)
+{
+    static const UINT8 prefixes[] = { 0x66, 0x67, 0xF2, 0xF3, 0xF0, 0x2E, 0x26, 0x36, 0x3E, 0x64, 0x65 };
+
+    size_t at = 0;
+
+    for (UINT64 count = random(4); count; count--)
+        bytes[at++] = prefixes[random(sizeof(prefixes))];
+
+    if (mode == decode_64 && random(2))
+        bytes[at++] = 0x40 | (UINT8)random(16);
+
+    switch (random(8))
+    {
+    case 0:
+        bytes[at++] = 0x0F;
+        break;
+    case 1:
+        bytes[at++] = 0x0F;
+        bytes[at++] = random(2) ? 0x38 : 0x3A;
+        break;
+    case 2:
+    case 3:
+    {
+        // vex, xop and evex. outside of long mode the byte after them needs mod 3, or its les, lds, pop or bound
+
+        static const UINT8 escapes[] = { 0xC4, 0xC5, 0x8F, 0x62 };
+
+        bytes[at++] = escapes[random(sizeof(escapes))];
+        bytes[at++] = (UINT8)rng() | (mode == decode_64 ? 0 : 0xC0);
+        break;
+    }
+    default:
+        break;
+    }
+
+    while (at < DECODER_MAX_LENGTH)
+        bytes[at++] = (UINT8)rng();
+
+    return;
+}
+
+// address -> length and mnemonic of every instruction objdump -w printed
+std::map<UINT64, std::pair<UINT8, std::string>> disassemble(const std::vector<UINT8>& code, DECODER_MODE mode)
+{
+    std::map<UINT64, std::pair<UINT8, std::string>> listing;
+
+    char path[] = "/tmp/hv_decoder_fuzz_XXXXXX";
+    int file = mkstemp(path);
+
+    if (file < 0 || write(file, code.data(), code.size()) != (ssize_t)code.size())
+    {
+        fprintf(stderr, "couldnt write %s \n", path);
+        exit(1);
+    }
+
+    close(file);
+
+    const char* objdump     = getenv("OBJDUMP") ? getenv("OBJDUMP") : "objdump";
+    const char* machine     = mode == decode_64 ? "i386:x86-64" : mode == decode_32 ? "i386" : "i8086";
+
+    std::string command = std::string(objdump) + " -D -w -z --insn-width=16 -b binary -m " + machine + " " + path;
+
+    FILE* output = popen(command.c_str(), "r");
+
+    if (!output)
+    {
+        fprintf(stderr, "couldnt run %s \n", objdump);
+        exit(1);
+    }
+
+    char line[512];
+
+    while (fgets(line, sizeof(line), output))
+    {
+        // "  20:\t66 90                \txchg   %ax,%ax"
+
+        char* end;
+        UINT64 address = strtoull(line, &end, 16);
+
+        if (end == line || *end != ':' || end[1] != '\t')
+            continue;
+
+        char* hex = end + 2;
+        char* text = strchr(hex, '\t');
+
+        UINT8 length = 0;
+
+        for (char* c = hex; *c && c != text; c++)
+        {
+            if (isxdigit(c[0]) && isxdigit(c[1]))
+            {
+                length++;
+                c++;
+            }
+        }
+
+        listing[address] = { length, text ? std::string(text + 1, strcspn(text + 1, "\n")) : "" };
+    }
+
+    pclose(output);
+    unlink(path);
+
+    return listing;
+}
+
+bool only_prefixes(const std::string& text)
+{
+    static const char* prefixes[] = { "rex", "data16", "data32", "addr16", "addr32", "lock", "rep", "repz", "repnz", "repe", "repne",
+                                      "cs", "ds", "es", "ss", "fs", "gs", "bnd", "notrack", "xacquire", "xrelease" };
+
+    char words[256];
+    strncpy(words, text.c_str(), sizeof(words) - 1);
+    words[sizeof(words) - 1] = 0;
+
+    for (char* word = strtok(words, " "); word; word = strtok(nullptr, " "))
+    {
+        bool prefix = false;
+
+        for (auto name : prefixes)
+            prefix |= !strcmp(word, name) || (!strcmp(name, "rex") && !strncmp(word, "rex.", 4));
+
+        if (!prefix)
+            return false;
+    }
+
+    return true;
+}
+
+int fuzz_decode(UINT64 count, DECODER_MODE mode)
+{
+    UINT64 compared = 0, skipped = 0, mismatches = 0;
+
+    std::vector<UINT8> code;
+
+    for (UINT64 done = 0; done < count; )
+    {
+        UINT64 batch = std::min<UINT64>(count - done, BATCH_SIZE);
+
+        code.assign(batch * SLOT_SIZE, 0x90);
+
+        for (UINT64 i = 0; i < batch; i++)
+            random_candidate(&code[i * SLOT_SIZE], mode);
+
+        auto listing = disassemble(code, mode);
+
+        for (UINT64 i = 0; i < batch; i++)
+        {
+            const UINT8* bytes = &code[i * SLOT_SIZE];
+
+            // objdump prints prefixes the instruction doesnt use, like a rex that isnt right before the opcode,
+            // on lines of their own. the cpu skips them, so they count towards the instruction that follows
+
+            // objdump doesnt apply a size prefix from such a line to the instruction though, its length is
+            // meaningless then
+
+            UINT64 expected = 0;
+            std::string text;
+            bool unreliable = false;
+
+            auto reference = listing.find(i * SLOT_SIZE);
+
+            for (; reference != listing.end() && reference->first == i * SLOT_SIZE + expected; reference++)
+            {
+                expected += reference->second.first;
+                text += reference->second.second + "; ";
+
+                if (!only_prefixes(reference->second.second))
+                    break;
+
+                unreliable |= reference->second.second.find("data") != std::string::npos || reference->second.second.find("addr") != std::string::npos;
+            }
+
+            DECODED_INSTRUCTION insn;
+
+            bool decoded = decoder::decode(bytes, DECODER_MAX_LENGTH, mode, insn);
+
+            // objdump folds a wait into the x87 instruction after it, for the cpu its one of its own
+
+            unreliable |= decoded && insn.map == map_one_byte && insn.opcode == 0x9B;
+
+            if (reference == listing.end() || unreliable || text.find("(bad)") != std::string::npos)
+            {
+                skipped++;
+                continue;
+            }
+
+            // objdump sees the nops behind the 15 bytes, an instruction running into them is one the decoder refuses
+
+            if (expected > DECODER_MAX_LENGTH)
+                expected = 0;
+
+            UINT8 length = decoded ? insn.length : 0;
+
+            compared++;
+
+            if (length == expected)
+                continue;
+
+            if (mismatches++ < 32)
+            {
+                print_bytes(bytes, DECODER_MAX_LENGTH);
+                printf("\n  decoder %u, objdump %llu: %s \n", length, expected, text.c_str());
+            }
+        }
+
+        done += batch;
+    }
+
+    printf("mode %u: %llu compared, %llu skipped, %llu mismatches \n", mode * 8, compared, skipped, mismatches);
+
+    return mismatches ? 1 : 0;
+}
+
+struct CASE
+{
+    UINT8 bytes[DECODER_MAX_LENGTH + 1];
+    UINT8 length;
+    GENERAL_REGISTERS regs;
+    UINT64 rflags;
+};
+
+// one of the memory forms emulator.cpp supports
+struct FORM
+{
+    UINT8 map;
+    UINT8 opcode;
+    INT8 extension;     // the reg field for group opcodes, -1 if its a register
+    UINT8 immediate;    // 0, 1, or 4 for an immediate of the operand size capped at 4
+    bool byte_reg;      // the reg field names a byte register
+};
+
+const FORM forms[] =
+{
+    { map_one_byte, 0x88, -1, 0, true },  { map_one_byte, 0x89, -1, 0, false },
+    { map_one_byte, 0x8A, -1, 0, true },  { map_one_byte, 0x8B, -1, 0, false },
+    { map_one_byte, 0xC6, 0, 1, false },  { map_one_byte, 0xC7, 0, 4, false },
+    { map_one_byte, 0x63, -1, 0, false },
+    { map_one_byte, 0x86, -1, 0, true },  { map_one_byte, 0x87, -1, 0, false },
+    { map_one_byte, 0x08, -1, 0, true },  { map_one_byte, 0x09, -1, 0, false },
+    { map_one_byte, 0x0A, -1, 0, true },  { map_one_byte, 0x0B, -1, 0, false },
+    { map_one_byte, 0x20, -1, 0, true },  { map_one_byte, 0x21, -1, 0, false },
+    { map_one_byte, 0x22, -1, 0, true },  { map_one_byte, 0x23, -1, 0, false },
+    { map_one_byte, 0x80, 1, 1, false },  { map_one_byte, 0x80, 4, 1, false },
+    { map_one_byte, 0x81, 1, 4, false },  { map_one_byte, 0x81, 4, 4, false },
+    { map_one_byte, 0x83, 1, 1, false },  { map_one_byte, 0x83, 4, 1, false },
+    { map_0f, 0xB6, -1, 0, false },       { map_0f, 0xB7, -1, 0, false },
+    { map_0f, 0xBE, -1, 0, false },       { map_0f, 0xBF, -1, 0, false },
+};
+
+// an instruction whose operands all stay inside data, rsp is never one of them since run_native needs it
+void random_case(CASE& test, UINT8* data, UINT8* code)
+{
+    auto& regs = test.regs;
+
+    for (UINT8 i = 0; i < 16; i++)
+        decoder::gpr(&regs, i) = rng();
+
+    test.rflags = 0x202 | (rng() & (COMPARED_FLAGS & ~0x400ull));
+
+    UINT8* at = test.bytes;
+
+    bool opsize     = !random(4);
+    bool addrsize   = !random(4);
+
+    if (opsize)
+        *at++ = 0x66;
+
+    if (addrsize)
+        *at++ = 0x67;
+
+    // addresses in registers, the upper half is garbage when only the lower one is used
+
+    UINT64 upper = addrsize ? rng() << 32 : 0;
+
+    auto pointer = [&](UINT64 offset) { return upper | ((UINT64)data + offset); };
+
+    UINT8 kind = (UINT8)random(8);
+
+    if (kind == 0)
+    {
+        // stos and movs, with a few iterations in either direction
+
+        bool rep = random(2);
+
+        if (rep)
+            *at++ = 0xF3;
+
+        if (random(2))
+            *at++ = 0x48;
+
+        static const UINT8 strings[] = { 0xA4, 0xA5, 0xAA, 0xAB };
+
+        *at++ = strings[random(4)];
+
+        if (random(2))
+            test.rflags |= 0x400;
+
+        decoder::gpr(&regs, 1) = upper | random(9);
+        decoder::gpr(&regs, 6) = pointer(0x4000 + random(0x100));
+        decoder::gpr(&regs, 7) = pointer(0x8000 + random(0x100));
+    }
+    else if (kind == 1)
+    {
+        // mov between the accumulator and an absolute offset
+
+        if (random(2))
+            *at++ = 0x48;
+
+        *at++ = 0xA0 + (UINT8)random(4);
+
+        UINT64 address = (UINT64)data + random(DATA_SIZE - 8);
+
+        memcpy(at, &address, addrsize ? 4 : 8);
+        at += addrsize ? 4 : 8;
+    }
+    else
+    {
+        const FORM& form = forms[random(sizeof(forms) / sizeof(forms[0]))];
+
+        UINT8 rex = random(2) ? 0x40 | (UINT8)random(16) : 0;
+
+        UINT8 mod   = (UINT8)random(3);
+        UINT8 rm    = (UINT8)random(8);
+        UINT8 reg   = form.extension >= 0 ? form.extension : (UINT8)random(8);
+
+        bool sib            = rm == 4;
+        bool rip_relative   = !sib && rm == 5 && mod == 0;
+
+        UINT8 scale = 0, index = 4, base = rm;
+
+        if (sib)
+        {
+            scale   = (UINT8)random(4);
+            index   = (UINT8)random(8);
+            base    = (UINT8)random(8);
+        }
+
+        UINT8 base_number   = base | (rex & 1) << 3;
+        UINT8 index_number  = index | (rex & 2) << 2;
+
+        bool has_base   = !rip_relative && !(sib && base == 5 && mod == 0);
+        bool has_index  = sib && index_number != 4;
+
+        if (has_base && base_number == 4)
+        {
+            // r12 is fine, only rsp is ours
+
+            rex |= 0x41;
+            base_number = 12;
+        }
+
+        if (has_index && index_number == base_number && has_base)
+        {
+            has_index   = false;
+            index       = 4;
+            rex         &= ~2;
+        }
+
+        // the register operand, spl and rsp would be our own stack pointer
+
+        if (form.extension < 0 && (reg | (rex & 4) << 1) == 4 && (rex || !form.byte_reg))
+            reg = 0;
+
+        if (rex)
+            *at++ = rex;
+
+        if (form.map == map_0f)
+            *at++ = 0x0F;
+
+        *at++ = form.opcode;
+        *at++ = (UINT8)(mod << 6 | reg << 3 | rm);
+
+        if (sib)
+            *at++ = (UINT8)(scale << 6 | index << 3 | base);
+
+        // the offset into data the operand lands on, 8 bytes short of the end for the widest access
+
+        INT64 target = 0x1000 + random(DATA_SIZE - 0x2000);
+        INT64 address = 0;
+
+        if (has_index)
+        {
+            UINT64 value = random(0x40);
+
+            decoder::gpr(&regs, index_number) = upper | value;
+            address += value << scale;
+        }
+
+        if (has_base)
+        {
+            // the rest of the way is the displacement, within disp8 for mod 1
+
+            INT64 displacement = mod == 1 ? (INT64)random(0x100) - 0x80 : mod == 2 ? (INT64)random(0x2000) - 0x1000 : 0;
+
+            decoder::gpr(&regs, base_number) = pointer(target - address - displacement);
+
+            if (mod == 1)
+                *at++ = (UINT8)displacement;
+            else if (mod == 2)
+            {
+                INT32 disp32 = (INT32)displacement;
+
+                memcpy(at, &disp32, 4);
+                at += 4;
+            }
+        }
+        else
+        {
+            // absolute or rip relative, the displacement is all of it. rip relative is fixed up below once the length is known
+
+            INT32 disp32 = (INT32)((UINT64)data + target - address);
+
+            memcpy(at, &disp32, 4);
+            at += 4;
+        }
+
+        UINT8* displacement_end = at;
+
+        UINT8 immediate = form.immediate == 4 ? (opsize && !(rex & 8) ? 2 : 4) : form.immediate;
+
+        for (UINT8 i = 0; i < immediate; i++)
+            *at++ = (UINT8)rng();
+
+        if (rip_relative)
+        {
+            INT32 disp32 = (INT32)((INT64)data + target - address - (INT64)(code + (at - test.bytes)));
+
+            memcpy(displacement_end - 4, &disp32, 4);
+        }
+    }
+
+    test.length = (UINT8)(at - test.bytes);
+
+    return;
+}
+
+sigjmp_buf native_fault;
+
+void on_fault(int signal)
+{
+    siglongjmp(native_fault, signal);
+}
+
+struct EMULATED_DATA
+{
+    UINT8* copy;
+    UINT64 base;
+};
+
+bool emulated_read(void* context, UINT64 address, void* buffer, UINT8 size)
+{
+    auto data = (EMULATED_DATA*)context;
+
+    if (address - data->base > (UINT64)DATA_SIZE - size)
+        return false;
+
+    memcpy(buffer, data->copy + (address - data->base), size);
+
+    return true;
+}
+
+bool emulated_write(void* context, UINT64 address, const void* buffer, UINT8 size)
+{
+    auto data = (EMULATED_DATA*)context;
+
+    if (address - data->base > (UINT64)DATA_SIZE - size)
+        return false;
+
+    memcpy(data->copy + (address - data->base), buffer, size);
+
+    return true;
+}
+
+struct ARENA
+{
+    UINT8* data;
+    UINT8* code;
+    std::vector<UINT8> copy;
+};
+
+ARENA make_arena()
+{
+    ARENA arena;
+
+    arena.data = (UINT8*)mmap(nullptr, DATA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    arena.code = (UINT8*)mmap(nullptr, 0x1000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+    if (arena.data == MAP_FAILED || arena.code == MAP_FAILED)
+    {
+        fprintf(stderr, "couldnt map the arena below 2gb \n");
+        exit(1);
+    }
+
+    arena.copy.resize(DATA_SIZE);
+
+    return arena;
+}
+
+void print_case(const CASE& test, const DECODED_INSTRUCTION& insn)
+{
+    print_bytes(test.bytes, test.length);
+    printf("(opcode %02x map %u operand %u address %u) \n", insn.opcode, insn.map, insn.operand_size, insn.address_size);
+
+    return;
+}
+
+int fuzz_emulate(UINT64 count)
+{
+    ARENA arena = make_arena();
+
+    signal(SIGSEGV, on_fault);
+    signal(SIGBUS, on_fault);
+
+    UINT64 compared = 0, mismatches = 0;
+
+    for (UINT64 n = 0; n < count; n++)
+    {
+        CASE test;
+
+        random_case(test, arena.data, arena.code);
+
+        for (UINT64 i = 0; i < DATA_SIZE; i += 8)
+            *(UINT64*)(arena.data + i) = rng();
+
+        memcpy(arena.copy.data(), arena.data, DATA_SIZE);
+
+        DECODED_INSTRUCTION insn;
+
+        if (!decoder::decode(test.bytes, test.length, decode_64, insn) || insn.length != test.length)
+        {
+            mismatches++;
+            printf("decoder refused or misread the length of ");
+            print_bytes(test.bytes, test.length);
+            printf("\n");
+            continue;
+        }
+
+        // the emulator first, run_native changes the registers in place
+
+        GENERAL_REGISTERS emulated_regs = test.regs;
+        EMULATED_DATA context{ arena.copy.data(), (UINT64)arena.data };
+
+        EMULATOR_STATE state{ .regs = &emulated_regs, .rflags = test.rflags, .next_rip = (UINT64)arena.code + test.length };
+        EMULATOR_OPS ops{ .context = &context, .read = emulated_read, .write = emulated_write };
+
+        auto status = emulator::emulate(insn, state, ops);
+
+        memcpy(arena.code, test.bytes, test.length);
+        arena.code[test.length] = 0xC3;
+
+        GENERAL_REGISTERS native_regs = test.regs;
+        UINT64 native_rflags = test.rflags;
+
+        if (int signal = sigsetjmp(native_fault, 1))
+        {
+            printf("signal %i running ", signal);
+            print_case(test, insn);
+            mismatches++;
+            continue;
+        }
+
+        run_native(&native_regs, arena.code, &native_rflags);
+
+        compared++;
+
+        bool matches = status == emulate_done;
+
+        for (UINT8 i = 0; i < 16; i++)
+            matches &= i == 4 || decoder::gpr(&emulated_regs, i) == decoder::gpr(&native_regs, i);
+
+        matches &= !((state.rflags ^ native_rflags) & COMPARED_FLAGS);
+        matches &= !memcmp(arena.copy.data(), arena.data, DATA_SIZE);
+
+        if (matches)
+            continue;
+
+        if (mismatches++ >= 32)
+            continue;
+
+        printf("status %u for ", status);
+        print_case(test, insn);
+
+        for (UINT8 i = 0; i < 16; i++)
+        {
+            if (decoder::gpr(&emulated_regs, i) != decoder::gpr(&native_regs, i) && i != 4)
+                printf("  %s emulated %llx native %llx \n", gpr_names[i], decoder::gpr(&emulated_regs, i), decoder::gpr(&native_regs, i));
+        }
+
+        if ((state.rflags ^ native_rflags) & COMPARED_FLAGS)
+            printf("  rflags emulated %llx native %llx \n", state.rflags, native_rflags);
+
+        for (UINT64 i = 0; i < DATA_SIZE; i++)
+        {
+            if (arena.copy[i] != arena.data[i])
+            {
+                printf("  data +%llx emulated %02x native %02x \n", i, arena.copy[i], arena.data[i]);
+                break;
+            }
+        }
+    }
+
+    printf("%llu compared, %llu mismatches \n", compared, mismatches);
+
+    return mismatches ? 1 : 0;
+}
+
+int bench(UINT64 count)
+{
+    ARENA arena = make_arena();
+
+    std::vector<CASE> cases(count);
+    std::vector<DECODED_INSTRUCTION> decoded(count);
+
+    for (auto& test : cases)
+        random_case(test, arena.data, arena.code);
+
+    memcpy(arena.copy.data(), arena.data, DATA_SIZE);
+
+    UINT64 lengths = 0;
+
+    UINT64 start = __rdtsc();
+
+    for (UINT64 i = 0; i < count; i++)
+    {
+        decoder::decode(cases[i].bytes, cases[i].length, decode_64, decoded[i]);
+        lengths += decoded[i].length;
+    }
+
+    UINT64 decode_cycles = __rdtsc() - start;
+
+    EMULATED_DATA context{ arena.copy.data(), (UINT64)arena.data };
+    EMULATOR_OPS ops{ .context = &context, .read = emulated_read, .write = emulated_write };
+
+    UINT64 done = 0;
+
+    start = __rdtsc();
+
+    for (UINT64 i = 0; i < count; i++)
+    {
+        GENERAL_REGISTERS regs = cases[i].regs;
+        EMULATOR_STATE state{ .regs = &regs, .rflags = cases[i].rflags, .next_rip = (UINT64)arena.code + cases[i].length };
+
+        done += emulator::emulate(decoded[i], state, ops) == emulate_done;
+    }
+
+    UINT64 emulate_cycles = __rdtsc() - start;
+
+    printf("instructions,bytes,emulated,decode_cycles,emulate_cycles\n");
+    printf("%llu,%llu,%llu,%.1f,%.1f\n", count, lengths, done, (double)decode_cycles / count, (double)emulate_cycles / count);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* mode    = argc > 1 ? argv[1] : "";
+    UINT64 count        = argc > 2 ? strtoull(argv[2], nullptr, 0) : 100000;
+
+    rng.seed(argc > 3 ? strtoull(argv[3], nullptr, 0) : 1);
+
+    if (!count)
+    {
+        fprintf(stderr, "needs at least one instruction \n");
+        return 1;
+    }
+
+    if (!strcmp(mode, "decode"))
+    {
+        unsigned int bits = argc > 4 ? (unsigned int)strtoul(argv[4], nullptr, 0) : 64;
+
+        if (bits != 64 && bits != 32 && bits != 16)
+        {
+            fprintf(stderr, "the mode is 64, 32 or 16 \n");
+            return 1;
+        }
+
+        return fuzz_decode(count, (DECODER_MODE)(bits / 8));
+    }
+
+    if (!strcmp(mode, "emulate"))
+        return fuzz_emulate(count);
+
+    if (!strcmp(mode, "bench"))
+        return bench(count);
+
+    fprintf(stderr, "usage: hv_decoder_fuzz decode [instructions] [seed] [64 | 32 | 16] \n"
+                    "       hv_decoder_fuzz emulate [instructions] [seed] \n"
+                    "       hv_decoder_fuzz bench [instructions] [seed] \n");
+
+    return 1;
+}
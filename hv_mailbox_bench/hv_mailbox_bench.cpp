@@ -0,0 +1,373 @@
+// hv_mailbox_bench.cpp : the driver's own mailbox.cpp, with threads standing in for cores.
+// a simulated core runs guest code until its nmi latch is set or it takes some other exit, then it drains
+// its mailbox and claims the kick the way hv::handle_vmexit and handlers::nmi do. kicks that arrive while
+// the latch is still set merge into it like nmi-s do, so a request nobody runs means the kick protocol lost it.
+// usage:
+//   hv_mailbox_bench stress [cores] [requests per core] [other exit every n spins, 0 for kicks only]
+//   hv_mailbox_bench latency [most producers] [requests per producer]
+// stress posts from every core to random others and checks each request runs exactly once and in order
+// per sender. latency prints csv with the tsc cycles from post to the handler, into one core that waits in guest code
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+#include "../amd_hv/hv/mailbox/mailbox.h"
+
+struct CORE
+{
+    MAILBOX mailbox;
+    std::atomic<bool> nmi{ false };     // the latch, set by a kick and taken by the exit it causes
+
+    // only touched by the core itself
+    std::vector<UINT64> last;           // stress, per sender the last request this core ran
+    std::vector<UINT64> latencies;      // latency, cycles per request
+    UINT64 ran = 0;
+    UINT64 exits = 0;
+    UINT64 nmi_exits = 0;
+    UINT64 forwarded = 0;               // nmi exits that claimed no kick
+    UINT64 errors = 0;
+};
+
+std::vector<CORE> cores;
+std::atomic<UINT64> delivered;
+std::atomic<bool> stop;
+
+void pin_to_core(unsigned int core)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % std::thread::hardware_concurrency(), &set);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// the owner stands in for the vcpu, handlers get their core back through it
+CORE& owner_of(vcpu* owner)
+{
+    return *(CORE*)owner;
+}
+
+// context is the sender in the upper half and its count of requests to this core in the lower half
+void stress_handler(vcpu* owner, void* context)
+{
+    auto& core      = owner_of(owner);
+    UINT64 sender   = (UINT64)context >> 32;
+    UINT64 index    = (UINT64)context & 0xFFFFFFFF;
+
+    if (index != core.last[sender] + 1)
+        core.errors++;
+
+    core.last[sender] = index;
+    core.ran++;
+
+    delivered++;
+}
+
+// context is the tsc when it was posted
+void latency_handler(vcpu* owner, void* context)
+{
+    auto& core = owner_of(owner);
+
+    core.latencies.push_back(__rdtsc() - (UINT64)context);
+    core.ran++;
+
+    delivered++;
+}
+
+// retries while the target is full, false only if the run is over. a target that lost a kick stays full
+bool post(unsigned int target, MAILBOX_HANDLER handler, void* context, UINT64& full)
+{
+    while (!stop)
+    {
+        auto result = mailbox::post(&cores[target].mailbox, handler, context);
+
+        if (result == mailbox_kick)
+            cores[target].nmi = true;
+
+        if (result != mailbox_full)
+            return true;
+
+        full++;
+        sched_yield();
+    }
+
+    return false;
+}
+
+void exit(CORE& core)
+{
+    core.exits++;
+
+    // hv::handle_vmexit, any exit but an nmi drains first thing
+
+    if (!core.nmi)
+    {
+        mailbox::drain(&core.mailbox, (vcpu*)&core);
+
+        // the rest of the exit handler, other cores keep posting meanwhile
+
+        sched_yield();
+        return;
+    }
+
+    // handlers::nmi, the latch is only taken once the nmi is delivered on the host.
+    // kicked stays set until then, so the cores posting meanwhile dont send kicks that would merge into it
+
+    sched_yield();
+
+    core.nmi_exits++;
+
+    // every nmi here is a kick, one nobody claims would go to the os
+
+    if (!mailbox::claim_kick(&core.mailbox))
+        core.forwarded++;
+
+    core.nmi = false;
+
+    mailbox::drain(&core.mailbox, (vcpu*)&core);
+}
+
+// guest code, until the latch or some other exit
+void run_guest(CORE& core, UINT64 exit_every, UINT64& spins)
+{
+    for (int i = 0; i < 64; i++)
+    {
+        if (core.nmi || (exit_every && ++spins % exit_every == 0))
+        {
+            exit(core);
+            return;
+        }
+
+        _mm_pause();
+    }
+
+    sched_yield();
+}
+
+void reset(unsigned int count)
+{
+    cores = std::vector<CORE>(count);
+
+    for (auto& core : cores)
+    {
+        mailbox::init(&core.mailbox);
+        core.last.assign(count, 0);
+    }
+
+    delivered   = 0;
+    stop        = false;
+}
+
+int stress(unsigned int count, UINT64 requests, UINT64 exit_every)
+{
+    reset(count);
+
+    std::vector<std::vector<UINT64>> sent(count, std::vector<UINT64>(count, 0));
+    std::vector<UINT64> full(count, 0);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int self = 0; self < count; self++)
+    {
+        threads.emplace_back([&, self]
+        {
+            pin_to_core(self);
+
+            std::mt19937_64 random(self);
+            UINT64 spins = 0;
+
+            for (UINT64 i = 0; i < requests; i++)
+            {
+                unsigned int target = (self + 1 + random() % (count - 1)) % count;
+
+                if (!post(target, stress_handler, (void*)((UINT64)self << 32 | (sent[self][target] + 1)), full[self]))
+                    break;
+
+                sent[self][target]++;
+
+                run_guest(cores[self], exit_every, spins);
+            }
+
+            while (!stop)
+                run_guest(cores[self], exit_every, spins);
+        });
+    }
+
+    // every request has been kicked, so they all run without another exit unless one was lost
+
+    UINT64 total    = count * requests;
+    auto deadline   = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+    while (delivered < total && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    stop = true;
+
+    for (auto& thread : threads)
+        thread.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // requests that couldnt even be posted count as missing too, their target stopped draining
+
+    UINT64 errors = 0, missing = total, exits = 0, nmi_exits = 0, forwarded = 0, full_total = 0, leftover = 0;
+
+    for (unsigned int target = 0; target < count; target++)
+    {
+        auto& core = cores[target];
+
+        for (unsigned int sender = 0; sender < count; sender++)
+            missing -= core.last[sender];
+
+        errors      += core.errors;
+        exits       += core.exits;
+        nmi_exits   += core.nmi_exits;
+        forwarded   += core.forwarded;
+        full_total  += full[target];
+        leftover    += core.mailbox.kicks;
+    }
+
+    printf("cores,requests,exit_every,delivered,missing,out_of_order,exits,nmi_exits,forwarded_nmis,full,unclaimed_kicks,requests_per_second\n");
+    printf("%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.0f\n", count, (unsigned long long)total, (unsigned long long)exit_every,
+        (unsigned long long)delivered.load(), (unsigned long long)missing, (unsigned long long)errors, (unsigned long long)exits,
+        (unsigned long long)nmi_exits, (unsigned long long)forwarded, (unsigned long long)full_total, (unsigned long long)leftover, total / seconds);
+
+    if (missing || errors || delivered != total)
+    {
+        fprintf(stderr, "FAILED: %llu requests never ran, %llu ran out of order \n", (unsigned long long)missing, (unsigned long long)errors);
+        return 1;
+    }
+
+    return 0;
+}
+
+// nearest rank, samples are sorted
+UINT64 percentile(const std::vector<UINT64>& samples, double p)
+{
+    size_t rank = (size_t)(p * samples.size() + 0.999999);
+
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+void latency(unsigned int producers, UINT64 requests)
+{
+    reset(producers + 1);
+
+    std::vector<UINT64> full(producers + 1, 0);
+    std::vector<std::thread> threads;
+
+    // core 0 only runs guest code, every exit it takes is a kick
+
+    threads.emplace_back([&]
+    {
+        pin_to_core(0);
+
+        UINT64 spins = 0;
+
+        while (!stop)
+            run_guest(cores[0], 0, spins);
+    });
+
+    for (unsigned int self = 1; self <= producers; self++)
+    {
+        threads.emplace_back([&, self]
+        {
+            pin_to_core(self);
+
+            for (UINT64 i = 0; i < requests; i++)
+            {
+                post(0, latency_handler, (void*)__rdtsc(), full[self]);
+
+                // spaced out, so most requests find the core in guest code
+
+                for (int spin = 0; spin < 256; spin++)
+                    _mm_pause();
+
+                sched_yield();
+            }
+        });
+    }
+
+    while (delivered < producers * requests)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    stop = true;
+
+    for (auto& thread : threads)
+        thread.join();
+
+    auto& samples = cores[0].latencies;
+
+    std::sort(samples.begin(), samples.end());
+
+    UINT64 total = 0, full_total = 0;
+
+    for (auto sample : samples)
+        total += sample;
+
+    for (auto count : full)
+        full_total += count;
+
+    printf("%u,%zu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", producers, samples.size(),
+        (unsigned long long)samples.front(), (unsigned long long)percentile(samples, 0.5), (unsigned long long)percentile(samples, 0.99),
+        (unsigned long long)percentile(samples, 0.999), (unsigned long long)samples.back(), (unsigned long long)(total / samples.size()),
+        (unsigned long long)cores[0].nmi_exits, (unsigned long long)full_total);
+
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    const char* mode = argc > 1 ? argv[1] : "";
+
+    if (!strcmp(mode, "stress"))
+    {
+        unsigned int count  = argc > 2 ? (unsigned int)strtoul(argv[2], nullptr, 0) : 8;
+        UINT64 requests     = argc > 3 ? strtoull(argv[3], nullptr, 0) : 100000;
+        UINT64 exit_every   = argc > 4 ? strtoull(argv[4], nullptr, 0) : 0;
+
+        if (count < 2 || !requests)
+        {
+            fprintf(stderr, "stress needs at least 2 cores and a request \n");
+            return 1;
+        }
+
+        return stress(count, requests, exit_every);
+    }
+
+    if (!strcmp(mode, "latency"))
+    {
+        unsigned int most   = argc > 2 ? (unsigned int)strtoul(argv[2], nullptr, 0) : 8;
+        UINT64 requests     = argc > 3 ? strtoull(argv[3], nullptr, 0) : 10000;
+
+        if (!most || !requests)
+        {
+            fprintf(stderr, "latency needs a producer and a request \n");
+            return 1;
+        }
+
+        printf("producers,samples,min,p50,p99,p99.9,max,mean,nmi_exits,full\n");
+
+        for (unsigned int producers = 1; producers <= most; producers *= 2)
+            latency(producers, requests);
+
+        return 0;
+    }
+
+    fprintf(stderr, "usage: hv_mailbox_bench stress [cores] [requests per core] [other exit every n spins] \n"
+                    "       hv_mailbox_bench latency [most producers] [requests per producer] \n");
+
+    return 1;
+}
@@ -0,0 +1,409 @@
+// hv_overhead.cpp : what running under the hypervisor costs, per instruction class.
+// it runs the same way on bare metal, under amd_hv and on linux, so a run on each can be compared:
+//   hv_overhead run [label] > hv.csv
+//   hv_overhead compare bare.csv hv.csv
+// latencies are the median and the best of many batches, in nanoseconds and tsc cycles
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include "../hv_client/hv_client.h"
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PING_ID 0x123
+#define COMMAND_KEY 0x123456789
+#endif
+
+#define PAGE_SIZE_BYTES 0x1000
+
+// the few things that differ between the platforms
+namespace platform
+{
+    void pin_to_core(unsigned int core)
+    {
+#ifdef _WIN32
+        SetThreadAffinityMask(GetCurrentThread(), 1ull << core);
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+    void cpuid(unsigned int leaf, unsigned int regs[4])
+    {
+#ifdef _WIN32
+        __cpuid((int*)regs, leaf);
+#else
+        __cpuid(leaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // the cpuid command channel, the key and command go in rcx and rdx which the intrinsics cant set.
+    // true only when amd_hv answered
+    bool cpuid_command()
+    {
+#ifdef _WIN32
+        return send_hv_command(COMMAND_KEY, PING_ID);
+#else
+        unsigned long long rax = 0, rbx, rcx = COMMAND_KEY, rdx = PING_ID;
+
+        asm volatile("cpuid" : "+a"(rax), "=b"(rbx), "+c"(rcx), "+d"(rdx));
+
+        return rax == 1;
+#endif
+    }
+
+    // a system call that does next to nothing in the kernel
+    void null_syscall()
+    {
+#ifdef _WIN32
+        GetThreadPriority(GetCurrentThread());
+#else
+        syscall(SYS_getppid);
+#endif
+    }
+
+    void* map(size_t size)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        // a transparent huge page would turn most of the faults into one
+
+        madvise(memory, size, MADV_NOHUGEPAGE);
+
+        return memory;
+#endif
+    }
+
+    void unmap(void* memory, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(memory, 0, MEM_RELEASE);
+#else
+        munmap(memory, size);
+#endif
+    }
+}
+
+struct RESULT
+{
+    const char* test;
+    const char* unit;
+    double median;
+    double best;
+};
+
+std::vector<RESULT> results;
+
+unsigned long long read_tsc()
+{
+    unsigned int aux;
+
+    return __rdtscp(&aux);
+}
+
+// batch returns how many operations it did, every batch is timed as a whole and divided by that
+template <typename F>
+void measure(const char* test, int runs, F&& batch)
+{
+    std::vector<double> ns(runs), cycles(runs);
+
+    batch();
+
+    for (int i = 0; i < runs; i++)
+    {
+        auto start_time             = std::chrono::steady_clock::now();
+        unsigned long long start    = read_tsc();
+
+        double operations = (double)batch();
+
+        unsigned long long end  = read_tsc();
+        auto end_time           = std::chrono::steady_clock::now();
+
+        ns[i]       = std::chrono::duration<double, std::nano>(end_time - start_time).count() / operations;
+        cycles[i]   = (end - start) / operations;
+    }
+
+    std::sort(ns.begin(), ns.end());
+    std::sort(cycles.begin(), cycles.end());
+
+    results.push_back({ test, "ns", ns[runs / 2], ns[0] });
+    results.push_back({ test, "cycles", cycles[runs / 2], cycles[0] });
+}
+
+void benchmark_instructions()
+{
+    constexpr int runs = 200;
+    constexpr int iterations = 1000;
+
+    measure("cpuid", runs, [] {
+        unsigned int regs[4];
+
+        for (int i = 0; i < iterations; i++)
+            platform::cpuid(0, regs);
+
+        return iterations;
+    });
+
+    measure("cpuid command", runs, [] {
+        for (int i = 0; i < iterations; i++)
+            platform::cpuid_command();
+
+        return iterations;
+    });
+
+    measure("rdtsc", runs, [] {
+        for (int i = 0; i < iterations; i++)
+            __rdtsc();
+
+        return iterations;
+    });
+
+    measure("rdtscp", runs, [] {
+        unsigned int aux;
+
+        for (int i = 0; i < iterations; i++)
+            __rdtscp(&aux);
+
+        return iterations;
+    });
+
+    measure("syscall", runs, [] {
+        for (int i = 0; i < iterations; i++)
+            platform::null_syscall();
+
+        return iterations;
+    });
+}
+
+// first touches of freshly mapped pages, each one a demand zero fault
+void benchmark_page_faults()
+{
+    constexpr int runs = 50;
+    constexpr size_t pages = 0x1000;
+
+    measure("page fault", runs, [] {
+        auto memory = (volatile char*)platform::map(pages * PAGE_SIZE_BYTES);
+
+        for (size_t i = 0; i < pages; i++)
+            memory[i * PAGE_SIZE_BYTES] = 1;
+
+        platform::unmap((void*)memory, pages * PAGE_SIZE_BYTES);
+
+        return (int)pages;
+    });
+}
+
+// two threads on the same core handing a semaphore back and forth, every handoff is a switch
+void benchmark_context_switches()
+{
+    constexpr int runs = 20;
+    constexpr int round_trips = 2000;
+
+    std::binary_semaphore ping(0), pong(0);
+    bool done = false;
+
+    std::thread partner([&] {
+        platform::pin_to_core(0);
+
+        for (;;)
+        {
+            ping.acquire();
+
+            if (done)
+                break;
+
+            pong.release();
+        }
+    });
+
+    measure("context switch", runs, [&] {
+        for (int i = 0; i < round_trips; i++)
+        {
+            ping.release();
+            pong.acquire();
+        }
+
+        return round_trips * 2;
+    });
+
+    done = true;
+    ping.release();
+    partner.join();
+}
+
+// bandwidth is reported like a latency, the median and best in MB/s
+void benchmark_memcpy()
+{
+    constexpr int runs = 20;
+    constexpr size_t size = 64 << 20;
+
+    auto source         = (char*)platform::map(size);
+    auto destination    = (char*)platform::map(size);
+
+    memset(source, 1, size);
+    memset(destination, 0, size);
+
+    std::vector<double> bandwidth(runs);
+
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        memcpy(destination, source, size);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        bandwidth[i] = size / seconds / (1 << 20);
+    }
+
+    std::sort(bandwidth.begin(), bandwidth.end());
+
+    results.push_back({ "memcpy", "MB/s", bandwidth[runs / 2], bandwidth[runs - 1] });
+
+    platform::unmap(source, size);
+    platform::unmap(destination, size);
+}
+
+int run(const char* label)
+{
+    // core 0 only, the hypervisor's state is per core and the context switch test needs both threads there
+
+    platform::pin_to_core(0);
+
+    bool hypervised = platform::cpuid_command();
+
+    fprintf(stderr, "%s \n", hypervised ? "running under amd_hv" : "not running under amd_hv");
+
+    benchmark_instructions();
+    benchmark_page_faults();
+    benchmark_context_switches();
+    benchmark_memcpy();
+
+    printf("label,hypervised,test,unit,median,best\n");
+
+    for (auto& result : results)
+        printf("%s,%d,%s,%s,%.2f,%.2f\n", label, hypervised, result.test, result.unit, result.median, result.best);
+
+    return 0;
+}
+
+// test and unit to median, from a file run wrote
+bool load(const char* path, std::map<std::string, double>& medians, std::vector<std::string>& order)
+{
+    FILE* file = fopen(path, "r");
+
+    if (!file)
+        return false;
+
+    char line[512];
+
+    // skip the header
+
+    if (!fgets(line, sizeof(line), file))
+    {
+        fclose(file);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char* fields[6] = {};
+        char* cursor = line;
+
+        for (int i = 0; i < 6 && cursor; i++)
+        {
+            fields[i] = cursor;
+            cursor = strchr(cursor, ',');
+
+            if (cursor)
+                *cursor++ = 0;
+        }
+
+        if (!fields[4])
+            continue;
+
+        std::string key = std::string(fields[2]) + "," + fields[3];
+
+        if (!medians.count(key))
+            order.push_back(key);
+
+        medians[key] = atof(fields[4]);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+int compare(const char* baseline_path, const char* measured_path)
+{
+    std::map<std::string, double> baseline, measured;
+    std::vector<std::string> order, unused;
+
+    if (!load(baseline_path, baseline, order) || !load(measured_path, measured, unused))
+    {
+        fprintf(stderr, "couldnt read %s or %s \n", baseline_path, measured_path);
+        return 1;
+    }
+
+    printf("%-24s %-7s %12s %12s %10s\n", "test", "unit", "baseline", "measured", "slowdown");
+
+    for (auto& key : order)
+    {
+        if (!measured.count(key))
+            continue;
+
+        size_t comma    = key.find(',');
+        auto test       = key.substr(0, comma);
+        auto unit       = key.substr(comma + 1);
+
+        double before   = baseline[key];
+        double after    = measured[key];
+
+        // bandwidth drops where latency grows
+
+        double slowdown = unit == "MB/s" ? before / after : after / before;
+
+        printf("%-24s %-7s %12.2f %12.2f %9.2fx\n", test.c_str(), unit.c_str(), before, after, slowdown);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "run"))
+        return run(argc > 2 ? argv[2] : "");
+
+    if (argc > 3 && !strcmp(argv[1], "compare"))
+        return compare(argv[2], argv[3]);
+
+    fprintf(stderr, "usage: hv_overhead run [label] > results.csv \n");
+    fprintf(stderr, "       hv_overhead compare baseline.csv measured.csv \n");
+
+    return 1;
+}
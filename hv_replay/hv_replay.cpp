@@ -0,0 +1,643 @@
+// hv_replay.cpp : replays exits recorded by usermode_test's capture mode offline and checks them.
+// the driver's own exit path runs here, hv::handle_vmexit and everything it calls, built against ../hv_shim and linked
+// with machine.cpp standing in for windows, the cpu and helpers.asm. each record's before state goes into the vmcb and
+// the register frame, and what the handlers leave behind has to match the record's after state.
+// what the record doesnt hold is taken from it instead of checked: the cpuid leaves of the recording cpu, its tsc,
+// hypercall results that come from live hypervisor state, and events other cores posted. an exit that needed guest
+// memory, which isnt recorded, only gets the spill contract checked: a handler may only change the registers it
+// declared in handlers.h, the exit path wouldnt have written anything else back
+// usage:
+//   hv_replay verify <capture> [most mismatches printed]
+//   hv_replay bench <capture> [passes]
+//   hv_replay synth <capture> [exits] [cores]
+// verify exits with 1 on any mismatch. bench prints csv with the exit mix and what handle_vmexit costs per exit code
+// on this machine. synth runs a made up exit mix through the exit path and writes what it did as a capture,
+// for trying the tools without a recording. verify on a synth capture passes by construction, its expectations
+// came from the same exit path, so only a real recording says anything about the handlers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+#include "../amd_hv/hv/hv.h"
+
+// CAPTURE_STATE::gpr slots, GENERAL_REGISTERS order
+enum GPR : int
+{
+    r15, r14, r13, r12, r11, r10, r9, r8, rdi, rsi, rbp, rsp, rbx, rdx, rcx, rax
+};
+
+const char* gpr_names[16] = { "r15", "r14", "r13", "r12", "r11", "r10", "r9", "r8", "rdi", "rsi", "rbp", "rsp", "rbx", "rdx", "rcx", "rax" };
+
+// a register changed that the handler didnt declare, reported with the value it had before the exit
+const char* undeclared_names[16] =
+{
+    "undeclared r15", "undeclared r14", "undeclared r13", "undeclared r12", "undeclared r11", "undeclared r10", "undeclared r9", "undeclared r8",
+    "undeclared rdi", "undeclared rsi", "undeclared rbp", "undeclared rsp", "undeclared rbx", "undeclared rdx", "undeclared rcx", "undeclared rax"
+};
+
+constexpr UINT64 upper_half = 0xFFFFFFFF00000000;
+
+// what the record could be held to
+enum CHECK
+{
+    check_full,         // every field
+    check_registers,    // only the spill contract, the exit read guest memory
+};
+
+struct REPLAY
+{
+    MACHINE_OUTPUT output;
+    CHECK check;
+    bool partial;       // some fields came from the record
+};
+
+// the part of the exit that doesnt depend on anything the record lacks, or true if the rest is taken from the record
+bool from_record(const CAPTURE_RECORD& record, const CAPTURE_STATE& replayed)
+{
+    auto& before = record.before;
+
+    switch (record.exit_code)
+    {
+    case SVMEXIT::RDTSC:
+    case SVMEXIT::RDTSCP:
+
+        // the tsc and TSC_AUX of the machine running the replay
+
+        return true;
+    case SVMEXIT::VMMCALL:
+    {
+        if (before.gpr[rax] >> 32 != HYPERCALL_KEY)
+            return false;
+
+        // whatever the registry turns down, and the calls that only hand back what they got
+
+        UINT64 code = before.gpr[rax] & HYPERCALL_CODE_MASK;
+
+        if (replayed.gpr[rax] == call_invalid || replayed.gpr[rax] == call_denied)
+            return false;
+
+        return code != HYPERCALL_PING && code != HYPERCALL_SHUTDOWN && code != HYPERCALL_ECHO;
+    }
+    default:
+        return false;
+    }
+}
+
+// runs record through handle_vmexit and takes what the replay cant know from the record
+void replay_exit(const CAPTURE_RECORD& record, REPLAY& result)
+{
+    auto& before    = record.before;
+    auto& after     = record.after;
+    auto& state     = result.output.state;
+
+    // the leaf the recording cpu returned, the handler keeps the upper halves of the registers itself
+
+    MACHINE_INPUT input{};
+
+    if (record.exit_code == SVMEXIT::CPUID && before.gpr[rcx] != COMMAND_KEY)
+    {
+        input.leaf_armed    = true;
+        input.leaf[0]       = (int)after.gpr[rax];
+        input.leaf[1]       = (int)after.gpr[rbx];
+        input.leaf[2]       = (int)after.gpr[rcx];
+        input.leaf[3]       = (int)after.gpr[rdx];
+    }
+
+    machine::run(record, input, result.output);
+
+    result.check    = result.output.guest_accesses ? check_registers : check_full;
+    result.partial  = false;
+
+    if (from_record(record, state))
+    {
+        // a status in rax and up to 6 results, rdtsc only writes rax and rdx and rdtscp adds rcx
+
+        for (int gpr : { rax, rcx, rdx, r8, r9, r10, r11 })
+        {
+            if (record.declared & 1 << gpr)
+                state.gpr[gpr] = after.gpr[gpr];
+        }
+
+        result.partial = true;
+    }
+
+    // events other cores queued and notifications they posted arent recorded, the replay only
+    // knows the ones this exit raised itself
+
+    if (state.event_inject == before.event_inject)
+        state.event_inject = after.event_inject;
+
+    if (state.v_ctl == before.v_ctl)
+        state.v_ctl = after.v_ctl;
+
+    if (state.interrupt_shadow == before.interrupt_shadow)
+        state.interrupt_shadow = after.interrupt_shadow;
+}
+
+struct MISMATCH
+{
+    const char* field;
+    UINT64 replayed;
+    UINT64 recorded;
+};
+
+void compare(const CAPTURE_RECORD& record, const REPLAY& result, std::vector<MISMATCH>& mismatches)
+{
+    auto& before    = record.before;
+    auto& after     = record.after;
+    auto& output    = result.output;
+    auto& state     = output.state;
+
+    // a capture from another build declared other registers, the rest of it says little about this one
+
+    UINT16 declared = machine::spill_mask(record.exit_code);
+
+    if (record.declared != declared)
+        mismatches.push_back({ "declared", declared, record.declared });
+
+    // the exit path only writes back what the handler declared, a change to anything else would be lost on hardware
+
+    for (int gpr = 0; gpr < 16; gpr++)
+    {
+        if (before.gpr[gpr] != after.gpr[gpr] && !(record.declared & 1 << gpr))
+            mismatches.push_back({ undeclared_names[gpr], before.gpr[gpr], after.gpr[gpr] });
+    }
+
+    // the same for what the replay did, and helpers.asm has to get the guest vmcb back for vmrun
+
+    for (int gpr = 0; gpr < 16; gpr++)
+    {
+        if (before.gpr[gpr] != state.gpr[gpr] && !(declared & 1 << gpr))
+            mismatches.push_back({ undeclared_names[gpr], state.gpr[gpr], before.gpr[gpr] });
+    }
+
+    UINT64 guest_vmcb = machine::guest_vmcb(record.core);
+
+    if (output.host_rax != guest_vmcb)
+        mismatches.push_back({ "host rax", guest_vmcb, output.host_rax });
+
+    // rdtsc and rdtscp zero extend, whichever tsc was read
+
+    if (record.exit_code == SVMEXIT::RDTSC || record.exit_code == SVMEXIT::RDTSCP)
+    {
+        for (int gpr : { rax, rdx, rcx })
+        {
+            if ((gpr != rcx || record.exit_code == SVMEXIT::RDTSCP) && (after.gpr[gpr] & upper_half))
+                mismatches.push_back({ gpr_names[gpr], after.gpr[gpr] & ~upper_half, after.gpr[gpr] });
+        }
+    }
+
+    if (result.check != check_full)
+        return;
+
+    // registers reported above arent reported twice
+
+    for (int gpr = 0; gpr < 16; gpr++)
+    {
+        if (state.gpr[gpr] != after.gpr[gpr] && (before.gpr[gpr] == after.gpr[gpr] || (record.declared & 1 << gpr)) &&
+            (before.gpr[gpr] == state.gpr[gpr] || (declared & 1 << gpr)))
+            mismatches.push_back({ gpr_names[gpr], state.gpr[gpr], after.gpr[gpr] });
+    }
+
+    const struct
+    {
+        const char* name;
+        UINT64 replayed;
+        UINT64 recorded;
+    } fields[] =
+    {
+        { "rip",                state.rip,              after.rip },
+        { "rflags",             state.rflags,           after.rflags },
+        { "cr0",                state.cr0,              after.cr0 },
+        { "cr2",                state.cr2,              after.cr2 },
+        { "cr3",                state.cr3,              after.cr3 },
+        { "cr4",                state.cr4,              after.cr4 },
+        { "efer",               state.efer,             after.efer },
+        { "event_inject",       state.event_inject,     after.event_inject },
+        { "interrupt_shadow",   state.interrupt_shadow, after.interrupt_shadow },
+        { "v_ctl",              state.v_ctl,            after.v_ctl },
+        { "cpl",                state.cpl,              after.cpl },
+    };
+
+    for (auto& field : fields)
+    {
+        if (field.replayed != field.recorded)
+            mismatches.push_back({ field.name, field.replayed, field.recorded });
+    }
+}
+
+bool load(const char* path, std::vector<CAPTURE_RECORD>& records)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        fprintf(stderr, "cant open %s \n", path);
+        return false;
+    }
+
+    CAPTURE_RECORD record;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+        records.push_back(record);
+
+    bool partial = !feof(file) || ftell(file) % sizeof(CAPTURE_RECORD);
+
+    fclose(file);
+
+    if (partial)
+    {
+        fprintf(stderr, "%s isnt a capture, its size isnt a multiple of %zu bytes \n", path, sizeof(CAPTURE_RECORD));
+        return false;
+    }
+
+    return true;
+}
+
+std::string exit_name(UINT64 code)
+{
+    switch (code)
+    {
+    case SVMEXIT::INTR:     return "intr";
+    case SVMEXIT::NMI:      return "nmi";
+    case SVMEXIT::VINTR:    return "vintr";
+    case SVMEXIT::RDTSC:    return "rdtsc";
+    case SVMEXIT::CPUID:    return "cpuid";
+    case SVMEXIT::IRET:     return "iret";
+    case SVMEXIT::PAUSE:    return "pause";
+    case SVMEXIT::VMRUN:    return "vmrun";
+    case SVMEXIT::VMMCALL:  return "vmmcall";
+    case SVMEXIT::RDTSCP:   return "rdtscp";
+    }
+
+    char name[32];
+
+    if (code - SVMEXIT::DE < 32)
+        snprintf(name, sizeof(name), "exception %llu", (unsigned long long)(code - SVMEXIT::DE));
+    else
+        snprintf(name, sizeof(name), "0x%llx", (unsigned long long)code);
+
+    return name;
+}
+
+// the machine needs a vcpu for every core the records came from
+bool boot(const std::vector<CAPTURE_RECORD>& records)
+{
+    int cores = 1;
+
+    for (auto& record : records)
+        cores = max(cores, record.core + 1);
+
+    if (!machine::boot(cores))
+    {
+        fprintf(stderr, "the hypervisor didnt set up \n");
+        return false;
+    }
+
+    return true;
+}
+
+int verify(const std::vector<CAPTURE_RECORD>& records, UINT64 most_printed)
+{
+    struct COUNTS
+    {
+        UINT64 exits = 0;
+        UINT64 failed = 0;
+        UINT64 registers_only = 0;  // only the spill contract could be checked
+        UINT64 partial = 0;         // some results were taken from the record
+    };
+
+    std::map<UINT64, COUNTS> per_exit;
+    std::map<UINT16, UINT64> last_sequence;
+
+    UINT64 failed = 0, gaps = 0, printed = 0;
+
+    std::vector<MISMATCH> mismatches;
+
+    if (!boot(records))
+        return 1;
+
+    for (auto& record : records)
+    {
+        auto& counts = per_exit[record.exit_code];
+
+        counts.exits++;
+
+        // the ring was full, those exits are missing but the ones around them are still good
+
+        auto& last = last_sequence[record.core];
+
+        if (last && record.sequence != last + 1)
+            gaps++;
+
+        last = record.sequence;
+
+        REPLAY result;
+        mismatches.clear();
+
+        replay_exit(record, result);
+        compare(record, result, mismatches);
+
+        if (result.check != check_full)
+            counts.registers_only++;
+        else if (result.partial)
+            counts.partial++;
+
+        if (mismatches.empty())
+            continue;
+
+        counts.failed++;
+        failed++;
+
+        for (auto& mismatch : mismatches)
+        {
+            if (printed++ >= most_printed)
+                break;
+
+            printf("core %u sequence %llu %s: %s replayed %llx recorded %llx \n", record.core, (unsigned long long)record.sequence,
+                exit_name(record.exit_code).c_str(), mismatch.field, (unsigned long long)mismatch.replayed, (unsigned long long)mismatch.recorded);
+        }
+    }
+
+    printf("exit,exits,mismatched,registers_only,partial\n");
+
+    for (auto& [code, counts] : per_exit)
+    {
+        printf("%s,%llu,%llu,%llu,%llu\n", exit_name(code).c_str(), (unsigned long long)counts.exits, (unsigned long long)counts.failed,
+            (unsigned long long)counts.registers_only, (unsigned long long)counts.partial);
+    }
+
+    printf("%zu exits on %zu cores, %llu mismatched, %llu gaps from dropped records \n", records.size(), last_sequence.size(),
+        (unsigned long long)failed, (unsigned long long)gaps);
+
+    return failed ? 1 : 0;
+}
+
+void bench(const std::vector<CAPTURE_RECORD>& records, int passes)
+{
+    struct TIMES
+    {
+        UINT64 exits = 0;
+        double seconds = 0;
+    };
+
+    if (!boot(records))
+        return;
+
+    // grouped by exit code so every group runs as one stream, like a burst of the same exit would
+
+    std::map<UINT64, std::vector<const CAPTURE_RECORD*>> groups;
+
+    for (auto& record : records)
+        groups[record.exit_code].push_back(&record);
+
+    std::map<UINT64, TIMES> times;
+
+    UINT64 sink = 0;
+
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (auto& [code, group] : groups)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            for (auto record : group)
+            {
+                REPLAY result;
+
+                replay_exit(*record, result);
+
+                sink += result.output.state.rip;
+            }
+
+            auto& entry = times[code];
+
+            entry.exits     += group.size();
+            entry.seconds   += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    // the time includes loading the record into the vmcb and the frame, which helpers.asm and the cpu do on hardware
+
+    printf("exit,exits,share,ns_per_exit\n");
+
+    for (auto& [code, entry] : times)
+        printf("%s,%zu,%.4f,%.2f\n", exit_name(code).c_str(), groups[code].size(), (double)groups[code].size() / records.size(), entry.seconds * 1e9 / entry.exits);
+
+    // keeps the loop from being optimized out
+
+    if (sink == 1)
+        printf("\n");
+}
+
+// a guest state that could have exited on core in long mode
+CAPTURE_STATE random_state(std::mt19937_64& random, UINT64 cr3)
+{
+    CAPTURE_STATE state{};
+
+    for (auto& gpr : state.gpr)
+        gpr = random();
+
+    state.rip       = 0xFFFFF80000000000 | (random() & 0xFFFFFFFFF);
+    state.gpr[rsp]  = 0xFFFFA00000000000 | (random() & 0xFFFFFFF0);
+    state.rflags    = 0x202 | (random() & 0x8D5);
+    state.cr0       = 0x80050033;
+    state.cr2       = random() & 0x7FFFFFFFFFFF;
+    state.cr3       = cr3;
+    state.cr4       = 0x350EF8;
+    state.efer      = 0xD01;
+    state.cpl       = random() % 4 == 0 ? 3 : 0;
+
+    return state;
+}
+
+int synth(const char* path, UINT64 exits, unsigned int cores)
+{
+    // roughly what an idle windows desktop exits on once the tsc is intercepted
+
+    const struct
+    {
+        UINT64 code;
+        unsigned int weight;
+        UINT8 length;       // of the instruction, instruction intercepts save nrip
+    } mix[] =
+    {
+        { SVMEXIT::CPUID,           30, 2 },
+        { SVMEXIT::RDTSC,           25, 2 },
+        { SVMEXIT::RDTSCP,          10, 3 },
+        { SVMEXIT::VMMCALL,         10, 3 },
+        { SVMEXIT::PAUSE,           10, 2 },
+        { SVMEXIT::NMI,             5,  0 },
+        { SVMEXIT::VINTR,           5,  0 },
+        { SVMEXIT::DE + 14,         5,  0 },
+    };
+
+    // hypercalls that dont need guest memory, and a code nothing is registered for
+
+    const UINT64 calls[] = { HYPERCALL_PING, HYPERCALL_ECHO, HYPERCALL_TSC_STATS, HYPERCALL_XSAVE_STATS, HYPERCALL_SHUTDOWN, COMMAND_MAX - 1 };
+
+    unsigned int total_weight = 0;
+
+    for (auto& entry : mix)
+        total_weight += entry.weight;
+
+    if (!machine::boot(cores))
+    {
+        fprintf(stderr, "the hypervisor didnt set up \n");
+        return 1;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "cant open %s \n", path);
+        return 1;
+    }
+
+    std::mt19937_64 random(1);
+    std::vector<UINT64> sequences(cores, 0), tscs(cores, 1000000);
+
+    for (UINT64 i = 0; i < exits; i++)
+    {
+        unsigned int pick = random() % total_weight;
+        auto entry = &mix[0];
+
+        for (auto& candidate : mix)
+        {
+            if (pick < candidate.weight)
+            {
+                entry = &candidate;
+                break;
+            }
+
+            pick -= candidate.weight;
+        }
+
+        CAPTURE_RECORD record{};
+
+        record.core         = (UINT16)(random() % cores);
+        record.sequence     = ++sequences[record.core];
+        record.tsc          = tscs[record.core] += 1000 + random() % 100000;
+        record.exit_code    = entry->code;
+        record.declared     = machine::spill_mask(entry->code);
+        record.before       = random_state(random, 0x1AD000 + (random() % 64) * 0x1000);
+
+        if (entry->length)
+            record.nrip = record.before.rip + entry->length;
+
+        auto& before = record.before;
+
+        MACHINE_INPUT input{};
+
+        switch (entry->code)
+        {
+        case SVMEXIT::CPUID:
+
+            if (random() % 8 == 0)
+            {
+                before.gpr[rcx] = COMMAND_KEY;
+                before.gpr[rdx] = PING_ID;
+                break;
+            }
+
+            input.leaf_armed = true;
+
+            for (auto& value : input.leaf)
+                value = (int)random();
+
+            break;
+        case SVMEXIT::VMMCALL:
+
+            // a probe from something that doesnt know us
+
+            if (random() % 16 == 0)
+                break;
+
+            before.gpr[rax] = HYPERCALL_CODE(calls[random() % RTL_NUMBER_OF(calls)]);
+
+            // a core argument past the last core now and then
+
+            before.gpr[rcx] = random() % (cores + 1);
+            break;
+        case SVMEXIT::DE + 14:
+
+            // a page fault on a present page, the error code and the address
+
+            record.exit_info1 = (random() & 0x1E) | 1;
+            record.exit_info2 = random() & 0x7FFFFFFFFFFF;
+            break;
+        default:
+            break;
+        }
+
+        MACHINE_OUTPUT output;
+
+        machine::run(record, input, output);
+
+        record.after = output.state;
+
+        fwrite(&record, sizeof(record), 1, file);
+    }
+
+    fclose(file);
+
+    printf("%llu exits on %u cores written to %s \n", (unsigned long long)exits, cores, path);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* mode = argc > 1 ? argv[1] : "";
+
+    if (argc > 2 && !strcmp(mode, "verify"))
+    {
+        std::vector<CAPTURE_RECORD> records;
+
+        if (!load(argv[2], records))
+            return 1;
+
+        return verify(records, argc > 3 ? strtoull(argv[3], nullptr, 0) : 32);
+    }
+
+    if (argc > 2 && !strcmp(mode, "bench"))
+    {
+        std::vector<CAPTURE_RECORD> records;
+
+        if (!load(argv[2], records) || records.empty())
+            return 1;
+
+        bench(records, argc > 3 ? atoi(argv[3]) : 100);
+
+        return 0;
+    }
+
+    if (argc > 2 && !strcmp(mode, "synth"))
+    {
+        UINT64 exits        = argc > 3 ? strtoull(argv[3], nullptr, 0) : 100000;
+        unsigned int cores  = argc > 4 ? (unsigned int)strtoul(argv[4], nullptr, 0) : 8;
+
+        if (!cores || cores > 0xFFFF)
+        {
+            fprintf(stderr, "synth needs between 1 and 65535 cores \n");
+            return 1;
+        }
+
+        return synth(argv[2], exits, cores);
+    }
+
+    fprintf(stderr, "usage: hv_replay verify <capture> [most mismatches printed] \n"
+                    "       hv_replay bench <capture> [passes] \n"
+                    "       hv_replay synth <capture> [exits] [cores] \n");
+
+    return 1;
+}
@@ -0,0 +1,591 @@
+// machine.cpp : what the driver expects from windows, the cpu and helpers.asm, for running its exit path in a process.
+// memory is identity mapped, the local apics are x2apics whose registers are msrs, and the privileged instructions
+// do nothing or read made up values. cpuid goes to the cpu running the replay unless an exit armed a recorded leaf
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+#include "machine.h"
+
+#include "../amd_hv/hv/hv.h"
+#include "../amd_hv/hv/vcpu/vcpu.h"
+#include "../amd_hv/hv/memory/memory.h"
+#include "../amd_hv/hv/asm/asm.h"
+
+namespace
+{
+    int core_count;
+    int current_core;
+
+    MACHINE_INPUT input;
+
+    UINT32 guest_accesses;
+
+    std::map<UINT64, UINT64> msrs;     // core << 32 | msr
+
+    // a windows x64 gdt, the vcpus take the host's code and data segments from it
+    const UINT64 gdt[] =
+    {
+        0,
+        0,
+        0x00209B0000000000,     // 0x10 kernel code
+        0x00CF93000000FFFF,     // 0x18 kernel data
+        0x00CFFB000000FFFF,     // 0x20 user code, compatibility mode
+        0x00CFF3000000FFFF,     // 0x28 user data
+        0x0020FB0000000000,     // 0x30 user code
+    };
+
+    // EDX of 0x8000000A on the svm cpus the hypervisor runs on, lbr virtualization,
+    // nrip save, decode assists, pause filter and pause filter threshold
+    constexpr int svm_features = 1 << 1 | 1 << 3 | 1 << 7 | 1 << 10 | 1 << 12;
+
+    // fills the GENERAL_REGISTERS slots nothing spilled on this exit, a handler reading one gets garbage on hardware
+    constexpr UINT64 poison = 0xBADC0FFEE0000000;
+
+    // volatile registers, helpers.asm spills and fills them on every exit
+    constexpr UINT16 volatile_mask = gpr_rax | gpr_rcx | gpr_rdx | gpr_r8 | gpr_r9 | gpr_r10 | gpr_r11;
+
+    // the start of vcpu, which helpers.asm reaches into through its vcpu STRUCT. the members are private,
+    // the replay sets them the way the asm does
+    struct ASM_VIEW
+    {
+        VMCB                guest_vmcb;
+        VMCB                host_vmcb;
+        char                host_save_area[0x1000];
+        void*               host_stack_base;
+        void*               host_stack;
+        UINT64              guest_vmcb_phys;
+        UINT64              host_vmcb_phys;
+        GENERAL_REGISTERS*  regs;
+        GUEST_XMM*          xmm;
+        const UINT16*       spill_masks;
+        UINT64              spill_mask;
+    };
+
+    static_assert(sizeof(ASM_VIEW) < sizeof(vcpu), "ASM_VIEW has to mirror the start of vcpu");
+
+    // xmm0 - xmm5 right under GENERAL_REGISTERS, like helpers.asm leaves them on the host stack
+    struct alignas(16) FRAME
+    {
+        GUEST_XMM           xmm;
+        GENERAL_REGISTERS   regs;
+    };
+
+    FRAME frame;
+
+    ASM_VIEW* view(vcpu* vcpu)
+    {
+        return reinterpret_cast<ASM_VIEW*>(vcpu);
+    }
+
+    void* allocate(SIZE_T size)
+    {
+        size = (size + PAGE_SIZE - 1) & ~(SIZE_T)(PAGE_SIZE - 1);
+
+        void* address = aligned_alloc(PAGE_SIZE, size);
+
+        if (address)
+            memset(address, 0, size);
+
+        return address;
+    }
+}
+
+bool machine::boot(int cores)
+{
+    core_count = cores;
+
+    if (!hv::setup())
+        return false;
+
+    for (int i = 0; i < cores; i++)
+    {
+        // setup reads the apic id and the msrs of the core its running on
+
+        current_core = i;
+
+        auto vcpu = hv::get_vcpu(i);
+
+        if (!vcpu->setup())
+            return false;
+
+        view(vcpu)->regs    = &frame.regs;
+        view(vcpu)->xmm     = &frame.xmm;
+    }
+
+    current_core = 0;
+
+    return true;
+}
+
+int machine::cores()
+{
+    return core_count;
+}
+
+UINT64 machine::guest_vmcb(int core)
+{
+    return view(hv::get_vcpu(core))->guest_vmcb_phys;
+}
+
+UINT16 machine::spill_mask(UINT64 exit_code)
+{
+    return exit_code < SPILL_TABLE_SIZE ? hv::get_spill_masks()[exit_code] : (UINT16)gpr_all;
+}
+
+void machine::run(const CAPTURE_RECORD& record, const MACHINE_INPUT& exit_input, MACHINE_OUTPUT& output)
+{
+    auto vcpu       = hv::get_vcpu(record.core);
+    auto asm_view   = view(vcpu);
+    auto& before    = record.before;
+    auto& control   = vcpu->get_guest().get_control_area();
+    auto& state     = vcpu->get_guest().get_state_save_area();
+    auto& after     = output.state;
+
+    current_core    = record.core;
+    input           = exit_input;
+    guest_accesses  = 0;
+
+    // what the cpu writes into the vmcb on #VMEXIT
+
+    control.exit_code               = record.exit_code;
+    control.exit_info1              = record.exit_info1;
+    control.exit_info2              = record.exit_info2;
+    control.exit_int_info.value     = record.exit_int_info;
+    control.nrip                    = record.nrip;
+    control.cur_instr.bytes_amt     = record.fetched;
+    control.event_inject.value      = before.event_inject;
+    control.interrupt_shadow        = before.interrupt_shadow;
+    control.v_ctl.value             = before.v_ctl;
+
+    memcpy(control.cur_instr.instruction_bytes, record.instruction, sizeof(record.instruction));
+
+    state.rip               = before.rip;
+    state.rflags.AsUInt     = before.rflags;
+    state.cr0.AsUInt        = before.cr0;
+    state.cr2               = before.cr2;
+    state.cr3.AsUInt        = before.cr3;
+    state.cr4.AsUInt        = before.cr4;
+    state.efer.value        = before.efer;
+    state.cpl               = (UINT8)before.cpl;
+    state.rax               = before.gpr[15];
+    state.rsp               = before.gpr[11];
+
+    // helpers.asm, rax holds the guest vmcb for vmrun, the volatile registers always go into the frame
+    // and the nonvolatile ones only if the handler declared them
+
+    UINT16 mask = record.exit_code < SPILL_TABLE_SIZE ? asm_view->spill_masks[record.exit_code] : (UINT16)gpr_all;
+
+    asm_view->spill_mask = mask;
+
+    auto slots = (UINT64*)&frame.regs;
+
+    for (int slot = 0; slot < 16; slot++)
+        slots[slot] = ((volatile_mask | mask) & ~gpr_rsp) & 1 << slot ? before.gpr[slot] : poison | slot;
+
+    frame.regs.rax = asm_view->guest_vmcb_phys;
+
+    memset(&frame.xmm, 0, sizeof(frame.xmm));
+
+    output.shutdown = hv::handle_vmexit(vcpu);
+
+    // the replay keeps going where the hypervisor would have left
+
+    vcpu->wants_shutdown() = 0;
+
+    // what the guest has after vmrun, the frame for what helpers.asm fills, the cpu still holds the rest
+
+    for (int slot = 0; slot < 16; slot++)
+        after.gpr[slot] = (volatile_mask | mask) & 1 << slot ? slots[slot] : before.gpr[slot];
+
+    after.gpr[15]           = state.rax;
+    after.gpr[11]           = state.rsp;
+    after.rip               = state.rip;
+    after.rflags            = state.rflags.AsUInt;
+    after.cr0               = state.cr0.AsUInt;
+    after.cr2               = state.cr2;
+    after.cr3               = state.cr3.AsUInt;
+    after.cr4               = state.cr4.AsUInt;
+    after.efer              = state.efer.value;
+    after.event_inject      = control.event_inject.value;
+    after.interrupt_shadow  = control.interrupt_shadow;
+    after.v_ctl             = control.v_ctl.value;
+    after.cpl               = state.cpl;
+    after.reserved          = 0;
+
+    // vmrun runs whatever vmcb the rax slot points at
+
+    output.host_rax         = frame.regs.rax;
+    output.guest_accesses   = guest_accesses;
+    input.leaf_armed        = false;
+
+    return;
+}
+
+// the memory module maps physical pages through a pte of its own, none of the guest's memory is recorded
+
+bool memory::setup_ranges()
+{
+    return true;
+}
+
+bool memory::is_ram(UINT64 phys, UINT64* next)
+{
+    UNREFERENCED_PARAMETER(phys);
+
+    *next = MAXUINT64;
+
+    return false;
+}
+
+bool memory::setup_window(MAP_WINDOW& window)
+{
+    window = {};
+
+    return true;
+}
+
+void memory::free_window(MAP_WINDOW& window)
+{
+    UNREFERENCED_PARAMETER(window);
+}
+
+void* memory::map_phys(vcpu* vcpu, UINT64 phys)
+{
+    UNREFERENCED_PARAMETER(vcpu);
+    UNREFERENCED_PARAMETER(phys);
+
+    guest_accesses++;
+
+    return nullptr;
+}
+
+bool memory::translate(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, UINT64* phys, bool writable)
+{
+    UNREFERENCED_PARAMETER(vcpu);
+    UNREFERENCED_PARAMETER(cr3);
+    UNREFERENCED_PARAMETER(cpl);
+    UNREFERENCED_PARAMETER(virt);
+    UNREFERENCED_PARAMETER(phys);
+    UNREFERENCED_PARAMETER(writable);
+
+    guest_accesses++;
+
+    return false;
+}
+
+bool memory::read_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, void* buffer, SIZE_T size)
+{
+    UNREFERENCED_PARAMETER(vcpu);
+    UNREFERENCED_PARAMETER(cr3);
+    UNREFERENCED_PARAMETER(cpl);
+    UNREFERENCED_PARAMETER(virt);
+    UNREFERENCED_PARAMETER(buffer);
+    UNREFERENCED_PARAMETER(size);
+
+    guest_accesses++;
+
+    return false;
+}
+
+bool memory::write_guest(vcpu* vcpu, UINT64 cr3, UINT8 cpl, UINT64 virt, const void* buffer, SIZE_T size)
+{
+    UNREFERENCED_PARAMETER(vcpu);
+    UNREFERENCED_PARAMETER(cr3);
+    UNREFERENCED_PARAMETER(cpl);
+    UNREFERENCED_PARAMETER(virt);
+    UNREFERENCED_PARAMETER(buffer);
+    UNREFERENCED_PARAMETER(size);
+
+    guest_accesses++;
+
+    return false;
+}
+
+extern "C"
+{
+    // windows
+
+    PVOID ExAllocatePoolZero(int type, SIZE_T size, ULONG tag)
+    {
+        UNREFERENCED_PARAMETER(type);
+        UNREFERENCED_PARAMETER(tag);
+
+        return allocate(size);
+    }
+
+    void ExFreePoolWithTag(PVOID address, ULONG tag)
+    {
+        UNREFERENCED_PARAMETER(tag);
+
+        free(address);
+    }
+
+    PVOID MmAllocateContiguousMemory(SIZE_T size, PHYSICAL_ADDRESS highest)
+    {
+        UNREFERENCED_PARAMETER(highest);
+
+        return allocate(size);
+    }
+
+    void MmFreeContiguousMemory(PVOID address)
+    {
+        free(address);
+    }
+
+    PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID address)
+    {
+        return { .QuadPart = (LONGLONG)address };
+    }
+
+    PVOID MmGetVirtualForPhysical(PHYSICAL_ADDRESS address)
+    {
+        return (PVOID)address.QuadPart;
+    }
+
+    BOOLEAN MmIsAddressValid(PVOID address)
+    {
+        return address != nullptr;
+    }
+
+    PVOID MmMapIoSpace(PHYSICAL_ADDRESS address, SIZE_T size, int type)
+    {
+        UNREFERENCED_PARAMETER(address);
+        UNREFERENCED_PARAMETER(type);
+
+        return allocate(size);
+    }
+
+    void MmUnmapIoSpace(PVOID address, SIZE_T size)
+    {
+        UNREFERENCED_PARAMETER(size);
+
+        free(address);
+    }
+
+    ULONG KeQueryActiveProcessorCount(KAFFINITY* affinity)
+    {
+        UNREFERENCED_PARAMETER(affinity);
+
+        return core_count;
+    }
+
+    ULONG KeGetCurrentProcessorNumberEx(PROCESSOR_NUMBER* number)
+    {
+        if (number)
+            *number = { 0, (UCHAR)current_core, 0 };
+
+        return current_core;
+    }
+
+    ULONG KeGetProcessorIndexFromNumber(PROCESSOR_NUMBER* number)
+    {
+        return number->Number;
+    }
+
+    void KeSetSystemAffinityThread(KAFFINITY affinity)
+    {
+        current_core = __builtin_ctzll(affinity);
+    }
+
+    PVOID KeRegisterNmiCallback(PNMI_CALLBACK callback, PVOID context)
+    {
+        UNREFERENCED_PARAMETER(context);
+
+        return (PVOID)callback;
+    }
+
+    NTSTATUS KeDeregisterNmiCallback(PVOID handle)
+    {
+        UNREFERENCED_PARAMETER(handle);
+
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS PsSetCreateProcessNotifyRoutine(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove)
+    {
+        UNREFERENCED_PARAMETER(routine);
+        UNREFERENCED_PARAMETER(remove);
+
+        return STATUS_SUCCESS;
+    }
+
+    void RtlCaptureContext(CONTEXT* context)
+    {
+        *context = {};
+
+        context->SegCs = 0x10;
+        context->SegSs = 0x18;
+        context->SegDs = 0x2B;
+        context->SegEs = 0x2B;
+        context->SegFs = 0x53;
+        context->SegGs = 0x2B;
+    }
+
+    ULONG DbgPrintEx(ULONG component, ULONG level, const char* format, ...)
+    {
+        UNREFERENCED_PARAMETER(component);
+        UNREFERENCED_PARAMETER(level);
+
+        va_list args;
+        va_start(args, format);
+
+        vfprintf(stderr, format, args);
+
+        va_end(args);
+
+        return 0;
+    }
+
+    // the cpu
+
+    void __cpuidex(int regs[4], int leaf, int subleaf)
+    {
+        if (input.leaf_armed)
+        {
+            memcpy(regs, input.leaf, sizeof(input.leaf));
+
+            input.leaf_armed = false;
+            return;
+        }
+
+        __asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+
+        if ((unsigned int)leaf == 0x8000000A)
+            regs[3] |= svm_features;
+    }
+
+    void __cpuid(int regs[4], int leaf)
+    {
+        __cpuidex(regs, leaf, 0);
+    }
+
+    unsigned long long __readmsr(unsigned long msr)
+    {
+        // x2apic mode, the apic id register reads the core index
+
+        if (msr == IA32_APIC_BASE)
+            return 0xFEE00000 | 1 << 11 | 1 << 10 | (current_core ? 0 : 1 << 8);
+
+        if (msr == 0x802)
+            return current_core;
+
+        auto entry = msrs.find((UINT64)current_core << 32 | msr);
+
+        return entry == msrs.end() ? 0 : entry->second;
+    }
+
+    void __writemsr(unsigned long msr, unsigned long long value)
+    {
+        msrs[(UINT64)current_core << 32 | msr] = value;
+    }
+
+    unsigned long long __readcr0()
+    {
+        return 0x80050033;
+    }
+
+    unsigned long long __readcr2()
+    {
+        return 0;
+    }
+
+    unsigned long long __readcr3()
+    {
+        return 0x1AD000;
+    }
+
+    unsigned long long __readcr4()
+    {
+        return 0x350EF8;
+    }
+
+    void __writecr3(unsigned long long value)
+    {
+        UNREFERENCED_PARAMETER(value);
+    }
+
+    unsigned long long __readdr(unsigned int number)
+    {
+        return number == 6 ? 0xFFFF0FF0 : 0x400;
+    }
+
+    void __sgdt(void* descriptor)
+    {
+        SEGMENT_DESCRIPTOR_REGISTER_64 gdtr{};
+
+        gdtr.Limit      = sizeof(gdt) - 1;
+        gdtr.BaseAddress = (UINT64)gdt;
+
+        memcpy(descriptor, &gdtr, sizeof(gdtr));
+    }
+
+    void __sidt(void* descriptor)
+    {
+        memset(descriptor, 0, sizeof(SEGMENT_DESCRIPTOR_REGISTER_64));
+    }
+
+    unsigned long __segmentlimit(unsigned long selector)
+    {
+        UNREFERENCED_PARAMETER(selector);
+
+        return 0xFFFFFFFF;
+    }
+
+    unsigned long long __readpmc(unsigned long counter)
+    {
+        UNREFERENCED_PARAMETER(counter);
+
+        return 0;
+    }
+
+    void _disable()
+    {
+    }
+
+    void __svm_vmsave(unsigned long long vmcb)
+    {
+        UNREFERENCED_PARAMETER(vmcb);
+    }
+
+    void __svm_vmload(unsigned long long vmcb)
+    {
+        UNREFERENCED_PARAMETER(vmcb);
+    }
+
+    void __svm_stgi()
+    {
+    }
+
+    void __svm_clgi()
+    {
+    }
+
+    // helpers.asm, the replay never enters a guest
+
+    bool start_hv(struct vcpu* vcpu)
+    {
+        UNREFERENCED_PARAMETER(vcpu);
+
+        return false;
+    }
+
+    bool send_hv_command(unsigned long long key, unsigned long long command)
+    {
+        UNREFERENCED_PARAMETER(key);
+        UNREFERENCED_PARAMETER(command);
+
+        return false;
+    }
+
+    unsigned long long hv_call(unsigned long long code, struct HYPERCALL_ARGS* args)
+    {
+        UNREFERENCED_PARAMETER(code);
+        UNREFERENCED_PARAMETER(args);
+
+        return call_invalid;
+    }
+}
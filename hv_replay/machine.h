@@ -0,0 +1,41 @@
+#pragma once
+
+// the cpu, windows and helpers.asm as far as the driver's exit path needs them, so hv_replay can link the driver's
+// own sources on linux and run recorded exits through hv::handle_vmexit. the guest's memory isnt recorded,
+// so every guest memory access fails like it would on a page thats not present
+
+#include "../amd_hv/hv/capture/capture.h"
+
+// what the machine answers while one exit is handled
+struct MACHINE_INPUT
+{
+    bool    leaf_armed;     // the next cpuid returns leaf, instead of what the cpu running the replay says
+    int     leaf[4];
+};
+
+// what the exit left
+struct MACHINE_OUTPUT
+{
+    CAPTURE_STATE   state;              // the guest after vmrun, in the same shape capture::on_resume writes it
+    UINT32          guest_accesses;     // reads, writes and page walks of guest memory, which all failed
+    UINT64          host_rax;           // the frame's rax slot, vmrun takes the guest vmcb from it
+    bool            shutdown;           // the exit asked for the hypervisor to unload
+};
+
+namespace machine
+{
+    // runs hv::setup and every vcpu's setup with cores cores, which cant be changed later
+    bool boot(int cores);
+
+    int cores();
+
+    // the physical address of core's guest vmcb, what host_rax has to be
+    UINT64 guest_vmcb(int core);
+
+    // the build's spill mask for exit_code, what helpers.asm would look up
+    UINT16 spill_mask(UINT64 exit_code);
+
+    // loads record's exit and before state into the vmcb of record.core, builds the register frame
+    // the way helpers.asm does and calls hv::handle_vmexit
+    void run(const CAPTURE_RECORD& record, const MACHINE_INPUT& input, MACHINE_OUTPUT& output);
+}
@@ -0,0 +1,178 @@
+// hv_search_bench.cpp : throughput of the hypervisor's pattern search kernels, built from the driver's
+// own search.cpp. the buffer is searched page by page the way a search job does it, and is bigger
+// than the caches like the memory a job goes over. prints csv with GB/s per kernel and pattern
+// usage: hv_search_bench [MB] [runs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../amd_hv/hv/search/search.h"
+
+constexpr size_t page_size = 0x1000;
+
+struct BENCH_PATTERN
+{
+    const char* name;
+    const char* text;   // hex bytes, ?? for a wildcard
+};
+
+const BENCH_PATTERN patterns[] =
+{
+    { "4 bytes",                "48 8B 05 ??" },
+    { "8 bytes",                "4D 5A 90 00 03 00 00 00" },
+    { "16 bytes wildcards",     "48 89 5C 24 ?? 48 89 74 24 ?? 57 48 83 EC ?? 48" },
+    { "32 bytes",               "E8 ?? ?? ?? ?? 48 8B D8 48 85 C0 74 ?? 48 8B 4B 08 E8 ?? ?? ?? ?? 85 C0 75 ?? 48 8B 43 10 48 89" },
+    { "wildcard start",         "?? ?? 0F 05 C3" },
+};
+
+const char* kernel_names[] = { "best", "scalar", "sse", "avx2" };
+
+bool parse(const char* text, SEARCH_PATTERN& pattern)
+{
+    pattern = {};
+
+    while (*text && pattern.length < SEARCH_MAX_PATTERN)
+    {
+        if (*text == ' ')
+        {
+            text++;
+            continue;
+        }
+
+        if (text[0] == '?')
+        {
+            pattern.length++;
+            text += 2;
+            continue;
+        }
+
+        pattern.bytes[pattern.length] = (UINT8)strtoul(std::string(text, 2).c_str(), nullptr, 16);
+        pattern.mask[pattern.length++] = 0xFF;
+        text += 2;
+    }
+
+    return search::prepare(pattern);
+}
+
+// every search job goes one page at a time, and checks the starts near the end of a page on a copy
+size_t search_pages(SEARCH_KERNEL kernel, const SEARCH_PATTERN& pattern, const UINT8* buffer, size_t size)
+{
+    UINT32 offsets[64];
+    size_t found    = 0;
+    size_t inside   = page_size - pattern.length + 1;
+
+    for (size_t page = 0; page < size; page += page_size)
+    {
+        size_t last = std::min(page_size, size - pattern.length + 1 - page);
+        size_t start = 0;
+
+        for (;;)
+        {
+            size_t matched = search::find(kernel, pattern, buffer + page, start, std::min(last, inside), offsets, 64);
+
+            found += matched;
+
+            if (matched < 64)
+                break;
+
+            start = offsets[63] + 1;
+        }
+
+        if (last > inside)
+        {
+            UINT8 stitch[SEARCH_MAX_PATTERN * 2];
+
+            memcpy(stitch, buffer + page + inside, pattern.length * 2 - 2);
+
+            found += search::find(kernel, pattern, stitch, 0, last - inside, offsets, 64);
+        }
+    }
+
+    return found;
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = (argc > 1 ? strtoull(argv[1], nullptr, 0) : 256) << 20;
+    int runs    = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (!size || runs <= 0)
+    {
+        fprintf(stderr, "usage: hv_search_bench [MB] [runs] \n");
+        return 1;
+    }
+
+    bool avx2 = __builtin_cpu_supports("avx2");
+
+    std::vector<UINT8> buffer(size + page_size);
+
+    // xorshift noise, with code like byte frequencies so the anchors dont match more often than in memory dumps
+
+    unsigned long long state = 0x9E3779B97F4A7C15;
+
+    for (auto& byte : buffer)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        byte = (state & 0x300) ? 0 : (UINT8)state;
+    }
+
+    printf("kernel,pattern,MB,matches,GB/s\n");
+
+    for (auto& bench : patterns)
+    {
+        SEARCH_PATTERN pattern;
+
+        if (!parse(bench.text, pattern))
+        {
+            fprintf(stderr, "bad pattern %s \n", bench.name);
+            return 1;
+        }
+
+        // planted on both sides of page boundaries, the rest only matches by chance
+
+        for (size_t offset = page_size - 3; offset + pattern.length < size; offset += 0x100000)
+        {
+            for (UINT32 i = 0; i < pattern.length; i++)
+                buffer[offset + i] = pattern.bytes[i];
+        }
+
+        size_t expected = 0;
+
+        for (auto kernel : { search_scalar, search_sse, search_avx2 })
+        {
+            if (kernel == search_avx2 && !avx2)
+                continue;
+
+            double best     = 0;
+            size_t found    = 0;
+
+            for (int run = 0; run < runs; run++)
+            {
+                auto start = std::chrono::steady_clock::now();
+
+                found = search_pages(kernel, pattern, buffer.data(), size);
+
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                best = std::max(best, size / seconds / 1e9);
+            }
+
+            if (kernel == search_scalar)
+                expected = found;
+            else if (found != expected)
+                fprintf(stderr, "%s found %zu matches of %s, scalar found %zu \n", kernel_names[kernel], found, bench.name, expected);
+
+            printf("%s,%s,%zu,%zu,%.2f\n", kernel_names[kernel], bench.name, size >> 20, found, best);
+        }
+    }
+
+    return 0;
+}
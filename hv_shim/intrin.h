@@ -0,0 +1,56 @@
+#pragma once
+
+// msvc intrinsics. the unprivileged ones are gcc builtins or defined here, cpuid and the privileged ones are only declared,
+// a tool that links code using them has to provide them
+
+#include <x86intrin.h>
+#include <immintrin.h>
+
+// the c++ headers pulled in above undefine these
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define _ReadWriteBarrier()	__asm__ __volatile__("" ::: "memory")
+#define _rotl64(value, shift)	__rolq(value, shift)
+
+inline unsigned char _BitScanForward(unsigned long* index, unsigned long mask)
+{
+	if (!mask)
+		return 0;
+
+	*index = __builtin_ctzl(mask);
+
+	return 1;
+}
+
+// cpuid is unprivileged, but a tool running the handlers has to answer it with the guest's leaves
+
+extern "C"
+{
+	void __cpuidex(int regs[4], int leaf, int subleaf);
+	void __cpuid(int regs[4], int leaf);
+
+	unsigned long long __readmsr(unsigned long msr);
+	void __writemsr(unsigned long msr, unsigned long long value);
+
+	unsigned long long __readcr0();
+	unsigned long long __readcr2();
+	unsigned long long __readcr3();
+	unsigned long long __readcr4();
+	void __writecr3(unsigned long long value);
+	unsigned long long __readdr(unsigned int number);
+
+	void __sidt(void* descriptor);
+	unsigned long __segmentlimit(unsigned long selector);
+	unsigned long long __readpmc(unsigned long counter);
+	void __invlpg(void* address);
+	void _disable();
+
+	void __svm_vmsave(unsigned long long vmcb);
+	void __svm_vmload(unsigned long long vmcb);
+	void __svm_stgi();
+	void __svm_clgi();
+}
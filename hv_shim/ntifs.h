@@ -0,0 +1,175 @@
+#pragma once
+
+// just enough of the wdk for the driver's os independent modules to build on linux with gcc,
+// the linux tools put this directory first on the include path and define _KERNEL_MODE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define __declspec(...)
+
+#define ULONG_MAX 0xFFFFFFFFul
+#define __forceinline inline __attribute__((always_inline))
+#define _In_
+
+// the llp64 widths, long is 32 bits on windows
+typedef int8_t		CHAR, INT8;
+typedef uint8_t		UCHAR, BYTE, BOOLEAN, UINT8;
+typedef int16_t		SHORT, INT16;
+typedef uint16_t	USHORT, WORD, UINT16;
+typedef int32_t		INT, LONG, INT32, NTSTATUS;
+typedef uint32_t	UINT, ULONG, DWORD, UINT32;
+typedef long long	LONG64, INT64, LONGLONG;
+typedef unsigned long long	ULONG64, UINT64, ULONGLONG, ULONG_PTR, SIZE_T, DWORD64, KAFFINITY;
+typedef void*		PVOID;
+typedef void*		HANDLE;
+typedef UCHAR		KIRQL;
+
+typedef union
+{
+	struct
+	{
+		ULONG	LowPart;
+		LONG	HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER, PHYSICAL_ADDRESS;
+
+typedef struct
+{
+	USHORT	Group;
+	UCHAR	Number;
+	UCHAR	Reserved;
+} PROCESSOR_NUMBER;
+
+typedef struct
+{
+	ULONG64	Low;
+	LONG64	High;
+} M128A;
+
+typedef struct
+{
+	ULONG64	P1Home;
+	USHORT	SegCs, SegDs, SegEs, SegFs, SegGs, SegSs;
+	ULONG64	Rip, Rsp;
+} CONTEXT;
+
+typedef struct _PHYSICAL_MEMORY_RANGE
+{
+	PHYSICAL_ADDRESS	BaseAddress;
+	LARGE_INTEGER		NumberOfBytes;
+} PHYSICAL_MEMORY_RANGE, *PPHYSICAL_MEMORY_RANGE;
+
+typedef struct _DRIVER_OBJECT
+{
+	void (*DriverUnload)(struct _DRIVER_OBJECT*);
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct
+{
+	int unused;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef BOOLEAN (*PNMI_CALLBACK)(PVOID context, BOOLEAN handled);
+typedef void (*PCREATE_PROCESS_NOTIFY_ROUTINE)(HANDLE parent, HANDLE process, BOOLEAN create);
+
+#define TRUE	1
+#define FALSE	0
+
+#define MAXUINT8	((UINT8)~0)
+#define MAXUINT16	((UINT16)~0)
+#define MAXUINT32	((UINT32)~0)
+#define MAXUINT64	((UINT64)~0ull)
+#define MAXLONG64	0x7FFFFFFFFFFFFFFFll
+
+#define PAGE_SIZE			0x1000
+#define PAGE_SHIFT			12
+#define KERNEL_STACK_SIZE	0x6000
+
+#define NonPagedPool		0
+#define NonPagedPoolNx		512
+#define POOL_FLAG_NON_PAGED	0x40ull
+#define MmNonCached			0
+#define MmCached			1
+
+#define STATUS_SUCCESS				((NTSTATUS)0)
+#define STATUS_NOT_SUPPORTED		((NTSTATUS)0xC00000BB)
+#define STATUS_FAILED_DRIVER_ENTRY	((NTSTATUS)0xC0000365)
+#define NT_SUCCESS(status)			((NTSTATUS)(status) >= 0)
+
+#define DPFLTR_IHVDRIVER_ID	77
+#define DPFLTR_ERROR_LEVEL	0
+
+#define UNREFERENCED_PARAMETER(x)	(void)(x)
+#define FIELD_OFFSET(type, field)	offsetof(type, field)
+#define RTL_NUMBER_OF(array)		(sizeof(array) / sizeof((array)[0]))
+#define C_ASSERT(e)					static_assert(e, #e)
+#define ALIGN_UP_BY(length, align)	(((ULONG_PTR)(length) + (align) - 1) & ~((ULONG_PTR)(align) - 1))
+#define BYTES_TO_PAGES(size)		(((size) >> PAGE_SHIFT) + (((size) & (PAGE_SIZE - 1)) != 0))
+#define PAGE_ALIGN(va)				((PVOID)((ULONG_PTR)(va) & ~(ULONG_PTR)(PAGE_SIZE - 1)))
+#define BYTE_OFFSET(va)				((ULONG)((ULONG_PTR)(va) & (PAGE_SIZE - 1)))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+// the interlocked family maps onto the gcc builtins, they are full barriers like on windows
+
+#define InterlockedIncrement(target)							__atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(target)							__atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(target)							__atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(target)							__atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(target, value)						__atomic_exchange_n(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(target, value)					__atomic_exchange_n(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(target, value)					__atomic_fetch_add(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedOr(target, value)							__atomic_fetch_or(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedAnd(target, value)							__atomic_fetch_and(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedOr64(target, value)							__atomic_fetch_or(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedAnd64(target, value)							__atomic_fetch_and(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(target, value, comparand)		__sync_val_compare_and_swap(target, comparand, value)
+#define InterlockedCompareExchange64(target, value, comparand)		__sync_val_compare_and_swap(target, comparand, value)
+#define InterlockedCompareExchangePointer(target, value, comparand)	__sync_val_compare_and_swap(target, comparand, value)
+
+// a function, the builtin warns about every call that drops the old pointer
+inline PVOID InterlockedExchangePointer(PVOID volatile* target, PVOID value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+// the kernel routines the driver calls, a tool that links os dependent modules has to provide the ones they use
+
+extern "C"
+{
+	PVOID ExAllocatePoolZero(int type, SIZE_T size, ULONG tag);
+	void ExFreePoolWithTag(PVOID address, ULONG tag);
+	void ExFreePool(PVOID address);
+
+	PVOID MmAllocateContiguousMemory(SIZE_T size, PHYSICAL_ADDRESS highest);
+	void MmFreeContiguousMemory(PVOID address);
+	PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID address);
+	PVOID MmGetVirtualForPhysical(PHYSICAL_ADDRESS address);
+	BOOLEAN MmIsAddressValid(PVOID address);
+	PVOID MmAllocateMappingAddress(SIZE_T size, ULONG tag);
+	void MmFreeMappingAddress(PVOID address, ULONG tag);
+	PVOID MmMapIoSpace(PHYSICAL_ADDRESS address, SIZE_T size, int type);
+	void MmUnmapIoSpace(PVOID address, SIZE_T size);
+	PPHYSICAL_MEMORY_RANGE MmGetPhysicalMemoryRanges();
+
+	ULONG KeQueryActiveProcessorCount(KAFFINITY* affinity);
+	NTSTATUS KeGetProcessorNumberFromIndex(ULONG index, PROCESSOR_NUMBER* number);
+	ULONG KeGetCurrentProcessorNumberEx(PROCESSOR_NUMBER* number);
+	ULONG KeGetProcessorIndexFromNumber(PROCESSOR_NUMBER* number);
+	void KeSetSystemAffinityThread(KAFFINITY affinity);
+	void KeRevertToUserAffinityThread();
+	PVOID KeRegisterNmiCallback(PNMI_CALLBACK callback, PVOID context);
+	NTSTATUS KeDeregisterNmiCallback(PVOID handle);
+
+	NTSTATUS PsSetCreateProcessNotifyRoutine(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove);
+
+	void RtlCaptureContext(CONTEXT* context);
+
+	ULONG DbgPrintEx(ULONG component, ULONG level, const char* format, ...);
+}
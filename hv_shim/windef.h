@@ -0,0 +1,3 @@
+#pragma once
+
+// everything the driver uses from windef.h is in the ntifs.h shim
@@ -0,0 +1,169 @@
+// hv_snapshot_bench.cpp : what a snapshot job does to every page, zero check and lz4, with the driver's own
+// compress.cpp. prints csv with how the pages split up, the compression ratio and the throughput.
+// usage: hv_snapshot_bench [memory images...]
+// without images it takes this process's own readable mappings, which are libraries, heap and stack like
+// most of a guest's memory. raw physical memory dumps give the numbers a snapshot of that machine would
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../amd_hv/hv/compress/compress.h"
+
+constexpr size_t page_size = 0x1000;
+
+bool is_zero(const UINT8* page)
+{
+    UINT64 bits = 0;
+
+    for (size_t i = 0; i < page_size; i += 8)
+    {
+        UINT64 word;
+        memcpy(&word, page + i, 8);
+        bits |= word;
+    }
+
+    return !bits;
+}
+
+std::vector<UINT8> read_file(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    std::vector<UINT8> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    data.resize(data.size() / page_size * page_size);
+
+    return data;
+}
+
+// copies every readable private or file backed mapping, the vvar and vsyscall pages cant be read
+std::vector<UINT8> read_self()
+{
+    std::vector<UINT8> data;
+    std::ifstream maps("/proc/self/maps");
+
+    FILE* mem = fopen("/proc/self/mem", "rb");
+
+    std::string line;
+
+    while (std::getline(maps, line))
+    {
+        unsigned long long start, end;
+        char perms[5];
+
+        if (sscanf(line.c_str(), "%llx-%llx %4s", &start, &end, perms) != 3 || perms[0] != 'r')
+            continue;
+
+        if (line.find("[vvar") != std::string::npos || line.find("[vsyscall]") != std::string::npos)
+            continue;
+
+        size_t offset = data.size();
+
+        data.resize(offset + (end - start));
+
+        if (fseeko(mem, start, SEEK_SET) || fread(data.data() + offset, 1, end - start, mem) != end - start)
+            data.resize(offset);
+    }
+
+    fclose(mem);
+
+    return data;
+}
+
+void bench(const char* name, const std::vector<UINT8>& image)
+{
+    static COMPRESS_WORKSPACE work;
+
+    size_t pages = image.size() / page_size;
+
+    if (!pages)
+    {
+        fprintf(stderr, "%s has no full page \n", name);
+        return;
+    }
+
+    std::vector<UINT8> out(pages * page_size);
+    std::vector<UINT16> sizes(pages);
+
+    size_t zero = 0, compressed = 0, raw = 0, bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < pages; i++)
+    {
+        auto page = image.data() + i * page_size;
+
+        if (is_zero(page))
+        {
+            sizes[i] = 0;
+            zero++;
+            continue;
+        }
+
+        size_t size = compress::lz4(work, page, page_size, out.data() + i * page_size, page_size - 1);
+
+        if (size)
+            compressed++;
+        else
+        {
+            size = page_size;
+            raw++;
+        }
+
+        sizes[i]    = (UINT16)size;
+        bytes       += size;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the client side, every block has to come back as the page it was made from
+
+    UINT8 page[page_size];
+
+    start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < pages; i++)
+    {
+        if (sizes[i] == 0 || sizes[i] == page_size)
+            continue;
+
+        if (compress::unlz4(out.data() + i * page_size, sizes[i], page, page_size) != page_size || memcmp(page, image.data() + i * page_size, page_size))
+        {
+            fprintf(stderr, "page %zu of %s didnt survive \n", i, name);
+            return;
+        }
+    }
+
+    double expand = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // every non zero page also costs a 16 byte record, a zero run only one
+
+    size_t stream = bytes + (compressed + raw) * 16;
+
+    printf("%s,%zu,%zu,%zu,%zu,%.2f,%.2f,%.0f,%.0f\n", name, pages, zero, compressed, raw,
+        (double)(pages - zero) * page_size / std::max<size_t>(bytes, 1), (double)pages * page_size / std::max<size_t>(stream, 1),
+        pages * page_size / seconds / 1e6, compressed * page_size / std::max(expand, 1e-9) / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+    printf("image,pages,zero,lz4,raw,lz4_ratio,stream_ratio,snapshot_MB/s,expand_MB/s\n");
+
+    if (argc < 2)
+    {
+        bench("self", read_self());
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+        bench(argv[i], read_file(argv[i]));
+
+    return 0;
+}
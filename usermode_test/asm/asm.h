@@ -1,6 +0,0 @@
-#pragma once
-
-extern "C" 
-{ 
-	bool send_hv_command(unsigned long long key, unsigned long long command);
-}
\ No newline at end of file
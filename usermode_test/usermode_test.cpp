@@ -2,18 +2,1137 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <windows.h>
+#include <intrin.h>
 
-#include "asm/asm.h"
-#define PING_ID 0x123
-#define COMMAND_KEY 0x123456789
+#include "../hv_client/hv_client.h"
 
-int main()
+// runs the call in batches and reports the average and the fastest batch per call, in tsc cycles
+template <typename F>
+void measure_round_trip(const char* name, F&& call)
 {
-    if (send_hv_command(COMMAND_KEY, PING_ID))
+    constexpr int batches = 1000;
+    constexpr int batch_size = 100;
+
+    unsigned long long total = 0;
+    unsigned long long best = MAXULONGLONG;
+    unsigned int aux;
+
+    for (int i = 0; i < batches; i++)
+    {
+        unsigned long long start = __rdtscp(&aux);
+
+        for (int j = 0; j < batch_size; j++)
+            call();
+
+        unsigned long long cycles = __rdtscp(&aux) - start;
+
+        total += cycles;
+        best = min(best, cycles);
+    }
+
+    printf("%-24s avg %6llu cycles, best %6llu cycles\n", name, total / (batches * batch_size), best / batch_size);
+}
+
+// makes the call through the client, which sends the kernel only commands to the driver's device, and says why it failed
+bool checked_call(const char* name, unsigned long long code, HYPERCALL_ARGS& args)
+{
+    auto status = client::call(code, args);
+
+    if (status != call_success)
+    {
+        printf("%s failed: %s \n", name, client::status_name(status));
+        return false;
+    }
+
+    return true;
+}
+
+void benchmark_round_trip()
+{
+    // stay on one core so tsc readings are comparable
+
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    HYPERCALL_ARGS args{};
+
+    measure_round_trip("cpuid passthrough", [] { int regs[4]; __cpuid(regs, 0); });
+    measure_round_trip("cpuid channel ping", [] { send_hv_command(COMMAND_KEY, PING_ID); });
+    measure_round_trip("vmmcall ping", [&] { hv_call(HYPERCALL_CODE(HYPERCALL_PING), &args); });
+    measure_round_trip("vmmcall echo", [&] { hv_call(HYPERCALL_CODE(HYPERCALL_ECHO), &args); });
+    measure_round_trip("vmmcall xmm echo", [&] { hv_call_xmm(HYPERCALL_CODE(HYPERCALL_ECHO), &args); });
+}
+
+// the same checksum hypercall with the scalar and the avx2 path, the difference at 64 bytes is mostly
+// the xsave and xrstor of the guest's extended state, at a page the vector loop pays for it.
+// checksum is for the kernel, so from here every call includes the round trip through the driver's device
+void benchmark_simd()
+{
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    auto buffer = (unsigned long long*)VirtualAlloc(nullptr, 0x1000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    VirtualLock(buffer, 0x1000);
+
+    for (int i = 0; i < 0x1000 / 8; i++)
+        buffer[i] = i * 0x9E3779B97F4A7C15;
+
+    for (unsigned long long size : { 64ull, 0x1000ull })
+    {
+        for (unsigned long long flags : { (unsigned long long)CHECKSUM_SCALAR, 0ull })
+        {
+            HYPERCALL_ARGS args{};
+
+            char name[64];
+            sprintf_s(name, "checksum %llu %s", size, flags ? "scalar" : "avx2");
+
+            args.regs[0] = (unsigned long long)buffer;
+            args.regs[1] = size;
+            args.regs[2] = flags;
+
+            if (!checked_call(name, HYPERCALL_CHECKSUM, args))
+            {
+                VirtualFree(buffer, 0, MEM_RELEASE);
+                return;
+            }
+
+            measure_round_trip(name, [&] 
+            {
+                args.regs[0] = (unsigned long long)buffer;
+                args.regs[1] = size;
+                args.regs[2] = flags;
+                client::call(HYPERCALL_CHECKSUM, args);
+            });
+
+            printf("    checksum %llx \n", args.regs[0]);
+        }
+    }
+
+    HYPERCALL_ARGS args{};
+
+    if (!hv_call(HYPERCALL_CODE(HYPERCALL_XSAVE_STATS), &args) && args.regs[0])
+        printf("core 0: %llu simd exits, %llu cycles per xsave and xrstor, %llu byte area \n", args.regs[0], args.regs[1] / args.regs[0], args.regs[2]);
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+// how the hypervisor found out about the instructions it intercepted, summed over all cores.
+// anything in the software columns means the cpu lacks nrip save or decode assists
+void print_instruction_stats()
+{
+    auto stats = (INSTRUCTION_STATS*)VirtualAlloc(nullptr, sizeof(INSTRUCTION_STATS), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    VirtualLock(stats, sizeof(INSTRUCTION_STATS));
+
+    INSTRUCTION_STATS total{};
+    unsigned long long supported = 0;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        HYPERCALL_ARGS args{};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)stats;
+
+        if (hv_call(HYPERCALL_CODE(HYPERCALL_INSTRUCTION_STATS), &args))
+            continue;
+
+        supported = args.regs[0];
+
+        total.nrip_hits         += stats->nrip_hits;
+        total.software_lengths  += stats->software_lengths;
+        total.assist_fetches    += stats->assist_fetches;
+        total.software_fetches  += stats->software_fetches;
+        total.assist_operands   += stats->assist_operands;
+        total.software_operands += stats->software_operands;
+        total.failures          += stats->failures;
+        total.cache_hits        += stats->cache_hits;
+        total.cache_misses      += stats->cache_misses;
+    }
+
+    printf("nrip save %s, decode assists %s \n", supported & INSTRUCTION_NRIP_SAVE ? "yes" : "no", supported & INSTRUCTION_DECODE_ASSISTS ? "yes" : "no");
+    printf("%-10s %12s %12s \n", "", "hardware", "software");
+    printf("%-10s %12llu %12llu \n", "length", total.nrip_hits, total.software_lengths);
+    printf("%-10s %12llu %12llu \n", "fetch", total.assist_fetches, total.software_fetches);
+    printf("%-10s %12llu %12llu \n", "operands", total.assist_operands, total.software_operands);
+    printf("%llu instructions couldnt be read or decoded \n", total.failures);
+    printf("decode cache %llu hits %llu misses \n", total.cache_hits, total.cache_misses);
+
+    VirtualFree(stats, 0, MEM_RELEASE);
+}
+
+// a loop dominated by cpuid exits, timed the way guest code would time itself
+unsigned long long time_cpuid_loop()
+{
+    constexpr int runs = 100;
+    constexpr int iterations = 1000;
+
+    unsigned long long best = MAXULONGLONG;
+    unsigned int aux;
+    int cpuid_regs[4];
+
+    for (int i = 0; i < runs; i++)
+    {
+        unsigned long long start = __rdtscp(&aux);
+
+        for (int j = 0; j < iterations; j++)
+            __cpuid(cpuid_regs, 0);
+
+        best = min(best, __rdtscp(&aux) - start);
+    }
+
+    return best / iterations;
+}
+
+// compare the printed numbers against a run on bare metal, compensated modes should land close to it.
+// offset mode needs a skew cap, a few thousand exits worth of it
+void benchmark_tsc(bool loaded)
+{
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    if (!loaded)
+    {
+        printf("%-24s %6llu cycles per cpuid\n", "bare metal", time_cpuid_loop());
+        return;
+    }
+
+    const char* names[] = { "tsc mode off", "tsc mode offset", "tsc mode intercept" };
+
+    HYPERCALL_ARGS args{};
+
+    for (int mode = TSC_MODE_OFF; mode <= TSC_MODE_INTERCEPT; mode++)
+    {
+        args = {};
+        args.regs[0] = mode;
+        args.regs[2] = 10000000;
+
+        if (!checked_call("tsc config", HYPERCALL_TSC_CONFIG, args))
+            return;
+
+        printf("%-24s %6llu cycles per cpuid\n", names[mode], time_cpuid_loop());
+    }
+
+    // before going back to off, which shows the guest everything that was hidden
+
+    args = {};
+
+    if (checked_call("tsc stats", HYPERCALL_TSC_STATS, args))
+    {
+        printf("core 0: %llu exits compensated, %llu cycles hidden, %llu residual, %llu clamped reads, skew %llu\n",
+            args.regs[0], args.regs[1], args.regs[2], args.regs[3], args.regs[5]);
+    }
+
+    args = {};
+    checked_call("tsc config", HYPERCALL_TSC_CONFIG, args);
+}
+
+// enables the pause loop profiler for a while, then prints the most contended spin loops of every core
+void profile_pause(int seconds)
+{
+    constexpr int capacity = 1024;
+    constexpr int top = 10;
+
+    HYPERCALL_ARGS args{};
+
+    // 3000 pauses within 1000 cycles of eachother, every exit recorded
+
+    args.regs[0] = PAUSE_ENABLE | PAUSE_RESET;
+    args.regs[1] = 3000;
+    args.regs[2] = 1000;
+    args.regs[3] = 1;
+
+    if (!checked_call("pause config", HYPERCALL_PAUSE_CONFIG, args))
+        return;
+
+    Sleep(seconds * 1000);
+
+    // the hypervisor doesnt fault pages in, so the buffer has to be present before we export into it
+
+    auto entries = (PAUSE_ENTRY*)VirtualAlloc(nullptr, capacity * sizeof(PAUSE_ENTRY), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    memset(entries, 0, capacity * sizeof(PAUSE_ENTRY));
+    VirtualLock(entries, capacity * sizeof(PAUSE_ENTRY));
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        args = {};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)entries;
+        args.regs[2] = capacity;
+
+        if (!checked_call("pause export", HYPERCALL_PAUSE_EXPORT, args))
+            continue;
+
+        unsigned long long written = args.regs[0];
+
+        printf("core %u: %llu pause exits, %llu sampled, %llu dropped \n", core, args.regs[1], args.regs[2], args.regs[3]);
+
+        std::sort(entries, entries + written, [](auto& a, auto& b) { return a.count > b.count; });
+
+        for (unsigned long long i = 0; i < min(written, (unsigned long long)top); i++)
+            printf("    rip %p cr3 %p count %llu \n", (void*)entries[i].rip, (void*)entries[i].cr3, entries[i].count);
+    }
+
+    args = {};
+    checked_call("pause config", HYPERCALL_PAUSE_CONFIG, args);
+
+    VirtualFree(entries, 0, MEM_RELEASE);
+}
+
+// there is no unwind info in the hypervisor, so anything on the captured stack
+// that could be a return address is treated as a frame, similar to a frame pointer less stack scan
+bool plausible_frame(const SAMPLE& sample, unsigned long long value)
+{
+    bool kernel = sample.rip >> 63;
+
+    if ((value >> 63) != kernel || (value >> 47 != 0 && value >> 47 != 0x1FFFF))
+        return false;
+
+    // pointers into the stack itself
+    if (value - (sample.rsp - 0x100000) < 0x200000)
+        return false;
+
+    return value > 0x10000;
+}
+
+// samples guest execution with the given period in guest cycles, then prints folded stacks
+// "cr3;frame;...;rip count" of every core, which flamegraph.pl takes as is
+void profile_samples(int seconds, unsigned long long period)
+{
+    constexpr int capacity = 2048;
+
+    HYPERCALL_ARGS args{};
+
+    args.regs[0] = SAMPLER_ENABLE | SAMPLER_RESET;
+    args.regs[1] = period;
+    args.regs[2] = SAMPLE_STACK_DEPTH;
+
+    if (!checked_call("sampler config", HYPERCALL_SAMPLER_CONFIG, args))
+    {
+        printf("the sampling period has to be at least 10000 cycles \n");
+        return;
+    }
+
+    auto samples = (SAMPLE*)VirtualAlloc(nullptr, capacity * sizeof(SAMPLE), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    memset(samples, 0, capacity * sizeof(SAMPLE));
+    VirtualLock(samples, capacity * sizeof(SAMPLE));
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    std::map<std::string, unsigned long long> folded;
+    unsigned long long total = 0, dropped = 0, cycles = 0;
+
+    client::ping_all_cores();
+
+    // rings are drained every 100ms so they dont fill up
+
+    for (int tick = 0; tick <= seconds * 10; tick++)
+    {
+        if (tick == seconds * 10)
+        {
+            args = {};
+            checked_call("sampler config", HYPERCALL_SAMPLER_CONFIG, args);
+            client::ping_all_cores();
+        }
+        else
+            Sleep(100);
+
+        for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+        {
+            args = {};
+            args.regs[0] = core;
+            args.regs[1] = (unsigned long long)samples;
+            args.regs[2] = capacity;
+
+            if (!checked_call("sampler export", HYPERCALL_SAMPLER_EXPORT, args))
+                continue;
+
+            for (unsigned long long i = 0; i < args.regs[0]; i++)
+            {
+                auto& sample = samples[i];
+
+                char frame[32];
+                sprintf_s(frame, "%llx", sample.cr3);
+                std::string stack = frame;
+
+                // the stack goes from the caller down to rip
+
+                for (int j = (int)sample.depth - 1; j >= 0; j--)
+                {
+                    if (!plausible_frame(sample, sample.stack[j]))
+                        continue;
+
+                    sprintf_s(frame, ";%llx", sample.stack[j]);
+                    stack += frame;
+                }
+
+                sprintf_s(frame, ";%llx", sample.rip);
+                folded[stack + frame]++;
+            }
+
+            if (tick == seconds * 10)
+            {
+                total   += args.regs[1];
+                dropped += args.regs[2];
+                cycles  += args.regs[3];
+            }
+        }
+    }
+
+    for (auto& [stack, count] : folded)
+        printf("%s %llu\n", stack.c_str(), count);
+
+    printf("%llu samples, %llu dropped, %llu host cycles per sample \n", total, dropped, total ? cycles / total : 0);
+
+    VirtualFree(samples, 0, MEM_RELEASE);
+}
+
+// compares the world switch cost with and without lbr virtualization,
+// then records the last guest branch at every exit for a while and prints the hottest branches of every core
+void profile_branches(int seconds)
+{
+    constexpr int capacity = 1024;
+    constexpr int top = 10;
+
+    HYPERCALL_ARGS args{};
+
+    auto ping = [] { HYPERCALL_ARGS args{}; hv_call(HYPERCALL_CODE(HYPERCALL_PING), &args); };
+
+    measure_round_trip("vmmcall ping, no lbr", ping);
+
+    args.regs[0] = LBR_ENABLE | LBR_RESET | LBR_CAPTURE_EXITS;
+
+    if (!checked_call("lbr config", HYPERCALL_LBR_CONFIG, args))
+        return;
+
+    client::ping_all_cores();
+
+    measure_round_trip("vmmcall ping, lbr", ping);
+
+    Sleep(seconds * 1000);
+
+    auto entries = (BRANCH_ENTRY*)VirtualAlloc(nullptr, capacity * sizeof(BRANCH_ENTRY), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    memset(entries, 0, capacity * sizeof(BRANCH_ENTRY));
+    VirtualLock(entries, capacity * sizeof(BRANCH_ENTRY));
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        args = {};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)entries;
+        args.regs[2] = capacity;
+
+        if (!checked_call("lbr export", HYPERCALL_LBR_EXPORT, args))
+            continue;
+
+        unsigned long long written = args.regs[0];
+
+        printf("core %u: %llu captures, %llu dropped, %llu host cycles per capture \n", 
+            core, args.regs[1], args.regs[2], args.regs[1] ? args.regs[3] / args.regs[1] : 0);
+
+        std::sort(entries, entries + written, [](auto& a, auto& b) { return a.count > b.count; });
+
+        for (unsigned long long i = 0; i < min(written, (unsigned long long)top); i++)
+            printf("    %p -> %p cr3 %p count %llu \n", (void*)entries[i].from, (void*)entries[i].to, (void*)entries[i].cr3, entries[i].count);
+    }
+
+    args = {};
+    checked_call("lbr config", HYPERCALL_LBR_CONFIG, args);
+    client::ping_all_cores();
+
+    VirtualFree(entries, 0, MEM_RELEASE);
+}
+
+// measures what every exit reason costs the host, summed over all cores
+void profile_exit_cost(int seconds)
+{
+    HYPERCALL_ARGS args{};
+
+    args.regs[0] = EXIT_COST_ENABLE | EXIT_COST_RESET;
+
+    if (!checked_call("exit cost config", HYPERCALL_EXIT_COST_CONFIG, args))
+        return;
+
+    client::ping_all_cores();
+
+    Sleep(seconds * 1000);
+
+    auto records = (EXIT_COST_RECORD*)VirtualAlloc(nullptr, EXIT_COST_REASONS * sizeof(EXIT_COST_RECORD), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    memset(records, 0, EXIT_COST_REASONS * sizeof(EXIT_COST_RECORD));
+    VirtualLock(records, EXIT_COST_REASONS * sizeof(EXIT_COST_RECORD));
+
+    std::map<unsigned long long, EXIT_COST_RECORD> totals;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        args = {};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)records;
+        args.regs[2] = EXIT_COST_REASONS;
+
+        if (!checked_call("exit cost stats", HYPERCALL_EXIT_COST_STATS, args))
+            continue;
+
+        for (unsigned long long i = 0; i < args.regs[0]; i++)
+        {
+            auto& total = totals[records[i].exit_code];
+
+            total.exit_code = records[i].exit_code;
+            total.exits    += records[i].exits;
+
+            for (int j = 0; j < 4; j++)
+            {
+                total.world_switch[j] += records[i].world_switch[j];
+                total.handler[j]      += records[i].handler[j];
+            }
+        }
+    }
+
+    args = {};
+    checked_call("exit cost config", HYPERCALL_EXIT_COST_CONFIG, args);
+    client::ping_all_cores();
+
+    printf("%-6s %10s | %-35s | %-35s\n", "exit", "count", "world switch cycles/instr/l2/tlb", "handler cycles/instr/l2/tlb");
+
+    for (auto& [code, total] : totals)
+    {
+        auto& w = total.world_switch;
+        auto& h = total.handler;
+        auto n  = total.exits;
+
+        printf("0x%-4llx %10llu | %8llu %8llu %8.2f %8.2f | %8llu %8llu %8.2f %8.2f\n", code, n,
+            w[0] / n, w[1] / n, (double)w[2] / n, (double)w[3] / n,
+            h[0] / n, h[1] / n, (double)h[2] / n, (double)h[3] / n);
+    }
+
+    VirtualFree(records, 0, MEM_RELEASE);
+}
+
+// int3 caught by our own handler, the guest side of a #BP round trip
+unsigned long long time_breakpoints()
+{
+    constexpr int iterations = 10000;
+
+    unsigned int aux;
+    unsigned long long start = __rdtscp(&aux);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        __try
+        {
+            __debugbreak();
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+        }
+    }
+
+    return (__rdtscp(&aux) - start) / iterations;
+}
+
+// first touches of freshly committed pages, each one is a demand zero #PF the kernel resolves
+unsigned long long time_page_faults()
+{
+    constexpr int pages = 0x1000;
+
+    auto buffer = (volatile char*)VirtualAlloc(nullptr, pages * 0x1000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    unsigned int aux;
+    unsigned long long start = __rdtscp(&aux);
+
+    for (int i = 0; i < pages; i++)
+        buffer[i * 0x1000] = 1;
+
+    unsigned long long cycles = (__rdtscp(&aux) - start) / pages;
+
+    VirtualFree((void*)buffer, 0, MEM_RELEASE);
+
+    return cycles;
+}
+
+// what intercepting and reflecting #BP and #PF adds to each exception, seen from the guest and the host
+void benchmark_exceptions()
+{
+    constexpr unsigned long long mask = 1 << 3 | 1 << 14;
+
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    unsigned long long native_bp = time_breakpoints();
+    unsigned long long native_pf = time_page_faults();
+
+    HYPERCALL_ARGS args{};
+    args.regs[0] = mask;
+    args.regs[1] = EXCEPTION_RESET;
+
+    if (!checked_call("exception config", HYPERCALL_EXCEPTION_CONFIG, args))
+        return;
+
+    client::ping_all_cores();
+
+    unsigned long long intercepted_bp = time_breakpoints();
+    unsigned long long intercepted_pf = time_page_faults();
+
+    args = {};
+    checked_call("exception config", HYPERCALL_EXCEPTION_CONFIG, args);
+    client::ping_all_cores();
+
+    auto stats = (EXCEPTION_STATS*)VirtualAlloc(nullptr, sizeof(EXCEPTION_STATS), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    VirtualLock(stats, sizeof(EXCEPTION_STATS));
+
+    EXCEPTION_STATS total{};
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        args = {};
+        args.regs[0] = core;
+        args.regs[1] = (unsigned long long)stats;
+
+        if (!checked_call("exception stats", HYPERCALL_EXCEPTION_STATS, args))
+            continue;
+
+        for (int vector = 0; vector < EXCEPTION_VECTORS; vector++)
+        {
+            total.exits[vector]  += stats->exits[vector];
+            total.cycles[vector] += stats->cycles[vector];
+        }
+
+        total.reinjected += stats->reinjected;
+        total.deferred   += stats->deferred;
+    }
+
+    printf("%-4s %10s %10s %10s %12s \n", "", "native", "reflected", "exits", "host cycles");
+
+    printf("#BP  %10llu %10llu %10llu %12llu \n", native_bp, intercepted_bp, total.exits[3], total.exits[3] ? total.cycles[3] / total.exits[3] : 0);
+    printf("#PF  %10llu %10llu %10llu %12llu \n", native_pf, intercepted_pf, total.exits[14], total.exits[14] ? total.cycles[14] / total.exits[14] : 0);
+    printf("%llu interrupted events reinjected, %llu deferred \n", total.reinjected, total.deferred);
+
+    VirtualFree(stats, 0, MEM_RELEASE);
+}
+
+// posts completions and drains them again without a vector registered, a vector needs a guest driver
+// with an isr for it. the host side of a notification is the same either way
+void test_notify()
+{
+    constexpr int count = 16;
+
+    HYPERCALL_ARGS args{};
+
+    for (int i = 0; i < count; i++)
+    {
+        args = {};
+        args.regs[0] = 0x1000 + i;
+
+        if (!checked_call("notify post", HYPERCALL_NOTIFY_POST, args))
+            return;
+
+        if (!args.regs[0])
+            printf("completion %d didnt fit in the ring \n", i);
+    }
+
+    for (;;)
+    {
+        args = {};
+
+        auto status = client::call(HYPERCALL_NOTIFY_POLL, args);
+
+        if (status == call_empty)
+            break;
+
+        if (status != call_success)
+        {
+            printf("notify poll failed: %s \n", client::status_name(status));
+            return;
+        }
+
+        printf("completion 0x%llx status %llu, %llu left \n", args.regs[0], args.regs[1], args.regs[2]);
+    }
+}
+
+// checksums a buffer with a job, once at the hypercall's size limit to check it against the checksum
+// hypercall and once at size, and prints the longest any exit spent on it for each budget
+void test_jobs(unsigned long long size)
+{
+    constexpr unsigned long long single = 0x100000;
+
+    size = max(size, single);
+
+    client::core_pin pin(0);
+
+    auto buffer = (unsigned long long*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!buffer)
+    {
+        printf("cant allocate %llu bytes \n", size);
+        return;
+    }
+
+    // the job fails on pages that arent present, locking a big buffer usually needs a bigger working set
+
+    SetProcessWorkingSetSize(GetCurrentProcess(), size + 0x1000000, size + 0x2000000);
+    VirtualLock(buffer, size);
+
+    for (unsigned long long i = 0; i < size / 8; i++)
+        buffer[i] = i * 0x9E3779B97F4A7C15;
+
+    // set once a call fails, the other budgets would fail the same way
+
+    bool failed = false;
+
+    auto run = [&](unsigned long long length, unsigned long long budget, JOB_PROGRESS& progress)
+    {
+        auto status = client::job_start(JOB_CHECKSUM, buffer, length, budget, 0);
+
+        if (status != call_success)
+        {
+            printf("job start: %s \n", client::status_name(status));
+            failed = true;
+            return false;
+        }
+
+        // every poll is an exit of core 0, so it runs the job too
+
+        do
+        {
+            status = client::job_poll(0, progress);
+
+            if (status != call_success)
+            {
+                printf("job poll: %s \n", client::status_name(status));
+                failed = true;
+                return false;
+            }
+
+        } while (progress.state == job_running);
+
+        return progress.state == job_done;
+    };
+
+    JOB_PROGRESS progress;
+    unsigned long long expected = 0;
+
+    auto status = client::checksum(buffer, single, 0, expected);
+
+    if (status != call_success)
+    {
+        printf("checksum: %s \n", client::status_name(status));
+        VirtualFree(buffer, 0, MEM_RELEASE);
+        return;
+    }
+
+    if (run(single, 0, progress))
+        printf("1 MB job %s the checksum call \n", progress.result == expected ? "matches" : "DOESNT match");
+
+    if (failed)
+    {
+        VirtualFree(buffer, 0, MEM_RELEASE);
+        return;
+    }
+
+    for (unsigned long long budget : { 5000ull, 20000ull, 100000ull })
+    {
+        auto start = GetTickCount64();
+
+        if (!run(size, budget, progress))
+        {
+            if (failed)
+                break;
+
+            printf("budget %llu: stopped at %llu of %llu bytes, state %llu \n", budget, progress.done, progress.size, (unsigned long long)progress.state);
+            continue;
+        }
+
+        printf("budget %llu: %llu MB in %llu ms, %llu slices, longest slice %llu cycles \n",
+            budget, size >> 20, GetTickCount64() - start, progress.slices, progress.max_slice);
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+// searches physical memory below gb gigabytes for a pattern, printing matches while the job runs
+void test_search(const char* text, unsigned long long gb)
+{
+    constexpr unsigned int capacity = 0x400;
+
+    SEARCH_PARAMS params{};
+
+    if (!client::parse_pattern(text, params))
+    {
+        printf("cant parse the pattern \n");
+        return;
+    }
+
+    client::core_pin pin(0);
+
+    SIZE_T size = sizeof(SEARCH_RING_HEADER) + capacity * sizeof(unsigned long long);
+
+    auto ring = (unsigned char*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    VirtualLock(ring, size);
+
+    auto header     = (volatile SEARCH_RING_HEADER*)ring;
+    auto matches    = (unsigned long long*)(ring + sizeof(SEARCH_RING_HEADER));
+
+    params.capacity = capacity;
+    params.ring     = (unsigned long long)ring;
+
+    auto status = client::search_start(0, gb << 30, params, search_best, 0);
+
+    if (status != call_success)
+    {
+        printf("search start: %s \n", client::status_name(status));
+        VirtualFree(ring, 0, MEM_RELEASE);
+        return;
+    }
+
+    JOB_PROGRESS progress;
+
+    do
+    {
+        status = client::job_poll(0, progress);
+
+        if (status != call_success)
+        {
+            printf("job poll: %s \n", client::status_name(status));
+            break;
+        }
+
+        for (; header->head != header->tail; header->head++)
+            printf("match at 0x%llx \n", matches[header->head & (capacity - 1)]);
+
+    } while (progress.state == job_running);
+
+    printf("%llu matches, state %llu, %llu slices, longest slice %llu cycles \n",
+        progress.result, (unsigned long long)progress.state, progress.slices, progress.max_slice);
+
+    VirtualFree(ring, 0, MEM_RELEASE);
+}
+
+// snapshots physical memory below gb gigabytes into a file of records as they came out of the ring,
+// then takes passes incremental ones that only hold the pages that changed in between
+void test_snapshot(const char* path, unsigned long long gb, int passes)
+{
+    constexpr unsigned int capacity = 0x100;
+
+    FILE* file;
+
+    if (fopen_s(&file, path, "wb"))
+    {
+        printf("cant open %s \n", path);
+        return;
+    }
+
+    client::core_pin pin(0);
+
+    unsigned long long range        = gb << 30;
+    SIZE_T ring_size                = sizeof(SNAPSHOT_RING_HEADER) + capacity * SNAPSHOT_SLOT_SIZE;
+    SIZE_T prints_size              = (range / 0x1000 * 8 + 0xFFF) & ~0xFFFull;
+
+    auto ring   = (unsigned char*)VirtualAlloc(nullptr, ring_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    auto prints = (unsigned char*)VirtualAlloc(nullptr, prints_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    SetProcessWorkingSetSize(GetCurrentProcess(), ring_size + prints_size + 0x1000000, ring_size + prints_size + 0x2000000);
+    VirtualLock(ring, ring_size);
+    VirtualLock(prints, prints_size);
+
+    auto header = (volatile SNAPSHOT_RING_HEADER*)ring;
+
+    SNAPSHOT_PARAMS params{};
+    params.ring     = (unsigned long long)ring;
+    params.capacity = capacity;
+    params.prints   = (unsigned long long)prints;
+
+    for (int pass = 0; pass <= passes; pass++)
+    {
+        header->head = 0;
+        header->tail = 0;
+
+        auto status = client::snapshot_start(0, range, params, pass ? SNAPSHOT_INCREMENTAL : 0, 0);
+
+        if (status != call_success)
+        {
+            printf("snapshot start: %s \n", client::status_name(status));
+            break;
+        }
+
+        unsigned long long counts[3] = {}, pages = 0, bytes = 0;
+
+        auto start = GetTickCount64();
+
+        JOB_PROGRESS progress;
+
+        do
+        {
+            status = client::job_poll(0, progress);
+
+            if (status != call_success)
+            {
+                printf("job poll: %s \n", client::status_name(status));
+                break;
+            }
+
+            for (; header->head != header->tail; header->head++)
+            {
+                auto record = (const SNAPSHOT_RECORD*)(ring + sizeof(SNAPSHOT_RING_HEADER) + (header->head & (capacity - 1)) * SNAPSHOT_SLOT_SIZE);
+
+                fwrite(record, 1, sizeof(SNAPSHOT_RECORD) + record->size, file);
+
+                counts[record->kind] += record->pages;
+                pages += record->pages;
+                bytes += sizeof(SNAPSHOT_RECORD) + record->size;
+            }
+
+        } while (progress.state == job_running);
+
+        auto ms = max(GetTickCount64() - start, 1ull);
+
+        printf("pass %d: %llu pages (%llu raw, %llu lz4, %llu zero) in %llu ms, %.1f MB/s of memory, %.2fx smaller, state %llu, longest slice %llu cycles \n",
+            pass, pages, counts[snapshot_raw], counts[snapshot_lz4], counts[snapshot_zero], ms, pages * 4096.0 / 1048576 / (ms / 1000.0),
+            bytes ? pages * 4096.0 / bytes : 0, (unsigned long long)progress.state, progress.max_slice);
+    }
+
+    fclose(file);
+
+    VirtualFree(ring, 0, MEM_RELEASE);
+    VirtualFree(prints, 0, MEM_RELEASE);
+}
+
+// records every exit of every core into a file for hv_replay. the rings only hold 1024 exits per core,
+// so they are drained every 10ms, anything that didnt fit shows up as dropped
+void capture_exits(const char* path, int seconds)
+{
+    constexpr unsigned int capacity = 1024;
+
+    FILE* file;
+
+    if (fopen_s(&file, path, "wb"))
+    {
+        printf("cant open %s \n", path);
+        return;
+    }
+
+    auto records = (CAPTURE_RECORD*)VirtualAlloc(nullptr, capacity * sizeof(CAPTURE_RECORD), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    VirtualLock(records, capacity * sizeof(CAPTURE_RECORD));
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    auto status = client::capture_config(CAPTURE_ENABLE | CAPTURE_RESET);
+
+    if (status != call_success)
+    {
+        printf("capture config: %s \n", client::status_name(status));
+
+        fclose(file);
+        VirtualFree(records, 0, MEM_RELEASE);
+        return;
+    }
+
+    client::ping_all_cores();
+
+    unsigned long long written = 0, captured = 0, dropped = 0, cycles = 0;
+
+    for (int tick = 0; tick <= seconds * 100; tick++)
+    {
+        if (tick == seconds * 100)
+        {
+            status = client::capture_config(0);
+
+            if (status != call_success)
+                printf("capture config: %s \n", client::status_name(status));
+
+            client::ping_all_cores();
+        }
+        else
+            Sleep(10);
+
+        for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+        {
+            CAPTURE_EXPORT result;
+
+            status = client::capture_export(core, records, capacity, result);
+
+            if (status != call_success)
+            {
+                printf("capture export: %s \n", client::status_name(status));
+                continue;
+            }
+
+            fwrite(records, sizeof(CAPTURE_RECORD), result.written, file);
+            written += result.written;
+
+            if (tick == seconds * 100)
+            {
+                captured    += result.captured;
+                dropped     += result.dropped;
+                cycles      += result.cycles;
+            }
+        }
+    }
+
+    fclose(file);
+
+    printf("%llu exits written to %s, %llu captured, %llu dropped, %llu host cycles per record \n",
+        written, path, captured, dropped, captured ? cycles / captured : 0);
+
+    VirtualFree(records, 0, MEM_RELEASE);
+}
+
+// every registered command with its schema, then how often it ran on each core summed up
+void print_commands()
+{
+    auto list = (COMMAND_INFO*)VirtualAlloc(nullptr, COMMAND_MAX * sizeof(COMMAND_INFO), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    auto stats = (COMMAND_STATS*)VirtualAlloc(nullptr, COMMAND_MAX * sizeof(COMMAND_STATS), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    unsigned long long written = 0, version = 0;
+
+    auto status = client::command_list(list, COMMAND_MAX, written, version);
+
+    if (status != call_success)
+    {
+        printf("command list failed: %s \n", client::status_name(status));
+
+        VirtualFree(list, 0, MEM_RELEASE);
+        VirtualFree(stats, 0, MEM_RELEASE);
+        return;
+    }
+
+    if (version != COMMAND_INTERFACE_VERSION)
+        printf("the driver's command interface is version %llu, this build knows %d \n", version, COMMAND_INTERFACE_VERSION);
+
+    COMMAND_STATS total[COMMAND_MAX]{};
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        if (client::command_stats(core, stats, COMMAND_MAX) != call_success)
+            continue;
+
+        for (int code = 0; code < COMMAND_MAX; code++)
+        {
+            total[code].calls       += stats[code].calls;
+            total[code].failures    += stats[code].failures;
+            total[code].cycles      += stats[code].cycles;
+        }
+    }
+
+    const char arg_names[] = { '-', 'v', 'c', 'a', 'r' };
+
+    printf("%-4s %-20s %-3s %-3s %-5s %-6s %12s %10s %12s \n", "code", "name", "ver", "cpl", "flags", "args", "calls", "failures", "cycles/call");
+
+    for (unsigned long long i = 0; i < written; i++)
+    {
+        auto& command = list[i];
+        auto& counts = total[command.code % COMMAND_MAX];
+
+        char args[7] = {};
+
+        for (int j = 0; j < 6; j++)
+            args[j] = command.args[j] <= arg_result ? arg_names[command.args[j]] : '?';
+
+        char flags[4] = { command.flags & COMMAND_SESSION ? 's' : '-', command.flags & COMMAND_BROADCAST ? 'b' : '-',
+            command.flags & COMMAND_BROADCAST_ONCE ? 'o' : '-', 0 };
+
+        printf("0x%02x %-20.*s %3u %3u %-5s %-6s %12llu %10llu %12llu \n", command.code, COMMAND_NAME_LENGTH, command.name,
+            command.version, command.cpl, flags, args, counts.calls, counts.failures, counts.calls ? counts.cycles / counts.calls : 0);
+    }
+
+    VirtualFree(list, 0, MEM_RELEASE);
+    VirtualFree(stats, 0, MEM_RELEASE);
+}
+
+// every cached vmcb field the driver changed without clearing its clean bit, per core
+void print_vmcb_stats()
+{
+    constexpr int capacity = 64;
+
+    VMCB_MISMATCH fields[capacity];
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (unsigned int core = 0; core < info.dwNumberOfProcessors; core++)
+    {
+        VMCB_STATS result{};
+
+        auto status = client::vmcb_stats(core, fields, capacity, result);
+
+        if (status != call_success)
+        {
+            printf("vmcb stats failed: %s \n", client::status_name(status));
+            return;
+        }
+
+        printf("core %u: %llu exits verified, %llu mismatches \n", core, result.verified, result.mismatches);
+
+        for (unsigned long long i = 0; i < result.written; i++)
+        {
+            printf("    %-24.*s %10llu last on exit 0x%llx \n", VMCB_FIELD_NAME_LENGTH, fields[i].name,
+                fields[i].count, fields[i].last_exit_code);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (client::loaded())
+    {
         printf("hypervisor is loaded\n");
+
+        if (argc > 2 && !strcmp(argv[1], "pause"))
+            profile_pause(atoi(argv[2]));
+        else if (argc > 3 && !strcmp(argv[1], "sample"))
+            profile_samples(atoi(argv[2]), strtoull(argv[3], nullptr, 0));
+        else if (argc > 2 && !strcmp(argv[1], "lbr"))
+            profile_branches(atoi(argv[2]));
+        else if (argc > 2 && !strcmp(argv[1], "exits"))
+            profile_exit_cost(atoi(argv[2]));
+        else if (argc > 1 && !strcmp(argv[1], "exceptions"))
+            benchmark_exceptions();
+        else if (argc > 1 && !strcmp(argv[1], "notify"))
+            test_notify();
+        else if (argc > 2 && !strcmp(argv[1], "jobs"))
+            test_jobs(strtoull(argv[2], nullptr, 0) << 20);
+        else if (argc > 3 && !strcmp(argv[1], "search"))
+            test_search(argv[2], strtoull(argv[3], nullptr, 0));
+        else if (argc > 3 && !strcmp(argv[1], "capture"))
+            capture_exits(argv[2], atoi(argv[3]));
+        else if (argc > 1 && !strcmp(argv[1], "commands"))
+            print_commands();
+        else if (argc > 1 && !strcmp(argv[1], "vmcb"))
+            print_vmcb_stats();
+        else if (argc > 3 && !strcmp(argv[1], "snapshot"))
+            test_snapshot(argv[2], strtoull(argv[3], nullptr, 0), argc > 4 ? atoi(argv[4]) : 0);
+        else
+        {
+            benchmark_round_trip();
+            benchmark_simd();
+            benchmark_tsc(true);
+            print_instruction_stats();
+        }
+    }
     else
+    {
         printf("hypervisor isnt loaded \n");
 
+        benchmark_tsc(false);
+    }
+
     std::cin.get();
 
     return 0;